@@ -7,6 +7,7 @@
 
 #include "mmlib.h"
 #include "mmerrno.h"
+#include "mmthread.h"
 #include <stdlib.h>
 #include "mmpredefs.h"
 
@@ -157,3 +158,38 @@ void _mm_freea_on_heap(void* ptr)
 
 	mm_aligned_free(base - MM_STK_ALIGN);
 }
+
+
+/**
+ * mm_thr_prefault_stack() - touch the stack of the calling thread
+ * @size:       number of bytes of stack to touch
+ *
+ * Write in the @size bytes of stack below the current stack frame, so that
+ * the pages are mapped before the calling thread enters its latency
+ * sensitive code. This is meant to be used after mm_mlockall() has been
+ * called with MM_MLOCK_FUTURE (or MM_MLOCK_CURRENT after this call): the
+ * stack pages then stay in RAM and the thread never takes a page fault
+ * when its stack grows up to @size bytes.
+ *
+ * @size must be smaller than the remaining stack space of the calling
+ * thread, otherwise the behavior is undefined (the thread likely crashes
+ * by stack overflow).
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_prefault_stack(size_t size)
+{
+	volatile unsigned char* stack;
+	size_t i;
+
+	if (!size)
+		return 0;
+
+	stack = alloca(size);
+	for (i = 0; i < size; i += MM_PAGESZ)
+		stack[i] = 0;
+
+	stack[size - 1] = 0;
+	return 0;
+}
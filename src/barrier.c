@@ -0,0 +1,344 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+#include "spinwait.h"
+#include "topology-internal.h"
+
+#define BARRIER_SPIN_COUNT      16      // number of checks before sleeping
+
+/**
+ * DOC: barrier and latch
+ *
+ * A barrier makes a group of threads meet at phase boundaries: each
+ * thread calling mm_thr_barrier_wait() is blocked until the number of
+ * threads specified at initialization have called it. The barrier is then
+ * automatically reset for the next phase.
+ *
+ * A latch is a one-shot counter: threads calling mm_thr_latch_wait() are
+ * blocked until the counter is brought down to 0 with
+ * mm_thr_latch_count_down(). Once released, a latch stays released.
+ *
+ * Phases of a barrier are usually short and the threads arrive almost at
+ * the same time. Hence a waiting thread spins for a short while on the
+ * phase counter before sleeping on it with the futex layer. The thread
+ * completing a phase makes a system call only if some threads are
+ * sleeping. Unlike a barrier built on a condition variable, the released
+ * threads do not have to go through a mutex one after the other.
+ *
+ * On a single CPU system, the thread that would end the spin cannot run
+ * while the waiter spins: the waiter then goes to sleep immediately.
+ */
+
+
+/**
+ * can_spin() - test whether spinning is worth it
+ *
+ * Return: true if the system has more than one CPU.
+ */
+static
+bool can_spin(void)
+{
+	static int num_cpu = 0;
+	int num;
+
+	num = mm_atomic_load_i32(&num_cpu, MM_ATOMIC_RELAXED);
+	if (num == 0) {
+		num = get_num_cpu();
+		mm_atomic_store_i32(&num_cpu, num, MM_ATOMIC_RELAXED);
+	}
+
+	return num > 1;
+}
+
+
+/**
+ * spin_wait_change() - spin until a word changes
+ * @addr:       address of the word to watch
+ * @val:        value of the word which makes the thread to spin
+ *
+ * Return: true if *@addr has changed from @val, false if spin has been
+ * given up.
+ */
+static
+bool spin_wait_change(uint32_t* addr, uint32_t val)
+{
+	int i, backoff = 1;
+
+	if (!can_spin())
+		return false;
+
+	for (i = 0; i < BARRIER_SPIN_COUNT; i++) {
+		if (mm_atomic_load_u32(addr, MM_ATOMIC_ACQUIRE) != val)
+			return true;
+
+		spin_backoff(&backoff);
+	}
+
+	return false;
+}
+
+
+/**
+ * mm_thr_barrier_init() - Initialize a barrier
+ * @barrier:    barrier to initialize
+ * @count:      number of threads that must wait at each phase
+ * @flags:      OR-combination of flags indicating the type of @barrier
+ *
+ * Use this function to initialize @barrier for @count threads. If @flags
+ * contains MM_THR_PSHARED, @barrier can be shared by other processes.
+ *
+ * Return: 0 in case of success, EINVAL if @count is 0 or greater than
+ * INT_MAX.
+ */
+API_EXPORTED
+int mm_thr_barrier_init(mm_thr_barrier_t* barrier, unsigned int count,
+                        int flags)
+{
+	if (count == 0 || count > INT_MAX) {
+		mm_raise_error(EINVAL, "invalid barrier count %u", count);
+		return EINVAL;
+	}
+
+	barrier->flags = flags;
+	barrier->count = count;
+	barrier->arrived = 0;
+	barrier->generation = 0;
+	barrier->nsleeper = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_barrier_wait() - synchronize at a barrier
+ * @barrier:    initialized barrier
+ *
+ * This function blocks the calling thread until the number of threads
+ * specified in mm_thr_barrier_init() have called it. When this happens,
+ * all the threads are released and @barrier is reset to wait for the next
+ * phase.
+ *
+ * Return: MM_THR_BARRIER_SERIAL_THREAD for one arbitrary thread of the
+ * phase, 0 for the others.
+ */
+API_EXPORTED
+int mm_thr_barrier_wait(mm_thr_barrier_t* barrier)
+{
+	uint32_t gen, arrived;
+
+	gen = mm_atomic_load_u32(&barrier->generation, MM_ATOMIC_ACQUIRE);
+	arrived = mm_atomic_fetch_add_u32(&barrier->arrived, 1,
+	                                  MM_ATOMIC_ACQ_REL) + 1;
+
+	// Last thread of the phase: reset the barrier and release the others
+	if (arrived == barrier->count) {
+		mm_atomic_store_u32(&barrier->arrived, 0, MM_ATOMIC_RELAXED);
+		mm_atomic_fetch_add_u32(&barrier->generation, 1,
+		                        MM_ATOMIC_SEQ_CST);
+		if (mm_atomic_load_u32(&barrier->nsleeper, MM_ATOMIC_SEQ_CST))
+			futex_wake(&barrier->generation, INT_MAX,
+			           barrier->flags);
+
+		return MM_THR_BARRIER_SERIAL_THREAD;
+	}
+
+	if (spin_wait_change(&barrier->generation, gen))
+		return 0;
+
+	mm_atomic_fetch_add_u32(&barrier->nsleeper, 1, MM_ATOMIC_SEQ_CST);
+	while (mm_atomic_load_u32(&barrier->generation, MM_ATOMIC_ACQUIRE)
+	       == gen)
+		futex_wait(&barrier->generation, gen, barrier->flags, NULL);
+
+	mm_atomic_fetch_sub_u32(&barrier->nsleeper, 1, MM_ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_barrier_deinit() - cleanup an initialized barrier
+ * @barrier:    initialized barrier to destroy
+ *
+ * It is undefined behavior to destroy a barrier on which threads are
+ * blocked.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_barrier_deinit(mm_thr_barrier_t* barrier)
+{
+	(void)barrier;
+	return 0;
+}
+
+
+/**
+ * mm_thr_latch_init() - Initialize a latch
+ * @latch:      latch to initialize
+ * @count:      initial value of the counter of @latch
+ * @flags:      OR-combination of flags indicating the type of @latch
+ *
+ * Use this function to initialize @latch with the counter set to @count.
+ * The type of latch is controlled by @flags which must contains one or
+ * several of the following:
+ *
+ * - MM_THR_PSHARED: init a latch shareable by other processes.
+ * - MM_THR_WAIT_MONOTONIC: the clock base used in mm_thr_latch_timedwait()
+ *   is MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_latch_init(mm_thr_latch_t* latch, unsigned int count, int flags)
+{
+	latch->flags = flags;
+	latch->count = count;
+	latch->nwaiter = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_latch_count_down() - decrement the counter of a latch
+ * @latch:      initialized latch
+ * @n:          value to subtract from the counter
+ *
+ * This function decrements the counter of @latch by @n. If the counter
+ * reaches 0, all the threads waiting for @latch are released.
+ *
+ * Return: 0 in case of success, EINVAL if @n is greater than the current
+ * value of the counter.
+ */
+API_EXPORTED
+int mm_thr_latch_count_down(mm_thr_latch_t* latch, unsigned int n)
+{
+	uint32_t count;
+
+	count = mm_atomic_load_u32(&latch->count, MM_ATOMIC_RELAXED);
+	do {
+		if (n > count) {
+			mm_raise_error(EINVAL, "latch count down by %u while "
+			               "count is %u", n, count);
+			return EINVAL;
+		}
+	} while (!mm_atomic_cas_u32(&latch->count, &count, count - n,
+	                            MM_ATOMIC_SEQ_CST));
+
+	if (count == n
+	    && mm_atomic_load_u32(&latch->nwaiter, MM_ATOMIC_SEQ_CST))
+		futex_wake(&latch->count, INT_MAX, latch->flags);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_latch_trywait() - test whether a latch is released
+ * @latch:      initialized latch
+ *
+ * Return: 0 if the counter of @latch is 0, EAGAIN otherwise.
+ */
+API_EXPORTED
+int mm_thr_latch_trywait(mm_thr_latch_t* latch)
+{
+	if (mm_atomic_load_u32(&latch->count, MM_ATOMIC_ACQUIRE))
+		return EAGAIN;
+
+	return 0;
+}
+
+
+static
+int latch_wait(mm_thr_latch_t* latch, const struct mm_timespec* abstime)
+{
+	uint32_t count;
+	int ret = 0;
+
+	count = mm_atomic_load_u32(&latch->count, MM_ATOMIC_ACQUIRE);
+	if (count == 0)
+		return 0;
+
+	if (spin_wait_change(&latch->count, count)
+	    && mm_atomic_load_u32(&latch->count, MM_ATOMIC_ACQUIRE) == 0)
+		return 0;
+
+	mm_atomic_fetch_add_u32(&latch->nwaiter, 1, MM_ATOMIC_SEQ_CST);
+
+	while ((count = mm_atomic_load_u32(&latch->count, MM_ATOMIC_ACQUIRE))) {
+		if (ret)
+			break;
+
+		ret = futex_wait(&latch->count, count, latch->flags, abstime);
+	}
+
+	mm_atomic_fetch_sub_u32(&latch->nwaiter, 1, MM_ATOMIC_RELAXED);
+
+	return count ? ret : 0;
+}
+
+
+/**
+ * mm_thr_latch_wait() - wait for a latch to be released
+ * @latch:      initialized latch
+ *
+ * This function blocks the calling thread until the counter of @latch
+ * reaches 0. If it is already 0, the function returns immediately.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_latch_wait(mm_thr_latch_t* latch)
+{
+	return latch_wait(latch, NULL);
+}
+
+
+/**
+ * mm_thr_latch_timedwait() - wait for a latch to be released with timeout
+ * @latch:      initialized latch
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the same as mm_thr_latch_wait() excepting that it
+ * returns if @latch is not released before @abstime. The clock of @abstime
+ * is MM_CLK_MONOTONIC if @latch has been initialized with
+ * MM_THR_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if @latch has been released, ETIMEDOUT if @abstime has been
+ * reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_thr_latch_timedwait(mm_thr_latch_t* latch,
+                           const struct mm_timespec* abstime)
+{
+	return latch_wait(latch, abstime);
+}
+
+
+/**
+ * mm_thr_latch_deinit() - cleanup an initialized latch
+ * @latch:      initialized latch to destroy
+ *
+ * It is undefined behavior to destroy a latch on which threads are
+ * blocked.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_latch_deinit(mm_thr_latch_t* latch)
+{
+	(void)latch;
+	return 0;
+}
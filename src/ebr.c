@@ -0,0 +1,585 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmatomic.h"
+#include "mmebr.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmlog.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "thread-local.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define RECLAIM_INTERVAL        64      // number of retire between reclaims
+#define RETIRED_MIN_CAPACITY    64
+#define SYNC_SPIN_COUNT         16      // reclaim attempts before sleeping
+
+#define ALIGN_CACHELINE(size) \
+	(((size) + MM_CACHELINE_SIZE - 1) & ~(MM_CACHELINE_SIZE - 1))
+
+/**
+ * DOC: epoch based reclamation
+ *
+ * A lock-free data structure cannot free a node as soon as it is removed:
+ * other threads may have obtained a pointer to it before the removal and
+ * still be reading it. Epoch based reclamation defers the free until all
+ * those threads are guaranteed to be done.
+ *
+ * A thread accessing a shared structure does so in a critical section
+ * delimited by mm_ebr_enter() and mm_ebr_exit(). Critical sections are
+ * cheap (no lock, no system call) and can be nested. Once a node has been
+ * unlinked from the structure, it is passed to mm_ebr_retire() along with
+ * the function that will free it, instead of being freed directly.
+ *
+ * A global epoch counter can only be advanced when every thread in a
+ * critical section has observed its current value. An object retired
+ * while the global epoch is E is therefore no longer visible to any thread
+ * once the epoch has reached E+2: it is then freed. The retired objects
+ * are kept in a list private to the retiring thread. Every 64 calls to
+ * mm_ebr_retire(), the thread attempts to advance the global epoch and
+ * frees the objects of its list that can be freed: the cost of the
+ * reclamation is amortized over the retirements.
+ *
+ * A thread must be registered to use the functions of this module. This
+ * happens automatically at the first call to mm_ebr_enter() or
+ * mm_ebr_retire(), or explicitly with mm_ebr_register(). A thread is
+ * unregistered automatically when it exits, the objects it had retired and
+ * that could not be freed yet being handed over to the other threads.
+ *
+ * A thread must not block for a long time in a critical section since
+ * this prevents the epoch to advance, hence any memory to be reclaimed.
+ */
+
+/**
+ * struct retired - object waiting to be freed
+ * @ptr:        pointer to the object
+ * @free_fn:    function to call with @ptr to free the object
+ * @epoch:      global epoch at the time the object has been retired
+ */
+struct retired {
+	void* ptr;
+	void (* free_fn)(void*);
+	uint64_t epoch;
+};
+
+/**
+ * struct retired_list - dynamic array of retired objects
+ * @items:      array of retired objects
+ * @num:        number of objects in @items
+ * @cap:        allocated length of @items
+ */
+struct retired_list {
+	struct retired* items;
+	int num;
+	int cap;
+};
+
+/**
+ * struct ebr_record - state of a registered thread
+ * @state:      (epoch << 1) | 1 while the thread is in a critical section,
+ *              0 otherwise. Modified only by the owning thread.
+ * @in_use:     1 if the record is owned by a registered thread
+ * @nesting:    nesting depth of critical sections
+ * @num_since_reclaim: number of objects retired since the last reclaim
+ * @retired:    objects retired by the thread that are not freed yet
+ * @next:       next record in the list of all records
+ *
+ * Records are allocated on their own cache lines and are never freed: the
+ * record of an unregistered thread is reused by the next thread to
+ * register.
+ */
+struct ebr_record {
+	uint64_t state;
+	uint32_t in_use;
+	int nesting;
+	int num_since_reclaim;
+	struct retired_list retired;
+	struct ebr_record* next;
+};
+
+static uint64_t global_epoch;
+static mm_atomic_ptr_t record_list;
+static thread_local struct ebr_record* self_record;
+
+static struct retired_list orphans;
+static mm_thr_mutex_t orphan_lock = MM_THR_MUTEX_INITIALIZER;
+
+static mm_thr_once_t exit_key_once = MM_THR_ONCE_INIT;
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         Retired object lists                           *
+ *                                                                        *
+ **************************************************************************/
+
+static
+int retired_list_add(struct retired_list* list, struct retired item)
+{
+	struct retired* items;
+	int cap;
+
+	if (list->num == list->cap) {
+		cap = list->cap ? 2*list->cap : RETIRED_MIN_CAPACITY;
+		items = realloc(list->items, cap * sizeof(*items));
+		if (!items)
+			return mm_raise_from_errno("Cannot grow retired list");
+
+		list->items = items;
+		list->cap = cap;
+	}
+
+	list->items[list->num++] = item;
+	return 0;
+}
+
+
+/**
+ * retired_list_reclaim() - free the objects that are no longer visible
+ * @list:       list of retired objects
+ * @epoch:      current global epoch
+ *
+ * Free the objects of @list retired at least 2 epochs before @epoch and
+ * remove them from @list. The order of remaining objects is preserved.
+ */
+static
+void retired_list_reclaim(struct retired_list* list, uint64_t epoch)
+{
+	struct retired* item;
+	int i, num_kept;
+
+	num_kept = 0;
+	for (i = 0; i < list->num; i++) {
+		item = &list->items[i];
+		if (item->epoch + 2 <= epoch)
+			item->free_fn(item->ptr);
+		else
+			list->items[num_kept++] = *item;
+	}
+
+	list->num = num_kept;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           Epoch management                             *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * try_advance_epoch() - increment global epoch if possible
+ *
+ * The global epoch is incremented only if all threads in critical section
+ * have observed its current value.
+ *
+ * Return: the global epoch after the attempt
+ */
+static
+uint64_t try_advance_epoch(void)
+{
+	struct ebr_record* rec;
+	uint64_t epoch, state;
+
+	// Pair with the fence in mm_ebr_enter(): either the thread entering a
+	// critical section is seen here, or it sees the updates preceding the
+	// retirement of the objects
+	mm_atomic_fence(MM_ATOMIC_SEQ_CST);
+	epoch = mm_atomic_load_u64(&global_epoch, MM_ATOMIC_SEQ_CST);
+
+	rec = mm_atomic_load_ptr(&record_list, MM_ATOMIC_ACQUIRE);
+	for (; rec != NULL; rec = rec->next) {
+		state = mm_atomic_load_u64(&rec->state, MM_ATOMIC_ACQUIRE);
+		if ((state & 1) && (state >> 1) != epoch)
+			return epoch;
+	}
+
+	if (mm_atomic_cas_u64(&global_epoch, &epoch, epoch + 1,
+	                      MM_ATOMIC_ACQ_REL))
+		return epoch + 1;
+
+	// Another thread has advanced the epoch, its value is now in epoch
+	return epoch;
+}
+
+
+/**
+ * reclaim_orphans() - free objects left by unregistered threads
+ * @epoch:      current global epoch
+ * @wait:       if false, give up if the orphan list is being used
+ */
+static
+void reclaim_orphans(uint64_t epoch, bool wait)
+{
+	if (wait)
+		mm_thr_mutex_lock(&orphan_lock);
+	else if (mm_thr_mutex_trylock(&orphan_lock))
+		return;
+
+	retired_list_reclaim(&orphans, epoch);
+	mm_thr_mutex_unlock(&orphan_lock);
+}
+
+
+/**
+ * reclaim() - attempt to advance epoch and free retired objects
+ * @rec:        record of the calling thread, can be NULL
+ * @wait:       if false, do not wait for the orphan list
+ */
+static
+void reclaim(struct ebr_record* rec, bool wait)
+{
+	uint64_t epoch;
+
+	epoch = try_advance_epoch();
+	if (rec) {
+		rec->num_since_reclaim = 0;
+		retired_list_reclaim(&rec->retired, epoch);
+	}
+
+	reclaim_orphans(epoch, wait);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         Thread registration                            *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * unregister_record() - release the record of a thread
+ * @rec:        record of the thread to unregister
+ *
+ * Objects retired by the thread that cannot be freed yet are moved to the
+ * orphan list. The record is then available to other threads.
+ */
+static
+void unregister_record(struct ebr_record* rec)
+{
+	int i;
+
+	reclaim(rec, true);
+
+	if (rec->retired.num) {
+		mm_thr_mutex_lock(&orphan_lock);
+		for (i = 0; i < rec->retired.num; i++) {
+			if (retired_list_add(&orphans, rec->retired.items[i]))
+				mm_log_warn("Retired object %p leaked",
+				            rec->retired.items[i].ptr);
+		}
+		mm_thr_mutex_unlock(&orphan_lock);
+	}
+
+	free(rec->retired.items);
+	rec->retired = (struct retired_list) {.items = NULL};
+	rec->nesting = 0;
+	rec->num_since_reclaim = 0;
+	mm_atomic_store_u64(&rec->state, 0, MM_ATOMIC_RELEASE);
+	mm_atomic_store_u32(&rec->in_use, 0, MM_ATOMIC_RELEASE);
+}
+
+
+#ifdef _WIN32
+
+static DWORD exit_key = FLS_OUT_OF_INDEXES;
+
+static
+VOID WINAPI on_thread_exit(PVOID data)
+{
+	if (data)
+		unregister_record(data);
+}
+
+
+static
+void init_exit_key(void)
+{
+	exit_key = FlsAlloc(on_thread_exit);
+}
+
+
+static
+void set_exit_key(struct ebr_record* rec)
+{
+	if (exit_key != FLS_OUT_OF_INDEXES)
+		FlsSetValue(exit_key, rec);
+}
+
+#else /* _WIN32 */
+
+static pthread_key_t exit_key;
+static bool exit_key_valid;
+
+static
+void on_thread_exit(void* data)
+{
+	self_record = NULL;
+	unregister_record(data);
+}
+
+
+static
+void init_exit_key(void)
+{
+	exit_key_valid = (pthread_key_create(&exit_key, on_thread_exit) == 0);
+}
+
+
+static
+void set_exit_key(struct ebr_record* rec)
+{
+	if (exit_key_valid)
+		pthread_setspecific(exit_key, rec);
+}
+
+#endif /* !_WIN32 */
+
+
+/**
+ * get_record() - get record of calling thread, registering it if needed
+ *
+ * Return: the record of the calling thread. If the registration fails, the
+ * process is aborted.
+ */
+static
+struct ebr_record* get_record(void)
+{
+	if (LIKELY(self_record))
+		return self_record;
+
+	if (mm_ebr_register()) {
+		mm_log_fatal("Cannot register thread for memory reclamation");
+		abort();
+	}
+
+	return self_record;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           API implementation                           *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_ebr_register() - register the calling thread for memory reclamation
+ *
+ * Register the calling thread so that its critical sections are taken into
+ * account by the reclamation. A thread does not need to call this function
+ * explicitly since it is registered at its first call to mm_ebr_enter() or
+ * mm_ebr_retire(). However doing so allows to handle an allocation
+ * failure. The thread is unregistered automatically when it exits. Calling
+ * this function on an already registered thread has no effect.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_ebr_register(void)
+{
+	struct ebr_record* rec;
+	void* head;
+	uint32_t in_use;
+
+	if (self_record)
+		return 0;
+
+	mm_thr_once(&exit_key_once, init_exit_key);
+
+	// Reuse the record of a thread that has been unregistered
+	rec = mm_atomic_load_ptr(&record_list, MM_ATOMIC_ACQUIRE);
+	for (; rec != NULL; rec = rec->next) {
+		in_use = 0;
+		if (mm_atomic_cas_u32(&rec->in_use, &in_use, 1,
+		                      MM_ATOMIC_ACQUIRE))
+			goto exit;
+	}
+
+	rec = mm_aligned_alloc(MM_CACHELINE_SIZE,
+	                       ALIGN_CACHELINE(sizeof(*rec)));
+	if (!rec)
+		return -1;
+
+	*rec = (struct ebr_record) {.in_use = 1};
+
+	head = mm_atomic_load_ptr(&record_list, MM_ATOMIC_RELAXED);
+	do {
+		rec->next = head;
+	} while (!mm_atomic_cas_ptr(&record_list, &head, rec,
+	                            MM_ATOMIC_RELEASE));
+
+exit:
+	self_record = rec;
+	set_exit_key(rec);
+	return 0;
+}
+
+
+/**
+ * mm_ebr_unregister() - unregister the calling thread
+ *
+ * Unregister the calling thread which must not be in a critical section.
+ * The objects it has retired and that cannot be freed yet will be freed
+ * later by the other threads. This is done automatically when a thread
+ * exits: this function is useful only for a thread that stops using the
+ * reclamation while continuing to run. Calling this function on a thread
+ * that is not registered has no effect.
+ */
+API_EXPORTED
+void mm_ebr_unregister(void)
+{
+	struct ebr_record* rec = self_record;
+
+	if (!rec)
+		return;
+
+	set_exit_key(NULL);
+	self_record = NULL;
+	unregister_record(rec);
+}
+
+
+/**
+ * mm_ebr_enter() - enter a critical section
+ *
+ * Mark the beginning of a section where the calling thread can access
+ * shared objects that other threads may retire concurrently. Those objects
+ * will not be freed before the thread calls mm_ebr_exit(). Critical
+ * sections can be nested: only the outermost one has an effect.
+ *
+ * The calling thread is registered if not done yet. If the registration
+ * fails, the process is aborted.
+ */
+API_EXPORTED
+void mm_ebr_enter(void)
+{
+	struct ebr_record* rec = get_record();
+	uint64_t epoch;
+
+	if (rec->nesting++)
+		return;
+
+	epoch = mm_atomic_load_u64(&global_epoch, MM_ATOMIC_RELAXED);
+	mm_atomic_store_u64(&rec->state, (epoch << 1) | 1, MM_ATOMIC_RELAXED);
+
+	// Announce the critical section before any access to shared objects
+	mm_atomic_fence(MM_ATOMIC_SEQ_CST);
+}
+
+
+/**
+ * mm_ebr_exit() - leave a critical section
+ *
+ * Mark the end of the critical section started with mm_ebr_enter(). After
+ * this call, the calling thread must not use the shared objects it has
+ * obtained in the critical section. It is undefined behavior to call this
+ * function outside of a critical section.
+ */
+API_EXPORTED
+void mm_ebr_exit(void)
+{
+	struct ebr_record* rec = self_record;
+
+	if (--rec->nesting)
+		return;
+
+	mm_atomic_store_u64(&rec->state, 0, MM_ATOMIC_RELEASE);
+}
+
+
+/**
+ * mm_ebr_retire() - free an object when no thread can access it anymore
+ * @ptr:        object to free
+ * @free_fn:    function freeing @ptr
+ *
+ * Defer the call of @free_fn with @ptr until all threads that were in a
+ * critical section at the time of the call have left it. @ptr must already
+ * be unreachable for the threads entering a critical section after the
+ * call, ie, it must have been unlinked from the shared data structure.
+ *
+ * This function can be called inside or outside of a critical section. Once
+ * every 64 calls, the calling thread frees the objects it has retired and
+ * that can now be freed.
+ *
+ * The calling thread is registered if not done yet. If the registration
+ * fails, the process is aborted.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In case of failure, @ptr is not retired.
+ */
+API_EXPORTED
+int mm_ebr_retire(void* ptr, void (*free_fn)(void*))
+{
+	struct ebr_record* rec = get_record();
+	struct retired item = {.ptr = ptr, .free_fn = free_fn};
+
+	// Epoch must be read after the object has been unlinked
+	mm_atomic_fence(MM_ATOMIC_SEQ_CST);
+	item.epoch = mm_atomic_load_u64(&global_epoch, MM_ATOMIC_SEQ_CST);
+
+	if (retired_list_add(&rec->retired, item))
+		return -1;
+
+	if (++rec->num_since_reclaim >= RECLAIM_INTERVAL)
+		reclaim(rec, false);
+
+	return 0;
+}
+
+
+/**
+ * mm_ebr_reclaim() - free retired objects that can be freed
+ *
+ * Attempt to advance the global epoch and free the objects retired by the
+ * calling thread and by the threads that have exited that can be freed.
+ * This function never blocks. It is called automatically by
+ * mm_ebr_retire(), hence a thread needs to call it only to release memory
+ * earlier.
+ */
+API_EXPORTED
+void mm_ebr_reclaim(void)
+{
+	reclaim(self_record, false);
+}
+
+
+/**
+ * mm_ebr_synchronize() - wait for retired objects to be freed
+ *
+ * Block until all the objects retired by the calling thread have been
+ * freed. This requires all other threads to leave the critical sections
+ * they are in. The calling thread must not be in a critical section.
+ */
+API_EXPORTED
+void mm_ebr_synchronize(void)
+{
+	struct ebr_record* rec = self_record;
+	int count = 0;
+
+	while (1) {
+		reclaim(rec, true);
+		if (!rec || rec->retired.num == 0)
+			break;
+
+		if (++count > SYNC_SPIN_COUNT)
+			mm_relative_sleep_ms(1);
+	}
+}
@@ -8,6 +8,7 @@
 #include "error-internal.h"
 #include "mmerrno.h"
 #include "mmlog.h"
+#include "thread-local.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -17,16 +18,6 @@
 
 #include "nls-internals.h"
 
-#ifndef thread_local
-#  if defined (__GNUC__)
-#    define thread_local __thread
-#  elif defined (_MSC_VER)
-#    define thread_local __declspec(thread)
-#  else
-#    error Do not know how to specify thread local attribute
-#  endif
-#endif
-
 struct errmsg_entry {
 	int errnum;
 	const char* msg;
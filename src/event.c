@@ -0,0 +1,220 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+
+#define EVT_SIGNALED    0x1     // event is in signaled state
+#define EVT_WAITER_INC  0x2     // increment of number of waiters
+
+/**
+ * DOC: event
+ *
+ * An event is a synchronization object which is either signaled or not.
+ * Threads waiting for an event are blocked until the event is signaled
+ * with mm_thr_event_set(). Depending on the type of event:
+ *
+ * - manual-reset (default): the event stays signaled and all the waiting
+ *   threads are released, until the event is reset with
+ *   mm_thr_event_reset().
+ * - auto-reset (MM_THR_AUTORESET): only one waiting thread is released and
+ *   the event is automatically reset when this thread returns from the
+ *   wait.
+ *
+ * The signaled state and the number of waiters are kept in a single 32bit
+ * word: setting the event makes a system call only if there are waiters,
+ * and waiting on a signaled event makes none.
+ */
+
+
+/**
+ * try_consume() - check whether an event is signaled
+ * @event:      initialized event
+ *
+ * If @event is an auto-reset event, the signaled state is consumed.
+ *
+ * Return: true if @event was signaled, false otherwise.
+ */
+static
+bool try_consume(mm_thr_event_t* event)
+{
+	uint32_t state;
+
+	state = mm_atomic_load_u32(&event->state, MM_ATOMIC_ACQUIRE);
+	if (!(event->flags & MM_THR_AUTORESET))
+		return (state & EVT_SIGNALED);
+
+	while (state & EVT_SIGNALED) {
+		if (mm_atomic_cas_u32(&event->state, &state,
+		                      state & ~EVT_SIGNALED,
+		                      MM_ATOMIC_ACQUIRE))
+			return true;
+	}
+
+	return false;
+}
+
+
+static
+int event_wait(mm_thr_event_t* event, const struct mm_timespec* abstime)
+{
+	uint32_t state;
+	int ret = 0;
+
+	if (try_consume(event))
+		return 0;
+
+	mm_atomic_fetch_add_u32(&event->state, EVT_WAITER_INC,
+	                        MM_ATOMIC_SEQ_CST);
+
+	while (!try_consume(event)) {
+		if (ret)
+			break;
+
+		state = mm_atomic_load_u32(&event->state, MM_ATOMIC_RELAXED);
+		if (state & EVT_SIGNALED)
+			continue;
+
+		ret = futex_wait(&event->state, state, event->flags, abstime);
+	}
+
+	mm_atomic_fetch_sub_u32(&event->state, EVT_WAITER_INC,
+	                        MM_ATOMIC_RELAXED);
+
+	// On timeout, the last attempt to consume the event has failed
+	return (ret && !try_consume(event)) ? ret : 0;
+}
+
+
+/**
+ * mm_thr_event_init() - Initialize an event
+ * @event:      event to initialize
+ * @flags:      OR-combination of flags indicating the type of @event
+ *
+ * Use this function to initialize @event in non-signaled state. The type of
+ * event is controlled by @flags which must contains one or several of the
+ * following:
+ *
+ * - MM_THR_PSHARED: init an event shareable by other processes.
+ * - MM_THR_AUTORESET: init an auto-reset event. Otherwise the event is a
+ *   manual-reset event.
+ * - MM_THR_WAIT_MONOTONIC: the clock base used in mm_thr_event_timedwait()
+ *   is MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_event_init(mm_thr_event_t* event, int flags)
+{
+	event->flags = flags;
+	event->state = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_event_set() - set an event in signaled state
+ * @event:      initialized event
+ *
+ * If @event is a manual-reset event, all threads waiting for it are
+ * released, as well as all threads waiting for it until it is reset. If
+ * @event is an auto-reset event, one thread waiting for it is released, or
+ * if there is none, the next thread waiting for it.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_event_set(mm_thr_event_t* event)
+{
+	uint32_t state;
+	int num;
+
+	state = mm_atomic_fetch_or_u32(&event->state, EVT_SIGNALED,
+	                               MM_ATOMIC_SEQ_CST);
+	if (state & EVT_SIGNALED || state < EVT_WAITER_INC)
+		return 0;
+
+	num = (event->flags & MM_THR_AUTORESET) ? 1 : INT_MAX;
+	futex_wake(&event->state, num, event->flags);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_event_reset() - set an event in non-signaled state
+ * @event:      initialized event
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_event_reset(mm_thr_event_t* event)
+{
+	mm_atomic_fetch_and_u32(&event->state, ~EVT_SIGNALED,
+	                        MM_ATOMIC_RELAXED);
+	return 0;
+}
+
+
+/**
+ * mm_thr_event_wait() - wait for an event to be signaled
+ * @event:      initialized event
+ *
+ * This function blocks the calling thread until @event is signaled. If
+ * @event is an auto-reset event, it is reset when the function returns.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_event_wait(mm_thr_event_t* event)
+{
+	return event_wait(event, NULL);
+}
+
+
+/**
+ * mm_thr_event_timedwait() - wait for an event to be signaled with timeout
+ * @event:      initialized event
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the same as mm_thr_event_wait() excepting that it
+ * returns if @event is not signaled before @abstime. The clock of @abstime
+ * is MM_CLK_MONOTONIC if @event has been initialized with
+ * MM_THR_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if @event has been signaled, ETIMEDOUT if @abstime has been
+ * reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_thr_event_timedwait(mm_thr_event_t* event,
+                           const struct mm_timespec* abstime)
+{
+	return event_wait(event, abstime);
+}
+
+
+/**
+ * mm_thr_event_deinit() - cleanup an initialized event
+ * @event:      initialized event to destroy
+ *
+ * It is undefined behavior to destroy an event on which threads are
+ * blocked.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_event_deinit(mm_thr_event_t* event)
+{
+	(void)event;
+	return 0;
+}
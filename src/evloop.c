@@ -0,0 +1,1168 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define _GNU_SOURCE             // for NSIG
+
+#include "mmerrno.h"
+#include "mmevloop.h"
+#include "mmpredefs.h"
+#include "mmtime.h"
+
+/**
+ * DOC: event loop
+ *
+ * mm_poll() is given the whole set of file descriptors at each call and
+ * scans it entirely: with thousands of connections, most of the time is
+ * spent building and scanning arrays of descriptors which are idle. It
+ * also has no notion of timers or signals.
+ *
+ * An event loop (struct mm_evloop) keeps the interest list in the kernel:
+ * a file descriptor is registered once with mm_evloop_add_fd() along with
+ * a callback, and each iteration of the loop only handles the descriptors
+ * that are ready. The cost of an iteration does not depend on the number
+ * of registered descriptors. A descriptor can be watched in level-triggered
+ * mode (the default: the callback is called as long as the descriptor is
+ * ready) or edge-triggered mode with MM_EV_ET (the callback is called when
+ * the descriptor becomes ready, and must then read or write until the
+ * operation would block).
+ *
+ * Any file descriptor that can be polled can be registered, in particular
+ * the sockets, the pipes created with mm_pipe() and the connections
+ * returned by mm_ipc_srv_accept() or mm_ipc_connect().
+ *
+ * In addition, the loop delivers as callbacks:
+ *
+ * - the expiration of timers created with mm_evloop_add_timer()
+ * - the signals registered with mm_evloop_add_signal()
+ * - the tasks posted by other threads with mm_evloop_post()
+ *
+ * All the callbacks are called from the thread running the loop with
+ * mm_evloop_run() or mm_evloop_run_once(). Except mm_evloop_post() and
+ * mm_evloop_stop() which can be called from any thread, the functions
+ * operating on a loop must be called from this thread (including from the
+ * callbacks) or while the loop is not running.
+ *
+ * On Linux, the loop is built on epoll, the timers on timerfd, the signals
+ * on signalfd and the wakeup of the loop by other threads on eventfd. The
+ * event loop is not supported on the other platforms: mm_evloop_create()
+ * fails with ENOTSUP.
+ */
+
+#if defined (__linux__)
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "mmatomic.h"
+#include "mmthread.h"
+
+#define MAX_EVENTS              64
+#define VALID_FD_EVENTS         (MM_EV_IN | MM_EV_OUT | MM_EV_ET)
+
+enum source_type {
+	SRC_FD,
+	SRC_TIMER,
+	SRC_SIGNAL,
+	SRC_WAKE,
+};
+
+/**
+ * struct evloop_source - source of events watched by the loop
+ * @type:       type of the source
+ * @fd:         file descriptor watched
+ * @fd_cb:      callback of a SRC_FD source
+ * @cb:         callback of a SRC_TIMER source
+ * @data:       pointer passed to the callback
+ * @removed:    set if the source has been unregistered during a dispatch
+ * @next:       next source in the list of sources to free
+ */
+struct evloop_source {
+	enum source_type type;
+	int fd;
+	mm_evloop_fd_cb fd_cb;
+	mm_evloop_cb cb;
+	void* data;
+	int removed;
+	struct evloop_source* next;
+};
+
+/**
+ * struct signal_handler - registration of a signal
+ * @cb:         callback called when the signal is received, NULL if the
+ *              signal is not registered
+ * @data:       pointer passed to @cb
+ * @was_blocked: non zero if the signal was blocked before its registration
+ */
+struct signal_handler {
+	mm_evloop_cb cb;
+	void* data;
+	int was_blocked;
+};
+
+/**
+ * struct evloop_task - task posted to the loop
+ * @cb:         function to call
+ * @data:       pointer passed to @cb
+ * @next:       next task in the queue
+ */
+struct evloop_task {
+	mm_evloop_task_cb cb;
+	void* data;
+	struct evloop_task* next;
+};
+
+/**
+ * struct mm_evloop - event loop
+ * @epfd:       epoll file descriptor
+ * @stop:       set when mm_evloop_run() must return
+ * @dispatching: non zero while the events of an iteration are dispatched
+ * @sources:    array of the sources of fd and timers, indexed by fd
+ * @num_sources: length of @sources
+ * @removed:    sources unregistered during the current dispatch
+ * @wake_src:   eventfd source used to wake up the loop
+ * @sig_src:    signalfd source, its fd is -1 if no signal was registered
+ * @sigmask:    set of the registered signals
+ * @signals:    registration of each signal
+ * @task_lock:  lock protecting the queue of posted tasks
+ * @task_head:  first posted task
+ * @task_tail:  link to update to append a posted task
+ */
+struct mm_evloop {
+	int epfd;
+	int32_t stop;
+	int dispatching;
+	struct evloop_source** sources;
+	int num_sources;
+	struct evloop_source* removed;
+	struct evloop_source wake_src;
+	struct evloop_source sig_src;
+	sigset_t sigmask;
+	struct signal_handler signals[NSIG];
+	mm_thr_mutex_t task_lock;
+	struct evloop_task* task_head;
+	struct evloop_task** task_tail;
+};
+
+
+static
+uint32_t to_epoll_events(int events)
+{
+	uint32_t epevents = 0;
+
+	if (events & MM_EV_IN)
+		epevents |= EPOLLIN;
+
+	if (events & MM_EV_OUT)
+		epevents |= EPOLLOUT;
+
+	if (events & MM_EV_ET)
+		epevents |= EPOLLET;
+
+	return epevents;
+}
+
+
+static
+int from_epoll_events(uint32_t epevents)
+{
+	int revents = 0;
+
+	if (epevents & EPOLLIN)
+		revents |= MM_EV_IN;
+
+	if (epevents & EPOLLOUT)
+		revents |= MM_EV_OUT;
+
+	if (epevents & EPOLLERR)
+		revents |= MM_EV_ERR;
+
+	if (epevents & EPOLLHUP)
+		revents |= MM_EV_HUP;
+
+	return revents;
+}
+
+
+static
+int watch_source(struct mm_evloop* loop, struct evloop_source* src,
+                 int op, uint32_t epevents)
+{
+	struct epoll_event ev = {.events = epevents, .data.ptr = src};
+
+	if (epoll_ctl(loop->epfd, op, src->fd, &ev))
+		return mm_raise_from_errno("Cannot watch fd %i", src->fd);
+
+	return 0;
+}
+
+
+static
+void wake_loop(struct mm_evloop* loop)
+{
+	uint64_t one = 1;
+	ssize_t rsz;
+
+	// If the counter is saturated, the loop is already woken up
+	rsz = write(loop->wake_src.fd, &one, sizeof(one));
+	(void)rsz;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Registration of fd and timers                     *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * get_source() - get the source registered for a file descriptor
+ * @loop:       event loop
+ * @fd:         file descriptor of the source
+ * @type:       expected type of the source
+ *
+ * Return: the source registered for @fd if it is of type @type, NULL
+ * otherwise.
+ */
+static
+struct evloop_source* get_source(struct mm_evloop* loop, int fd,
+                                 enum source_type type)
+{
+	struct evloop_source* src;
+
+	if (fd < 0 || fd >= loop->num_sources)
+		return NULL;
+
+	src = loop->sources[fd];
+	if (!src || src->type != type)
+		return NULL;
+
+	return src;
+}
+
+
+/**
+ * add_source() - watch a new source and index it by its fd
+ * @loop:       event loop
+ * @src:        source to add
+ * @epevents:   epoll events to watch
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+static
+int add_source(struct mm_evloop* loop, struct evloop_source* src,
+               uint32_t epevents)
+{
+	struct evloop_source** sources;
+	int num;
+
+	if (src->fd >= loop->num_sources) {
+		num = loop->num_sources ? loop->num_sources : 64;
+		while (num <= src->fd)
+			num *= 2;
+
+		sources = realloc(loop->sources, num * sizeof(*sources));
+		if (!sources)
+			return mm_raise_from_errno("Cannot grow source table");
+
+		memset(sources + loop->num_sources, 0,
+		       (num - loop->num_sources) * sizeof(*sources));
+		loop->sources = sources;
+		loop->num_sources = num;
+	}
+
+	if (watch_source(loop, src, EPOLL_CTL_ADD, epevents))
+		return -1;
+
+	loop->sources[src->fd] = src;
+	return 0;
+}
+
+
+/**
+ * remove_source() - stop watching a source and free it
+ * @loop:       event loop
+ * @src:        source to remove
+ *
+ * If the events of the current iteration are being dispatched, an event of
+ * @src may still be pending in the batch: @src is then only marked as
+ * removed and freed at the end of the dispatch.
+ */
+static
+void remove_source(struct mm_evloop* loop, struct evloop_source* src)
+{
+	// Fail if the fd has already been closed, but then it is not
+	// watched anymore anyway
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+	loop->sources[src->fd] = NULL;
+
+	if (!loop->dispatching) {
+		free(src);
+		return;
+	}
+
+	src->removed = 1;
+	src->next = loop->removed;
+	loop->removed = src;
+}
+
+
+/**
+ * mm_evloop_add_fd() - watch a file descriptor
+ * @loop:       event loop
+ * @fd:         file descriptor to watch
+ * @events:     OR-combination of MM_EV_IN, MM_EV_OUT and MM_EV_ET
+ * @cb:         function called when @fd is ready
+ * @data:       pointer passed to @cb
+ *
+ * Register @fd in @loop. @cb is called when @fd is ready for reading if
+ * @events contains MM_EV_IN, ready for writing if it contains MM_EV_OUT.
+ * The revents argument of @cb then indicates the conditions met, which may
+ * also include MM_EV_ERR and MM_EV_HUP: those are always reported. If
+ * @events contains MM_EV_ET, @fd is watched in edge-triggered mode.
+ *
+ * @fd must be unregistered with mm_evloop_del_fd() before being closed.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular EEXIST if @fd is already registered, EPERM if
+ * @fd cannot be polled (like a regular file).
+ */
+API_EXPORTED
+int mm_evloop_add_fd(struct mm_evloop* loop, int fd, int events,
+                     mm_evloop_fd_cb cb, void* data)
+{
+	struct evloop_source* src;
+
+	if (!cb || (events & ~VALID_FD_EVENTS))
+		return mm_raise_error(EINVAL, "Invalid events (0x%08x) "
+		                      "or callback", events);
+
+	if (fd < 0)
+		return mm_raise_error(EBADF, "Invalid fd %i", fd);
+
+	if (fd < loop->num_sources && loop->sources[fd])
+		return mm_raise_error(EEXIST, "fd %i already registered", fd);
+
+	src = malloc(sizeof(*src));
+	if (!src)
+		return mm_raise_from_errno("Cannot allocate source");
+
+	*src = (struct evloop_source) {
+		.type = SRC_FD,
+		.fd = fd,
+		.fd_cb = cb,
+		.data = data,
+	};
+
+	if (add_source(loop, src, to_epoll_events(events))) {
+		free(src);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_evloop_mod_fd() - change the events watched on a file descriptor
+ * @loop:       event loop
+ * @fd:         file descriptor registered with mm_evloop_add_fd()
+ * @events:     OR-combination of MM_EV_IN, MM_EV_OUT and MM_EV_ET
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular ENOENT if @fd is not registered.
+ */
+API_EXPORTED
+int mm_evloop_mod_fd(struct mm_evloop* loop, int fd, int events)
+{
+	struct evloop_source* src;
+
+	if (events & ~VALID_FD_EVENTS)
+		return mm_raise_error(EINVAL, "Invalid events 0x%08x", events);
+
+	src = get_source(loop, fd, SRC_FD);
+	if (!src)
+		return mm_raise_error(ENOENT, "fd %i not registered", fd);
+
+	return watch_source(loop, src, EPOLL_CTL_MOD, to_epoll_events(events));
+}
+
+
+/**
+ * mm_evloop_del_fd() - stop watching a file descriptor
+ * @loop:       event loop
+ * @fd:         file descriptor registered with mm_evloop_add_fd()
+ *
+ * Once this function has returned, the callback of @fd is not called
+ * anymore, even if @fd was ready in the current iteration of the loop.
+ * @fd is not closed.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular ENOENT if @fd is not registered.
+ */
+API_EXPORTED
+int mm_evloop_del_fd(struct mm_evloop* loop, int fd)
+{
+	struct evloop_source* src;
+
+	src = get_source(loop, fd, SRC_FD);
+	if (!src)
+		return mm_raise_error(ENOENT, "fd %i not registered", fd);
+
+	remove_source(loop, src);
+	return 0;
+}
+
+
+/**
+ * mm_evloop_add_timer() - create a timer in the loop
+ * @loop:       event loop
+ * @clock_id:   clock of the expiration times, MM_CLK_MONOTONIC or
+ *              MM_CLK_REALTIME
+ * @cb:         function called when the timer expires
+ * @data:       pointer passed to @cb
+ *
+ * Create a disarmed timer which calls @cb from the loop when it expires.
+ * The timer is armed with mm_evloop_arm_timer().
+ *
+ * Return: the non negative ID of the timer in case of success, -1
+ * otherwise with error state set accordingly.
+ */
+API_EXPORTED
+int mm_evloop_add_timer(struct mm_evloop* loop, clockid_t clock_id,
+                        mm_evloop_cb cb, void* data)
+{
+	struct evloop_source* src;
+	int fd;
+
+	if (clock_id != MM_CLK_MONOTONIC && clock_id != MM_CLK_REALTIME)
+		return mm_raise_error(EINVAL, "Unsupported clock id for timer:"
+		                      " %i", (int)clock_id);
+
+	if (!cb)
+		return mm_raise_error(EINVAL, "Timer callback cannot be NULL");
+
+	src = malloc(sizeof(*src));
+	if (!src)
+		return mm_raise_from_errno("Cannot allocate source");
+
+	fd = timerfd_create(clock_id, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		mm_raise_from_errno("Cannot create timer");
+		free(src);
+		return -1;
+	}
+
+	*src = (struct evloop_source) {
+		.type = SRC_TIMER,
+		.fd = fd,
+		.cb = cb,
+		.data = data,
+	};
+
+	if (add_source(loop, src, EPOLLIN)) {
+		close(fd);
+		free(src);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/**
+ * mm_evloop_arm_timer() - set the expiration of a timer of the loop
+ * @loop:       event loop
+ * @id:         ID of the timer returned by mm_evloop_add_timer()
+ * @flags:      0 or MM_TIMER_ABSTIME
+ * @value:      expiration time
+ * @period:     period of the timer, NULL or zero for a one-shot timer
+ *
+ * Arm the timer @id to expire at @value, an absolute time of the clock of
+ * the timer if @flags contains MM_TIMER_ABSTIME, an interval from now
+ * otherwise. If @period is not zero, the timer expires again every @period
+ * after the first expiration. If the loop is too late to process several
+ * expirations, the callback is called only once for all of them.
+ *
+ * A zero @value disarms the timer.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular ENOENT if @id is not a timer of @loop.
+ */
+API_EXPORTED
+int mm_evloop_arm_timer(struct mm_evloop* loop, int id, int flags,
+                        const struct mm_timespec* value,
+                        const struct mm_timespec* period)
+{
+	struct itimerspec its = {.it_interval = {0, 0}};
+	struct evloop_source* src;
+	int tfd_flags = 0;
+
+	src = get_source(loop, id, SRC_TIMER);
+	if (!src)
+		return mm_raise_error(ENOENT, "timer %i not registered", id);
+
+	its.it_value.tv_sec = value->tv_sec;
+	its.it_value.tv_nsec = value->tv_nsec;
+	if (period) {
+		its.it_interval.tv_sec = period->tv_sec;
+		its.it_interval.tv_nsec = period->tv_nsec;
+	}
+
+	if (flags & MM_TIMER_ABSTIME)
+		tfd_flags |= TFD_TIMER_ABSTIME;
+
+	if (timerfd_settime(src->fd, tfd_flags, &its, NULL))
+		return mm_raise_from_errno("Cannot arm timer %i", id);
+
+	return 0;
+}
+
+
+/**
+ * mm_evloop_del_timer() - destroy a timer of the loop
+ * @loop:       event loop
+ * @id:         ID of the timer returned by mm_evloop_add_timer()
+ *
+ * Once this function has returned, the callback of the timer is not called
+ * anymore, even if it expired in the current iteration of the loop.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular ENOENT if @id is not a timer of @loop.
+ */
+API_EXPORTED
+int mm_evloop_del_timer(struct mm_evloop* loop, int id)
+{
+	struct evloop_source* src;
+	int fd;
+
+	src = get_source(loop, id, SRC_TIMER);
+	if (!src)
+		return mm_raise_error(ENOENT, "timer %i not registered", id);
+
+	// The timerfd must be removed from the epoll set before being
+	// closed, and src may be freed by remove_source()
+	fd = src->fd;
+	remove_source(loop, src);
+	close(fd);
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                               Signals                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_evloop_add_signal() - receive a signal in the loop
+ * @loop:       event loop
+ * @signum:     signal to receive
+ * @cb:         function called when @signum is received
+ * @data:       pointer passed to @cb
+ *
+ * Register @cb to be called from the loop when @signum is received by the
+ * process, instead of the signal being handled asynchronously.
+ *
+ * For this, @signum must be blocked in all the threads of the process: if
+ * a thread does not block it, the signal may be delivered to this thread
+ * with its usual disposition. This function blocks @signum in the calling
+ * thread, so it should be called before creating the other threads, which
+ * inherit the signal mask of their creator.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular EEXIST if @signum is already registered.
+ */
+API_EXPORTED
+int mm_evloop_add_signal(struct mm_evloop* loop, int signum,
+                         mm_evloop_cb cb, void* data)
+{
+	struct signal_handler* handler;
+	sigset_t set, oldset;
+	int fd;
+
+	if (!cb || signum <= 0 || signum >= NSIG)
+		return mm_raise_error(EINVAL, "Invalid signal %i or callback",
+		                      signum);
+
+	handler = &loop->signals[signum];
+	if (handler->cb)
+		return mm_raise_error(EEXIST, "Signal %i already registered",
+		                      signum);
+
+	sigaddset(&loop->sigmask, signum);
+	fd = signalfd(loop->sig_src.fd, &loop->sigmask,
+	              SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		sigdelset(&loop->sigmask, signum);
+		return mm_raise_from_errno("Cannot watch signal %i", signum);
+	}
+
+	// The signalfd is created at the first registration
+	if (loop->sig_src.fd < 0) {
+		loop->sig_src.fd = fd;
+		if (watch_source(loop, &loop->sig_src, EPOLL_CTL_ADD,
+		                 EPOLLIN)) {
+			close(fd);
+			loop->sig_src.fd = -1;
+			sigdelset(&loop->sigmask, signum);
+			return -1;
+		}
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, signum);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+
+	handler->cb = cb;
+	handler->data = data;
+	handler->was_blocked = sigismember(&oldset, signum);
+
+	return 0;
+}
+
+
+static
+void unblock_signal(struct mm_evloop* loop, int signum)
+{
+	sigset_t set;
+
+	if (loop->signals[signum].was_blocked)
+		return;
+
+	sigemptyset(&set);
+	sigaddset(&set, signum);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+
+/**
+ * mm_evloop_del_signal() - stop receiving a signal in the loop
+ * @loop:       event loop
+ * @signum:     signal registered with mm_evloop_add_signal()
+ *
+ * If @signum was not blocked before its registration, it is unblocked in
+ * the calling thread.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular ENOENT if @signum is not registered.
+ */
+API_EXPORTED
+int mm_evloop_del_signal(struct mm_evloop* loop, int signum)
+{
+	if (signum <= 0 || signum >= NSIG || !loop->signals[signum].cb)
+		return mm_raise_error(ENOENT, "Signal %i not registered",
+		                      signum);
+
+	sigdelset(&loop->sigmask, signum);
+	signalfd(loop->sig_src.fd, &loop->sigmask, 0);
+
+	unblock_signal(loop, signum);
+	loop->signals[signum].cb = NULL;
+
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Loop and dispatch                             *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_evloop_create() - create an event loop
+ *
+ * Return: pointer to the new event loop in case of success, NULL otherwise
+ * with error state set accordingly.
+ */
+API_EXPORTED
+struct mm_evloop* mm_evloop_create(void)
+{
+	struct mm_evloop* loop;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop) {
+		mm_raise_from_errno("Cannot allocate event loop");
+		return NULL;
+	}
+
+	loop->wake_src = (struct evloop_source) {.type = SRC_WAKE, .fd = -1};
+	loop->sig_src = (struct evloop_source) {.type = SRC_SIGNAL, .fd = -1};
+	sigemptyset(&loop->sigmask);
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		mm_raise_from_errno("Cannot create epoll fd");
+		goto error;
+	}
+
+	loop->wake_src.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->wake_src.fd < 0) {
+		mm_raise_from_errno("Cannot create eventfd");
+		goto error;
+	}
+
+	if (watch_source(loop, &loop->wake_src, EPOLL_CTL_ADD, EPOLLIN))
+		goto error;
+
+	mm_thr_mutex_init(&loop->task_lock, 0);
+	loop->task_tail = &loop->task_head;
+
+	return loop;
+
+error:
+	if (loop->wake_src.fd >= 0)
+		close(loop->wake_src.fd);
+
+	if (loop->epfd >= 0)
+		close(loop->epfd);
+
+	free(loop);
+	return NULL;
+}
+
+
+/**
+ * mm_evloop_destroy() - destroy an event loop
+ * @loop:       event loop to destroy (may be NULL)
+ *
+ * Free @loop and its timers, and restore the mask of the registered signals
+ * in the calling thread. The registered file descriptors are not closed.
+ * The tasks posted and not run yet are discarded. This function must not be
+ * called from a callback of @loop.
+ */
+API_EXPORTED
+void mm_evloop_destroy(struct mm_evloop* loop)
+{
+	struct evloop_task* task;
+	struct evloop_source* src;
+	int i;
+
+	if (!loop)
+		return;
+
+	for (i = 0; i < loop->num_sources; i++) {
+		src = loop->sources[i];
+		if (!src)
+			continue;
+
+		if (src->type == SRC_TIMER)
+			close(src->fd);
+
+		free(src);
+	}
+
+	for (i = 1; i < NSIG; i++) {
+		if (loop->signals[i].cb)
+			unblock_signal(loop, i);
+	}
+
+	while (loop->task_head) {
+		task = loop->task_head;
+		loop->task_head = task->next;
+		free(task);
+	}
+
+	if (loop->sig_src.fd >= 0)
+		close(loop->sig_src.fd);
+
+	close(loop->wake_src.fd);
+	close(loop->epfd);
+	mm_thr_mutex_deinit(&loop->task_lock);
+	free(loop->sources);
+	free(loop);
+}
+
+
+static
+int dispatch_signals(struct mm_evloop* loop)
+{
+	struct signalfd_siginfo info;
+	struct signal_handler* handler;
+	int num_cb = 0;
+
+	while (read(loop->sig_src.fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo >= NSIG)
+			continue;
+
+		handler = &loop->signals[info.ssi_signo];
+		if (!handler->cb)
+			continue;
+
+		handler->cb(loop, info.ssi_signo, handler->data);
+		num_cb++;
+	}
+
+	return num_cb;
+}
+
+
+static
+int run_posted_tasks(struct mm_evloop* loop)
+{
+	struct evloop_task * task, * next;
+	uint64_t count;
+	ssize_t rsz;
+	int num_cb = 0;
+
+	rsz = read(loop->wake_src.fd, &count, sizeof(count));
+	(void)rsz;
+
+	mm_thr_mutex_lock(&loop->task_lock);
+	task = loop->task_head;
+	loop->task_head = NULL;
+	loop->task_tail = &loop->task_head;
+	mm_thr_mutex_unlock(&loop->task_lock);
+
+	for (; task; task = next) {
+		next = task->next;
+		task->cb(loop, task->data);
+		free(task);
+		num_cb++;
+	}
+
+	return num_cb;
+}
+
+
+static
+int dispatch_event(struct mm_evloop* loop, struct evloop_source* src,
+                   uint32_t epevents)
+{
+	uint64_t num_exp;
+
+	if (src->removed)
+		return 0;
+
+	switch (src->type) {
+	case SRC_FD:
+		src->fd_cb(loop, src->fd, from_epoll_events(epevents),
+		           src->data);
+		return 1;
+
+	case SRC_TIMER:
+		// Nothing to read if the timer has been rearmed meanwhile
+		if (read(src->fd, &num_exp, sizeof(num_exp)) < 0)
+			return 0;
+
+		src->cb(loop, src->fd, src->data);
+		return 1;
+
+	case SRC_SIGNAL:
+		return dispatch_signals(loop);
+
+	case SRC_WAKE:
+		return run_posted_tasks(loop);
+
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ * mm_evloop_run_once() - run one iteration of an event loop
+ * @loop:       event loop
+ * @timeout_ms: maximum time to wait for an event in milliseconds, -1 to
+ *              wait indefinitely
+ *
+ * Wait for events of @loop for at most @timeout_ms and call the callbacks
+ * of the sources that are ready. This function must not be called from a
+ * callback.
+ *
+ * Return: the number of callbacks called in case of success (0 if the
+ * timeout has been reached or the wait interrupted), -1 otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+int mm_evloop_run_once(struct mm_evloop* loop, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct evloop_source* src;
+	int i, num, num_cb;
+
+	num = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout_ms);
+	if (num < 0) {
+		if (errno == EINTR)
+			return 0;
+
+		return mm_raise_from_errno("epoll_wait() failed");
+	}
+
+	num_cb = 0;
+	loop->dispatching = 1;
+	for (i = 0; i < num; i++)
+		num_cb += dispatch_event(loop, events[i].data.ptr,
+		                         events[i].events);
+
+	loop->dispatching = 0;
+
+	while (loop->removed) {
+		src = loop->removed;
+		loop->removed = src->next;
+		free(src);
+	}
+
+	return num_cb;
+}
+
+
+/**
+ * mm_evloop_run() - run an event loop until stopped
+ * @loop:       event loop
+ *
+ * Run iterations of @loop until mm_evloop_stop() is called. The tasks
+ * posted with mm_evloop_post() before the stop request are run before this
+ * function returns. The loop can then be run again. This function must not
+ * be called from a callback.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_evloop_run(struct mm_evloop* loop)
+{
+	int rv = 0;
+
+	while (!mm_atomic_load_i32(&loop->stop, MM_ATOMIC_ACQUIRE)) {
+		if (mm_evloop_run_once(loop, -1) < 0) {
+			rv = -1;
+			break;
+		}
+	}
+
+	// The wakeup of tasks posted just before the stop request may not
+	// have been dispatched yet
+	if (rv == 0)
+		run_posted_tasks(loop);
+
+	mm_atomic_store_i32(&loop->stop, 0, MM_ATOMIC_RELAXED);
+	return rv;
+}
+
+
+/**
+ * mm_evloop_stop() - request an event loop to stop
+ * @loop:       event loop
+ *
+ * Make mm_evloop_run() return once the current iteration of @loop is
+ * completed. This function can be called from any thread, including from a
+ * callback of @loop. If @loop is not running, the next call to
+ * mm_evloop_run() runs the tasks posted so far and returns without waiting
+ * for events.
+ */
+API_EXPORTED
+void mm_evloop_stop(struct mm_evloop* loop)
+{
+	mm_atomic_store_i32(&loop->stop, 1, MM_ATOMIC_RELEASE);
+	wake_loop(loop);
+}
+
+
+/**
+ * mm_evloop_post() - run a function in the thread of an event loop
+ * @loop:       event loop
+ * @cb:         function to call
+ * @data:       pointer passed to @cb
+ *
+ * Queue a call to @cb and wake up @loop, which calls it in its next
+ * iteration. This function can be called from any thread. The posted
+ * functions are called in the order they have been posted.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_evloop_post(struct mm_evloop* loop, mm_evloop_task_cb cb, void* data)
+{
+	struct evloop_task* task;
+
+	if (!cb)
+		return mm_raise_error(EINVAL, "Task callback cannot be NULL");
+
+	task = malloc(sizeof(*task));
+	if (!task)
+		return mm_raise_from_errno("Cannot allocate task");
+
+	task->cb = cb;
+	task->data = data;
+	task->next = NULL;
+
+	mm_thr_mutex_lock(&loop->task_lock);
+	*loop->task_tail = task;
+	loop->task_tail = &task->next;
+	mm_thr_mutex_unlock(&loop->task_lock);
+
+	wake_loop(loop);
+	return 0;
+}
+
+
+#else /* !__linux__ */
+
+/* doc in linux implementation */
+API_EXPORTED
+struct mm_evloop* mm_evloop_create(void)
+{
+	mm_raise_error(ENOTSUP, "event loop not supported on platform");
+	return NULL;
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+void mm_evloop_destroy(struct mm_evloop* loop)
+{
+	(void)loop;
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_add_fd(struct mm_evloop* loop, int fd, int events,
+                     mm_evloop_fd_cb cb, void* data)
+{
+	(void)loop;
+	(void)fd;
+	(void)events;
+	(void)cb;
+	(void)data;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_mod_fd(struct mm_evloop* loop, int fd, int events)
+{
+	(void)loop;
+	(void)fd;
+	(void)events;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_del_fd(struct mm_evloop* loop, int fd)
+{
+	(void)loop;
+	(void)fd;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_add_timer(struct mm_evloop* loop, clockid_t clock_id,
+                        mm_evloop_cb cb, void* data)
+{
+	(void)loop;
+	(void)clock_id;
+	(void)cb;
+	(void)data;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_arm_timer(struct mm_evloop* loop, int id, int flags,
+                        const struct mm_timespec* value,
+                        const struct mm_timespec* period)
+{
+	(void)loop;
+	(void)id;
+	(void)flags;
+	(void)value;
+	(void)period;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_del_timer(struct mm_evloop* loop, int id)
+{
+	(void)loop;
+	(void)id;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_add_signal(struct mm_evloop* loop, int signum,
+                         mm_evloop_cb cb, void* data)
+{
+	(void)loop;
+	(void)signum;
+	(void)cb;
+	(void)data;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_del_signal(struct mm_evloop* loop, int signum)
+{
+	(void)loop;
+	(void)signum;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_post(struct mm_evloop* loop, mm_evloop_task_cb cb, void* data)
+{
+	(void)loop;
+	(void)cb;
+	(void)data;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_run_once(struct mm_evloop* loop, int timeout_ms)
+{
+	(void)loop;
+	(void)timeout_ms;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_evloop_run(struct mm_evloop* loop)
+{
+	(void)loop;
+	return mm_raise_error(ENOTSUP, "event loop not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+void mm_evloop_stop(struct mm_evloop* loop)
+{
+	(void)loop;
+}
+
+#endif /* !__linux__ */
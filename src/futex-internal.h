@@ -0,0 +1,60 @@
+/*
+   @mindmaze_header@
+*/
+#ifndef FUTEX_INTERNAL_H
+#define FUTEX_INTERNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmthread.h"
+#include "mmtime.h"
+
+/**
+ * DOC: futex layer
+ *
+ * futex_wait() and futex_wake() provide the minimal wait/wake on address
+ * mechanism needed to build the synchronization objects that are fully
+ * implemented in userspace (on top of atomic operations). The objects are
+ * then usable with the same code on all platforms.
+ *
+ * @flags of both functions is an OR-combination of:
+ *
+ * - MM_THR_PSHARED: the address may be mapped in several processes
+ * - MM_THR_WAIT_MONOTONIC: @abstime in futex_wait() is based on
+ *   MM_CLK_MONOTONIC instead of MM_CLK_REALTIME.
+ *
+ * The wait can return spuriously: the caller must always check the value
+ * at the address after futex_wait() returns. futex_wait() fails with
+ * EINVAL if @abstime is not a valid time: the caller must then stop
+ * waiting and report the error.
+ *
+ * futex_requeue() moves the threads waiting on an address to another one
+ * without waking them, so that they can be woken one at a time later. When
+ * the platform cannot requeue, it wakes them all instead.
+ */
+
+int futex_wait(uint32_t* addr, uint32_t expected, int flags,
+               const struct mm_timespec* abstime);
+void futex_wake(uint32_t* addr, int num, int flags);
+int futex_requeue(uint32_t* addr, uint32_t expected, uint32_t* target,
+                  int flags);
+
+
+/**
+ * futex_abstime_is_valid() - test whether a timeout can be waited on
+ * @abstime:    absolute time of timeout or NULL to wait indefinitely
+ *
+ * Return: true if @abstime is NULL or a normalized non negative time.
+ */
+static inline
+bool futex_abstime_is_valid(const struct mm_timespec* abstime)
+{
+	if (!abstime)
+		return true;
+
+	return abstime->tv_sec >= 0
+	       && abstime->tv_nsec >= 0 && abstime->tv_nsec < NS_IN_SEC;
+}
+
+#endif /* FUTEX_INTERNAL_H */
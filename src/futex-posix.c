@@ -0,0 +1,276 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#define POLL_SLEEP_MIN_NS       1000
+#define POLL_SLEEP_MAX_NS       1000000
+
+
+#ifdef __linux__
+
+/**
+ * futex_wait() - wait for the value at an address to change
+ * @addr:       address of the 32bit word to monitor
+ * @expected:   value that @addr is expected to contain
+ * @flags:      OR-combination of MM_THR_PSHARED and MM_THR_WAIT_MONOTONIC
+ * @abstime:    absolute time of timeout or NULL to wait indefinitely
+ *
+ * If the value at @addr is @expected, the calling thread is put to sleep
+ * until futex_wake() is called on @addr, @abstime is reached or a spurious
+ * wakeup occurs. Otherwise the function returns immediately.
+ *
+ * Return: ETIMEDOUT if @abstime has been reached, EINVAL if @abstime is
+ * not a valid time, 0 otherwise.
+ */
+LOCAL_SYMBOL
+int futex_wait(uint32_t* addr, uint32_t expected, int flags,
+               const struct mm_timespec* abstime)
+{
+	int op;
+
+	if (!futex_abstime_is_valid(abstime)) {
+		mm_raise_error(EINVAL, "invalid timeout {%lli, %li}",
+		               (long long)abstime->tv_sec,
+		               (long)abstime->tv_nsec);
+		return EINVAL;
+	}
+
+	// FUTEX_WAIT_BITSET takes an absolute timeout (unlike FUTEX_WAIT)
+	op = FUTEX_WAIT_BITSET;
+	if (!(flags & MM_THR_PSHARED))
+		op |= FUTEX_PRIVATE_FLAG;
+
+	if (!(flags & MM_THR_WAIT_MONOTONIC))
+		op |= FUTEX_CLOCK_REALTIME;
+
+	if (syscall(SYS_futex, addr, op, expected, abstime,
+	            NULL, FUTEX_BITSET_MATCH_ANY) == 0)
+		return 0;
+
+	// EAGAIN (value mismatch) and EINTR are reported as wakeup
+	return (errno == ETIMEDOUT) ? ETIMEDOUT : 0;
+}
+
+
+/**
+ * futex_wake() - wake threads waiting on address
+ * @addr:       address of the 32bit word waited
+ * @num:        maximum number of threads to wake (INT_MAX to wake all)
+ * @flags:      MM_THR_PSHARED if @addr may be mapped in other processes
+ */
+LOCAL_SYMBOL
+void futex_wake(uint32_t* addr, int num, int flags)
+{
+	int op;
+
+	op = FUTEX_WAKE;
+	if (!(flags & MM_THR_PSHARED))
+		op |= FUTEX_PRIVATE_FLAG;
+
+	syscall(SYS_futex, addr, op, num, NULL, NULL, 0);
+}
+
+
+/**
+ * futex_requeue() - move threads waiting on address to another address
+ * @addr:       address of the 32bit word waited
+ * @expected:   value that @addr is expected to contain
+ * @target:     address on which the waiters of @addr must be moved
+ * @flags:      MM_THR_PSHARED if @addr and @target may be mapped in other
+ *              processes
+ *
+ * If the value at @addr is @expected, all the threads waiting on @addr are
+ * moved to wait on @target, without being woken up: they will be woken by
+ * a futex_wake() on @target. The comparison and the move are atomic with
+ * respect to futex_wait() on @addr.
+ *
+ * On platforms which cannot requeue, the threads waiting on @addr are
+ * woken up instead and 0 is returned.
+ *
+ * Return: the number of threads moved to @target, -1 if the value at @addr
+ * was not @expected.
+ */
+LOCAL_SYMBOL
+int futex_requeue(uint32_t* addr, uint32_t expected, uint32_t* target,
+                  int flags)
+{
+	long ret;
+	int op;
+
+	op = FUTEX_CMP_REQUEUE;
+	if (!(flags & MM_THR_PSHARED))
+		op |= FUTEX_PRIVATE_FLAG;
+
+	// The maximum number of threads to requeue is passed in timeout
+	ret = syscall(SYS_futex, addr, op, 0, (void*)(uintptr_t)INT_MAX,
+	              target, expected);
+	if (ret >= 0)
+		return ret;
+
+	if (errno == EAGAIN)
+		return -1;
+
+	// Requeue not supported: fallback to waking all the waiters
+	futex_wake(addr, INT_MAX, flags);
+	return 0;
+}
+
+#else /* __linux__ */
+
+/*
+ * Without futex, wait by polling the address with sleep of exponentially
+ * increasing duration (bounded to 1ms).
+ */
+LOCAL_SYMBOL
+int futex_wait(uint32_t* addr, uint32_t expected, int flags,
+               const struct mm_timespec* abstime)
+{
+	struct timespec delay = {.tv_sec = 0, .tv_nsec = POLL_SLEEP_MIN_NS};
+	struct mm_timespec now;
+	clockid_t clk_id;
+
+	if (!futex_abstime_is_valid(abstime)) {
+		mm_raise_error(EINVAL, "invalid timeout {%lli, %li}",
+		               (long long)abstime->tv_sec,
+		               (long)abstime->tv_nsec);
+		return EINVAL;
+	}
+
+	clk_id = (flags & MM_THR_WAIT_MONOTONIC) ? MM_CLK_MONOTONIC
+	                                         : MM_CLK_REALTIME;
+
+	while (mm_atomic_load_u32(addr, MM_ATOMIC_ACQUIRE) == expected) {
+		if (abstime) {
+			mm_gettime(clk_id, &now);
+			if (mm_timediff_ns(abstime, &now) <= 0)
+				return ETIMEDOUT;
+		}
+
+		nanosleep(&delay, NULL);
+		if (delay.tv_nsec < POLL_SLEEP_MAX_NS)
+			delay.tv_nsec *= 2;
+	}
+
+	return 0;
+}
+
+
+LOCAL_SYMBOL
+void futex_wake(uint32_t* addr, int num, int flags)
+{
+	(void)addr;
+	(void)num;
+	(void)flags;
+}
+
+
+LOCAL_SYMBOL
+int futex_requeue(uint32_t* addr, uint32_t expected, uint32_t* target,
+                  int flags)
+{
+	// The waiters poll @addr: they notice the change by themselves
+	(void)addr;
+	(void)expected;
+	(void)target;
+	(void)flags;
+	return 0;
+}
+
+#endif /* !__linux__ */
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         Wait on address API                            *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_wait_on_address() - wait for the value at an address to change
+ * @addr:       address of the 32bit word to monitor (must be 4 bytes aligned)
+ * @expected:   value that @addr is expected to contain
+ * @flags:      OR-combination of flags controlling the wait
+ * @abstime:    absolute time of timeout or NULL to wait indefinitely
+ *
+ * If the value at @addr is @expected, the calling thread is put to sleep
+ * until mm_wake_by_address() is called on @addr, the timeout @abstime is
+ * reached or a spurious wakeup occurs. Otherwise the function returns
+ * immediately. The comparison and the sleep are done atomically with
+ * respect to mm_wake_by_address(): a wakeup occurring after the value has
+ * been changed cannot be missed. This allows to wait for a flag in memory
+ * without the round trip of a mutex and condition variable.
+ *
+ * @flags must contains one or several of the following:
+ *
+ * - MM_THR_PSHARED: @addr may be in memory mapped by several processes.
+ *   mm_wake_by_address() must be called with the same flag.
+ * - MM_THR_WAIT_MONOTONIC: the clock base of @abstime is MM_CLK_MONOTONIC
+ *   instead of the default MM_CLK_REALTIME.
+ *
+ * Since the function may return spuriously, the caller must check again
+ * the value at @addr after the function returns.
+ *
+ * On Linux, the wait and wake are done with a single system call. On
+ * Windows, a thread waiting with MM_THR_PSHARED polls the address instead
+ * of sleeping until being woken up.
+ *
+ * Return: 0 if the value at @addr was not @expected or the thread has been
+ * woken up, ETIMEDOUT if @abstime has been reached, EINVAL if @addr is not
+ * properly aligned or @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_wait_on_address(uint32_t* addr, uint32_t expected, int flags,
+                       const struct mm_timespec* abstime)
+{
+	if ((uintptr_t)addr % sizeof(*addr)) {
+		mm_raise_error(EINVAL, "%p is not aligned on 32bit", addr);
+		return EINVAL;
+	}
+
+	return futex_wait(addr, expected, flags, abstime);
+}
+
+
+/**
+ * mm_wake_by_address() - wake threads waiting on address
+ * @addr:       address of the 32bit word waited (must be 4 bytes aligned)
+ * @num:        maximum number of threads to wake (INT_MAX to wake all)
+ * @flags:      MM_THR_PSHARED if @addr may be in memory mapped by several
+ *              processes.
+ *
+ * This function wakes up at most @num threads waiting in
+ * mm_wait_on_address() on @addr. It must be called after having changed the
+ * value at @addr.
+ *
+ * Return: 0 in case of success, EINVAL if @addr is not properly aligned or
+ * @num is not positive.
+ */
+API_EXPORTED
+int mm_wake_by_address(uint32_t* addr, int num, int flags)
+{
+	if ((uintptr_t)addr % sizeof(*addr) || num <= 0) {
+		mm_raise_error(EINVAL, "invalid address %p or number of "
+		               "thread to wake %i", addr, num);
+		return EINVAL;
+	}
+
+	futex_wake(addr, num, flags);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <windows.h>
+#include <synchapi.h>
+#include <limits.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+
+#define POLL_SLEEP_MAX_MS       1
+#define NS_IN_MS                (NS_IN_SEC / MS_IN_SEC)
+
+/**
+ * get_timeout_ms() - compute the relative timeout to wait
+ * @flags:      OR-combination of MM_THR_PSHARED and MM_THR_WAIT_MONOTONIC
+ * @abstime:    absolute time of timeout or NULL to wait indefinitely
+ * @timeout_ms: location receiving the timeout in milliseconds
+ *
+ * Return: ETIMEDOUT if @abstime has been reached, 0 otherwise
+ */
+static
+int get_timeout_ms(int flags, const struct mm_timespec* abstime,
+                   DWORD* timeout_ms)
+{
+	struct mm_timespec now;
+	int64_t delta_ns;
+	clockid_t clk_id;
+
+	if (!abstime) {
+		*timeout_ms = INFINITE;
+		return 0;
+	}
+
+	clk_id = (flags & MM_THR_WAIT_MONOTONIC) ? MM_CLK_MONOTONIC
+	                                         : MM_CLK_REALTIME;
+	mm_gettime(clk_id, &now);
+	delta_ns = mm_timediff_ns(abstime, &now);
+	if (delta_ns <= 0)
+		return ETIMEDOUT;
+
+	// Round up to avoid busy loop in the last millisecond
+	*timeout_ms = (DWORD)((delta_ns + NS_IN_MS - 1) / NS_IN_MS);
+	return 0;
+}
+
+
+/**
+ * pshared_poll_wait() - wait for the value at a shared address to change
+ * @addr:       address of the 32bit word to monitor
+ * @expected:   value that @addr is expected to contain
+ * @flags:      OR-combination of MM_THR_PSHARED and MM_THR_WAIT_MONOTONIC
+ * @abstime:    absolute time of timeout or NULL to wait indefinitely
+ *
+ * WaitOnAddress() works only between threads of the same process. For
+ * process shared data, the address is polled, yielding the CPU between
+ * checks.
+ *
+ * Return: ETIMEDOUT if @abstime has been reached, 0 otherwise.
+ */
+static
+int pshared_poll_wait(uint32_t* addr, uint32_t expected, int flags,
+                      const struct mm_timespec* abstime)
+{
+	DWORD timeout_ms, sleep_ms = 0;
+
+	while (mm_atomic_load_u32(addr, MM_ATOMIC_ACQUIRE) == expected) {
+		if (get_timeout_ms(flags, abstime, &timeout_ms))
+			return ETIMEDOUT;
+
+		Sleep(sleep_ms);
+		sleep_ms = POLL_SLEEP_MAX_MS;
+	}
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+LOCAL_SYMBOL
+int futex_wait(uint32_t* addr, uint32_t expected, int flags,
+               const struct mm_timespec* abstime)
+{
+	DWORD timeout_ms;
+
+	if (!futex_abstime_is_valid(abstime)) {
+		mm_raise_error(EINVAL, "invalid timeout {%lli, %li}",
+		               (long long)abstime->tv_sec,
+		               (long)abstime->tv_nsec);
+		return EINVAL;
+	}
+
+	if (flags & MM_THR_PSHARED)
+		return pshared_poll_wait(addr, expected, flags, abstime);
+
+	if (get_timeout_ms(flags, abstime, &timeout_ms))
+		return ETIMEDOUT;
+
+	if (!WaitOnAddress(addr, &expected, sizeof(expected), timeout_ms)
+	    && GetLastError() == ERROR_TIMEOUT)
+		return ETIMEDOUT;
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+LOCAL_SYMBOL
+void futex_wake(uint32_t* addr, int num, int flags)
+{
+	int i;
+
+	// Threads of other processes poll the address
+	if (flags & MM_THR_PSHARED)
+		return;
+
+	if (num == INT_MAX) {
+		WakeByAddressAll(addr);
+		return;
+	}
+
+	for (i = 0; i < num; i++)
+		WakeByAddressSingle(addr);
+}
+
+
+/* doc in posix implementation */
+LOCAL_SYMBOL
+int futex_requeue(uint32_t* addr, uint32_t expected, uint32_t* target,
+                  int flags)
+{
+	(void)target;
+
+	if (mm_atomic_load_u32(addr, MM_ATOMIC_RELAXED) != expected)
+		return -1;
+
+	// WaitOnAddress() has no requeue operation: wake all the waiters
+	futex_wake(addr, INT_MAX, flags);
+	return 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         Wait on address API                            *
+ *                                                                        *
+ **************************************************************************/
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_wait_on_address(uint32_t* addr, uint32_t expected, int flags,
+                       const struct mm_timespec* abstime)
+{
+	if ((uintptr_t)addr % sizeof(*addr)) {
+		mm_raise_error(EINVAL, "%p is not aligned on 32bit", addr);
+		return EINVAL;
+	}
+
+	return futex_wait(addr, expected, flags, abstime);
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_wake_by_address(uint32_t* addr, int num, int flags)
+{
+	if ((uintptr_t)addr % sizeof(*addr) || num <= 0) {
+		mm_raise_error(EINVAL, "invalid address %p or number of "
+		               "thread to wake %i", addr, num);
+		return EINVAL;
+	}
+
+	futex_wake(addr, num, flags);
+	return 0;
+}
@@ -0,0 +1,564 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define _GNU_SOURCE             // for dladdr()
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstat.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmlog.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "thread-local.h"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#define LOCKSTAT_NUM_ENTRY      1024    // must be a power of 2
+#define LOCKSTAT_NUM_LOCK       256     // must be a power of 2
+#define LOCKSTAT_MAX_HELD       16
+
+#define ENTRY_FREE      0
+#define ENTRY_BUSY      1       // key of entry is being written
+#define ENTRY_READY     2
+#define ENTRY_DELETED   3       // lock has been destroyed, never reused
+
+#define LOCK_DELETED    ((void*)1)
+
+#define HASH_MULT       UINT64_C(0x9E3779B97F4A7C15)
+
+/**
+ * DOC: lock contention instrumentation
+ *
+ * When instrumented, a mutex records statistics about its contended
+ * acquisitions, ie, the calls to mm_thr_mutex_lock() that could not get
+ * the lock immediately. The statistics are attributed to the pair formed
+ * by the mutex and the return address of mm_thr_mutex_lock(), so that the
+ * different call sites of the same hot lock can be told apart.
+ *
+ * The statistics are kept in a fixed size hash table whose entries are
+ * allocated without lock: an entry is claimed by a compare-and-swap of its
+ * state, its key is written, then it is published with a release store.
+ * The counters of an entry are updated with atomic additions. When a lock
+ * is destroyed, its entries are marked deleted: they are no longer
+ * reported, and a new lock at the same address gets new entries. The
+ * deleted entries are not reused, so that the probe sequences remain
+ * valid for the lock-free lookup.
+ *
+ * The hold time is only known for the contended acquisitions: the lock and
+ * the time at which it has been obtained are pushed on a small per-thread
+ * stack, which mm_thr_mutex_unlock() looks up while the instrumentation is
+ * active.
+ *
+ * When no lock is instrumented, the overhead on mm_thr_mutex_lock() and
+ * mm_thr_mutex_unlock() is a relaxed load of a global variable. The path of
+ * an uncontended lock is left untouched.
+ */
+
+/**
+ * struct lockstat_entry - statistics of a lock and a call site
+ * @state:      ENTRY_FREE, ENTRY_BUSY, ENTRY_READY or ENTRY_DELETED
+ * @lock:       address of the lock
+ * @caller:     return address of the lock function
+ * @count:      number of contended acquisitions
+ * @wait_ns:    total time spent waiting for the lock
+ * @max_wait_ns: longest wait for the lock
+ * @hold_ns:    total time the lock has been held after a contended
+ *              acquisition
+ */
+struct lockstat_entry {
+	uint32_t state;
+	const void* lock;
+	const void* caller;
+	int64_t count;
+	int64_t wait_ns;
+	int64_t max_wait_ns;
+	int64_t hold_ns;
+};
+
+/**
+ * struct held_lock - lock acquired after contention by the current thread
+ * @entry:      statistic entry to which the hold time must be accounted
+ * @lock:       address of the lock
+ * @start_ns:   monotonic time at which the lock has been acquired
+ */
+struct held_lock {
+	struct lockstat_entry* entry;
+	const void* lock;
+	int64_t start_ns;
+};
+
+static struct lockstat_entry entries[LOCKSTAT_NUM_ENTRY];
+static mm_atomic_ptr_t registered_locks[LOCKSTAT_NUM_LOCK];
+static int32_t lockstat_all;
+
+static thread_local struct held_lock held_locks[LOCKSTAT_MAX_HELD];
+static thread_local int num_held;
+
+// number of registered locks, plus one if all locks are instrumented
+LOCAL_SYMBOL int32_t lockstat_active;
+
+
+MM_CONSTRUCTOR(init_lockstat)
+{
+	const char* envval;
+
+	envval = getenv("MM_LOCKSTAT");
+	if (!envval || !envval[0] || !strcmp(envval, "0"))
+		return;
+
+	mm_atomic_store_i32(&lockstat_all, 1, MM_ATOMIC_RELAXED);
+	mm_atomic_fetch_add_i32(&lockstat_active, 1, MM_ATOMIC_RELAXED);
+}
+
+
+static
+int64_t get_time_ns(void)
+{
+	struct mm_timespec ts;
+
+	mm_gettime(MM_CLK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static
+unsigned int hash_key(const void* lock, const void* caller)
+{
+	uint64_t val;
+
+	val = (uint64_t)(uintptr_t)lock * HASH_MULT;
+	val = (val ^ (uint64_t)(uintptr_t)caller) * HASH_MULT;
+	return (unsigned int)(val >> 32);
+}
+
+
+/**
+ * get_entry() - find or allocate the entry of a lock and a call site
+ * @lock:       address of the lock
+ * @caller:     return address of the lock function
+ *
+ * Return: pointer to the entry, NULL if the table is full.
+ */
+static
+struct lockstat_entry* get_entry(const void* lock, const void* caller)
+{
+	struct lockstat_entry* entry;
+	unsigned int i, idx;
+	uint32_t state;
+
+	idx = hash_key(lock, caller);
+	for (i = 0; i < LOCKSTAT_NUM_ENTRY; i++) {
+		entry = &entries[(idx + i) & (LOCKSTAT_NUM_ENTRY - 1)];
+		state = mm_atomic_load_u32(&entry->state, MM_ATOMIC_ACQUIRE);
+		if (state == ENTRY_FREE
+		    && mm_atomic_cas_u32(&entry->state, &state, ENTRY_BUSY,
+		                         MM_ATOMIC_ACQUIRE)) {
+			entry->lock = lock;
+			entry->caller = caller;
+			mm_atomic_store_u32(&entry->state, ENTRY_READY,
+			                    MM_ATOMIC_RELEASE);
+			return entry;
+		}
+
+		// Another thread is writing the key of this entry
+		while (state == ENTRY_BUSY) {
+			mm_cpu_relax();
+			state = mm_atomic_load_u32(&entry->state,
+			                           MM_ATOMIC_ACQUIRE);
+		}
+
+		if (state == ENTRY_READY
+		    && entry->lock == lock && entry->caller == caller)
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * drop_entries() - mark deleted all the entries of a lock
+ * @lock:       address of the lock being destroyed
+ */
+static
+void drop_entries(const void* lock)
+{
+	struct lockstat_entry* entry;
+	uint32_t state;
+	int i;
+
+	for (i = 0; i < LOCKSTAT_NUM_ENTRY; i++) {
+		entry = &entries[i];
+		state = mm_atomic_load_u32(&entry->state, MM_ATOMIC_ACQUIRE);
+		if (state == ENTRY_READY && entry->lock == lock)
+			mm_atomic_cas_u32(&entry->state, &state, ENTRY_DELETED,
+			                  MM_ATOMIC_RELAXED);
+	}
+}
+
+
+static
+bool is_registered(const void* lock)
+{
+	unsigned int i, idx;
+	void* val;
+
+	idx = hash_key(lock, NULL);
+	for (i = 0; i < LOCKSTAT_NUM_LOCK; i++) {
+		val = mm_atomic_load_ptr(
+			&registered_locks[(idx + i) & (LOCKSTAT_NUM_LOCK - 1)],
+			MM_ATOMIC_RELAXED);
+		if (val == lock)
+			return true;
+
+		if (val == NULL)
+			break;
+	}
+
+	return false;
+}
+
+
+/**
+ * lockstat_register() - instrument a lock
+ * @lock:       address of the lock
+ *
+ * Called at initialization of a lock with MM_THR_LOCKSTAT flag. Does
+ * nothing if @lock is already registered. If too many locks are
+ * instrumented, a warning is logged and @lock is not instrumented.
+ */
+LOCAL_SYMBOL
+void lockstat_register(const void* lock)
+{
+	unsigned int i, idx;
+	mm_atomic_ptr_t* slot;
+	void* val;
+
+	// A lock initialized twice must be counted once
+	if (is_registered(lock))
+		return;
+
+	idx = hash_key(lock, NULL);
+	for (i = 0; i < LOCKSTAT_NUM_LOCK; i++) {
+		slot = &registered_locks[(idx + i) & (LOCKSTAT_NUM_LOCK - 1)];
+		val = mm_atomic_load_ptr(slot, MM_ATOMIC_RELAXED);
+		if (val != NULL && val != LOCK_DELETED)
+			continue;
+
+		if (mm_atomic_cas_ptr(slot, &val, (void*)lock,
+		                      MM_ATOMIC_RELAXED)) {
+			mm_atomic_fetch_add_i32(&lockstat_active, 1,
+			                        MM_ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	mm_log_warn("Too many locks instrumented, %p is not", lock);
+}
+
+
+/**
+ * lockstat_unregister() - stop instrumenting a lock
+ * @lock:       address of the lock
+ *
+ * Called at cleanup of any lock while the instrumentation is active. The
+ * statistics of @lock are dropped, so that they are not attributed to a
+ * lock later initialized at the same address. The registration of @lock,
+ * if any, is removed.
+ */
+LOCAL_SYMBOL
+void lockstat_unregister(const void* lock)
+{
+	unsigned int i, idx;
+	mm_atomic_ptr_t* slot;
+	void* val;
+
+	drop_entries(lock);
+
+	idx = hash_key(lock, NULL);
+	for (i = 0; i < LOCKSTAT_NUM_LOCK; i++) {
+		slot = &registered_locks[(idx + i) & (LOCKSTAT_NUM_LOCK - 1)];
+		val = mm_atomic_load_ptr(slot, MM_ATOMIC_RELAXED);
+		if (val == NULL)
+			return;
+
+		if (val == lock
+		    && mm_atomic_cas_ptr(slot, &val, LOCK_DELETED,
+		                         MM_ATOMIC_RELAXED)) {
+			mm_atomic_fetch_sub_i32(&lockstat_active, 1,
+			                        MM_ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
+
+
+/**
+ * lockstat_begin_wait() - start measuring a contended acquisition
+ * @wait:       state of the acquisition to initialize
+ * @lock:       address of the lock whose acquisition has failed
+ * @caller:     return address of the lock function
+ *
+ * Return: true if @lock is instrumented and the acquisition must be
+ * finished with lockstat_end_wait(), false otherwise.
+ */
+LOCAL_SYMBOL
+bool lockstat_begin_wait(struct lockstat_wait* wait, const void* lock,
+                         const void* caller)
+{
+	if (!mm_atomic_load_i32(&lockstat_all, MM_ATOMIC_RELAXED)
+	    && !is_registered(lock))
+		return false;
+
+	wait->entry = get_entry(lock, caller);
+	if (!wait->entry)
+		return false;
+
+	wait->lock = lock;
+	wait->start_ns = get_time_ns();
+	return true;
+}
+
+
+/**
+ * lockstat_end_wait() - account a contended acquisition
+ * @wait:       state initialized by lockstat_begin_wait()
+ * @acquired:   true if the lock has been acquired
+ */
+LOCAL_SYMBOL
+void lockstat_end_wait(const struct lockstat_wait* wait, int acquired)
+{
+	struct lockstat_entry* entry = wait->entry;
+	int64_t now, wait_ns, max_wait_ns;
+
+	now = get_time_ns();
+	wait_ns = now - wait->start_ns;
+
+	mm_atomic_fetch_add_i64(&entry->count, 1, MM_ATOMIC_RELAXED);
+	mm_atomic_fetch_add_i64(&entry->wait_ns, wait_ns, MM_ATOMIC_RELAXED);
+	max_wait_ns = mm_atomic_load_i64(&entry->max_wait_ns,
+	                                 MM_ATOMIC_RELAXED);
+	while (wait_ns > max_wait_ns
+	       && !mm_atomic_cas_i64(&entry->max_wait_ns, &max_wait_ns,
+	                             wait_ns, MM_ATOMIC_RELAXED)) {
+	}
+
+	if (!acquired || num_held == LOCKSTAT_MAX_HELD)
+		return;
+
+	held_locks[num_held++] = (struct held_lock) {
+		.entry = entry,
+		.lock = wait->lock,
+		.start_ns = now,
+	};
+}
+
+
+/**
+ * lockstat_release() - account hold time of a lock being released
+ * @lock:       address of the lock
+ *
+ * Does nothing if @lock has not been obtained by the calling thread after
+ * an instrumented contended acquisition.
+ */
+LOCAL_SYMBOL
+void lockstat_release(const void* lock)
+{
+	int i;
+
+	for (i = num_held - 1; i >= 0; i--) {
+		if (held_locks[i].lock != lock)
+			continue;
+
+		mm_atomic_fetch_add_i64(&held_locks[i].entry->hold_ns,
+		                        get_time_ns() - held_locks[i].start_ns,
+		                        MM_ATOMIC_RELAXED);
+		held_locks[i] = held_locks[--num_held];
+		return;
+	}
+}
+
+
+static
+int cmp_wait_time(const void* a, const void* b)
+{
+	const struct lockstat_entry* e1 = a;
+	const struct lockstat_entry* e2 = b;
+
+	if (e1->wait_ns != e2->wait_ns)
+		return (e1->wait_ns < e2->wait_ns) ? 1 : -1;
+
+	return (e1->count < e2->count) - (e1->count > e2->count);
+}
+
+
+/**
+ * format_caller() - write symbolic name of a call site
+ * @caller:     return address of the lock function
+ * @str:        output buffer
+ * @len:        size of @str
+ */
+static
+void format_caller(const void* caller, char* str, size_t len)
+{
+	uintptr_t addr = (uintptr_t)caller;
+
+#ifndef _WIN32
+	Dl_info info;
+	const char* modname;
+
+	if (dladdr((void*)caller, &info) && info.dli_fname) {
+		if (info.dli_sname) {
+			snprintf(str, len, "%s+0x%" PRIxPTR, info.dli_sname,
+			         addr - (uintptr_t)info.dli_saddr);
+		} else {
+			modname = strrchr(info.dli_fname, '/');
+			modname = modname ? modname+1 : info.dli_fname;
+			snprintf(str, len, "%s+0x%" PRIxPTR, modname,
+			         addr - (uintptr_t)info.dli_fbase);
+		}
+
+		return;
+	}
+#endif
+
+	snprintf(str, len, "0x%" PRIxPTR, addr);
+}
+
+
+static
+int full_write(int fd, const char* buf, size_t len)
+{
+	ssize_t rsz;
+
+	while (len) {
+		rsz = mm_write(fd, buf, len);
+		if (rsz < 0)
+			return -1;
+
+		len -= rsz;
+		buf += rsz;
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_lockstat_dump() - report lock contention statistics
+ * @fd:         file descriptor to which the report must be written
+ *
+ * Write the statistics of the contended acquisitions of the instrumented
+ * mutexes. A mutex is instrumented if it has been initialized with the
+ * MM_THR_LOCKSTAT flag, or if the environment variable MM_LOCKSTAT is set
+ * to a value other than "0" when mmlib is loaded, in which case all
+ * mutexes are instrumented.
+ *
+ * The report contains one line per mutex and call site of
+ * mm_thr_mutex_lock(), sorted by decreasing total wait time. The columns
+ * are: the address of the mutex, the call site, the number of contended
+ * acquisitions, the total and maximum time spent waiting for the mutex,
+ * and the total time the mutex has been held after those acquisitions.
+ * Times are in microseconds. Only the acquisitions that could not get the
+ * mutex immediately are accounted.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_thr_lockstat_dump(int fd)
+{
+	struct lockstat_entry* sorted;
+	struct lockstat_entry* entry;
+	char line[256], caller[128];
+	int i, num, len, rv;
+
+	sorted = malloc(sizeof(entries));
+	if (!sorted)
+		return mm_raise_from_errno("Cannot allocate lock statistics");
+
+	num = 0;
+	for (i = 0; i < LOCKSTAT_NUM_ENTRY; i++) {
+		entry = &entries[i];
+		if (mm_atomic_load_u32(&entry->state, MM_ATOMIC_ACQUIRE)
+		    != ENTRY_READY)
+			continue;
+
+		sorted[num] = (struct lockstat_entry) {
+			.lock = entry->lock,
+			.caller = entry->caller,
+			.count = mm_atomic_load_i64(&entry->count,
+			                            MM_ATOMIC_RELAXED),
+			.wait_ns = mm_atomic_load_i64(&entry->wait_ns,
+			                              MM_ATOMIC_RELAXED),
+			.max_wait_ns = mm_atomic_load_i64(&entry->max_wait_ns,
+			                                  MM_ATOMIC_RELAXED),
+			.hold_ns = mm_atomic_load_i64(&entry->hold_ns,
+			                              MM_ATOMIC_RELAXED),
+		};
+		if (sorted[num].count)
+			num++;
+	}
+
+	qsort(sorted, num, sizeof(*sorted), cmp_wait_time);
+
+	len = sprintf(line, "%-18s %-32s %10s %14s %12s %14s\n", "lock",
+	              "caller", "count", "wait_total_us", "wait_max_us",
+	              "hold_total_us");
+	rv = full_write(fd, line, len);
+	for (i = 0; i < num && rv == 0; i++) {
+		entry = &sorted[i];
+		format_caller(entry->caller, caller, sizeof(caller));
+		len = snprintf(line, sizeof(line),
+		               "%-18p %-32s %10" PRIi64 " %14" PRIi64
+		               " %12" PRIi64 " %14" PRIi64 "\n",
+		               entry->lock, caller, entry->count,
+		               entry->wait_ns / 1000, entry->max_wait_ns / 1000,
+		               entry->hold_ns / 1000);
+		if (len >= (int)sizeof(line))
+			len = sizeof(line) - 1;
+
+		rv = full_write(fd, line, len);
+	}
+
+	free(sorted);
+	return rv;
+}
+
+
+/**
+ * mm_thr_lockstat_reset() - clear lock contention statistics
+ *
+ * Reset the statistics reported by mm_thr_lockstat_dump() of all mutexes
+ * and call sites. The mutexes that are instrumented remain so.
+ */
+API_EXPORTED
+void mm_thr_lockstat_reset(void)
+{
+	struct lockstat_entry* entry;
+	int i;
+
+	for (i = 0; i < LOCKSTAT_NUM_ENTRY; i++) {
+		entry = &entries[i];
+		mm_atomic_store_i64(&entry->count, 0, MM_ATOMIC_RELAXED);
+		mm_atomic_store_i64(&entry->wait_ns, 0, MM_ATOMIC_RELAXED);
+		mm_atomic_store_i64(&entry->max_wait_ns, 0, MM_ATOMIC_RELAXED);
+		mm_atomic_store_i64(&entry->hold_ns, 0, MM_ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,58 @@
+/*
+   @mindmaze_header@
+*/
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmatomic.h"
+#include "mmpredefs.h"
+
+#if defined (_MSC_VER)
+#  include <intrin.h>
+#  define LOCKSTAT_CALLER()     _ReturnAddress()
+#else
+#  define LOCKSTAT_CALLER()     __builtin_return_address(0)
+#endif
+
+/**
+ * struct lockstat_wait - state of a contended lock acquisition
+ * @entry:      statistic entry of the lock and caller
+ * @lock:       lock being acquired
+ * @start_ns:   monotonic time at which the wait started
+ */
+struct lockstat_wait {
+	struct lockstat_entry* entry;
+	const void* lock;
+	int64_t start_ns;
+};
+
+extern int32_t lockstat_active;
+
+bool lockstat_begin_wait(struct lockstat_wait* wait, const void* lock,
+                         const void* caller);
+void lockstat_end_wait(const struct lockstat_wait* wait, int acquired);
+void lockstat_release(const void* lock);
+void lockstat_register(const void* lock);
+void lockstat_unregister(const void* lock);
+
+
+/**
+ * lockstat_is_active() - test whether any lock may be instrumented
+ *
+ * This is the only test performed on the paths of the lock functions when
+ * the instrumentation is not in use.
+ *
+ * Return: true if the instrumentation is enabled for all locks or if at
+ * least one lock has been initialized with MM_THR_LOCKSTAT.
+ */
+static inline
+bool lockstat_is_active(void)
+{
+	return UNLIKELY(mm_atomic_load_i32(&lockstat_active,
+	                                   MM_ATOMIC_RELAXED) != 0);
+}
+
+#endif /* ifndef LOCKSTAT_H */
@@ -0,0 +1,257 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+
+#define MCOND_VALID_FLAGS       (MM_THR_PSHARED | MM_THR_WAIT_MONOTONIC)
+
+/**
+ * DOC: wait-morphing condition variable
+ *
+ * When mm_thr_cond_broadcast() wakes up many threads waiting on a
+ * condition variable, all of them immediately fight for the mutex
+ * associated with the condition: only one gets it and the others go back
+ * to sleep, this time on the mutex. With tens of waiters, this thundering
+ * herd wastes most of the CPU time in scheduling and cache line transfers.
+ *
+ * The wait-morphing condition variable (mm_thr_mcond_t) is used with a
+ * mm_thr_mutex_t like a regular condition variable, but
+ * mm_thr_mcond_broadcast() does not wake up the waiters. It moves them, in
+ * a single system call, to a second wait queue private to the condition
+ * and wakes up only the first one. Each waiter, once it has reacquired the
+ * mutex, wakes up the next waiter of this queue, which then blocks on the
+ * mutex until the previous one releases it. At any time, at most one of
+ * the broadcast waiters contends for the mutex.
+ *
+ * mm_thr_mcond_signal() and mm_thr_mcond_broadcast() make no system call
+ * if no thread waits on the condition.
+ *
+ * The queue move relies on the requeue operation of the futex system call
+ * and is available only on Linux. On the other platforms, a broadcast
+ * wakes up all the waiters like mm_thr_cond_broadcast() does.
+ */
+
+
+/**
+ * wake_next_handoff() - wake the next waiter requeued by a broadcast
+ * @cond:       initialized condition variable
+ */
+static
+void wake_next_handoff(mm_thr_mcond_t* cond)
+{
+	uint32_t num;
+
+	num = mm_atomic_load_u32(&cond->nhandoff, MM_ATOMIC_RELAXED);
+	while (num > 0) {
+		if (mm_atomic_cas_u32(&cond->nhandoff, &num, num - 1,
+		                      MM_ATOMIC_RELAXED)) {
+			futex_wake(&cond->handoff, 1, cond->flags);
+			return;
+		}
+	}
+}
+
+
+static
+int mcond_wait(mm_thr_mcond_t* cond, mm_thr_mutex_t* mutex,
+               const struct mm_timespec* abstime)
+{
+	uint32_t seq;
+	int ret, lock_ret;
+
+	// Read the sequence before releasing the mutex: a signal occurring
+	// after the release changes it, hence cannot be missed.
+	mm_atomic_fetch_add_u32(&cond->nwaiter, 1, MM_ATOMIC_SEQ_CST);
+	seq = mm_atomic_load_u32(&cond->seq, MM_ATOMIC_SEQ_CST);
+
+	ret = mm_thr_mutex_unlock(mutex);
+	if (ret) {
+		mm_atomic_fetch_sub_u32(&cond->nwaiter, 1, MM_ATOMIC_RELAXED);
+		return ret;
+	}
+
+	ret = futex_wait(&cond->seq, seq, cond->flags, abstime);
+	lock_ret = mm_thr_mutex_lock(mutex);
+
+	// Pass the wakeup to the next broadcast waiter: it will sleep on
+	// the mutex until this thread releases it
+	wake_next_handoff(cond);
+	mm_atomic_fetch_sub_u32(&cond->nwaiter, 1, MM_ATOMIC_RELAXED);
+
+	return lock_ret ? lock_ret : ret;
+}
+
+
+/**
+ * mm_thr_mcond_init() - Initialize a wait-morphing condition variable
+ * @cond:       condition variable to initialize
+ * @flags:      OR-combination of flags indicating the type of @cond
+ *
+ * Use this function to initialize @cond. The type of condition is
+ * controlled by @flags which must contains one or several of the following:
+ *
+ * - MM_THR_PSHARED: init a condition shareable by other processes. The
+ *   mutex used with it must be process shared as well.
+ * - MM_THR_WAIT_MONOTONIC: the clock base used in mm_thr_mcond_timedwait()
+ *   is MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * If 0 is passed, a call to this function could have been avoided if
+ * @cond had been statically initialized with MM_THR_MCOND_INITIALIZER.
+ *
+ * Return: 0 in case of success, EINVAL if @flags contains an unsupported
+ * flag.
+ */
+API_EXPORTED
+int mm_thr_mcond_init(mm_thr_mcond_t* cond, int flags)
+{
+	if (flags & ~MCOND_VALID_FLAGS) {
+		mm_raise_error(EINVAL, "unsupported mcond flags 0x%08x",
+		               flags);
+		return EINVAL;
+	}
+
+	cond->flags = flags;
+	cond->seq = 0;
+	cond->nwaiter = 0;
+	cond->handoff = 0;
+	cond->nhandoff = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_mcond_wait() - wait on a wait-morphing condition
+ * @cond:       condition to wait
+ * @mutex:      mutex protecting the condition wait update, locked by the
+ *              calling thread
+ *
+ * This function atomically releases @mutex and blocks the calling thread
+ * on @cond, like mm_thr_cond_wait(). Upon return, @mutex is locked again
+ * by the calling thread. The function may return spuriously: the caller
+ * must check again the predicate associated with @cond.
+ *
+ * All the threads waiting at the same time on @cond must use the same
+ * mutex.
+ *
+ * Return: 0 in case of success, otherwise any error that
+ * mm_thr_mutex_unlock() and mm_thr_mutex_lock() can return.
+ */
+API_EXPORTED
+int mm_thr_mcond_wait(mm_thr_mcond_t* cond, mm_thr_mutex_t* mutex)
+{
+	return mcond_wait(cond, mutex, NULL);
+}
+
+
+/**
+ * mm_thr_mcond_timedwait() - wait on a wait-morphing condition with timeout
+ * @cond:       condition to wait
+ * @mutex:      mutex protecting the condition wait update, locked by the
+ *              calling thread
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the equivalent to mm_thr_mcond_wait(), except that it
+ * returns ETIMEDOUT if @abstime is reached before the condition is
+ * signaled. Even then, @mutex is locked again before the function returns.
+ * The clock base of @abstime is MM_CLK_MONOTONIC if @cond has been
+ * initialized with MM_THR_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 in case of success, ETIMEDOUT if @abstime has been reached,
+ * EINVAL if @abstime is not a valid time, otherwise any error that
+ * mm_thr_mutex_unlock() and mm_thr_mutex_lock() can return.
+ */
+API_EXPORTED
+int mm_thr_mcond_timedwait(mm_thr_mcond_t* cond, mm_thr_mutex_t* mutex,
+                           const struct mm_timespec* abstime)
+{
+	return mcond_wait(cond, mutex, abstime);
+}
+
+
+/**
+ * mm_thr_mcond_signal() - signal a wait-morphing condition
+ * @cond:       condition variable to signal
+ *
+ * This function unblocks at least one of the threads that are blocked on
+ * @cond, if any. Like mm_thr_cond_signal(), it may be called whether or not
+ * the calling thread owns the mutex associated with @cond.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_mcond_signal(mm_thr_mcond_t* cond)
+{
+	if (!mm_atomic_load_u32(&cond->nwaiter, MM_ATOMIC_SEQ_CST))
+		return 0;
+
+	mm_atomic_fetch_add_u32(&cond->seq, 1, MM_ATOMIC_SEQ_CST);
+	futex_wake(&cond->seq, 1, cond->flags);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_mcond_broadcast() - broadcast a wait-morphing condition
+ * @cond:       condition variable to broadcast
+ *
+ * This function unblocks all the threads currently blocked on @cond. The
+ * waiters are not woken up all at once: they are moved to a handoff queue
+ * and woken up one after the other, each one when the previous has
+ * reacquired the mutex. Like mm_thr_cond_broadcast(), it may be called
+ * whether or not the calling thread owns the mutex associated with @cond.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_mcond_broadcast(mm_thr_mcond_t* cond)
+{
+	uint32_t seq;
+	int num;
+
+	if (!mm_atomic_load_u32(&cond->nwaiter, MM_ATOMIC_SEQ_CST))
+		return 0;
+
+	// Retry if the sequence is changed by a concurrent signal
+	do {
+		seq = mm_atomic_fetch_add_u32(&cond->seq, 1,
+		                              MM_ATOMIC_SEQ_CST) + 1;
+		num = futex_requeue(&cond->seq, seq, &cond->handoff,
+		                    cond->flags);
+	} while (num < 0);
+
+	if (num > 0) {
+		mm_atomic_fetch_add_u32(&cond->nhandoff, num,
+		                        MM_ATOMIC_RELAXED);
+		wake_next_handoff(cond);
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_mcond_deinit() - cleanup an initialized wait-morphing condition
+ * @cond:       initialized condition variable to destroy
+ *
+ * It is undefined behavior to destroy a condition variable which is waited
+ * by a thread.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_mcond_deinit(mm_thr_mcond_t* cond)
+{
+	(void)cond;
+	return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef MMATOMIC_H
+#define MMATOMIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * DOC: atomic operations
+ *
+ * mmatomic.h provides atomic operations on 32bit and 64bit integers and on
+ * pointers which are usable with all the compilers supported by mmlib,
+ * including MSVC which does not provide the C11 stdatomic.h header. All
+ * the functions are inlined.
+ *
+ * For each of the suffixes ``i32``, ``u32``, ``i64`` and ``u64``
+ * (respectively operating on ``int32_t``, ``uint32_t``, ``int64_t`` and
+ * ``uint64_t``) the following functions are defined, here with the
+ * ``u32`` suffix:
+ *
+ * - mm_atomic_load_u32(obj, mo): return the value of \*obj
+ * - mm_atomic_store_u32(obj, val, mo): set \*obj to val
+ * - mm_atomic_exchange_u32(obj, val, mo): set \*obj to val and return its
+ *   previous value
+ * - mm_atomic_cas_u32(obj, expected, desired, mo): if \*obj is equal to
+ *   \*expected, set \*obj to desired and return true. Otherwise copy the
+ *   value of \*obj in \*expected and return false.
+ * - mm_atomic_fetch_add_u32(obj, val, mo), mm_atomic_fetch_sub_u32(),
+ *   mm_atomic_fetch_and_u32(), mm_atomic_fetch_or_u32(): apply the
+ *   operation on \*obj and return its previous value
+ *
+ * The same load, store, exchange and cas functions are defined for
+ * ``void*`` with the ``ptr`` suffix.
+ *
+ * The argument mo specifies the memory ordering constraint of the
+ * operation, with the same meaning as in C11. It must be one of
+ * MM_ATOMIC_RELAXED, MM_ATOMIC_ACQUIRE, MM_ATOMIC_RELEASE,
+ * MM_ATOMIC_ACQ_REL or MM_ATOMIC_SEQ_CST. If a cas fails, the ordering
+ * applied is mo without its release part.
+ *
+ * mm_atomic_fence() issues a memory fence, mm_cpu_relax() hints the CPU
+ * that the calling thread is busy waiting and MM_CACHELINE_SIZE is the
+ * size of a cache line to use to prevent false sharing.
+ */
+
+#define MM_CACHELINE_SIZE       64
+
+// pointer type usable as type argument of qualifiers in macro expansions
+typedef void* mm_atomic_ptr_t;
+
+/**************************************************************************
+ *                                                                        *
+ *                       GCC and clang implementation                     *
+ *                                                                        *
+ **************************************************************************/
+#if defined (__GNUC__) || defined (__clang__)
+
+#define MM_ATOMIC_RELAXED       __ATOMIC_RELAXED
+#define MM_ATOMIC_ACQUIRE       __ATOMIC_ACQUIRE
+#define MM_ATOMIC_RELEASE       __ATOMIC_RELEASE
+#define MM_ATOMIC_ACQ_REL       __ATOMIC_ACQ_REL
+#define MM_ATOMIC_SEQ_CST       __ATOMIC_SEQ_CST
+
+#define MM_ATOMIC_CAS_FAILURE_ORDER(mo) \
+	((mo) == MM_ATOMIC_RELEASE ? MM_ATOMIC_RELAXED \
+	 : (mo) == MM_ATOMIC_ACQ_REL ? MM_ATOMIC_ACQUIRE : (mo))
+
+#define MM_ATOMIC_DEFINE_COMMON(sfx, type) \
+static inline \
+type mm_atomic_load_##sfx(const volatile type* obj, int mo) \
+{ \
+	return __atomic_load_n(obj, mo); \
+} \
+static inline \
+void mm_atomic_store_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	__atomic_store_n(obj, val, mo); \
+} \
+static inline \
+type mm_atomic_exchange_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	return __atomic_exchange_n(obj, val, mo); \
+} \
+static inline \
+bool mm_atomic_cas_##sfx(volatile type* obj, type* expected, type desired, \
+                         int mo) \
+{ \
+	return __atomic_compare_exchange_n(obj, expected, desired, false, \
+	                                   mo, MM_ATOMIC_CAS_FAILURE_ORDER(mo)); \
+}
+
+#define MM_ATOMIC_DEFINE_ARITH(sfx, type) \
+static inline \
+type mm_atomic_fetch_add_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	return __atomic_fetch_add(obj, val, mo); \
+} \
+static inline \
+type mm_atomic_fetch_sub_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	return __atomic_fetch_sub(obj, val, mo); \
+} \
+static inline \
+type mm_atomic_fetch_and_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	return __atomic_fetch_and(obj, val, mo); \
+} \
+static inline \
+type mm_atomic_fetch_or_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	return __atomic_fetch_or(obj, val, mo); \
+}
+
+static inline
+void mm_atomic_fence(int mo)
+{
+	__atomic_thread_fence(mo);
+}
+
+static inline
+void mm_cpu_relax(void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_ia32_pause();
+#elif defined (__aarch64__) || defined (__arm__)
+	__asm__ __volatile__ ("yield" ::: "memory");
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+/**************************************************************************
+ *                                                                        *
+ *                           MSVC implementation                          *
+ *                                                                        *
+ **************************************************************************/
+#elif defined (_MSC_VER) && (defined (_M_X64) || defined (_M_ARM64))
+
+#include <intrin.h>
+
+#define MM_ATOMIC_RELAXED       0
+#define MM_ATOMIC_ACQUIRE       2
+#define MM_ATOMIC_RELEASE       3
+#define MM_ATOMIC_ACQ_REL       4
+#define MM_ATOMIC_SEQ_CST       5
+
+/*
+ * Interlocked functions are full barriers. Plain loads and stores need a
+ * compiler barrier on x64 (hardware ordering is strong enough) and a
+ * memory barrier on ARM64 when the ordering is not relaxed.
+ */
+#if defined (_M_ARM64)
+#define MM_ATOMIC_HW_BARRIER()    __dmb(_ARM64_BARRIER_ISH)
+#else
+#define MM_ATOMIC_HW_BARRIER()    _ReadWriteBarrier()
+#endif
+
+#define MM_ATOMIC_DEFINE_MSVC(sfx, type, itype, bits, isfx) \
+static inline \
+type mm_atomic_load_##sfx(const volatile type* obj, int mo) \
+{ \
+	type val = (type)__iso_volatile_load##bits( \
+	                (const volatile itype*)obj); \
+	if (mo != MM_ATOMIC_RELAXED) \
+		MM_ATOMIC_HW_BARRIER(); \
+	return val; \
+} \
+static inline \
+void mm_atomic_store_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	if (mo == MM_ATOMIC_SEQ_CST) { \
+		_InterlockedExchange##isfx((volatile itype*)obj, (itype)val); \
+		return; \
+	} \
+	if (mo != MM_ATOMIC_RELAXED) \
+		MM_ATOMIC_HW_BARRIER(); \
+	__iso_volatile_store##bits((volatile itype*)obj, (itype)val); \
+} \
+static inline \
+type mm_atomic_exchange_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	(void)mo; \
+	return (type)_InterlockedExchange##isfx((volatile itype*)obj, \
+	                                        (itype)val); \
+} \
+static inline \
+bool mm_atomic_cas_##sfx(volatile type* obj, type* expected, type desired, \
+                         int mo) \
+{ \
+	itype prev; \
+	(void)mo; \
+	prev = _InterlockedCompareExchange##isfx((volatile itype*)obj, \
+	                                         (itype)desired, \
+	                                         (itype)*expected); \
+	if (prev == (itype)*expected) \
+		return true; \
+	*expected = (type)prev; \
+	return false; \
+} \
+static inline \
+type mm_atomic_fetch_add_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	(void)mo; \
+	return (type)_InterlockedExchangeAdd##isfx((volatile itype*)obj, \
+	                                           (itype)val); \
+} \
+static inline \
+type mm_atomic_fetch_sub_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	(void)mo; \
+	return (type)_InterlockedExchangeAdd##isfx((volatile itype*)obj, \
+	                                           -(itype)val); \
+} \
+static inline \
+type mm_atomic_fetch_and_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	(void)mo; \
+	return (type)_InterlockedAnd##isfx((volatile itype*)obj, (itype)val); \
+} \
+static inline \
+type mm_atomic_fetch_or_##sfx(volatile type* obj, type val, int mo) \
+{ \
+	(void)mo; \
+	return (type)_InterlockedOr##isfx((volatile itype*)obj, (itype)val); \
+}
+
+MM_ATOMIC_DEFINE_MSVC(i32, int32_t, long, 32, )
+MM_ATOMIC_DEFINE_MSVC(u32, uint32_t, long, 32, )
+MM_ATOMIC_DEFINE_MSVC(i64, int64_t, __int64, 64, 64)
+MM_ATOMIC_DEFINE_MSVC(u64, uint64_t, __int64, 64, 64)
+
+static inline
+void* mm_atomic_load_ptr(void* const volatile* obj, int mo)
+{
+	void* val = (void*)__iso_volatile_load64((const volatile __int64*)obj);
+	if (mo != MM_ATOMIC_RELAXED)
+		MM_ATOMIC_HW_BARRIER();
+	return val;
+}
+
+static inline
+void mm_atomic_store_ptr(void* volatile* obj, void* val, int mo)
+{
+	if (mo == MM_ATOMIC_SEQ_CST) {
+		_InterlockedExchangePointer(obj, val);
+		return;
+	}
+	if (mo != MM_ATOMIC_RELAXED)
+		MM_ATOMIC_HW_BARRIER();
+	__iso_volatile_store64((volatile __int64*)obj, (__int64)val);
+}
+
+static inline
+void* mm_atomic_exchange_ptr(void* volatile* obj, void* val, int mo)
+{
+	(void)mo;
+	return _InterlockedExchangePointer(obj, val);
+}
+
+static inline
+bool mm_atomic_cas_ptr(void* volatile* obj, void** expected, void* desired,
+                       int mo)
+{
+	void* prev;
+
+	(void)mo;
+	prev = _InterlockedCompareExchangePointer(obj, desired, *expected);
+	if (prev == *expected)
+		return true;
+
+	*expected = prev;
+	return false;
+}
+
+static inline
+void mm_atomic_fence(int mo)
+{
+	if (mo == MM_ATOMIC_RELAXED)
+		return;
+
+#if defined (_M_ARM64)
+	__dmb(_ARM64_BARRIER_ISH);
+#else
+	if (mo == MM_ATOMIC_SEQ_CST)
+		__faststorefence();
+	else
+		_ReadWriteBarrier();
+#endif
+}
+
+static inline
+void mm_cpu_relax(void)
+{
+#if defined (_M_ARM64)
+	__yield();
+#else
+	_mm_pause();
+#endif
+}
+
+#else
+#error "mmatomic.h: unsupported compiler or architecture"
+#endif
+
+#if defined (__GNUC__) || defined (__clang__)
+MM_ATOMIC_DEFINE_COMMON(i32, int32_t)
+MM_ATOMIC_DEFINE_COMMON(u32, uint32_t)
+MM_ATOMIC_DEFINE_COMMON(i64, int64_t)
+MM_ATOMIC_DEFINE_COMMON(u64, uint64_t)
+MM_ATOMIC_DEFINE_COMMON(ptr, mm_atomic_ptr_t)
+MM_ATOMIC_DEFINE_ARITH(i32, int32_t)
+MM_ATOMIC_DEFINE_ARITH(u32, uint32_t)
+MM_ATOMIC_DEFINE_ARITH(i64, int64_t)
+MM_ATOMIC_DEFINE_ARITH(u64, uint64_t)
+#endif
+
+#endif /* ifndef MMATOMIC_H */
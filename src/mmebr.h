@@ -0,0 +1,25 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef MMEBR_H
+#define MMEBR_H
+
+#include "mmpredefs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MMLIB_API int mm_ebr_register(void);
+MMLIB_API void mm_ebr_unregister(void);
+MMLIB_API void mm_ebr_enter(void);
+MMLIB_API void mm_ebr_exit(void);
+MMLIB_API int mm_ebr_retire(void* ptr, void (*free_fn)(void*));
+MMLIB_API void mm_ebr_reclaim(void);
+MMLIB_API void mm_ebr_synchronize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef MMEBR_H */
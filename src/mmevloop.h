@@ -0,0 +1,56 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef MMEVLOOP_H
+#define MMEVLOOP_H
+
+#include "mmpredefs.h"
+#include "mmtime.h"
+
+#define MM_EV_IN        0x00000001
+#define MM_EV_OUT       0x00000002
+#define MM_EV_ERR       0x00000004
+#define MM_EV_HUP       0x00000008
+#define MM_EV_ET        0x00000010
+
+struct mm_evloop;
+
+typedef void (*mm_evloop_fd_cb)(struct mm_evloop* loop, int fd, int revents,
+                                void* data);
+typedef void (*mm_evloop_cb)(struct mm_evloop* loop, int id, void* data);
+typedef void (*mm_evloop_task_cb)(struct mm_evloop* loop, void* data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MMLIB_API struct mm_evloop* mm_evloop_create(void);
+MMLIB_API void mm_evloop_destroy(struct mm_evloop* loop);
+
+MMLIB_API int mm_evloop_add_fd(struct mm_evloop* loop, int fd, int events,
+                               mm_evloop_fd_cb cb, void* data);
+MMLIB_API int mm_evloop_mod_fd(struct mm_evloop* loop, int fd, int events);
+MMLIB_API int mm_evloop_del_fd(struct mm_evloop* loop, int fd);
+
+MMLIB_API int mm_evloop_add_timer(struct mm_evloop* loop, clockid_t clock_id,
+                                  mm_evloop_cb cb, void* data);
+MMLIB_API int mm_evloop_arm_timer(struct mm_evloop* loop, int id, int flags,
+                                  const struct mm_timespec* value,
+                                  const struct mm_timespec* period);
+MMLIB_API int mm_evloop_del_timer(struct mm_evloop* loop, int id);
+
+MMLIB_API int mm_evloop_add_signal(struct mm_evloop* loop, int signum,
+                                   mm_evloop_cb cb, void* data);
+MMLIB_API int mm_evloop_del_signal(struct mm_evloop* loop, int signum);
+
+MMLIB_API int mm_evloop_post(struct mm_evloop* loop,
+                             mm_evloop_task_cb cb, void* data);
+MMLIB_API int mm_evloop_run_once(struct mm_evloop* loop, int timeout_ms);
+MMLIB_API int mm_evloop_run(struct mm_evloop* loop);
+MMLIB_API void mm_evloop_stop(struct mm_evloop* loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef MMEVLOOP_H */
@@ -0,0 +1,32 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef MMPCPU_H
+#define MMPCPU_H
+
+#include <stdint.h>
+
+#include "mmpredefs.h"
+
+struct mm_pcpu_counter;
+
+typedef void (*mm_pcpu_counter_cb)(const char* name, int64_t value,
+                                   void* data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MMLIB_API struct mm_pcpu_counter* mm_pcpu_counter_create(const char* name);
+MMLIB_API void mm_pcpu_counter_destroy(struct mm_pcpu_counter* counter);
+MMLIB_API void mm_pcpu_counter_add(struct mm_pcpu_counter* counter,
+                                   int64_t value);
+MMLIB_API int64_t mm_pcpu_counter_read(const struct mm_pcpu_counter* counter);
+MMLIB_API void mm_pcpu_counter_foreach(mm_pcpu_counter_cb cb, void* data);
+MMLIB_API int mm_pcpu_counter_dump(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef MMPCPU_H */
@@ -0,0 +1,388 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmargparse.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmtime.h"
+#include "profile-shared.h"
+
+#define AGGR_MAX        (PROFSHM_MAX_PROC*PROFSHM_NUM_POINT)
+
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/**
+ * struct point - snapshot of measure point statistics
+ * @label:      label of the measure point (null terminated)
+ * @count:      number of iterations in which the point has been measured
+ * @sum:        sum of time differences (in ns)
+ * @min:        min time difference (in ns)
+ * @max:        max time difference (in ns)
+ * @median:     approximate median of time difference (in ns)
+ * @num_proc:   number of processes accounted in the statistics
+ */
+struct point {
+	char label[PROFSHM_LABEL_LEN+1];
+	int64_t count;
+	int64_t sum;
+	int64_t min;
+	int64_t max;
+	int64_t median;
+	int num_proc;
+};
+
+/**
+ * struct proc - snapshot of process slot
+ * @pid:        pid of the process
+ * @name:       short name of the program (null terminated)
+ * @num_iter:   number of iterations
+ * @num_points: number of valid elements in @points
+ * @points:     statistics of the measure points
+ */
+struct proc {
+	int64_t pid;
+	char name[PROFSHM_NAME_LEN+1];
+	int64_t num_iter;
+	int num_points;
+	struct point points[PROFSHM_NUM_POINT];
+};
+
+static struct proc procs[PROFSHM_MAX_PROC];
+static struct point aggr[AGGR_MAX];
+
+static unsigned int interval_ms = 1000;
+static unsigned int num_refresh = 0;
+static const char* batch_mode = NULL;
+
+static
+struct mm_arg_opt cmdline_optv[] = {
+	{"d|delay", MM_OPT_NEEDUINT, NULL, {.uiptr = &interval_ms},
+	 "Refresh the tables every @MS milliseconds. Default is 1000."},
+	{"n|iterations", MM_OPT_NEEDUINT, NULL, {.uiptr = &num_refresh},
+	 "Exit after @NUM refreshes. If 0 (the default), run until "
+	 "interrupted."},
+	{"b|batch", MM_OPT_NOVAL, "set", {.sptr = &batch_mode},
+	 "Do not clear the screen between refreshes. Useful to send the "
+	 "output to a file or another program."},
+};
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           Statistics snapshot                          *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * load_string() - copy a string published in the shared segment
+ * @dst:        buffer receiving the null terminated string
+ * @src:        characters in the shared segment
+ * @len_ptr:    pointer to the published length of @src
+ * @maxlen:     maximum length of @src
+ */
+static
+void load_string(char* dst, const char* src, const int32_t* len_ptr,
+                 int maxlen)
+{
+	int len;
+
+	len = __atomic_load_n(len_ptr, __ATOMIC_ACQUIRE);
+	if (len < 0 || len > maxlen)
+		len = 0;
+
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+
+/**
+ * load_proc() - take snapshot of a process slot
+ * @proc:       snapshot to fill
+ * @slot:       process slot in the shared segment
+ *
+ * Returns: 1 if the slot is used by a process, 0 otherwise
+ */
+static
+int load_proc(struct proc* proc, const struct profshm_proc* slot)
+{
+	const struct profshm_point* spt;
+	struct point* pt;
+	int i;
+
+	proc->pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+	if (proc->pid == 0)
+		return 0;
+
+	load_string(proc->name, slot->name, &slot->name_len,
+	            PROFSHM_NAME_LEN);
+	proc->num_iter = __atomic_load_n(&slot->num_iter, __ATOMIC_ACQUIRE);
+	proc->num_points = __atomic_load_n(&slot->num_points,
+	                                   __ATOMIC_RELAXED);
+	if (proc->num_points < 0 || proc->num_points > PROFSHM_NUM_POINT)
+		proc->num_points = 0;
+
+	for (i = 0; i < proc->num_points; i++) {
+		pt = &proc->points[i];
+		spt = &slot->points[i];
+
+		load_string(pt->label, spt->label, &spt->label_len,
+		            PROFSHM_LABEL_LEN);
+		if (pt->label[0] == '\0')
+			sprintf(pt->label, "#%i", i+1);
+
+		pt->count = proc->num_iter;
+		pt->sum = __atomic_load_n(&spt->sum, __ATOMIC_RELAXED);
+		pt->min = __atomic_load_n(&spt->min, __ATOMIC_RELAXED);
+		pt->max = __atomic_load_n(&spt->max, __ATOMIC_RELAXED);
+		pt->median = __atomic_load_n(&spt->median, __ATOMIC_RELAXED);
+		pt->num_proc = 1;
+	}
+
+	return 1;
+}
+
+
+/**
+ * aggregate() - merge the statistics of points with same label
+ * @num_proc:   number of process snapshots in procs array
+ *
+ * Returns: number of aggregated points in aggr array
+ */
+static
+int aggregate(int num_proc)
+{
+	int i, j, k, num_aggr = 0;
+	const struct point* pt;
+	struct point* apt;
+
+	for (i = 0; i < num_proc; i++) {
+		for (j = 0; j < procs[i].num_points; j++) {
+			pt = &procs[i].points[j];
+			if (pt->count == 0)
+				continue;
+
+			// Search aggregated point with same label
+			for (k = 0; k < num_aggr; k++) {
+				if (!strcmp(aggr[k].label, pt->label))
+					break;
+			}
+
+			apt = &aggr[k];
+			if (k == num_aggr) {
+				*apt = *pt;
+				apt->median = 0;
+				num_aggr++;
+				continue;
+			}
+
+			apt->count += pt->count;
+			apt->sum += pt->sum;
+			apt->min = MIN(apt->min, pt->min);
+			apt->max = MAX(apt->max, pt->max);
+			apt->num_proc++;
+		}
+	}
+
+	return num_aggr;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                               Display                                  *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * print_duration() - print a duration with a suitable unit
+ * @ns:         duration in nanoseconds
+ */
+static
+void print_duration(int64_t ns)
+{
+	static const char* const units[] = {"ns", "us", "ms", "s"};
+	double value = ns;
+	int i;
+
+	if (ns < 0 || ns == INT64_MAX) {
+		printf("%10s %2s |", "-", "");
+		return;
+	}
+
+	for (i = 0; i < 3 && value >= 10000.0; i++)
+		value /= 1000.0;
+
+	printf("%10.2f %-2s |", value, units[i]);
+}
+
+
+/**
+ * print_table() - print a table of measure point statistics
+ * @num_points: number of elements in @points
+ * @points:     statistics to print
+ * @aggregated: non zero if @points are aggregated over processes
+ */
+static
+void print_table(int num_points, const struct point* points, int aggregated)
+{
+	int i, width = 5;
+	const struct point* pt;
+
+	for (i = 0; i < num_points; i++)
+		width = MAX(width, (int)strlen(points[i].label));
+
+	printf("%*s |%10s |%13s |%13s |%13s |%13s |\n", width, "point",
+	       aggregated ? "procs" : "count", "mean", "min", "max",
+	       aggregated ? "total" : "median");
+
+	for (i = 0; i < num_points; i++) {
+		pt = &points[i];
+		printf("%*s |%10lli |", width, pt->label,
+		       aggregated ? (long long)pt->num_proc
+		                  : (long long)pt->count);
+		print_duration(pt->count ? pt->sum / pt->count : -1);
+		print_duration(pt->min);
+		print_duration(pt->max);
+		print_duration(aggregated ? pt->sum : pt->median);
+		printf("\n");
+	}
+}
+
+
+/**
+ * refresh() - print the current statistics of the shared segment
+ * @seg:        mapped shared profile segment
+ * @name:       name of the shared memory object
+ */
+static
+void refresh(const struct profshm_segment* seg, const char* name)
+{
+	int i, num_proc, num_aggr;
+
+	num_proc = 0;
+	for (i = 0; i < PROFSHM_MAX_PROC; i++)
+		num_proc += load_proc(&procs[num_proc], &seg->procs[i]);
+
+	if (!batch_mode)
+		printf("\033[H\033[2J");
+
+	printf("profile %s: %i process(es)\n", name, num_proc);
+
+	for (i = 0; i < num_proc; i++) {
+		printf("\npid %lli (%s): %lli iterations\n",
+		       (long long)procs[i].pid, procs[i].name,
+		       (long long)procs[i].num_iter);
+		print_table(procs[i].num_points, procs[i].points, 0);
+	}
+
+	num_aggr = aggregate(num_proc);
+	if (num_proc > 1 && num_aggr) {
+		printf("\naggregated over all processes\n");
+		print_table(num_aggr, aggr, 1);
+	}
+
+	printf("\n");
+	fflush(stdout);
+}
+
+
+/**
+ * map_segment() - map a shared profile segment for reading
+ * @name:       name of the shared memory object
+ *
+ * Returns: the mapped segment in case of success, NULL otherwise with error
+ * state set accordingly.
+ */
+static
+const struct profshm_segment* map_segment(const char* name)
+{
+	int fd;
+	struct mm_stat st;
+	const struct profshm_segment* seg;
+
+	fd = mm_shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (mm_fstat(fd, &st)) {
+		mm_close(fd);
+		return NULL;
+	}
+
+	if (st.size < (mm_off_t)sizeof(*seg)) {
+		mm_close(fd);
+		mm_raise_error(MM_EBADFMT, "%s is too small", name);
+		return NULL;
+	}
+
+	seg = mm_mapfile(fd, 0, sizeof(*seg), MM_MAP_READ|MM_MAP_SHARED);
+	mm_close(fd);
+	if (!seg)
+		return NULL;
+
+	if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != PROFSHM_MAGIC
+	    || seg->version != PROFSHM_VERSION
+	    || seg->max_proc != PROFSHM_MAX_PROC
+	    || seg->num_point != PROFSHM_NUM_POINT) {
+		mm_unmap((void*)seg);
+		mm_raise_error(MM_EBADFMT, "%s is not a compatible shared "
+		               "profile", name);
+		return NULL;
+	}
+
+	return seg;
+}
+
+
+int main(int argc, char* argv[])
+{
+	int arg_index;
+	unsigned int i;
+	const char* name;
+	const struct profshm_segment* seg;
+	struct mm_arg_parser parser = {
+		.doc = "Display live the timing statistics that processes "
+		       "publish in the shared memory object @NAME with "
+		       "mm_profile_attach_shared(). The statistics are shown "
+		       "per process and aggregated over all processes by "
+		       "label of measure point.",
+		.args_doc = "[options] NAME",
+		.optv = cmdline_optv,
+		.num_opt = MM_NELEM(cmdline_optv),
+		.execname = argv[0],
+	};
+
+	arg_index = mm_arg_parse(&parser, argc, argv);
+	if (arg_index != argc-1) {
+		fprintf(stderr, "shared memory object name missing\n");
+		return EXIT_FAILURE;
+	}
+
+	name = argv[arg_index];
+	seg = map_segment(name);
+	if (!seg) {
+		mm_print_lasterror("cannot attach profile %s", name);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; num_refresh == 0 || i < num_refresh; i++) {
+		if (i != 0)
+			mm_relative_sleep_ms(interval_ms);
+
+		refresh(seg, name);
+	}
+
+	mm_unmap((void*)seg);
+	return EXIT_SUCCESS;
+}
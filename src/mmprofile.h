@@ -17,8 +17,18 @@
 #define PROF_FORCE_MSEC 0x300
 #define PROF_FORCE_SEC  0x400
 
+#define PROF_MINFLT     0x0800
+#define PROF_MAJFLT     0x1000
+#define PROF_VCSW       0x2000
+#define PROF_IVCSW      0x4000
+#define PROF_RSS        0x8000
+#define PROF_RUSAGE     \
+	(PROF_MINFLT|PROF_MAJFLT|PROF_VCSW|PROF_IVCSW|PROF_RSS)
+
 #define PROF_RESET_CPUCLOCK  0x01
 #define PROF_RESET_KEEPLABEL 0x02
+#define PROF_RESET_RUSAGE    0x04
+#define PROF_RESET_RSS       0x08
 
 #include <stdint.h>
 
@@ -29,12 +39,121 @@ extern "C" {
 MMLIB_API void mm_tic(void);
 MMLIB_API void mm_toc(void);
 MMLIB_API void mm_toc_label(const char* label);
+MMLIB_API void mm_toc_label_static(const char* label);
 MMLIB_API int mm_profile_print(int mask, int fd);
 MMLIB_API void mm_profile_reset(int reset_flags);
 MMLIB_API int64_t mm_profile_get_data(int measure_point, int type);
+MMLIB_API int mm_profile_attach_shared(const char* name);
+MMLIB_API void mm_profile_detach_shared(void);
+
+MMLIB_API int mm_sampler_start(int freq_hz);
+MMLIB_API int mm_sampler_stop(int fd);
 
 #ifdef __cplusplus
 }
 #endif
 
+
+/**
+ * DOC: compile-time switchable profiling
+ *
+ * The following macros wrap the profiling calls so that they can be left in
+ * the code of release builds: they expand to nothing unless MM_PROFILE_ENABLE
+ * is defined before including mmprofile.h (typically on the compiler command
+ * line). This is the profiling counterpart of MM_LOG_MAXLEVEL for logging.
+ *
+ * MM_PROFILE_TIC()
+ *   start an iteration of profiling (see mm_tic())
+ *
+ * MM_PROFILE_TOC(label)
+ *   add a point of measure labelled with @label (see mm_toc_label_static()).
+ *   @label must be a string literal: it is registered by address, hence no
+ *   copy is done at runtime.
+ *
+ * MM_PROFILE_SCOPE(label)
+ *   declare a profiled scope: mm_tic() is called at the declaration and a
+ *   point of measure labelled with @label is added when the enclosing scope
+ *   is left (whatever the exit path). Additional points of measure can be
+ *   added within the scope with MM_PROFILE_TOC(). In C, this relies on the
+ *   cleanup attribute (gcc and clang). In C++, on a RAII object. With other
+ *   C compilers, using it fails at compile time: use MM_PROFILE_TIC() and
+ *   MM_PROFILE_TOC() at the boundaries of the scope instead.
+ *
+ * MM_PROFILE_RESET(flags)
+ *   reset the statistics (see mm_profile_reset())
+ *
+ * MM_PROFILE_PRINT(mask, fd)
+ *   print the statistics (see mm_profile_print())
+ */
+#if defined __cplusplus
+#define MM_PROFILE_VOID_CAST static_cast < void >
+#else
+#define MM_PROFILE_VOID_CAST (void)
+#endif
+
+#define MM_PROFILE_CONCAT_(a, b) a ## b
+#define MM_PROFILE_CONCAT(a, b) MM_PROFILE_CONCAT_(a, b)
+
+#ifdef MM_PROFILE_ENABLE
+
+#define MM_PROFILE_TIC()                mm_tic()
+#define MM_PROFILE_TOC(label)           mm_toc_label_static("" label "")
+#define MM_PROFILE_RESET(flags)         mm_profile_reset(flags)
+#define MM_PROFILE_PRINT(mask, fd)      mm_profile_print(mask, fd)
+
+#if defined __cplusplus
+
+class mm_profile_scope {
+public:
+	explicit mm_profile_scope(const char* label) : m_label(label)
+	{
+		mm_tic();
+	}
+
+	~mm_profile_scope()
+	{
+		mm_toc_label_static(m_label);
+	}
+
+private:
+	mm_profile_scope(const mm_profile_scope&);
+	mm_profile_scope& operator=(const mm_profile_scope&);
+
+	const char* m_label;
+};
+
+#define MM_PROFILE_SCOPE(label) \
+	mm_profile_scope MM_PROFILE_CONCAT(mm_profile_scope_, __LINE__)( \
+		"" label "")
+
+#elif defined (__GNUC__) || defined (__clang__)
+
+static inline
+void mm_profile_scope_exit(const char* const* label)
+{
+	mm_toc_label_static(*label);
+}
+
+#define MM_PROFILE_SCOPE(label) \
+	const char* MM_PROFILE_CONCAT(mm_profile_scope_, __LINE__) \
+	__attribute__((cleanup(mm_profile_scope_exit), unused)) = \
+		(mm_tic(), "" label "")
+
+#else
+
+#define MM_PROFILE_SCOPE(label) \
+	_Static_assert(0, "MM_PROFILE_SCOPE() needs C++ or cleanup attribute")
+
+#endif /* MM_PROFILE_SCOPE() definition */
+
+#else /* MM_PROFILE_ENABLE */
+
+#define MM_PROFILE_TIC()                MM_PROFILE_VOID_CAST(0)
+#define MM_PROFILE_TOC(label)           MM_PROFILE_VOID_CAST(0)
+#define MM_PROFILE_RESET(flags)         MM_PROFILE_VOID_CAST(0)
+#define MM_PROFILE_PRINT(mask, fd)      MM_PROFILE_VOID_CAST(0)
+#define MM_PROFILE_SCOPE(label)         MM_PROFILE_VOID_CAST(0)
+
+#endif /* MM_PROFILE_ENABLE */
+
 #endif /* ifndef MMPROFILE_H */
@@ -0,0 +1,55 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef MMQUEUE_H
+#define MMQUEUE_H
+
+#include <stddef.h>
+
+#include "mmpredefs.h"
+#include "mmtime.h"
+
+/* queue flags */
+#define MM_QUEUE_SPSC           0x00000000
+#define MM_QUEUE_MPMC           0x00000001
+#define MM_QUEUE_PSHARED        0x00000002
+#define MM_QUEUE_WAIT_MONOTONIC 0x00000004
+
+/**
+ * struct mm_queue - bounded ring queue of fixed size elements
+ *
+ * The layout of the structure is private. It contains no pointer: an
+ * initialized queue can be placed in memory shared by several processes
+ * and be mapped at different addresses in each of them.
+ */
+struct mm_queue;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+MMLIB_API size_t mm_queue_sizeof(unsigned int capacity, size_t elt_size,
+                                 int flags);
+MMLIB_API int mm_queue_init(struct mm_queue* queue, unsigned int capacity,
+                            size_t elt_size, int flags);
+MMLIB_API struct mm_queue* mm_queue_create(unsigned int capacity,
+                                           size_t elt_size, int flags);
+MMLIB_API void mm_queue_destroy(struct mm_queue* queue);
+MMLIB_API int mm_queue_enqueue(struct mm_queue* queue, const void* elt);
+MMLIB_API int mm_queue_dequeue(struct mm_queue* queue, void* elt);
+MMLIB_API unsigned int mm_queue_enqueue_batch(struct mm_queue* queue,
+                                              const void* elts,
+                                              unsigned int num);
+MMLIB_API unsigned int mm_queue_dequeue_batch(struct mm_queue* queue,
+                                              void* elts, unsigned int num);
+MMLIB_API int mm_queue_enqueue_wait(struct mm_queue* queue, const void* elt,
+                                    const struct mm_timespec* abstime);
+MMLIB_API int mm_queue_dequeue_wait(struct mm_queue* queue, void* elt,
+                                    const struct mm_timespec* abstime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef MMQUEUE_H */
@@ -348,6 +348,14 @@ MMLIB_API int mm_shm_open(const char* name, int oflag, int mode);
 MMLIB_API int mm_anon_shm(void);
 MMLIB_API int mm_shm_unlink(const char* name);
 
+#define MM_MLOCK_CURRENT 0x00000001
+#define MM_MLOCK_FUTURE  0x00000002
+
+MMLIB_API int mm_mlock(const void* addr, size_t len);
+MMLIB_API int mm_munlock(const void* addr, size_t len);
+MMLIB_API int mm_mlockall(int flags);
+MMLIB_API int mm_munlockall(void);
+
 
 /**************************************************************************
  *                        Interprocess communication                      *
@@ -6,6 +6,8 @@
 
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "mmtime.h"
 #include "mmpredefs.h"
@@ -26,8 +28,6 @@ typedef pthread_t mm_thread_t;
 
 #else // _WIN32
 
-#include <stdint.h>
-
 typedef union {
 	struct mm_thr_mutex_pshared {
 		int flag;
@@ -72,6 +72,264 @@ typedef struct mm_thread* mm_thread_t;
 
 #define MM_THR_PSHARED 0x00000001
 #define MM_THR_WAIT_MONOTONIC 0x00000002
+#define MM_THR_ADAPTIVE 0x00000004
+#define MM_THR_PREFER_WRITER 0x00000008
+#define MM_THR_AUTORESET 0x00000010
+#define MM_THR_LOCKSTAT 0x00000020
+#define MM_THR_PRIO_INHERIT 0x00000040
+
+#define MM_THR_DETACHED 0x00000100
+
+#define MM_THRPOOL_DISCARD 0x00000001
+
+#define MM_SCHED_OTHER 0
+#define MM_SCHED_FIFO 1
+#define MM_SCHED_RR 2
+
+#define MM_CPUSET_SIZE 1024
+
+/**
+ * struct mm_cpuset - set of CPUs
+ * @bits:       bitmask of CPUs: CPU i is in the set if the bit (i % 64) of
+ *              @bits[i / 64] is set.
+ *
+ * Use mm_cpuset_zero(), mm_cpuset_set(), mm_cpuset_clear() and
+ * mm_cpuset_isset() to manipulate it.
+ */
+struct mm_cpuset {
+	uint64_t bits[MM_CPUSET_SIZE / 64];
+};
+
+#define MM_CPU_DOMAIN_CORE      0
+#define MM_CPU_DOMAIN_PACKAGE   1
+#define MM_CPU_DOMAIN_NODE      2
+#define MM_CPU_DOMAIN_L2        3
+#define MM_CPU_DOMAIN_L3        4
+
+/**
+ * struct mm_cpu_info - location of a logical CPU in the machine topology
+ * @cpu:        index of the logical CPU, as used in struct mm_cpuset
+ * @core:       physical core of the CPU. CPUs sharing the same core are
+ *              SMT siblings (hyperthreads).
+ * @package:    physical package (socket) of the CPU
+ * @node:       NUMA node of the CPU
+ * @l2:         L2 cache shared by the CPU, -1 if unknown
+ * @l3:         L3 cache shared by the CPU, -1 if unknown
+ *
+ * The ids of a domain are numbered from 0 in the order of their lowest
+ * CPU: for example @core is lower than the &mm_cpu_topology.num_core.
+ */
+struct mm_cpu_info {
+	int cpu;
+	int core;
+	int package;
+	int node;
+	int l2;
+	int l3;
+};
+
+/**
+ * struct mm_cpu_topology - topology of the online CPUs of the machine
+ * @num_cpu:    number of online logical CPUs
+ * @num_core:   number of physical cores
+ * @num_package: number of physical packages
+ * @num_node:   number of NUMA nodes
+ * @num_l2:     number of distinct L2 caches
+ * @num_l3:     number of distinct L3 caches
+ * @cpus:       array of @num_cpu elements sorted by logical CPU index
+ */
+struct mm_cpu_topology {
+	int num_cpu;
+	int num_core;
+	int num_package;
+	int num_node;
+	int num_l2;
+	int num_l3;
+	const struct mm_cpu_info* cpus;
+};
+
+/**
+ * struct mm_thr_attr - attributes of thread creation
+ * @stacksize:  size of the thread stack in bytes. If 0, the system default
+ *              is used.
+ * @guardsize:  size of the guard area at the end of the stack in bytes. If
+ *              0, the system default is used.
+ * @cpuset:     set of CPUs on which the thread is allowed to run. If NULL,
+ *              the affinity is inherited from the creating thread.
+ * @name:       name of the thread (as shown by debuggers and profilers). If
+ *              NULL, the thread is not named.
+ * @flags:      0 or MM_THR_DETACHED to create the thread detached
+ *
+ * A zero-initialized structure results in the same thread as created by
+ * mm_thr_create().
+ */
+struct mm_thr_attr {
+	size_t stacksize;
+	size_t guardsize;
+	const struct mm_cpuset* cpuset;
+	const char* name;
+	int flags;
+};
+
+#define MM_THR_RWLOCK_NUM_SLOT 16
+
+/**
+ * struct mm_thr_rwlock_slot - reader counter of rwlock
+ * @count:      number of readers holding the lock through this slot
+ * @padding:    padding to put each slot in its own cache line
+ */
+struct mm_thr_rwlock_slot {
+	uint32_t count;
+	uint32_t padding[15];
+};
+
+/**
+ * typedef mm_thr_rwlock_t - reader-writer lock
+ * @flags:      flags passed at initialization
+ * @state:      writer state and waiter indicators
+ * @drain_seq:  sequence incremented when readers leave while a writer waits
+ * @padding:    padding to put @readers in separated cache lines
+ * @readers:    distributed reader counters
+ *
+ * The fields must be considered as opaque: use the mm_thr_rwlock_*()
+ * functions to manipulate the lock.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t state;
+	uint32_t drain_seq;
+	uint32_t padding[13];
+	struct mm_thr_rwlock_slot readers[MM_THR_RWLOCK_NUM_SLOT];
+} mm_thr_rwlock_t;
+
+#define MM_THR_RWLOCK_INITIALIZER {0}
+
+#define MM_THR_SEM_VALUE_MAX 0x7fffffff
+
+/**
+ * typedef mm_thr_sem_t - counting semaphore
+ * @flags:      flags passed at initialization
+ * @value:      current value of the semaphore
+ * @nwaiter:    number of threads waiting for @value to be positive
+ *
+ * The fields must be considered as opaque: use the mm_thr_sem_*()
+ * functions to manipulate the semaphore.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t value;
+	uint32_t nwaiter;
+} mm_thr_sem_t;
+
+/**
+ * typedef mm_thr_event_t - event object
+ * @flags:      flags passed at initialization
+ * @state:      signaled state and number of waiters
+ *
+ * The fields must be considered as opaque: use the mm_thr_event_*()
+ * functions to manipulate the event.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t state;
+} mm_thr_event_t;
+
+#define MM_THR_BARRIER_SERIAL_THREAD (-1)
+
+/**
+ * typedef mm_thr_barrier_t - barrier object
+ * @flags:      flags passed at initialization
+ * @count:      number of threads to wait for at each phase
+ * @arrived:    number of threads arrived in the current phase
+ * @generation: phase counter, incremented when all threads are arrived
+ * @nsleeper:   number of threads sleeping on @generation
+ *
+ * The fields must be considered as opaque: use the mm_thr_barrier_*()
+ * functions to manipulate the barrier.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t count;
+	uint32_t arrived;
+	uint32_t generation;
+	uint32_t nsleeper;
+} mm_thr_barrier_t;
+
+/**
+ * typedef mm_thr_latch_t - one-shot countdown latch
+ * @flags:      flags passed at initialization
+ * @count:      remaining count before the latch is released
+ * @nwaiter:    number of threads sleeping on @count
+ *
+ * The fields must be considered as opaque: use the mm_thr_latch_*()
+ * functions to manipulate the latch.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t count;
+	uint32_t nwaiter;
+} mm_thr_latch_t;
+
+/**
+ * typedef mm_thr_seqlock_t - sequence lock
+ * @flags:      flags passed at initialization
+ * @seq:        sequence counter, odd while a write is in progress
+ * @nwaiter:    number of writers sleeping on @seq
+ *
+ * The fields must be considered as opaque: use the mm_thr_seqlock_*()
+ * functions to manipulate the lock.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t seq;
+	uint32_t nwaiter;
+} mm_thr_seqlock_t;
+
+#define MM_THR_SEQLOCK_INITIALIZER {0}
+
+/**
+ * typedef mm_thr_qlock_t - fair queued lock
+ * @flags:      flags passed at initialization
+ * @padding:    unused
+ * @tail:       last thread of the queue of lock owner and waiters
+ * @owner:      queue node of the thread holding the lock
+ *
+ * The fields must be considered as opaque: use the mm_thr_qlock_*()
+ * functions to manipulate the lock.
+ */
+typedef struct {
+	int32_t flags;
+	int32_t padding;
+	void* tail;
+	void* owner;
+} mm_thr_qlock_t;
+
+#define MM_THR_QLOCK_INITIALIZER {0}
+
+/**
+ * typedef mm_thr_mcond_t - wait-morphing condition variable
+ * @flags:      flags passed at initialization
+ * @seq:        sequence counter incremented at each signal or broadcast,
+ *              waited by the threads not signaled yet
+ * @nwaiter:    number of threads waiting on the condition
+ * @handoff:    word on which the broadcast waiters are requeued
+ * @nhandoff:   number of requeued waiters which have not been woken yet
+ *
+ * The fields must be considered as opaque: use the mm_thr_mcond_*()
+ * functions to manipulate the condition variable.
+ */
+typedef struct {
+	int32_t flags;
+	uint32_t seq;
+	uint32_t nwaiter;
+	uint32_t handoff;
+	uint32_t nhandoff;
+} mm_thr_mcond_t;
+
+#define MM_THR_MCOND_INITIALIZER {0}
+
+struct mm_thrpool;
+struct mm_thrpool_group;
 
 
 #ifdef __cplusplus
@@ -84,6 +342,8 @@ MMLIB_API int mm_thr_mutex_trylock(mm_thr_mutex_t* mutex);
 MMLIB_API int mm_thr_mutex_consistent(mm_thr_mutex_t* mutex);
 MMLIB_API int mm_thr_mutex_unlock(mm_thr_mutex_t* mutex);
 MMLIB_API int mm_thr_mutex_deinit(mm_thr_mutex_t* mutex);
+MMLIB_API int mm_thr_lockstat_dump(int fd);
+MMLIB_API void mm_thr_lockstat_reset(void);
 MMLIB_API int mm_thr_cond_init(mm_thr_cond_t* cond, int flags);
 MMLIB_API int mm_thr_cond_wait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex);
 MMLIB_API int mm_thr_cond_timedwait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex,
@@ -92,15 +352,153 @@ MMLIB_API int mm_thr_cond_timedwait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex,
 MMLIB_API int mm_thr_cond_signal(mm_thr_cond_t* cond);
 MMLIB_API int mm_thr_cond_broadcast(mm_thr_cond_t* cond);
 MMLIB_API int mm_thr_cond_deinit(mm_thr_cond_t* cond);
+MMLIB_API int mm_thr_rwlock_init(mm_thr_rwlock_t* lock, int flags);
+MMLIB_API int mm_thr_rwlock_rdlock(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_rwlock_tryrdlock(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_rwlock_timedrdlock(mm_thr_rwlock_t* lock,
+                                        const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_rwlock_wrlock(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_rwlock_trywrlock(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_rwlock_timedwrlock(mm_thr_rwlock_t* lock,
+                                        const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_rwlock_unlock(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_rwlock_deinit(mm_thr_rwlock_t* lock);
+MMLIB_API int mm_thr_sem_init(mm_thr_sem_t* sem, unsigned int value,
+                              int flags);
+MMLIB_API int mm_thr_sem_post(mm_thr_sem_t* sem);
+MMLIB_API int mm_thr_sem_wait(mm_thr_sem_t* sem);
+MMLIB_API int mm_thr_sem_trywait(mm_thr_sem_t* sem);
+MMLIB_API int mm_thr_sem_timedwait(mm_thr_sem_t* sem,
+                                   const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_sem_deinit(mm_thr_sem_t* sem);
+MMLIB_API int mm_thr_event_init(mm_thr_event_t* event, int flags);
+MMLIB_API int mm_thr_event_set(mm_thr_event_t* event);
+MMLIB_API int mm_thr_event_reset(mm_thr_event_t* event);
+MMLIB_API int mm_thr_event_wait(mm_thr_event_t* event);
+MMLIB_API int mm_thr_event_timedwait(mm_thr_event_t* event,
+                                     const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_event_deinit(mm_thr_event_t* event);
+MMLIB_API int mm_thr_barrier_init(mm_thr_barrier_t* barrier,
+                                  unsigned int count, int flags);
+MMLIB_API int mm_thr_barrier_wait(mm_thr_barrier_t* barrier);
+MMLIB_API int mm_thr_barrier_deinit(mm_thr_barrier_t* barrier);
+MMLIB_API int mm_thr_latch_init(mm_thr_latch_t* latch, unsigned int count,
+                                int flags);
+MMLIB_API int mm_thr_latch_count_down(mm_thr_latch_t* latch, unsigned int n);
+MMLIB_API int mm_thr_latch_trywait(mm_thr_latch_t* latch);
+MMLIB_API int mm_thr_latch_wait(mm_thr_latch_t* latch);
+MMLIB_API int mm_thr_latch_timedwait(mm_thr_latch_t* latch,
+                                     const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_latch_deinit(mm_thr_latch_t* latch);
+MMLIB_API int mm_thr_seqlock_init(mm_thr_seqlock_t* seqlock, int flags);
+MMLIB_API int mm_thr_seqlock_write_begin(mm_thr_seqlock_t* seqlock);
+MMLIB_API int mm_thr_seqlock_write_end(mm_thr_seqlock_t* seqlock);
+MMLIB_API unsigned int mm_thr_seqlock_read_begin(const mm_thr_seqlock_t* lock);
+MMLIB_API int mm_thr_seqlock_read_retry(const mm_thr_seqlock_t* seqlock,
+                                        unsigned int seq);
+MMLIB_API void mm_thr_seqlock_read(const mm_thr_seqlock_t* seqlock,
+                                   void* dst, const void* src, size_t len);
+MMLIB_API void mm_thr_seqlock_write(mm_thr_seqlock_t* seqlock, void* dst,
+                                    const void* src, size_t len);
+MMLIB_API int mm_thr_seqlock_deinit(mm_thr_seqlock_t* seqlock);
+MMLIB_API int mm_thr_qlock_init(mm_thr_qlock_t* qlock, int flags);
+MMLIB_API int mm_thr_qlock_lock(mm_thr_qlock_t* qlock);
+MMLIB_API int mm_thr_qlock_trylock(mm_thr_qlock_t* qlock);
+MMLIB_API int mm_thr_qlock_unlock(mm_thr_qlock_t* qlock);
+MMLIB_API int mm_thr_qlock_deinit(mm_thr_qlock_t* qlock);
+MMLIB_API int mm_thr_mcond_init(mm_thr_mcond_t* cond, int flags);
+MMLIB_API int mm_thr_mcond_wait(mm_thr_mcond_t* cond, mm_thr_mutex_t* mutex);
+MMLIB_API int mm_thr_mcond_timedwait(mm_thr_mcond_t* cond,
+                                     mm_thr_mutex_t* mutex,
+                                     const struct mm_timespec* abstime);
+MMLIB_API int mm_thr_mcond_signal(mm_thr_mcond_t* cond);
+MMLIB_API int mm_thr_mcond_broadcast(mm_thr_mcond_t* cond);
+MMLIB_API int mm_thr_mcond_deinit(mm_thr_mcond_t* cond);
+MMLIB_API int mm_wait_on_address(uint32_t* addr, uint32_t expected, int flags,
+                                 const struct mm_timespec* abstime);
+MMLIB_API int mm_wake_by_address(uint32_t* addr, int num, int flags);
 MMLIB_API int mm_thr_once(mm_thr_once_t* once, void (* once_routine)(void));
 MMLIB_API int mm_thr_create(mm_thread_t* thread, void* (*proc)(void*),
                             void* arg);
 MMLIB_API int mm_thr_join(mm_thread_t thread, void** value_ptr);
 MMLIB_API int mm_thr_detach(mm_thread_t thread);
 MMLIB_API mm_thread_t mm_thr_self(void);
+MMLIB_API int mm_thr_create_ex(mm_thread_t* thread, void* (*proc)(void*),
+                               void* arg, const struct mm_thr_attr* attr);
+MMLIB_API int mm_thr_setaffinity(const struct mm_cpuset* cpuset);
+MMLIB_API int mm_thr_getaffinity(struct mm_cpuset* cpuset);
+MMLIB_API int mm_thr_set_sched(mm_thread_t thread, int policy, int prio);
+MMLIB_API int mm_thr_prefault_stack(size_t size);
+
+MMLIB_API const struct mm_cpu_topology* mm_cpu_topology_get(void);
+MMLIB_API int mm_cpu_topology_cpuset(struct mm_cpuset* set, int domain,
+                                     int id);
+MMLIB_API int mm_cpu_topology_spread(struct mm_cpuset* set, int domain);
+
+MMLIB_API struct mm_thrpool* mm_thrpool_create(int num_worker);
+MMLIB_API int mm_thrpool_destroy(struct mm_thrpool* pool, int flags);
+MMLIB_API int mm_thrpool_submit(struct mm_thrpool* pool,
+                                struct mm_thrpool_group* grp,
+                                void (* proc)(void*), void* arg);
+MMLIB_API int mm_thrpool_drain(struct mm_thrpool* pool);
+MMLIB_API struct mm_thrpool_group* mm_thrpool_group_create(void);
+MMLIB_API void mm_thrpool_group_destroy(struct mm_thrpool_group* grp);
+MMLIB_API int mm_thrpool_group_wait(struct mm_thrpool_group* grp);
 
 #ifdef __cplusplus
 }
 #endif
 
+
+/**
+ * mm_cpuset_zero() - remove all CPUs from a set
+ * @set:        CPU set to clear
+ */
+static inline
+void mm_cpuset_zero(struct mm_cpuset* set)
+{
+	int i;
+
+	for (i = 0; i < MM_CPUSET_SIZE / 64; i++)
+		set->bits[i] = 0;
+}
+
+
+/**
+ * mm_cpuset_set() - add a CPU to a set
+ * @set:        CPU set to modify
+ * @cpu:        index of the CPU to add (must be lower than MM_CPUSET_SIZE)
+ */
+static inline
+void mm_cpuset_set(struct mm_cpuset* set, int cpu)
+{
+	set->bits[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+}
+
+
+/**
+ * mm_cpuset_clear() - remove a CPU from a set
+ * @set:        CPU set to modify
+ * @cpu:        index of the CPU to remove (must be lower than MM_CPUSET_SIZE)
+ */
+static inline
+void mm_cpuset_clear(struct mm_cpuset* set, int cpu)
+{
+	set->bits[cpu / 64] &= ~((uint64_t)1 << (cpu % 64));
+}
+
+
+/**
+ * mm_cpuset_isset() - test whether a CPU is in a set
+ * @set:        CPU set to test
+ * @cpu:        index of the CPU to test (must be lower than MM_CPUSET_SIZE)
+ *
+ * Return: 1 if @cpu is in @set, 0 otherwise
+ */
+static inline
+int mm_cpuset_isset(const struct mm_cpuset* set, int cpu)
+{
+	return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
 #endif /* ifndef MMTHREAD_H */
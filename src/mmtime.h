@@ -233,6 +233,42 @@ void mm_timeadd_ms(struct mm_timespec* ts, int64_t dt)
 	}
 }
 
+/**************************************************************************
+ *                                 Timers                                 *
+ **************************************************************************/
+#define MM_TIMER_ABSTIME        0x00000001
+
+struct mm_timer;
+
+typedef void (*mm_timer_cb)(void* arg);
+
+/**
+ * struct mm_timer_stats - statistics of the expirations of a timer
+ * @num_expiry:         number of times the callback has been called
+ * @num_overrun:        number of periods skipped because the callback was
+ *                      called too late
+ * @mean_jitter_ns:     mean delay between the expiration time and the call
+ *                      of the callback
+ * @max_jitter_ns:      largest delay between the expiration time and the
+ *                      call of the callback
+ */
+struct mm_timer_stats {
+	int64_t num_expiry;
+	int64_t num_overrun;
+	int64_t mean_jitter_ns;
+	int64_t max_jitter_ns;
+};
+
+MMLIB_API struct mm_timer* mm_timer_create(clockid_t clock_id,
+                                           mm_timer_cb cb, void* arg);
+MMLIB_API void mm_timer_destroy(struct mm_timer* timer);
+MMLIB_API int mm_timer_arm(struct mm_timer* timer, int flags,
+                           const struct mm_timespec* value,
+                           const struct mm_timespec* period);
+MMLIB_API int mm_timer_cancel(struct mm_timer* timer);
+MMLIB_API void mm_timer_get_stats(struct mm_timer* timer,
+                                  struct mm_timer_stats* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,344 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define _GNU_SOURCE             // for sched_getcpu()
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpcpu.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "thread-local.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined (__linux__)
+#include <sched.h>
+#endif
+
+/**
+ * DOC: per-CPU counters
+ *
+ * A statistic counter incremented by many threads, for example a number
+ * of messages or bytes processed, is usually implemented as a single
+ * atomic integer. Each increment then needs the cache line of the counter
+ * to be owned exclusively by the CPU performing it: at high rates, the
+ * line keeps bouncing between the CPUs and the increments get as slow as
+ * a cache miss.
+ *
+ * A per-CPU counter (struct mm_pcpu_counter) is split into one slot per
+ * CPU, each on its own cache line. mm_pcpu_counter_add() updates the slot
+ * of the CPU it runs on: the line stays in the cache of this CPU and the
+ * update does not contend with the other CPUs. The slot is found with
+ * sched_getcpu() on Linux (a simple load from the rseq area of the thread
+ * with recent C libraries) and GetCurrentProcessorNumber() on Windows. On
+ * other platforms, each thread uses a slot of its own instead. Since the
+ * thread may migrate during the update, the slot is still updated
+ * atomically, but this atomic operation hits a line which is almost always
+ * local.
+ *
+ * The cost is moved to the read: mm_pcpu_counter_read() sums all the
+ * slots. The sum is not an atomic snapshot: increments concurrent to the
+ * read may or may not be accounted for. Such counters are meant for
+ * statistics that are updated often and read rarely.
+ *
+ * All the counters are registered under their name while they exist, so
+ * that they can be dumped at once with mm_pcpu_counter_dump() or iterated
+ * with mm_pcpu_counter_foreach().
+ */
+
+/**
+ * struct pcpu_slot - slot of a counter updated by one CPU
+ * @value:      partial sum of the counter
+ * @pad:        padding to the size of a cache line
+ */
+struct pcpu_slot {
+	int64_t value;
+	char pad[MM_CACHELINE_SIZE - sizeof(int64_t)];
+};
+
+/**
+ * struct mm_pcpu_counter - per-CPU counter
+ * @slots:      array of @mask+1 slots aligned on cache line
+ * @mask:       mask to apply on a CPU index to get its slot
+ * @next:       next counter in the registry
+ * @name:       name of the counter
+ */
+struct mm_pcpu_counter {
+	struct pcpu_slot* slots;
+	int mask;
+	struct mm_pcpu_counter* next;
+	char name[];
+};
+
+static mm_thr_mutex_t registry_lock = MM_THR_MUTEX_INITIALIZER;
+static struct mm_pcpu_counter* registry_head;
+static struct mm_pcpu_counter** registry_tail = &registry_head;
+
+static mm_thr_once_t num_slot_once = MM_THR_ONCE_INIT;
+static int num_slot;
+static int32_t next_thread_slot;
+static thread_local int thread_slot = -1;
+
+
+/**
+ * init_num_slot() - compute the number of slots of counters
+ *
+ * The number of slots is the lowest power of 2 above the highest index of
+ * online CPU, so that the slot of a CPU is found with a simple mask.
+ */
+static
+void init_num_slot(void)
+{
+	const struct mm_cpu_topology* topo = mm_cpu_topology_get();
+	int max_cpu = topo->cpus[topo->num_cpu - 1].cpu;
+
+	num_slot = 1;
+	while (num_slot <= max_cpu)
+		num_slot *= 2;
+}
+
+
+/**
+ * get_slot_index() - get the index of the slot of the calling thread
+ * @mask:       mask to apply to get an index in the slot array
+ *
+ * Return: index of the slot of the CPU running the calling thread if it
+ * can be retrieved, index of a slot associated with the calling thread
+ * otherwise.
+ */
+static inline
+int get_slot_index(int mask)
+{
+#if defined (_WIN32)
+	return GetCurrentProcessorNumber() & mask;
+#else
+#  if defined (__linux__)
+	int cpu = sched_getcpu();
+
+	if (cpu >= 0)
+		return cpu & mask;
+#  endif
+
+	if (thread_slot < 0)
+		thread_slot = mm_atomic_fetch_add_i32(&next_thread_slot, 1,
+		                                      MM_ATOMIC_RELAXED);
+
+	return thread_slot & mask;
+#endif
+}
+
+
+/**
+ * mm_pcpu_counter_create() - create a per-CPU counter
+ * @name:       name of the counter
+ *
+ * Create a counter initialized to 0 and register it under @name. The
+ * counter is meant to be updated with mm_pcpu_counter_add() and read with
+ * mm_pcpu_counter_read(). Several counters may have the same name.
+ *
+ * Return: pointer to the counter in case of success, NULL otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+struct mm_pcpu_counter* mm_pcpu_counter_create(const char* name)
+{
+	struct mm_pcpu_counter* counter;
+	size_t slots_size;
+
+	if (!name) {
+		mm_raise_error(EINVAL, "counter name cannot be NULL");
+		return NULL;
+	}
+
+	mm_thr_once(&num_slot_once, init_num_slot);
+
+	counter = malloc(sizeof(*counter) + strlen(name) + 1);
+	if (!counter) {
+		mm_raise_from_errno("Cannot allocate counter");
+		return NULL;
+	}
+
+	slots_size = num_slot * sizeof(*counter->slots);
+	counter->slots = mm_aligned_alloc(MM_CACHELINE_SIZE, slots_size);
+	if (!counter->slots) {
+		free(counter);
+		return NULL;
+	}
+
+	memset(counter->slots, 0, slots_size);
+	counter->mask = num_slot - 1;
+	counter->next = NULL;
+	strcpy(counter->name, name);
+
+	mm_thr_mutex_lock(&registry_lock);
+	*registry_tail = counter;
+	registry_tail = &counter->next;
+	mm_thr_mutex_unlock(&registry_lock);
+
+	return counter;
+}
+
+
+/**
+ * mm_pcpu_counter_destroy() - unregister and free a per-CPU counter
+ * @counter:    counter to destroy (may be NULL)
+ *
+ * The counter must not be updated nor read after this call.
+ */
+API_EXPORTED
+void mm_pcpu_counter_destroy(struct mm_pcpu_counter* counter)
+{
+	struct mm_pcpu_counter** link;
+
+	if (!counter)
+		return;
+
+	mm_thr_mutex_lock(&registry_lock);
+
+	for (link = &registry_head; *link; link = &(*link)->next) {
+		if (*link == counter)
+			break;
+	}
+
+	if (*link) {
+		*link = counter->next;
+		if (registry_tail == &counter->next)
+			registry_tail = link;
+	}
+
+	mm_thr_mutex_unlock(&registry_lock);
+
+	mm_aligned_free(counter->slots);
+	free(counter);
+}
+
+
+/**
+ * mm_pcpu_counter_add() - add a value to a per-CPU counter
+ * @counter:    counter to update
+ * @value:      value to add (may be negative)
+ *
+ * This function is thread-safe and lock-free. It only updates the slot of
+ * the CPU running the calling thread.
+ */
+API_EXPORTED
+void mm_pcpu_counter_add(struct mm_pcpu_counter* counter, int64_t value)
+{
+	struct pcpu_slot* slot;
+
+	slot = &counter->slots[get_slot_index(counter->mask)];
+	mm_atomic_fetch_add_i64(&slot->value, value, MM_ATOMIC_RELAXED);
+}
+
+
+/**
+ * mm_pcpu_counter_read() - get the value of a per-CPU counter
+ * @counter:    counter to read
+ *
+ * Sum the slots of @counter. The increments which are concurrent to this
+ * call may or may not be accounted for.
+ *
+ * Return: the sum of the values added to @counter
+ */
+API_EXPORTED
+int64_t mm_pcpu_counter_read(const struct mm_pcpu_counter* counter)
+{
+	int64_t sum = 0;
+	int i;
+
+	for (i = 0; i <= counter->mask; i++)
+		sum += mm_atomic_load_i64(&counter->slots[i].value,
+		                          MM_ATOMIC_RELAXED);
+
+	return sum;
+}
+
+
+/**
+ * mm_pcpu_counter_foreach() - iterate over the registered counters
+ * @cb:         function called for each counter
+ * @data:       pointer passed to @cb
+ *
+ * Call @cb with the name and the value of each counter currently
+ * registered, in their order of creation. The registry is locked during
+ * the iteration: @cb must not create nor destroy any counter.
+ */
+API_EXPORTED
+void mm_pcpu_counter_foreach(mm_pcpu_counter_cb cb, void* data)
+{
+	struct mm_pcpu_counter* counter;
+
+	mm_thr_mutex_lock(&registry_lock);
+
+	for (counter = registry_head; counter; counter = counter->next)
+		cb(counter->name, mm_pcpu_counter_read(counter), data);
+
+	mm_thr_mutex_unlock(&registry_lock);
+}
+
+
+struct dump_data {
+	int fd;
+	int rv;
+};
+
+
+static
+void dump_counter(const char* name, int64_t value, void* data)
+{
+	struct dump_data* dump = data;
+	char line[256];
+	char* buf = line;
+	ssize_t rsz;
+	int len;
+
+	if (dump->rv)
+		return;
+
+	// Long names are truncated to keep the line in the buffer
+	len = snprintf(line, sizeof(line), "%.200s: %lld\n",
+	               name, (long long)value);
+
+	// Write until the line is complete: error state is set on failure
+	while (len) {
+		rsz = mm_write(dump->fd, buf, len);
+		if (rsz < 0) {
+			dump->rv = -1;
+			return;
+		}
+
+		len -= rsz;
+		buf += rsz;
+	}
+}
+
+
+/**
+ * mm_pcpu_counter_dump() - write the value of all counters to a file
+ * @fd:         file descriptor open for writing
+ *
+ * Write one line "<name>: <value>" per registered counter in @fd, in their
+ * order of creation.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_pcpu_counter_dump(int fd)
+{
+	struct dump_data dump = {.fd = fd, .rv = 0};
+
+	mm_pcpu_counter_foreach(dump_counter, &dump);
+	return dump.rv;
+}
@@ -0,0 +1,84 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef PROFILE_SHARED_H
+#define PROFILE_SHARED_H
+
+#include <stdint.h>
+
+/**
+ * DOC: layout of shared profile segment
+ *
+ * The segment created by mm_profile_attach_shared() is made of a header
+ * followed by an array of PROFSHM_MAX_PROC process slots. A process claims
+ * a slot by atomically replacing its pid field (0 if the slot is free) with
+ * its own pid. Each slot is written only by the process owning it, while
+ * any number of readers (like mmprof-top) can map the segment read-only and
+ * load the statistics concurrently. Hence every field susceptible to change
+ * after initialization is stored and loaded with atomic operations.
+ *
+ * Only fixed size types are used and the 64-bit fields are naturally
+ * aligned so that the layout is the same for 32-bit and 64-bit processes.
+ */
+
+#define PROFSHM_MAGIC           0x6d6d7072  // "mmpr"
+#define PROFSHM_VERSION         1
+#define PROFSHM_MAX_PROC        64
+#define PROFSHM_NUM_POINT       16
+#define PROFSHM_LABEL_LEN       64
+#define PROFSHM_NAME_LEN        32
+
+/**
+ * struct profshm_point - statistics of a measure point
+ * @sum:        sum of the time differences with previous point (in ns)
+ * @min:        min time difference (in ns)
+ * @max:        max time difference (in ns)
+ * @median:     approximate median of the time difference (in ns)
+ * @label_len:  length of @label, set once @label has been written
+ * @label:      label of measure point (not null terminated)
+ */
+struct profshm_point {
+	int64_t sum;
+	int64_t min;
+	int64_t max;
+	int64_t median;
+	int32_t label_len;
+	int32_t pad;
+	char label[PROFSHM_LABEL_LEN];
+};
+
+/**
+ * struct profshm_proc - slot of process in the shared profile segment
+ * @pid:        pid of process owning the slot, 0 if slot is free
+ * @num_iter:   number of iterations recorded so far
+ * @num_points: number of measure points (excluding mm_tic())
+ * @name_len:   length of @name
+ * @name:       short name of the program (not null terminated)
+ * @points:     statistics of each measure point
+ */
+struct profshm_proc {
+	int64_t pid;
+	int64_t num_iter;
+	int32_t num_points;
+	int32_t name_len;
+	char name[PROFSHM_NAME_LEN];
+	struct profshm_point points[PROFSHM_NUM_POINT];
+};
+
+/**
+ * struct profshm_segment - shared profile segment
+ * @magic:      PROFSHM_MAGIC once the header has been initialized
+ * @version:    version of the layout (PROFSHM_VERSION)
+ * @max_proc:   number of elements in @procs
+ * @num_point:  number of elements in &profshm_proc.points
+ * @procs:      process slots
+ */
+struct profshm_segment {
+	int32_t magic;
+	int32_t version;
+	int32_t max_proc;
+	int32_t num_point;
+	struct profshm_proc procs[PROFSHM_MAX_PROC];
+};
+
+#endif /* PROFILE_SHARED_H */
@@ -5,14 +5,28 @@
 # include <config.h>
 #endif
 
+#define _GNU_SOURCE             // for RUSAGE_THREAD
+
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 #include "mmprofile.h"
 #include "mmpredefs.h"
+#include "mmerrno.h"
 #include "mmtime.h"
 #include "mmsysio.h"
+#include "profile-shared.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 #define SEC_IN_NSEC 1000000000
 #define NUM_TS_MAX          16
@@ -22,6 +36,8 @@
 #define UNIT_MASK  \
 	(PROF_FORCE_NSEC|PROF_FORCE_USEC|PROF_FORCE_MSEC|PROF_FORCE_SEC)
 #define NUM_COL_MAX          5
+#define USAGE_MASK \
+	(PROF_MINFLT|PROF_MAJFLT|PROF_VCSW|PROF_IVCSW|PROF_RSS)
 
 #define MIN(a, b) ((a) <= (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -48,6 +64,36 @@ const struct unit unit_list[] = {
 };
 #define NUM_UNIT ((int)(sizeof(unit_list)/sizeof(unit_list[0])))
 
+/**
+ * struct usage_field - resource usage counter definition
+ * @mask:       flag of the counter in mask of mm_profile_print()
+ * @name:       name which must appear in the header of the results
+ * @unit:       unit which must appear in the textual results
+ */
+struct usage_field {
+	int mask;
+	char name[8];
+	char unit[UNITSTR_LEN+1];
+};
+
+enum {
+	USAGE_MINFLT,
+	USAGE_MAJFLT,
+	USAGE_VCSW,
+	USAGE_IVCSW,
+	USAGE_RSS,
+	NUM_USAGE,
+};
+
+static
+const struct usage_field usage_fields[NUM_USAGE] = {
+	[USAGE_MINFLT] = {PROF_MINFLT, "minflt", ""},
+	[USAGE_MAJFLT] = {PROF_MAJFLT, "majflt", ""},
+	[USAGE_VCSW] = {PROF_VCSW, "vcsw", ""},
+	[USAGE_IVCSW] = {PROF_IVCSW, "ivcsw", ""},
+	[USAGE_RSS] = {PROF_RSS, "rss", "kB"},
+};
+
 /**************************************************************************
  *                                                                        *
  *                       Approximate median estimate                      *
@@ -133,9 +179,385 @@ static int64_t sum_diff_ts[NUM_TS_MAX];  // sum of time difference overall
 static struct median_estimator median_diff_ts[NUM_TS_MAX];  // approximate
                                                             // median of time
                                                             // diff
-static char* labels[NUM_TS_MAX];
+static const char* labels[NUM_TS_MAX];
 static char label_storage[MAX_LABEL_LEN*NUM_TS_MAX];
 
+static int usage_flags;         // resource usage recorded (PROF_RESET_*)
+static int64_t usage_ts[NUM_TS_MAX][NUM_USAGE];  // current iteration usage
+static int64_t sum_diff_usage[NUM_TS_MAX][NUM_USAGE];  // sum of usage
+                                                       // difference overall
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       Resource usage accounting                        *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * DOC:
+ * If enabled by mm_profile_reset(), the resource usage of the calling thread
+ * is read at each point of measure along with the timestamp. The counters
+ * are those reported by getrusage(): minor and major page faults, voluntary
+ * and involuntary context switches. Where the platform supports it, the
+ * counters of the calling thread only are used (RUSAGE_THREAD), otherwise
+ * the ones of the whole process. Optionally the resident set size of the
+ * process is read as well (only on Linux, through /proc/self/statm).
+ */
+
+#ifdef RUSAGE_THREAD
+#  define RUSAGE_WHO RUSAGE_THREAD
+#else
+#  define RUSAGE_WHO RUSAGE_SELF
+#endif
+
+static int statm_fd = -1;
+static long page_size_kb;
+
+
+/**
+ * read_rss_kb() - get the current resident set size of the process
+ *
+ * Returns: the resident set size in kB, 0 if it cannot be read.
+ */
+static
+int64_t read_rss_kb(void)
+{
+#ifdef __linux__
+	char buf[128];
+	ssize_t rsz;
+	long long size, resident;
+
+	if (statm_fd < 0)
+		return 0;
+
+	rsz = pread(statm_fd, buf, sizeof(buf)-1, 0);
+	if (rsz <= 0)
+		return 0;
+
+	buf[rsz] = '\0';
+	if (sscanf(buf, "%lld %lld", &size, &resident) != 2)
+		return 0;
+
+	return resident * page_size_kb;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * read_usage() - read the resource usage counters
+ * @usage:      array of NUM_USAGE elements receiving the counters
+ */
+static
+void read_usage(int64_t usage[])
+{
+#ifndef _WIN32
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_WHO, &ru) == 0) {
+		usage[USAGE_MINFLT] = ru.ru_minflt;
+		usage[USAGE_MAJFLT] = ru.ru_majflt;
+		usage[USAGE_VCSW] = ru.ru_nvcsw;
+		usage[USAGE_IVCSW] = ru.ru_nivcsw;
+	}
+#endif
+
+	if (usage_flags & PROF_RESET_RSS)
+		usage[USAGE_RSS] = read_rss_kb();
+}
+
+
+/**
+ * setup_usage() - configure the resource usage accounting
+ * @flags:      flags passed to mm_profile_reset()
+ */
+static
+void setup_usage(int flags)
+{
+	usage_flags = flags & (PROF_RESET_RUSAGE|PROF_RESET_RSS);
+
+	// Reading RSS is an option of the resource usage accounting
+	if (!(usage_flags & PROF_RESET_RUSAGE))
+		usage_flags = 0;
+
+#ifdef __linux__
+	if ((usage_flags & PROF_RESET_RSS) && statm_fd < 0) {
+		page_size_kb = sysconf(_SC_PAGESIZE) / 1024;
+		statm_fd = mm_open("/proc/self/statm", O_RDONLY, 0);
+	}
+#endif
+}
+
+
+/**
+ * get_usage_mask() - get the resource usage columns that can be displayed
+ * @mask:       mask supplied by user to mm_profile_print()
+ *
+ * Returns: the subset of @mask flags of resource usage which have been
+ * recorded.
+ */
+static
+int get_usage_mask(int mask)
+{
+	if (!(usage_flags & PROF_RESET_RUSAGE))
+		return 0;
+
+	if (!(usage_flags & PROF_RESET_RSS))
+		mask &= ~PROF_RSS;
+
+	return mask & USAGE_MASK;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       Shared memory statistics                         *
+ *                                                                        *
+ **************************************************************************/
+/**
+ * DOC:
+ * Once mm_profile_attach_shared() has been called, the statistics of each
+ * measure point are published at each iteration into a slot of a named
+ * shared memory segment (see profile-shared.h for the layout). The process
+ * is the only writer of its slot, so the values are simply stored
+ * atomically (no read-modify-write is needed), which allows a reader to
+ * observe them at any time without tearing.
+ */
+
+static struct profshm_segment* shm_seg;  // mapped shared segment
+static struct profshm_proc* shm_slot;    // slot owned by the process
+
+#define shared_store(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+
+
+/**
+ * get_self_pid() - get the pid of the current process
+ *
+ * Returns: pid of the calling process
+ */
+static
+int64_t get_self_pid(void)
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+
+
+/**
+ * process_is_alive() - test whether a process is still running
+ * @pid:        pid of the process to test
+ *
+ * Returns: 1 if the process @pid is running (or cannot be tested), 0
+ * otherwise.
+ */
+static
+int process_is_alive(int64_t pid)
+{
+#ifdef _WIN32
+	HANDLE hnd;
+	DWORD code = STILL_ACTIVE;
+
+	hnd = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+	if (!hnd)
+		return (GetLastError() == ERROR_ACCESS_DENIED);
+
+	GetExitCodeProcess(hnd, &code);
+	CloseHandle(hnd);
+	return (code == STILL_ACTIVE);
+#else
+	return (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+#endif
+}
+
+
+/**
+ * get_program_name() - get short name of the program of current process
+ * @name:       buffer receiving the name (not null terminated)
+ * @len:        size of @name
+ *
+ * Returns: the number of characters written in @name
+ */
+static
+int get_program_name(char* name, int len)
+{
+	const char* base = "";
+	int baselen;
+
+#if defined(_WIN32)
+	char path[MAX_PATH];
+	char* sep;
+
+	if (GetModuleFileNameA(NULL, path, sizeof(path)) > 0) {
+		path[sizeof(path)-1] = '\0';
+		sep = strrchr(path, '\\');
+		base = sep ? sep+1 : path;
+	}
+#elif defined(__GLIBC__)
+	base = program_invocation_short_name;
+#endif
+
+	baselen = MIN((int)strlen(base), len);
+	memcpy(name, base, baselen);
+	return baselen;
+}
+
+
+/**
+ * shared_publish_label() - publish label of a measure point
+ * @pt:         shared statistics of the measure point
+ * @label:      label to publish
+ *
+ * Write @label in the shared point and then set its length: a reader
+ * observing a non zero length will see the whole label.
+ */
+static
+void shared_publish_label(struct profshm_point* pt, const char* label)
+{
+	int len;
+
+	len = MIN((int)strlen(label), PROFSHM_LABEL_LEN);
+	memcpy(pt->label, label, len);
+	__atomic_store_n(&pt->label_len, len, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * shared_publish() - publish the statistics into shared memory if attached
+ *
+ * This function is meant to be called after the statistics of the previous
+ * iteration have been accounted by update_diffs().
+ */
+static
+void shared_publish(void)
+{
+	struct profshm_proc* slot = shm_slot;
+	struct profshm_point* pt;
+	int i, num_points;
+
+	if (!slot)
+		return;
+
+	num_points = MIN(MAX(num_ts-1, 0), PROFSHM_NUM_POINT);
+	for (i = 0; i < num_points; i++) {
+		pt = &slot->points[i];
+		if (labels[i+1] && !pt->label_len)
+			shared_publish_label(pt, labels[i+1]);
+
+		shared_store(&pt->sum, sum_diff_ts[i+1]);
+		shared_store(&pt->min, min_diff_ts[i+1]);
+		shared_store(&pt->max, max_diff_ts[i+1]);
+		shared_store(&pt->median,
+		             median_estimator_getvalue(&median_diff_ts[i+1]));
+	}
+
+	shared_store(&slot->num_points, num_points);
+	__atomic_store_n(&slot->num_iter, num_iter, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * shared_reset() - reset the statistics published in shared memory
+ * @keep_label: if non zero, the published labels are not reset
+ */
+static
+void shared_reset(int keep_label)
+{
+	struct profshm_proc* slot = shm_slot;
+	struct profshm_point* pt;
+	int i;
+
+	if (!slot)
+		return;
+
+	shared_store(&slot->num_iter, 0);
+	shared_store(&slot->num_points, 0);
+	for (i = 0; i < PROFSHM_NUM_POINT; i++) {
+		pt = &slot->points[i];
+		shared_store(&pt->sum, 0);
+		shared_store(&pt->min, INT64_MAX);
+		shared_store(&pt->max, 0);
+		shared_store(&pt->median, 0);
+		if (!keep_label)
+			shared_store(&pt->label_len, 0);
+	}
+}
+
+
+/**
+ * init_segment() - initialize or validate header of shared profile segment
+ * @seg:        mapped shared profile segment
+ *
+ * The header is initialized if the segment has just been created. Several
+ * processes may do it concurrently, but since they all write the same
+ * values, this is harmless.
+ *
+ * Returns: 0 in case of success, -1 otherwise with error state set
+ */
+static
+int init_segment(struct profshm_segment* seg)
+{
+	if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != PROFSHM_MAGIC) {
+		seg->version = PROFSHM_VERSION;
+		seg->max_proc = PROFSHM_MAX_PROC;
+		seg->num_point = PROFSHM_NUM_POINT;
+		__atomic_store_n(&seg->magic, PROFSHM_MAGIC, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	if (seg->version != PROFSHM_VERSION
+	    || seg->max_proc != PROFSHM_MAX_PROC
+	    || seg->num_point != PROFSHM_NUM_POINT)
+		return mm_raise_error(MM_EBADFMT, "incompatible layout of "
+		                      "shared profile segment");
+
+	return 0;
+}
+
+
+/**
+ * claim_slot() - get ownership of a process slot in shared profile segment
+ * @seg:        mapped shared profile segment
+ *
+ * A free slot is preferably claimed. If there are none, the slot of a
+ * process which has terminated without detaching is reclaimed.
+ *
+ * Returns: the claimed slot, NULL if none is available
+ */
+static
+struct profshm_proc* claim_slot(struct profshm_segment* seg)
+{
+	int64_t pid, prev;
+	int i, pass;
+
+	pid = get_self_pid();
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < PROFSHM_MAX_PROC; i++) {
+			prev = __atomic_load_n(&seg->procs[i].pid,
+			                       __ATOMIC_RELAXED);
+
+			// A slot already holding our pid is stale: it has
+			// been left by a previous process with same pid
+			if (prev != 0
+			    && !(pass && (prev == pid
+			                  || !process_is_alive(prev))))
+				continue;
+
+			if (__atomic_compare_exchange_n(&seg->procs[i].pid,
+			                                &prev, pid, 0,
+			                                __ATOMIC_ACQUIRE,
+			                                __ATOMIC_RELAXED))
+				return &seg->procs[i];
+		}
+	}
+
+	return NULL;
+}
+
 
 /**************************************************************************
  *                                                                        *
@@ -177,12 +599,13 @@ int64_t get_diff_ts(int i)
  *
  * This function is meant to be called at the end of all tic/toc iteration.
  * It updates the min, max and sum (for mean) of the time difference based
- * on the previous iteration.
+ * on the previous iteration. If attached to a shared profile segment, the
+ * updated statistics are published there.
  */
 static
 void update_diffs(void)
 {
-	int i;
+	int i, k;
 	int64_t diff;
 
 	for (i = 1; i < next_ts; i++) {
@@ -192,6 +615,16 @@ void update_diffs(void)
 		sum_diff_ts[i] += diff;
 		median_estimator_update(&median_diff_ts[i], diff);
 	}
+
+	shared_publish();
+
+	if (!usage_flags)
+		return;
+
+	for (i = 1; i < next_ts; i++) {
+		for (k = 0; k < NUM_USAGE; k++)
+			sum_diff_usage[i][k] += usage_ts[i][k] - usage_ts[i-1][k];
+	}
 }
 
 
@@ -216,6 +649,8 @@ void reset_diffs(void)
 		sum_diff_ts[i] = 0L;
 		median_estimator_init(&median_diff_ts[i]);
 	}
+
+	memset(sum_diff_usage, 0, sizeof(sum_diff_usage));
 }
 
 
@@ -236,6 +671,11 @@ static
 void estimate_toc_overhead(void)
 {
 	int i;
+	struct profshm_proc* slot;
+
+	// Do not publish the measures of the estimation
+	slot = shm_slot;
+	shm_slot = NULL;
 
 	reset_diffs();
 	toc_overhead = 0;
@@ -254,6 +694,7 @@ void estimate_toc_overhead(void)
 	}
 
 	toc_overhead = MIN(min_diff_ts[1], min_diff_ts[2]);
+	shm_slot = slot;
 }
 
 
@@ -275,6 +716,9 @@ void local_toc(void)
 		return;
 
 	timestamps[next_ts] = ts;
+	if (usage_flags)
+		read_usage(usage_ts[next_ts]);
+
 	if (next_ts >= num_ts)
 		num_ts = next_ts+1;
 
@@ -432,7 +876,7 @@ int get_display_unit(int num_points, int num_cols, int64_t data[], int mask)
 static
 int format_header_line(int mask, int label_width, char str[])
 {
-	int len;
+	int i, len, umask;
 
 	len = sprintf(str, "%*s |", label_width, "");
 
@@ -466,6 +910,16 @@ int format_header_line(int mask, int label_width, char str[])
 		               UNITSTR_LEN, "");
 	}
 
+	umask = get_usage_mask(mask);
+	for (i = 0; i < NUM_USAGE; i++) {
+		if (!(umask & usage_fields[i].mask))
+			continue;
+
+		len += sprintf(str+len, "%*s %*s |",
+		               VALUESTR_LEN, usage_fields[i].name,
+		               UNITSTR_LEN, "");
+	}
+
 	str[len++] = '\n';
 	memset(str+len, '-', len-1);
 	len += len-1;
@@ -475,6 +929,37 @@ int format_header_line(int mask, int label_width, char str[])
 }
 
 
+/**
+ * format_usage_cols() - print resource usage columns of a result line
+ * @umask:      resource usage columns to print (PROF_MINFLT, ...)
+ * @v:          index of the desired line in the table (first is 0)
+ * @str:        output string
+ *
+ * The printed values are the means over the iterations of the difference
+ * of counters between the point of measure and the previous one.
+ *
+ * Returns: number of bytes written in the output string
+ */
+static
+int format_usage_cols(int umask, int v, char str[])
+{
+	int i, len = 0;
+	double value;
+
+	for (i = 0; i < NUM_USAGE; i++) {
+		if (!(umask & usage_fields[i].mask))
+			continue;
+
+		value = (double)sum_diff_usage[v+1][i] / num_iter;
+		len += sprintf(str+len, "%*.2f %*s |",
+		               VALUESTR_LEN, value,
+		               UNITSTR_LEN, usage_fields[i].unit);
+	}
+
+	return len;
+}
+
+
 /**
  * format_result_line() - print a line of the result table
  * @ncol:       number of columns in @data
@@ -483,20 +968,23 @@ int format_header_line(int mask, int label_width, char str[])
  * @unit_index: index of the unit to use to display the result
  * @label_width:        maximum length of a registered label
  * @data:       array (num_col x @num_points) containing the results
+ * @umask:      resource usage columns to print (PROF_MINFLT, ...)
  * @str:        output string
  *
  * Returns: number of bytes written in the output string
  */
 static
 int format_result_line(int ncol, int num_points, int v, int unit_index,
-                       int label_width, const int64_t data[], char str[])
+                       int label_width, const int64_t data[], int umask,
+                       char str[])
 {
 	int i, len;
 	double value, scale = unit_list[unit_index].scale;
 	const char* unitname = unit_list[unit_index].name;
 
 	if (labels[v+1])
-		len = sprintf(str, "%*s |", label_width, labels[v+1]);
+		len = sprintf(str, "%*.*s |", label_width, label_width,
+		              labels[v+1]);
 	else
 		len = sprintf(str, "%*i |", label_width, v+1);
 
@@ -507,6 +995,8 @@ int format_result_line(int ncol, int num_points, int v, int unit_index,
 		               UNITSTR_LEN, unitname);
 	}
 
+	len += format_usage_cols(umask, v, str+len);
+
 	str[len++] = '\n';
 	return len;
 }
@@ -598,16 +1088,43 @@ void mm_toc(void)
 API_EXPORTED_RELOCATABLE
 void mm_toc_label(const char* label)
 {
+	char* label_copy;
+
 	// Copy label if it the first time to appear
 	if (!labels[next_ts]) {
-		labels[next_ts] = &label_storage[next_ts*MAX_LABEL_LEN];
-		strncpy(labels[next_ts], label, MAX_LABEL_LEN-1);
+		label_copy = &label_storage[next_ts*MAX_LABEL_LEN];
+		strncpy(label_copy, label, MAX_LABEL_LEN-1);
+		labels[next_ts] = label_copy;
 	}
 
 	local_toc();
 }
 
 
+/**
+ * mm_toc_label_static() - Add a new point of measure with a static label
+ * @label:      string with static storage duration (typically a literal)
+ *
+ * This function is the same as mm_toc_label() excepting that @label is not
+ * copied: only its pointer is registered at the measure point. This removes
+ * the overhead of the string copy at the first iteration, but @label must
+ * remain valid as long as the profile can be printed. This is typically
+ * what the MM_PROFILE_TOC() and MM_PROFILE_SCOPE() macros use.
+ *
+ * NOTE: Contrary to the usual API functions, mm_toc_label_static() uses the
+ * attribute API_EXPORTED_RELOCATABLE. This is done on purpose. See NOTE of
+ * estimate_toc_overhead().
+ */
+API_EXPORTED_RELOCATABLE
+void mm_toc_label_static(const char* label)
+{
+	if (!labels[next_ts])
+		labels[next_ts] = label;
+
+	local_toc();
+}
+
+
 /**
  * mm_profile_print() - Print the timing statistics gathered so far
  * @mask:       combination of flags indicating statistics must be printed
@@ -627,6 +1144,18 @@ void mm_toc_label(const char* label)
  * - PROF_FORCE_MSEC: force result display in milliseconds
  * - PROF_FORCE_SEC: force result display in seconds
  *
+ * If the resource usage accounting has been enabled by mm_profile_reset(),
+ * additional columns can be requested by the following flags. The value
+ * displayed is the mean over iterations of the counter increase between
+ * the previous point of measure and the current one:
+ *
+ * - PROF_MINFLT: minor page faults
+ * - PROF_MAJFLT: major page faults
+ * - PROF_VCSW: voluntary context switches
+ * - PROF_IVCSW: involuntary context switches
+ * - PROF_RSS: resident set size growth in kB (needs PROF_RESET_RSS)
+ * - PROF_RUSAGE: all of the above
+ *
  * Returns: 0 in case of success, -1 otherwise with errno set accordingly
  *
  * See: mm_profile_reset(), mm_tic(), write()
@@ -652,7 +1181,8 @@ int mm_profile_print(int mask, int fd)
 		else
 			len = format_result_line(ncol, num_points, i-1,
 			                         unit_index, label_width,
-			                         data, str);
+			                         data, get_usage_mask(mask),
+			                         str);
 
 
 		// Write line to file
@@ -669,14 +1199,18 @@ int mm_profile_print(int mask, int fd)
  * mm_profile_get_data - Retrieve profile result programmatically
  * @measure_point:      measure point whose statistic must be get
  * @type:               type of statistic (PROF_[CURR|MIN|MEAN|MAX|MEDIAN])
+ *                      or resource usage counter (PROF_[MINFLT|MAJFLT|
+ *                      VCSW|IVCSW|RSS])
  *
- * Return: statistic value in nanosecond
+ * Return: statistic value in nanosecond. If @type is a resource usage
+ * counter, the total increase of the counter at @measure_point over all
+ * iterations since last reset.
  */
 API_EXPORTED
 int64_t mm_profile_get_data(int measure_point, int type)
 {
 	int64_t data[NUM_TS_MAX];
-	int num_points, mask;
+	int i, num_points, mask;
 
 	if (measure_point >= num_ts-1)
 		return -1;
@@ -691,6 +1225,19 @@ int64_t mm_profile_get_data(int measure_point, int type)
 	case PROF_MEDIAN:
 		break;
 
+	case PROF_MINFLT:
+	case PROF_MAJFLT:
+	case PROF_VCSW:
+	case PROF_IVCSW:
+	case PROF_RSS:
+		if (!get_usage_mask(type))
+			return -1;
+
+		for (i = 0; usage_fields[i].mask != type; i++)
+			;
+
+		return sum_diff_usage[measure_point+1][i];
+
 	default:
 		return -1;
 	}
@@ -732,6 +1279,14 @@ int64_t mm_profile_get_data(int measure_point, int type)
  * label. Then the subsequent call to mm_toc_label() will not be affected by
  * the string copy overhead.
  *
+ * If the PROF_RESET_RUSAGE flag is set, the resource usage counters of the
+ * calling thread (page faults and context switches) are read at each
+ * mm_tic() and mm_toc() along with the timestamp. If PROF_RESET_RSS is set
+ * in addition, the resident set size of the process is read as well. This
+ * adds a system call (two with PROF_RESET_RSS) at each point of measure,
+ * whose overhead is accounted in the toc overhead estimation. The counters
+ * are reported by mm_profile_print() if requested.
+ *
  * At startup, the function are configured to use CPU based timer.
  *
  * See: mm_profile_print(), mm_tic(), mm_toc_label()
@@ -746,8 +1301,10 @@ void mm_profile_reset(int flags)
 	else
 		clock_id = MM_CLK_MONOTONIC;
 
+	setup_usage(flags);
 	estimate_toc_overhead();
 	reset_diffs();
+	shared_reset(flags & PROF_RESET_KEEPLABEL);
 
 	if (!(flags & PROF_RESET_KEEPLABEL)) {
 		labels[0] = label_storage;
@@ -755,3 +1312,107 @@ void mm_profile_reset(int flags)
 			labels[i] = NULL;
 	}
 }
+
+
+/**
+ * mm_profile_attach_shared() - publish the profile in shared memory
+ * @name:       name of the shared memory object holding the statistics
+ *
+ * This function makes the statistics of the measure points of the calling
+ * process be published into the shared memory object named @name (with the
+ * same naming rules as mm_shm_open()), which is created if it does not
+ * exist yet. Several processes (typically those of a same pipeline spawned
+ * with mm_spawn()) can attach to the same object: each one gets its own
+ * slot in it. Then the statistics of all of them can be monitored live by
+ * another process, for example with the mmprof-top tool.
+ *
+ * The statistics are updated in the shared memory at each mm_tic() and
+ * mm_profile_print() and are reset by mm_profile_reset(). The values are
+ * written atomically, so a reader can load them at any time. Only the
+ * timing statistics are published, the resource usage counters are not.
+ *
+ * A slot is released by mm_profile_detach_shared(). The slot of a process
+ * that has terminated without detaching is reused when another process
+ * needs one and none is free. The shared memory object is never removed
+ * automatically: use mm_shm_unlink() when it is no longer needed.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. The error %MM_EWRONGSTATE is reported if the profile is
+ * already attached, %MM_EBADFMT if the object exists but has not been
+ * created by a compatible version of mmlib and %ENOSPC if all the slots
+ * are used by running processes.
+ */
+API_EXPORTED
+int mm_profile_attach_shared(const char* name)
+{
+	int fd, len;
+	struct mm_stat st;
+	struct profshm_segment* seg;
+	struct profshm_proc* slot;
+
+	if (shm_seg)
+		return mm_raise_error(MM_EWRONGSTATE, "profile is already "
+		                      "attached to shared memory");
+
+	fd = mm_shm_open(name, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	// Set size of object if just created. If another process does the
+	// same concurrently, this is harmless since the size is the same.
+	if (mm_fstat(fd, &st)
+	    || (st.size < (mm_off_t)sizeof(*seg)
+	        && mm_ftruncate(fd, sizeof(*seg)))) {
+		mm_close(fd);
+		return -1;
+	}
+
+	seg = mm_mapfile(fd, 0, sizeof(*seg), MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	if (!seg)
+		return -1;
+
+	if (init_segment(seg))
+		goto error;
+
+	slot = claim_slot(seg);
+	if (!slot) {
+		mm_raise_error(ENOSPC, "no free slot in shared profile %s",
+		               name);
+		goto error;
+	}
+
+	shared_store(&slot->name_len, 0);
+	len = get_program_name(slot->name, sizeof(slot->name));
+	__atomic_store_n(&slot->name_len, len, __ATOMIC_RELEASE);
+
+	shm_seg = seg;
+	shm_slot = slot;
+	shared_reset(0);
+	shared_publish();
+	return 0;
+
+error:
+	mm_unmap(seg);
+	return -1;
+}
+
+
+/**
+ * mm_profile_detach_shared() - stop publishing the profile in shared memory
+ *
+ * Release the slot of the calling process in the shared memory object
+ * attached by mm_profile_attach_shared() and unmap it. This does nothing
+ * if the profile is not attached.
+ */
+API_EXPORTED
+void mm_profile_detach_shared(void)
+{
+	if (!shm_seg)
+		return;
+
+	__atomic_store_n(&shm_slot->pid, 0, __ATOMIC_RELEASE);
+	mm_unmap(shm_seg);
+	shm_seg = NULL;
+	shm_slot = NULL;
+}
@@ -10,10 +10,10 @@
 #include "mmsysio.h"
 #include "mmpredefs.h"
 #include "utils-win32.h"
-#include "atomic-win32.h"
 #include "mutex-lockval.h"
 #include "mmlog.h"
 #include "mmlib.h"
+#include "mmatomic.h"
 
 #include <windows.h>
 
@@ -214,7 +214,7 @@ void cleanup_mutex_lock(HANDLE hmap, struct shared_lock shlock, struct lockref_r
 	CloseHandle(hmap);
 
 	// Inspect the current value of the shared lock
-	lockval = atomic_load(shlock.ptr);
+	lockval = mm_atomic_load_i64(shlock.ptr, MM_ATOMIC_SEQ_CST);
 
 	// Find the modification to apply for each dead thread onto the shared lock value
 	cleanup_val = 0;
@@ -225,8 +225,9 @@ void cleanup_mutex_lock(HANDLE hmap, struct shared_lock shlock, struct lockref_r
 	}
 
 	// Apply the combined cleanup and compute the resulting value
-	// (atomic_fetch_add() returns the previous value before the add)
-	lockval = atomic_fetch_add(shlock.ptr, cleanup_val);
+	// (mm_atomic_fetch_add_i64() returns the previous value before the add)
+	lockval = mm_atomic_fetch_add_i64(shlock.ptr, cleanup_val,
+	                                  MM_ATOMIC_SEQ_CST);
 	lockval += cleanup_val;
 
 	// Notify the cleanup job is done
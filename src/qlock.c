@@ -0,0 +1,288 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+#include "thread-local.h"
+
+#define QLOCK_SPIN_COUNT        1024    // checks before parking
+#define MAX_HELD_QLOCK          32      // qlocks held at once by a thread
+
+#define NODE_WAITING    0
+#define NODE_PARKED     1
+#define NODE_GRANTED    2
+
+/**
+ * DOC: fair queued lock
+ *
+ * A mutex does not guarantee any order in which the waiting threads get
+ * the lock: a thread releasing the lock and trying to get it right after
+ * usually wins against the threads already waiting. When many threads
+ * contend for the same lock, some of them can then wait much longer than
+ * others. Moreover all the waiters poll the same cache line, which makes
+ * it bounce between the CPUs at each release.
+ *
+ * The queued lock (mm_thr_qlock_t) is a MCS lock: the threads waiting for
+ * the lock form a queue and get the lock in the order in which they have
+ * called mm_thr_qlock_lock(). Each waiter spins on a word of its own,
+ * written only by its predecessor when handing the lock over. After
+ * spinning for a while, a waiter sleeps on this word with the futex layer.
+ *
+ * The fairness has a cost: since the lock is handed to the next waiter,
+ * a sleeping waiter must be woken up before any other thread can get the
+ * lock. A queued lock is hence meant for heavily contended locks for
+ * which stable latency matters more than throughput. For other uses,
+ * mm_thr_mutex_t should be preferred.
+ *
+ * The queue nodes are stored in the memory of the waiting threads, hence a
+ * queued lock cannot be shared by other processes. A thread can hold at
+ * most 32 queued locks at the same time. Like a mutex, a queued lock must
+ * be unlocked by the thread that has locked it.
+ */
+
+/**
+ * struct qlock_node - node of the queue of a qlock
+ * @next:       node of the thread queued after this one
+ * @state:      NODE_WAITING, NODE_PARKED or NODE_GRANTED
+ */
+struct qlock_node {
+	mm_atomic_ptr_t next;
+	uint32_t state;
+};
+
+static thread_local struct qlock_node nodes[MAX_HELD_QLOCK];
+static thread_local uint32_t nodes_used;
+
+
+/**
+ * get_node() - get a free queue node of the calling thread
+ *
+ * Return: pointer to the node, NULL if all the nodes of the thread are in
+ * use.
+ */
+static
+struct qlock_node* get_node(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_HELD_QLOCK; i++) {
+		if (!(nodes_used & (1u << i))) {
+			nodes_used |= (1u << i);
+			return &nodes[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+static
+void put_node(struct qlock_node* node)
+{
+	nodes_used &= ~(1u << (node - nodes));
+}
+
+
+/**
+ * wait_granted() - wait for the lock to be handed over
+ * @node:       node of the calling thread in the queue
+ *
+ * Spin on @node for a while and then sleep on it until the predecessor has
+ * handed the lock over.
+ */
+static
+void wait_granted(struct qlock_node* node)
+{
+	uint32_t state = NODE_WAITING;
+	int i;
+
+	for (i = 0; i < QLOCK_SPIN_COUNT; i++) {
+		if (mm_atomic_load_u32(&node->state, MM_ATOMIC_ACQUIRE)
+		    == NODE_GRANTED)
+			return;
+
+		mm_cpu_relax();
+	}
+
+	// Fails if the lock has been granted in the meantime
+	if (!mm_atomic_cas_u32(&node->state, &state, NODE_PARKED,
+	                       MM_ATOMIC_ACQUIRE))
+		return;
+
+	while (mm_atomic_load_u32(&node->state, MM_ATOMIC_ACQUIRE)
+	       != NODE_GRANTED)
+		futex_wait(&node->state, NODE_PARKED, 0, NULL);
+}
+
+
+/**
+ * mm_thr_qlock_init() - Initialize a queued lock
+ * @qlock:      queued lock to initialize
+ * @flags:      OR-combination of flags indicating the type of @qlock
+ *
+ * Use this function to initialize @qlock. No flag is supported for the
+ * moment: @flags must be 0.
+ *
+ * If 0 is passed, a call to this function could have been avoided if
+ * @qlock had been statically initialized with MM_THR_QLOCK_INITIALIZER.
+ *
+ * Return: 0 in case of success, EINVAL if @flags is not supported (in
+ * particular if it contains MM_THR_PSHARED).
+ */
+API_EXPORTED
+int mm_thr_qlock_init(mm_thr_qlock_t* qlock, int flags)
+{
+	if (flags) {
+		mm_raise_error(EINVAL, "unsupported qlock flags 0x%08x",
+		               flags);
+		return EINVAL;
+	}
+
+	qlock->flags = flags;
+	qlock->tail = NULL;
+	qlock->owner = NULL;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_qlock_lock() - lock a queued lock
+ * @qlock:      initialized queued lock
+ *
+ * Lock @qlock. If it is held by another thread, the calling thread is
+ * queued and blocks until the threads queued before it have released the
+ * lock.
+ *
+ * Return: 0 in case of success, EAGAIN if the calling thread already holds
+ * the maximum number of queued locks.
+ */
+API_EXPORTED
+int mm_thr_qlock_lock(mm_thr_qlock_t* qlock)
+{
+	struct qlock_node* node;
+	struct qlock_node* prev;
+
+	node = get_node();
+	if (!node) {
+		mm_raise_error(EAGAIN, "too many qlocks held");
+		return EAGAIN;
+	}
+
+	mm_atomic_store_ptr(&node->next, NULL, MM_ATOMIC_RELAXED);
+	mm_atomic_store_u32(&node->state, NODE_WAITING, MM_ATOMIC_RELAXED);
+
+	prev = mm_atomic_exchange_ptr(&qlock->tail, node, MM_ATOMIC_ACQ_REL);
+	if (prev) {
+		mm_atomic_store_ptr(&prev->next, node, MM_ATOMIC_RELEASE);
+		wait_granted(node);
+	}
+
+	qlock->owner = node;
+	return 0;
+}
+
+
+/**
+ * mm_thr_qlock_trylock() - try to lock a queued lock
+ * @qlock:      initialized queued lock
+ *
+ * Lock @qlock if it is not held nor waited for by any thread. Otherwise
+ * return immediately.
+ *
+ * Return: 0 in case of success, EBUSY if the lock could not be taken
+ * immediately, EAGAIN if the calling thread already holds the maximum
+ * number of queued locks.
+ */
+API_EXPORTED
+int mm_thr_qlock_trylock(mm_thr_qlock_t* qlock)
+{
+	struct qlock_node* node;
+	void* tail = NULL;
+
+	if (mm_atomic_load_ptr(&qlock->tail, MM_ATOMIC_RELAXED))
+		return EBUSY;
+
+	node = get_node();
+	if (!node) {
+		mm_raise_error(EAGAIN, "too many qlocks held");
+		return EAGAIN;
+	}
+
+	mm_atomic_store_ptr(&node->next, NULL, MM_ATOMIC_RELAXED);
+	if (!mm_atomic_cas_ptr(&qlock->tail, &tail, node, MM_ATOMIC_ACQUIRE)) {
+		put_node(node);
+		return EBUSY;
+	}
+
+	qlock->owner = node;
+	return 0;
+}
+
+
+/**
+ * mm_thr_qlock_unlock() - unlock a queued lock
+ * @qlock:      queued lock held by the calling thread
+ *
+ * Release @qlock. If threads are waiting for it, the lock is handed over
+ * to the one which has been queued first.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_qlock_unlock(mm_thr_qlock_t* qlock)
+{
+	struct qlock_node* node = qlock->owner;
+	struct qlock_node* next;
+	void* tail = node;
+	uint32_t prev_state;
+
+	next = mm_atomic_load_ptr(&node->next, MM_ATOMIC_ACQUIRE);
+	if (!next) {
+		// No waiter: the lock is released by emptying the queue
+		if (mm_atomic_cas_ptr(&qlock->tail, &tail, NULL,
+		                      MM_ATOMIC_RELEASE))
+			goto exit;
+
+		// A thread is being queued: wait for it to be linked
+		while (!(next = mm_atomic_load_ptr(&node->next,
+		                                   MM_ATOMIC_ACQUIRE)))
+			mm_cpu_relax();
+	}
+
+	// Once granted, the node of next may be reused: at worst the wake
+	// is then spurious for another waiter of the same address
+	prev_state = mm_atomic_exchange_u32(&next->state, NODE_GRANTED,
+	                                    MM_ATOMIC_RELEASE);
+	if (prev_state == NODE_PARKED)
+		futex_wake(&next->state, 1, 0);
+
+exit:
+	put_node(node);
+	return 0;
+}
+
+
+/**
+ * mm_thr_qlock_deinit() - cleanup an initialized queued lock
+ * @qlock:      initialized queued lock to destroy
+ *
+ * It is undefined behavior to destroy a lock which is held or waited for.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_qlock_deinit(mm_thr_qlock_t* qlock)
+{
+	(void)qlock;
+	return 0;
+}
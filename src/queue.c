@@ -0,0 +1,695 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmqueue.h"
+#include "mmthread.h"
+
+#define SLOT_ALIGN      8
+#define SEQ_SIZE        SLOT_ALIGN      // size of sequence header in MPMC slot
+#define QUEUE_MAX_CAPACITY      (1u << 30)
+
+#define ROUND_UP(x, a)  (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/**
+ * DOC: queue
+ *
+ * A queue is a bounded ring buffer of fixed size elements. Two flavors are
+ * provided, selected at initialization:
+ *
+ * - MM_QUEUE_SPSC: only one thread may enqueue and only one thread may
+ *   dequeue at the same time. The producer and the consumer each own
+ *   their position and keep a cached copy of the position of the other:
+ *   the shared positions are read only when the cached copy tells the
+ *   queue is full (or empty).
+ * - MM_QUEUE_MPMC: any number of threads may enqueue and dequeue
+ *   concurrently. Each slot carries a sequence number telling whether it
+ *   is ready to be written or read for the current lap (algorithm of
+ *   Dmitry Vyukov). Producers (resp. consumers) claim slots by advancing
+ *   the tail (resp. head) with a compare and swap.
+ *
+ * The producer and consumer positions live in separated cache lines and
+ * the elements are stored right after the queue structure. The queue holds
+ * no pointer: it can be allocated in a shared memory mapping with the size
+ * reported by mm_queue_sizeof() and initialized in place with
+ * mm_queue_init(), then used by processes mapping it at different
+ * addresses.
+ *
+ * mm_queue_enqueue() and mm_queue_dequeue() never block. The
+ * mm_queue_enqueue_wait() and mm_queue_dequeue_wait() variants sleep with
+ * the futex layer when the queue is full or empty. The non-blocking
+ * operations make a system call only if some thread is sleeping on the
+ * queue.
+ */
+
+/**
+ * struct mm_queue - private layout of queue
+ * @flags:      flags passed at initialization
+ * @mask:       capacity - 1 (capacity is a power of 2)
+ * @elt_size:   size of an element
+ * @slot_size:  size of a slot in the ring buffer
+ * @tail:       producer position
+ * @head_cache: last head value seen by the producer (SPSC only)
+ * @head:       consumer position
+ * @tail_cache: last tail value seen by the consumer (SPSC only)
+ * @push_seq:   futex word incremented after enqueue if consumers sleep
+ * @pop_seq:    futex word incremented after dequeue if producers sleep
+ * @nsleep_consumer: number of consumers sleeping on @push_seq
+ * @nsleep_producer: number of producers sleeping on @pop_seq
+ * @slots:      ring buffer
+ */
+struct mm_queue {
+	uint32_t flags;
+	uint32_t mask;
+	uint32_t elt_size;
+	uint32_t slot_size;
+	uint32_t padding0[MM_CACHELINE_SIZE/4 - 4];
+
+	uint32_t tail;
+	uint32_t head_cache;
+	uint32_t padding1[MM_CACHELINE_SIZE/4 - 2];
+
+	uint32_t head;
+	uint32_t tail_cache;
+	uint32_t padding2[MM_CACHELINE_SIZE/4 - 2];
+
+	uint32_t push_seq;
+	uint32_t pop_seq;
+	uint32_t nsleep_consumer;
+	uint32_t nsleep_producer;
+	uint32_t padding3[MM_CACHELINE_SIZE/4 - 4];
+
+	unsigned char slots[];
+};
+
+
+static
+int get_futex_flags(const struct mm_queue* queue)
+{
+	int flags = 0;
+
+	if (queue->flags & MM_QUEUE_PSHARED)
+		flags |= MM_THR_PSHARED;
+
+	if (queue->flags & MM_QUEUE_WAIT_MONOTONIC)
+		flags |= MM_THR_WAIT_MONOTONIC;
+
+	return flags;
+}
+
+
+static
+size_t get_slot_size(size_t elt_size, int flags)
+{
+	size_t slot_size = ROUND_UP(elt_size, SLOT_ALIGN);
+
+	if (flags & MM_QUEUE_MPMC)
+		slot_size += SEQ_SIZE;
+
+	return slot_size;
+}
+
+
+static inline
+unsigned char* get_slot(struct mm_queue* queue, uint32_t pos)
+{
+	return queue->slots + (size_t)(pos & queue->mask) * queue->slot_size;
+}
+
+
+static inline
+uint32_t* get_slot_seq(struct mm_queue* queue, uint32_t pos)
+{
+	return (uint32_t*)get_slot(queue, pos);
+}
+
+
+static inline
+uint32_t load_slot_seq(struct mm_queue* queue, uint32_t pos)
+{
+	return mm_atomic_load_u32(get_slot_seq(queue, pos), MM_ATOMIC_ACQUIRE);
+}
+
+
+static inline
+unsigned char* get_slot_data(struct mm_queue* queue, uint32_t pos)
+{
+	return get_slot(queue, pos) + SEQ_SIZE;
+}
+
+
+/**
+ * notify() - wake up the threads sleeping on the other side of the queue
+ * @queue:      initialized queue
+ * @seq:        futex word of the side which has progressed
+ * @nsleep:     number of threads sleeping on @seq
+ *
+ * The full fence pairs with the one in wait_progress(): either the sleeper
+ * sees the progress before sleeping, either the notifier sees the sleeper.
+ */
+static
+void notify(struct mm_queue* queue, uint32_t* seq, uint32_t* nsleep)
+{
+	mm_atomic_fence(MM_ATOMIC_SEQ_CST);
+	if (!mm_atomic_load_u32(nsleep, MM_ATOMIC_RELAXED))
+		return;
+
+	mm_atomic_fetch_add_u32(seq, 1, MM_ATOMIC_RELEASE);
+	futex_wake(seq, INT_MAX, get_futex_flags(queue));
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          SPSC implementation                           *
+ *                                                                        *
+ **************************************************************************/
+static
+unsigned int spsc_enqueue(struct mm_queue* queue, const void* elts,
+                          unsigned int num)
+{
+	const unsigned char* src = elts;
+	uint32_t tail, head, capacity;
+	unsigned int i;
+
+	capacity = queue->mask + 1;
+	tail = queue->tail;
+	head = queue->head_cache;
+	if (num > capacity - (tail - head)) {
+		head = mm_atomic_load_u32(&queue->head, MM_ATOMIC_ACQUIRE);
+		queue->head_cache = head;
+	}
+
+	if (num > capacity - (tail - head))
+		num = capacity - (tail - head);
+
+	for (i = 0; i < num; i++) {
+		memcpy(get_slot(queue, tail + i), src, queue->elt_size);
+		src += queue->elt_size;
+	}
+
+	if (num)
+		mm_atomic_store_u32(&queue->tail, tail + num,
+		                    MM_ATOMIC_RELEASE);
+
+	return num;
+}
+
+
+static
+unsigned int spsc_dequeue(struct mm_queue* queue, void* elts,
+                          unsigned int num)
+{
+	unsigned char* dst = elts;
+	uint32_t tail, head;
+	unsigned int i;
+
+	head = queue->head;
+	tail = queue->tail_cache;
+	if (tail - head < num) {
+		tail = mm_atomic_load_u32(&queue->tail, MM_ATOMIC_ACQUIRE);
+		queue->tail_cache = tail;
+	}
+
+	if (num > tail - head)
+		num = tail - head;
+
+	for (i = 0; i < num; i++) {
+		memcpy(dst, get_slot(queue, head + i), queue->elt_size);
+		dst += queue->elt_size;
+	}
+
+	if (num)
+		mm_atomic_store_u32(&queue->head, head + num,
+		                    MM_ATOMIC_RELEASE);
+
+	return num;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          MPMC implementation                           *
+ *                                                                        *
+ **************************************************************************/
+static
+unsigned int mpmc_enqueue(struct mm_queue* queue, const void* elts,
+                          unsigned int num)
+{
+	const unsigned char* src = elts;
+	uint32_t pos, seq;
+	unsigned int i, avail;
+
+	pos = mm_atomic_load_u32(&queue->tail, MM_ATOMIC_RELAXED);
+	while (1) {
+		// Count the consecutive slots ready to be written for this lap
+		for (avail = 0; avail < num; avail++) {
+			seq = load_slot_seq(queue, pos + avail);
+			if (seq != pos + avail)
+				break;
+		}
+
+		if (avail == 0) {
+			seq = load_slot_seq(queue, pos);
+			// Slot not yet consumed from previous lap: queue full
+			if ((int32_t)(seq - pos) < 0)
+				return 0;
+
+			// Another producer has claimed the slot: retry
+			pos = mm_atomic_load_u32(&queue->tail,
+			                         MM_ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (mm_atomic_cas_u32(&queue->tail, &pos, pos + avail,
+		                      MM_ATOMIC_RELAXED))
+			break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		memcpy(get_slot_data(queue, pos + i), src, queue->elt_size);
+		mm_atomic_store_u32(get_slot_seq(queue, pos + i), pos + i + 1,
+		                    MM_ATOMIC_RELEASE);
+		src += queue->elt_size;
+	}
+
+	return avail;
+}
+
+
+static
+unsigned int mpmc_dequeue(struct mm_queue* queue, void* elts,
+                          unsigned int num)
+{
+	unsigned char* dst = elts;
+	uint32_t pos, seq;
+	unsigned int i, avail;
+
+	pos = mm_atomic_load_u32(&queue->head, MM_ATOMIC_RELAXED);
+	while (1) {
+		// Count the consecutive slots ready to be read for this lap
+		for (avail = 0; avail < num; avail++) {
+			seq = load_slot_seq(queue, pos + avail);
+			if (seq != pos + avail + 1)
+				break;
+		}
+
+		if (avail == 0) {
+			seq = load_slot_seq(queue, pos);
+			// Slot not yet written for this lap: queue empty
+			if ((int32_t)(seq - (pos + 1)) < 0)
+				return 0;
+
+			// Another consumer has claimed the slot: retry
+			pos = mm_atomic_load_u32(&queue->head,
+			                         MM_ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (mm_atomic_cas_u32(&queue->head, &pos, pos + avail,
+		                      MM_ATOMIC_RELAXED))
+			break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		memcpy(dst, get_slot_data(queue, pos + i), queue->elt_size);
+		mm_atomic_store_u32(get_slot_seq(queue, pos + i),
+		                    pos + i + queue->mask + 1,
+		                    MM_ATOMIC_RELEASE);
+		dst += queue->elt_size;
+	}
+
+	return avail;
+}
+
+
+static
+unsigned int queue_enqueue(struct mm_queue* queue, const void* elts,
+                           unsigned int num)
+{
+	unsigned int ret;
+
+	if (queue->flags & MM_QUEUE_MPMC)
+		ret = mpmc_enqueue(queue, elts, num);
+	else
+		ret = spsc_enqueue(queue, elts, num);
+
+	if (ret)
+		notify(queue, &queue->push_seq, &queue->nsleep_consumer);
+
+	return ret;
+}
+
+
+static
+unsigned int queue_dequeue(struct mm_queue* queue, void* elts,
+                           unsigned int num)
+{
+	unsigned int ret;
+
+	if (queue->flags & MM_QUEUE_MPMC)
+		ret = mpmc_dequeue(queue, elts, num);
+	else
+		ret = spsc_dequeue(queue, elts, num);
+
+	if (ret)
+		notify(queue, &queue->pop_seq, &queue->nsleep_producer);
+
+	return ret;
+}
+
+
+static
+int check_queue_params(unsigned int capacity, size_t elt_size, int flags)
+{
+	size_t slot_size;
+
+	if (capacity == 0 || capacity > QUEUE_MAX_CAPACITY
+	    || (capacity & (capacity - 1))) {
+		mm_raise_error(EINVAL, "invalid queue capacity %u "
+		               "(must be power of 2)", capacity);
+		return EINVAL;
+	}
+
+	if (elt_size == 0 || elt_size > UINT32_MAX / 2) {
+		mm_raise_error(EINVAL, "invalid element size %zu", elt_size);
+		return EINVAL;
+	}
+
+	// Only reachable on 32-bit platforms
+	slot_size = get_slot_size(elt_size, flags);
+	if (capacity > (SIZE_MAX - sizeof(struct mm_queue)) / slot_size) {
+		mm_raise_error(EOVERFLOW, "queue of %u elements of %zu bytes "
+		               "too large", capacity, elt_size);
+		return EOVERFLOW;
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_queue_sizeof() - get the memory size needed by a queue
+ * @capacity:   maximum number of elements in the queue
+ * @elt_size:   size of an element
+ * @flags:      flags that will be used to initialize the queue
+ *
+ * Return: the number of bytes to reserve for a queue initialized with
+ * mm_queue_init() with the same arguments. If those arguments are invalid
+ * or if the size is not representable in a size_t, 0 is returned with
+ * error state set accordingly (see mm_queue_init()).
+ */
+API_EXPORTED
+size_t mm_queue_sizeof(unsigned int capacity, size_t elt_size, int flags)
+{
+	if (check_queue_params(capacity, elt_size, flags))
+		return 0;
+
+	return sizeof(struct mm_queue)
+	       + capacity * get_slot_size(elt_size, flags);
+}
+
+
+/**
+ * mm_queue_init() - initialize a queue in place
+ * @queue:      memory to initialize, aligned on a cache line
+ * @capacity:   maximum number of elements in the queue (power of 2)
+ * @elt_size:   size of an element
+ * @flags:      OR-combination of flags indicating the type of @queue
+ *
+ * Use this function to initialize a queue in a memory area of at least
+ * mm_queue_sizeof(@capacity, @elt_size, @flags) bytes. This is the way to
+ * setup a queue in a shared memory mapping. The type of queue is
+ * controlled by @flags which must contains one or several of the
+ * following:
+ *
+ * - MM_QUEUE_SPSC: single producer single consumer queue (default).
+ * - MM_QUEUE_MPMC: multiple producers multiple consumers queue.
+ * - MM_QUEUE_PSHARED: the queue can be used by several processes. This
+ *   affects only the blocking operations.
+ * - MM_QUEUE_WAIT_MONOTONIC: the clock base used in the blocking
+ *   operations is MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * Elements are copied in and out of the queue with memcpy(): they are
+ * stored aligned on 8 bytes.
+ *
+ * Like the other queue operations, this function reports failure through
+ * its return value. The error state is also set accordingly.
+ *
+ * Return: 0 in case of success, otherwise an error code among:
+ *
+ * EINVAL
+ *   @capacity is not a power of 2, is 0 or greater than 2^30, or
+ *   @elt_size is 0.
+ * EOVERFLOW
+ *   the memory size of the queue is not representable in a size_t.
+ */
+API_EXPORTED
+int mm_queue_init(struct mm_queue* queue, unsigned int capacity,
+                  size_t elt_size, int flags)
+{
+	uint32_t i;
+	int ret;
+
+	ret = check_queue_params(capacity, elt_size, flags);
+	if (ret)
+		return ret;
+
+	memset(queue, 0, sizeof(*queue));
+	queue->flags = flags;
+	queue->mask = capacity - 1;
+	queue->elt_size = elt_size;
+	queue->slot_size = get_slot_size(elt_size, flags);
+
+	if (flags & MM_QUEUE_MPMC) {
+		for (i = 0; i < capacity; i++)
+			*get_slot_seq(queue, i) = i;
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_queue_create() - allocate and initialize a queue
+ * @capacity:   maximum number of elements in the queue (power of 2)
+ * @elt_size:   size of an element
+ * @flags:      OR-combination of flags indicating the type of queue
+ *
+ * This function allocates a queue in the heap and initializes it with
+ * mm_queue_init(). The queue must be destroyed with mm_queue_destroy().
+ *
+ * Return: pointer to the queue in case of success, NULL otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+struct mm_queue* mm_queue_create(unsigned int capacity, size_t elt_size,
+                                 int flags)
+{
+	struct mm_queue* queue;
+	size_t size;
+
+	size = mm_queue_sizeof(capacity, elt_size, flags);
+	if (size == 0)
+		return NULL;
+
+	queue = mm_aligned_alloc(MM_CACHELINE_SIZE, size);
+	if (!queue)
+		return NULL;
+
+	if (mm_queue_init(queue, capacity, elt_size, flags)) {
+		mm_aligned_free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+
+/**
+ * mm_queue_destroy() - destroy a queue created with mm_queue_create()
+ * @queue:      queue to destroy (may be NULL)
+ */
+API_EXPORTED
+void mm_queue_destroy(struct mm_queue* queue)
+{
+	mm_aligned_free(queue);
+}
+
+
+/**
+ * mm_queue_enqueue() - add an element to a queue
+ * @queue:      initialized queue
+ * @elt:        pointer to the element to copy in @queue
+ *
+ * Return: 0 if @elt has been added, EAGAIN if @queue is full.
+ */
+API_EXPORTED
+int mm_queue_enqueue(struct mm_queue* queue, const void* elt)
+{
+	return queue_enqueue(queue, elt, 1) ? 0 : EAGAIN;
+}
+
+
+/**
+ * mm_queue_dequeue() - remove an element from a queue
+ * @queue:      initialized queue
+ * @elt:        buffer receiving the element removed from @queue
+ *
+ * Return: 0 if an element has been removed, EAGAIN if @queue is empty.
+ */
+API_EXPORTED
+int mm_queue_dequeue(struct mm_queue* queue, void* elt)
+{
+	return queue_dequeue(queue, elt, 1) ? 0 : EAGAIN;
+}
+
+
+/**
+ * mm_queue_enqueue_batch() - add several elements to a queue
+ * @queue:      initialized queue
+ * @elts:       array of @num elements to copy in @queue
+ * @num:        number of elements in @elts
+ *
+ * This function adds as many elements of @elts as possible, in order, up
+ * to the capacity of @queue. The positions are claimed and published once
+ * for all the elements added.
+ *
+ * Return: the number of elements added.
+ */
+API_EXPORTED
+unsigned int mm_queue_enqueue_batch(struct mm_queue* queue, const void* elts,
+                                    unsigned int num)
+{
+	return queue_enqueue(queue, elts, num);
+}
+
+
+/**
+ * mm_queue_dequeue_batch() - remove several elements from a queue
+ * @queue:      initialized queue
+ * @elts:       array receiving up to @num elements
+ * @num:        maximum number of elements to remove
+ *
+ * Return: the number of elements removed.
+ */
+API_EXPORTED
+unsigned int mm_queue_dequeue_batch(struct mm_queue* queue, void* elts,
+                                    unsigned int num)
+{
+	return queue_dequeue(queue, elts, num);
+}
+
+
+/**
+ * wait_progress() - enqueue or dequeue an element, waiting if needed
+ * @queue:      initialized queue
+ * @src:        element to enqueue, NULL if dequeuing
+ * @dst:        buffer receiving the dequeued element, NULL if enqueuing
+ * @abstime:    timeout (NULL for infinite)
+ *
+ * The calling thread registers itself as sleeper and sleeps on the futex
+ * word of the other side until the operation succeeds. The value of the
+ * futex word is read before each attempt so that a progress happening
+ * between a failed attempt and the sleep is not missed.
+ *
+ * Return: 0 if the operation has succeeded, ETIMEDOUT or EINVAL otherwise.
+ */
+static
+int wait_progress(struct mm_queue* queue, const void* src, void* dst,
+                  const struct mm_timespec* abstime)
+{
+	uint32_t *seq, *nsleep;
+	uint32_t val;
+	unsigned int done;
+	int ret = 0;
+
+	seq = src ? &queue->pop_seq : &queue->push_seq;
+	nsleep = src ? &queue->nsleep_producer : &queue->nsleep_consumer;
+
+	mm_atomic_fetch_add_u32(nsleep, 1, MM_ATOMIC_RELAXED);
+	mm_atomic_fence(MM_ATOMIC_SEQ_CST);
+
+	while (1) {
+		val = mm_atomic_load_u32(seq, MM_ATOMIC_ACQUIRE);
+		if (src)
+			done = queue_enqueue(queue, src, 1);
+		else
+			done = queue_dequeue(queue, dst, 1);
+
+		if (done) {
+			ret = 0;
+			break;
+		}
+
+		if (ret)
+			break;
+
+		ret = futex_wait(seq, val, get_futex_flags(queue), abstime);
+	}
+
+	mm_atomic_fetch_sub_u32(nsleep, 1, MM_ATOMIC_RELAXED);
+	return ret;
+}
+
+
+/**
+ * mm_queue_enqueue_wait() - add an element to a queue, waiting if full
+ * @queue:      initialized queue
+ * @elt:        pointer to the element to copy in @queue
+ * @abstime:    absolute timeout, NULL to wait indefinitely
+ *
+ * This function is the same as mm_queue_enqueue() excepting that it blocks
+ * the calling thread while @queue is full. The clock of @abstime is
+ * MM_CLK_MONOTONIC if @queue has been initialized with
+ * MM_QUEUE_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if @elt has been added, ETIMEDOUT if @abstime has been reached
+ * before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_queue_enqueue_wait(struct mm_queue* queue, const void* elt,
+                          const struct mm_timespec* abstime)
+{
+	if (queue_enqueue(queue, elt, 1))
+		return 0;
+
+	return wait_progress(queue, elt, NULL, abstime);
+}
+
+
+/**
+ * mm_queue_dequeue_wait() - remove an element from a queue, waiting if empty
+ * @queue:      initialized queue
+ * @elt:        buffer receiving the element removed from @queue
+ * @abstime:    absolute timeout, NULL to wait indefinitely
+ *
+ * This function is the same as mm_queue_dequeue() excepting that it blocks
+ * the calling thread while @queue is empty. The clock of @abstime is
+ * MM_CLK_MONOTONIC if @queue has been initialized with
+ * MM_QUEUE_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if an element has been removed, ETIMEDOUT if @abstime has been
+ * reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_queue_dequeue_wait(struct mm_queue* queue, void* elt,
+                          const struct mm_timespec* abstime)
+{
+	if (queue_dequeue(queue, elt, 1))
+		return 0;
+
+	return wait_progress(queue, NULL, elt, abstime);
+}
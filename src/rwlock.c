@@ -0,0 +1,533 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "spinwait.h"
+#include "thread-local.h"
+
+#define RW_WRITER       0x1     // writer owns lock or waits readers to leave
+#define RW_OWNED        0x2     // writer owns the lock
+#define RW_WAITERS      0x4     // threads wait for RW_WRITER to be cleared
+#define RW_DRAIN_INC    0x8     // a writer waits readers to leave
+#define RW_DRAIN_MASK   (~(RW_DRAIN_INC - 1))
+
+#define NUM_SPIN_ROUND  16
+
+/**
+ * DOC: reader-writer lock
+ *
+ * A reader-writer lock allows several threads to read the protected data
+ * concurrently, while a thread modifying the data gets exclusive access.
+ * Initialized with MM_THR_PSHARED, the lock can be placed in shared memory
+ * and used by several processes.
+ *
+ * The readers are accounted in a set of distributed counters, each located
+ * in its own cache line. A thread always uses the same counter, so that
+ * concurrent readers in different threads do not bounce the same cache line
+ * between the CPUs: the read lock and unlock only modify the counter of the
+ * calling thread and read the writer state, which is modified only when a
+ * writer comes in.
+ *
+ * A writer first gets the exclusive writer flag of the lock, which prevents
+ * new readers to enter, and checks that all the reader counters are null.
+ * If readers are still present, the behavior depends on the lock type:
+ *
+ * - by default, the lock prefers readers: the writer releases the writer
+ *   flag and waits for readers to leave before retrying. A continuous flow
+ *   of readers can starve the writers.
+ * - if initialized with MM_THR_PREFER_WRITER, the writer keeps the writer
+ *   flag while waiting for the readers to leave. New readers wait for the
+ *   writer to complete, hence writers cannot be starved.
+ *
+ * Waits are done with a short spin before going to sleep with the futex
+ * layer.
+ */
+
+static unsigned int next_slot_index;
+
+/**
+ * get_reader_slot() - get the reader counter of the calling thread
+ * @lock:       initialized rwlock
+ *
+ * Return: pointer to the reader counter to use in @lock
+ */
+static
+struct mm_thr_rwlock_slot* get_reader_slot(mm_thr_rwlock_t* lock)
+{
+	static thread_local int slot_index = -1;
+
+	if (UNLIKELY(slot_index < 0)) {
+		slot_index = mm_atomic_fetch_add_u32(&next_slot_index, 1,
+		                                     MM_ATOMIC_RELAXED);
+		slot_index %= MM_THR_RWLOCK_NUM_SLOT;
+	}
+
+	return &lock->readers[slot_index];
+}
+
+
+/**
+ * readers_drained() - test that no reader holds the lock
+ * @lock:       initialized rwlock
+ *
+ * Return: true if all the reader counters are null, false otherwise
+ */
+static
+bool readers_drained(mm_thr_rwlock_t* lock)
+{
+	int i;
+
+	for (i = 0; i < MM_THR_RWLOCK_NUM_SLOT; i++) {
+		if (mm_atomic_load_u32(&lock->readers[i].count,
+		                       MM_ATOMIC_SEQ_CST))
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * release_reader_slot() - leave the lock as reader
+ * @lock:       initialized rwlock
+ * @slot:       reader counter of the calling thread
+ *
+ * Decrement the reader counter and wake the writers waiting for readers to
+ * leave if this counter drops to 0.
+ */
+static
+void release_reader_slot(mm_thr_rwlock_t* lock,
+                         struct mm_thr_rwlock_slot* slot)
+{
+	uint32_t state;
+
+	if (mm_atomic_fetch_sub_u32(&slot->count, 1, MM_ATOMIC_SEQ_CST) != 1)
+		return;
+
+	state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_SEQ_CST);
+	if ((state & (RW_WRITER | RW_OWNED)) == RW_WRITER
+	    || (state & RW_DRAIN_MASK)) {
+		mm_atomic_fetch_add_u32(&lock->drain_seq, 1, MM_ATOMIC_SEQ_CST);
+		futex_wake(&lock->drain_seq, INT_MAX, lock->flags);
+	}
+}
+
+
+/**
+ * wait_writer_cleared() - wait until the writer flag is released
+ * @lock:       initialized rwlock
+ * @abstime:    absolute timeout or NULL to wait indefinitely
+ *
+ * Return: 0 if the writer flag is not set, ETIMEDOUT if @abstime has been
+ * reached, EINVAL if @abstime is not a valid time.
+ */
+static
+int wait_writer_cleared(mm_thr_rwlock_t* lock,
+                        const struct mm_timespec* abstime)
+{
+	uint32_t state;
+	int ret, i, backoff = 1;
+
+	for (i = 0; i < NUM_SPIN_ROUND; i++) {
+		state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_ACQUIRE);
+		if (!(state & RW_WRITER))
+			return 0;
+
+		spin_backoff(&backoff);
+	}
+
+	while (state & RW_WRITER) {
+		// Notify the writer that it must wake us before sleeping
+		if (!(state & RW_WAITERS)
+		    && !mm_atomic_cas_u32(&lock->state, &state,
+		                          state | RW_WAITERS,
+		                          MM_ATOMIC_RELAXED))
+			continue;
+
+		ret = futex_wait(&lock->state, state | RW_WAITERS,
+		                 lock->flags, abstime);
+		if (ret)
+			return ret;
+
+		state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_ACQUIRE);
+	}
+
+	return 0;
+}
+
+
+/**
+ * wait_readers_drained() - wait until all readers have left the lock
+ * @lock:       initialized rwlock whose writer flag is owned by the caller
+ * @abstime:    absolute timeout or NULL to wait indefinitely
+ *
+ * Return: 0 if no reader holds the lock, ETIMEDOUT if @abstime has been
+ * reached, EINVAL if @abstime is not a valid time.
+ */
+static
+int wait_readers_drained(mm_thr_rwlock_t* lock,
+                         const struct mm_timespec* abstime)
+{
+	uint32_t seq;
+	int ret, i, backoff = 1;
+
+	for (i = 0; i < NUM_SPIN_ROUND; i++) {
+		if (readers_drained(lock))
+			return 0;
+
+		spin_backoff(&backoff);
+	}
+
+	while (1) {
+		seq = mm_atomic_load_u32(&lock->drain_seq, MM_ATOMIC_SEQ_CST);
+		if (readers_drained(lock))
+			return 0;
+
+		ret = futex_wait(&lock->drain_seq, seq, lock->flags, abstime);
+		if (ret)
+			return ret;
+	}
+}
+
+
+/**
+ * acquire_writer() - get the writer flag of the lock
+ * @lock:       initialized rwlock
+ * @abstime:    absolute timeout or NULL to wait indefinitely
+ * @try:        if true, do not wait if the writer flag is already set
+ *
+ * Return: 0 if the writer flag has been acquired, EBUSY if @try is true and
+ * the flag is set, ETIMEDOUT if @abstime has been reached, EINVAL if
+ * @abstime is not a valid time.
+ */
+static
+int acquire_writer(mm_thr_rwlock_t* lock, const struct mm_timespec* abstime,
+                   bool try)
+{
+	uint32_t state;
+	int ret;
+
+	state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_RELAXED);
+	while (1) {
+		if (!(state & RW_WRITER)) {
+			if (mm_atomic_cas_u32(&lock->state, &state,
+			                      state | RW_WRITER,
+			                      MM_ATOMIC_SEQ_CST))
+				return 0;
+
+			continue;
+		}
+
+		if (try)
+			return EBUSY;
+
+		ret = wait_writer_cleared(lock, abstime);
+		if (ret)
+			return ret;
+
+		state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_RELAXED);
+	}
+}
+
+
+/**
+ * release_writer() - release the writer flag of the lock
+ * @lock:       initialized rwlock whose writer flag is owned by the caller
+ * @drain_inc:  RW_DRAIN_INC if the caller is going to wait for readers to
+ *              leave, 0 otherwise
+ */
+static
+void release_writer(mm_thr_rwlock_t* lock, uint32_t drain_inc)
+{
+	uint32_t state, newstate;
+
+	state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_RELAXED);
+	do {
+		newstate = state & ~(RW_WRITER | RW_OWNED | RW_WAITERS);
+		newstate += drain_inc;
+	} while (!mm_atomic_cas_u32(&lock->state, &state, newstate,
+	                            MM_ATOMIC_SEQ_CST));
+
+	if (state & RW_WAITERS)
+		futex_wake(&lock->state, INT_MAX, lock->flags);
+}
+
+
+static
+int rwlock_rdlock(mm_thr_rwlock_t* lock, const struct mm_timespec* abstime,
+                  bool try)
+{
+	struct mm_thr_rwlock_slot* slot = get_reader_slot(lock);
+	uint32_t state;
+	int ret;
+
+	while (1) {
+		mm_atomic_fetch_add_u32(&slot->count, 1, MM_ATOMIC_SEQ_CST);
+		state = mm_atomic_load_u32(&lock->state, MM_ATOMIC_SEQ_CST);
+		if (!(state & RW_WRITER))
+			return 0;
+
+		// A writer is present: step back and let it proceed
+		release_reader_slot(lock, slot);
+		if (try)
+			return EBUSY;
+
+		ret = wait_writer_cleared(lock, abstime);
+		if (ret)
+			return ret;
+	}
+}
+
+
+static
+int rwlock_wrlock(mm_thr_rwlock_t* lock, const struct mm_timespec* abstime,
+                  bool try)
+{
+	uint32_t seq;
+	int ret;
+
+	while (1) {
+		ret = acquire_writer(lock, abstime, try);
+		if (ret)
+			return ret;
+
+		if (lock->flags & MM_THR_PREFER_WRITER) {
+			// Keep writer flag, hence new readers wait for us
+			if (try)
+				ret = readers_drained(lock) ? 0 : EBUSY;
+			else
+				ret = wait_readers_drained(lock, abstime);
+
+			if (ret) {
+				release_writer(lock, 0);
+				return ret;
+			}
+
+			break;
+		}
+
+		seq = mm_atomic_load_u32(&lock->drain_seq, MM_ATOMIC_SEQ_CST);
+		if (readers_drained(lock))
+			break;
+
+		if (try) {
+			release_writer(lock, 0);
+			return EBUSY;
+		}
+
+		// Let the readers in and retry when one reader counter drops
+		// to 0
+		release_writer(lock, RW_DRAIN_INC);
+		ret = futex_wait(&lock->drain_seq, seq, lock->flags, abstime);
+		mm_atomic_fetch_sub_u32(&lock->state, RW_DRAIN_INC,
+		                        MM_ATOMIC_RELAXED);
+		if (ret)
+			return ret;
+	}
+
+	mm_atomic_fetch_or_u32(&lock->state, RW_OWNED, MM_ATOMIC_RELAXED);
+	return 0;
+}
+
+
+/**
+ * mm_thr_rwlock_init() - Initialize a reader-writer lock
+ * @lock:       reader-writer lock to initialize
+ * @flags:      OR-combination of flags indicating the type of @lock
+ *
+ * Use this function to initialize @lock. The type of lock is controlled by
+ * @flags which must contains one or several of the following:
+ *
+ * - MM_THR_PSHARED: init a lock shareable by other processes.
+ * - MM_THR_PREFER_WRITER: a writer waiting for the lock prevents new
+ *   readers to get it. Without this flag, readers are preferred and a
+ *   continuous flow of readers can starve the writers. With this flag, a
+ *   thread must not hold several read locks on @lock at once.
+ * - MM_THR_WAIT_MONOTONIC: the clock base used in
+ *   mm_thr_rwlock_timedrdlock() and mm_thr_rwlock_timedwrlock() is
+ *   MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * If 0 is passed, a call to this function could have be avoided if the data
+ * pointed by @lock had been statically initialized with
+ * MM_THR_RWLOCK_INITIALIZER.
+ *
+ * On Windows, a thread waiting for a process shared lock polls the lock
+ * instead of sleeping until being woken up.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_rwlock_init(mm_thr_rwlock_t* lock, int flags)
+{
+	memset(lock, 0, sizeof(*lock));
+	lock->flags = flags;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_rwlock_rdlock() - lock a reader-writer lock for reading
+ * @lock:       initialized reader-writer lock
+ *
+ * This function acquires a read lock on @lock. If a writer holds the lock
+ * (or waits for it and @lock prefers writers), the calling thread blocks
+ * until it can get the read lock. A thread may hold several read locks on
+ * @lock: it must then call mm_thr_rwlock_unlock() the same number of times.
+ * This is not allowed if @lock prefers writers: a writer waiting between
+ * the two read locks would block the second one, while waiting itself for
+ * the first one to be released, hence a deadlock.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_rwlock_rdlock(mm_thr_rwlock_t* lock)
+{
+	return rwlock_rdlock(lock, NULL, false);
+}
+
+
+/**
+ * mm_thr_rwlock_tryrdlock() - try to lock a reader-writer lock for reading
+ * @lock:       initialized reader-writer lock
+ *
+ * This function is the same as mm_thr_rwlock_rdlock() excepting that it
+ * returns immediately if the read lock cannot be acquired.
+ *
+ * Return: 0 if the read lock has been acquired, EBUSY otherwise.
+ */
+API_EXPORTED
+int mm_thr_rwlock_tryrdlock(mm_thr_rwlock_t* lock)
+{
+	return rwlock_rdlock(lock, NULL, true);
+}
+
+
+/**
+ * mm_thr_rwlock_timedrdlock() - lock a reader-writer lock for reading with
+ *                               timeout
+ * @lock:       initialized reader-writer lock
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the same as mm_thr_rwlock_rdlock() excepting that it
+ * returns if the read lock cannot be acquired before @abstime. The clock
+ * of @abstime is MM_CLK_MONOTONIC if @lock has been initialized with
+ * MM_THR_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if the read lock has been acquired, ETIMEDOUT if @abstime has
+ * been reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_thr_rwlock_timedrdlock(mm_thr_rwlock_t* lock,
+                              const struct mm_timespec* abstime)
+{
+	return rwlock_rdlock(lock, abstime, false);
+}
+
+
+/**
+ * mm_thr_rwlock_wrlock() - lock a reader-writer lock for writing
+ * @lock:       initialized reader-writer lock
+ *
+ * This function acquires a write lock on @lock. If another thread holds
+ * @lock (for reading or writing), the calling thread blocks until it can
+ * get the write lock. It is undefined behavior if the calling thread
+ * already holds @lock.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_rwlock_wrlock(mm_thr_rwlock_t* lock)
+{
+	return rwlock_wrlock(lock, NULL, false);
+}
+
+
+/**
+ * mm_thr_rwlock_trywrlock() - try to lock a reader-writer lock for writing
+ * @lock:       initialized reader-writer lock
+ *
+ * This function is the same as mm_thr_rwlock_wrlock() excepting that it
+ * returns immediately if the write lock cannot be acquired.
+ *
+ * Return: 0 if the write lock has been acquired, EBUSY otherwise.
+ */
+API_EXPORTED
+int mm_thr_rwlock_trywrlock(mm_thr_rwlock_t* lock)
+{
+	return rwlock_wrlock(lock, NULL, true);
+}
+
+
+/**
+ * mm_thr_rwlock_timedwrlock() - lock a reader-writer lock for writing with
+ *                               timeout
+ * @lock:       initialized reader-writer lock
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the same as mm_thr_rwlock_wrlock() excepting that it
+ * returns if the write lock cannot be acquired before @abstime. The clock
+ * of @abstime is MM_CLK_MONOTONIC if @lock has been initialized with
+ * MM_THR_WAIT_MONOTONIC, MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if the write lock has been acquired, ETIMEDOUT if @abstime has
+ * been reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_thr_rwlock_timedwrlock(mm_thr_rwlock_t* lock,
+                              const struct mm_timespec* abstime)
+{
+	return rwlock_wrlock(lock, abstime, false);
+}
+
+
+/**
+ * mm_thr_rwlock_unlock() - unlock a reader-writer lock
+ * @lock:       reader-writer lock held by the calling thread
+ *
+ * This function releases the read or write lock held by the calling thread
+ * on @lock. It is undefined behavior if the calling thread does not hold
+ * @lock.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_rwlock_unlock(mm_thr_rwlock_t* lock)
+{
+	// While a reader holds the lock, RW_OWNED cannot be set
+	if (mm_atomic_load_u32(&lock->state, MM_ATOMIC_RELAXED) & RW_OWNED)
+		release_writer(lock, 0);
+	else
+		release_reader_slot(lock, get_reader_slot(lock));
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_rwlock_deinit() - cleanup an initialized reader-writer lock
+ * @lock:       initialized reader-writer lock to destroy
+ *
+ * This destroys the lock referenced by @lock. It is undefined behavior to
+ * destroy a lock that is held or waited by a thread.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_rwlock_deinit(mm_thr_rwlock_t* lock)
+{
+	(void)lock;
+	return 0;
+}
@@ -0,0 +1,746 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define _GNU_SOURCE             // for REG_* in ucontext and dladdr()
+
+#include "mmprofile.h"
+#include "mmerrno.h"
+#include "mmlog.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * DOC: statistical sampler
+ *
+ * Contrary to mm_tic()/mm_toc() which requires to instrument the code, the
+ * sampler provides a quick look at where the CPU time of a process is spent
+ * without any code modification. Once started with mm_sampler_start(), each
+ * thread of the process is interrupted at regular interval of its own CPU
+ * time. Its program counter and a short call stack (obtained by following
+ * the frame pointers) are recorded in a buffer owned by the sampled thread.
+ *
+ * When stopped with mm_sampler_stop(), the samples are aggregated and
+ * written in the *folded stack* text format: one line per distinct call
+ * stack, the frames being separated by semicolons from the outermost caller
+ * to the sampled function, followed by a space and the number of samples
+ * of this stack::
+ *
+ *   main;process_frame;compute_fft 187
+ *   main;process_frame;write_output 12
+ *
+ * This output can directly be fed to flamegraph tools. Frames are
+ * symbolized with dladdr(), hence only exported symbols can be named. The
+ * other frames are reported as module name and offset.
+ *
+ * For the call stack to be meaningful, the code must be compiled with frame
+ * pointers (-fno-omit-frame-pointer with gcc and clang).
+ */
+
+#define SAMPLER_MAX_DEPTH       32
+#define SAMPLER_BUFFER_LEN      4096
+#define SAMPLER_MAX_FREQ        10000
+#define MAX_FRAME_SIZE          (1024*1024)
+#define NS_IN_SEC               1000000000
+
+
+#if defined (__linux__)
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Old glibc do not provide this alias
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/**
+ * struct sample - content of one sample
+ * @depth:      number of valid entry in @pc
+ * @pc:         program counter of each frame, the sampled one first
+ */
+struct sample {
+	int depth;
+	void* pc[SAMPLER_MAX_DEPTH];
+};
+
+
+/**
+ * struct thread_buffer - sampling data of one thread
+ * @tid:        kernel ID of the sampled thread
+ * @timer:      timer interrupting the thread
+ * @has_timer:  true if @timer has been created
+ * @num_sample: number of samples recorded in @samples
+ * @num_drop:   number of samples lost because @samples is full
+ * @samples:    array of SAMPLER_BUFFER_LEN samples
+ *
+ * The fields @num_sample, @num_drop and @samples are only written by the
+ * signal handler executing in the sampled thread. Hence, the buffer has a
+ * single producer and does not need any lock. Those fields are read only
+ * when the sampling has stopped.
+ */
+struct thread_buffer {
+	pid_t tid;
+	timer_t timer;
+	int has_timer;
+	int num_sample;
+	int num_drop;
+	struct sample* samples;
+};
+
+
+static struct thread_buffer* thread_buffers;
+static int num_thread_buffers;
+static int sampler_running;
+static int num_handler_inflight;
+static int can_read_frames;
+static struct sigaction prev_sigprof_action;
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Signal handler implementation                     *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * read_frame() - safely read a frame record
+ * @fp:         frame pointer
+ * @record:     array of 2 pointers receiving the frame record
+ *
+ * Read the saved frame pointer and return address located at @fp. The
+ * memory is read with process_vm_readv() so that an invalid frame pointer
+ * (in function compiled without frame pointer) does not crash the process.
+ *
+ * Return: 0 in case of success, -1 if @fp does not point to readable memory.
+ */
+static
+int read_frame(uintptr_t fp, uintptr_t record[2])
+{
+	struct iovec local = {.iov_base = record, .iov_len = 2*sizeof(*record)};
+	struct iovec remote = {.iov_base = (void*)fp, .iov_len = local.iov_len};
+	ssize_t rsz;
+
+	if (!can_read_frames)
+		return -1;
+
+	rsz = syscall(SYS_process_vm_readv, getpid(), &local, 1, &remote, 1, 0);
+	if (rsz != (ssize_t)local.iov_len)
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * get_context_regs() - get program counter, frame and stack pointers
+ * @uctx:       context of the interrupted thread
+ * @pc:         location receiving the program counter
+ * @fp:         location receiving the frame pointer
+ * @sp:         location receiving the stack pointer
+ *
+ * Return: 0 if the architecture is supported, -1 otherwise.
+ */
+static
+int get_context_regs(const ucontext_t* uctx,
+                     uintptr_t* pc, uintptr_t* fp, uintptr_t* sp)
+{
+#if defined (__x86_64__)
+	*pc = uctx->uc_mcontext.gregs[REG_RIP];
+	*fp = uctx->uc_mcontext.gregs[REG_RBP];
+	*sp = uctx->uc_mcontext.gregs[REG_RSP];
+	return 0;
+#elif defined (__i386__)
+	*pc = uctx->uc_mcontext.gregs[REG_EIP];
+	*fp = uctx->uc_mcontext.gregs[REG_EBP];
+	*sp = uctx->uc_mcontext.gregs[REG_ESP];
+	return 0;
+#elif defined (__aarch64__)
+	*pc = uctx->uc_mcontext.pc;
+	*fp = uctx->uc_mcontext.regs[29];
+	*sp = uctx->uc_mcontext.sp;
+	return 0;
+#else
+	(void)uctx;
+	*pc = *fp = *sp = 0;
+	return -1;
+#endif
+}
+
+
+/**
+ * unwind_stack() - capture call stack of interrupted thread
+ * @uctx:       context of the interrupted thread
+ * @pcs:        array receiving the program counters
+ * @maxdepth:   length of @pcs
+ *
+ * Follow the chain of frame records from the interrupted context. The walk
+ * stops at the first frame pointer that does not look valid, ie, which is
+ * not moving toward the stack bottom, is too far from the previous one or
+ * points to unreadable memory.
+ *
+ * Return: number of element written in @pcs
+ */
+static
+int unwind_stack(const ucontext_t* uctx, void** pcs, int maxdepth)
+{
+	uintptr_t pc, fp, sp, record[2];
+	int depth;
+
+	if (get_context_regs(uctx, &pc, &fp, &sp))
+		return 0;
+
+	pcs[0] = (void*)pc;
+	for (depth = 1; depth < maxdepth; depth++) {
+		if (fp < sp || fp - sp > MAX_FRAME_SIZE
+		    || (fp & (sizeof(void*)-1))
+		    || read_frame(fp, record))
+			break;
+
+		// record[0] is the caller frame pointer, record[1] the
+		// return address into the caller
+		if (!record[1])
+			break;
+
+		pcs[depth] = (void*)record[1];
+		sp = fp;
+		fp = record[0];
+	}
+
+	return depth;
+}
+
+
+static
+void sigprof_handler(int signum, siginfo_t* info, void* uctx)
+{
+	struct thread_buffer* buf = info->si_value.sival_ptr;
+	struct sample* sample;
+	int index, prev_errno;
+
+	(void)signum;
+
+	__atomic_add_fetch(&num_handler_inflight, 1, __ATOMIC_SEQ_CST);
+
+	if (info->si_code != SI_TIMER || !buf
+	    || !__atomic_load_n(&sampler_running, __ATOMIC_SEQ_CST))
+		goto exit;
+
+	index = buf->num_sample;
+	if (index >= SAMPLER_BUFFER_LEN) {
+		buf->num_drop++;
+		goto exit;
+	}
+
+	prev_errno = errno;
+	sample = &buf->samples[index];
+	sample->depth = unwind_stack(uctx, sample->pc, SAMPLER_MAX_DEPTH);
+	buf->num_sample = index + 1;
+	errno = prev_errno;
+
+exit:
+	__atomic_sub_fetch(&num_handler_inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         Thread buffers setup                           *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * list_process_threads() - allocate one sampling buffer per thread
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+static
+int list_process_threads(void)
+{
+	DIR* dir;
+	struct dirent* entry;
+	struct thread_buffer* buffers = NULL;
+	struct thread_buffer* new_buffers;
+	int num = 0, num_max = 0;
+
+	dir = opendir("/proc/self/task");
+	if (!dir) {
+		mm_raise_from_errno("Cannot list threads of process");
+		return -1;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		if (num == num_max) {
+			num_max = num_max ? 2*num_max : 16;
+			new_buffers = realloc(buffers,
+			                      num_max * sizeof(*buffers));
+			if (!new_buffers) {
+				mm_raise_from_errno("Cannot allocate buffers");
+				free(buffers);
+				closedir(dir);
+				return -1;
+			}
+
+			buffers = new_buffers;
+		}
+
+		memset(&buffers[num], 0, sizeof(buffers[num]));
+		buffers[num].tid = atoi(entry->d_name);
+		num++;
+	}
+
+	closedir(dir);
+
+	thread_buffers = buffers;
+	num_thread_buffers = num;
+	return 0;
+}
+
+
+/**
+ * thread_cpuclock() - get CPU-time clock of a thread of the process
+ * @tid:        kernel ID of the thread
+ *
+ * This is the equivalent of pthread_getcpuclockid() but using the kernel
+ * thread ID (this follows the encoding of MAKE_THREAD_CPUCLOCK in Linux).
+ *
+ * Return: the clock ID measuring CPU time consumed by @tid
+ */
+static
+clockid_t thread_cpuclock(pid_t tid)
+{
+	return (clockid_t)((~(unsigned int)tid) << 3) | 6;
+}
+
+
+/**
+ * setup_thread_sampling() - start sampling timer of one thread
+ * @buf:        sampling buffer of the thread
+ * @period_ns:  sampling period in CPU time
+ *
+ * Return: 0 in case of success, -1 otherwise with errno set. If the thread
+ * has terminated in the meantime, 0 is returned and no timer is created.
+ */
+static
+int setup_thread_sampling(struct thread_buffer* buf, int64_t period_ns)
+{
+	struct sigevent sev = {0};
+	struct itimerspec its = {0};
+	size_t len = SAMPLER_BUFFER_LEN * sizeof(*buf->samples);
+	void* samples;
+
+	// Anonymous mapping: only pages actually written will consume memory
+	samples = mmap(NULL, len, PROT_READ|PROT_WRITE,
+	               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (samples == MAP_FAILED)
+		return -1;
+
+	buf->samples = samples;
+
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_value.sival_ptr = buf;
+	sev.sigev_notify_thread_id = buf->tid;
+	if (timer_create(thread_cpuclock(buf->tid), &sev, &buf->timer)) {
+		// thread has terminated since its listing: just ignore it
+		if (errno == EINVAL || errno == ESRCH)
+			return 0;
+
+		return -1;
+	}
+
+	buf->has_timer = 1;
+
+	its.it_value.tv_sec = period_ns / NS_IN_SEC;
+	its.it_value.tv_nsec = period_ns % NS_IN_SEC;
+	its.it_interval = its.it_value;
+	return timer_settime(buf->timer, 0, &its, NULL);
+}
+
+
+/**
+ * teardown_sampling() - stop all sampling timers and wait for handlers
+ */
+static
+void teardown_sampling(void)
+{
+	struct sigaction ign = {.sa_handler = SIG_IGN};
+	int i;
+
+	__atomic_store_n(&sampler_running, 0, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < num_thread_buffers; i++) {
+		if (thread_buffers[i].has_timer)
+			timer_delete(thread_buffers[i].timer);
+
+		thread_buffers[i].has_timer = 0;
+	}
+
+	// Deleting a timer does not remove its signal if already queued.
+	// Ignoring the signal discards the pending ones before the previous
+	// disposition is restored.
+	sigaction(SIGPROF, &ign, NULL);
+	while (__atomic_load_n(&num_handler_inflight, __ATOMIC_SEQ_CST))
+		sched_yield();
+
+	sigaction(SIGPROF, &prev_sigprof_action, NULL);
+}
+
+
+static
+void free_thread_buffers(void)
+{
+	int i;
+	size_t len = SAMPLER_BUFFER_LEN * sizeof(struct sample);
+
+	for (i = 0; i < num_thread_buffers; i++) {
+		if (thread_buffers[i].samples)
+			munmap(thread_buffers[i].samples, len);
+	}
+
+	free(thread_buffers);
+	thread_buffers = NULL;
+	num_thread_buffers = 0;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                      Aggregation and symbolization                     *
+ *                                                                        *
+ **************************************************************************/
+
+static
+int cmp_samples(const void* a, const void* b)
+{
+	const struct sample* s1 = *(const struct sample* const*)a;
+	const struct sample* s2 = *(const struct sample* const*)b;
+
+	if (s1->depth != s2->depth)
+		return s1->depth - s2->depth;
+
+	return memcmp(s1->pc, s2->pc, s1->depth * sizeof(s1->pc[0]));
+}
+
+
+static
+int full_write(int fd, const char* buf, size_t len)
+{
+	ssize_t rsz;
+
+	while (len) {
+		rsz = mm_write(fd, buf, len);
+		if (rsz < 0)
+			return -1;
+
+		len -= rsz;
+		buf += rsz;
+	}
+
+	return 0;
+}
+
+
+/**
+ * format_frame() - write symbolic name of a frame
+ * @pc:         program counter of the frame
+ * @is_retaddr: true if @pc is a return address and not the sampled location
+ * @str:        output buffer
+ * @len:        size of @str
+ *
+ * Return: the number of character written in @str (excluding the
+ * terminating null byte), 0 if @len is 0.
+ */
+static
+int format_frame(void* pc, int is_retaddr, char* str, size_t len)
+{
+	Dl_info info;
+	const char* modname;
+	uintptr_t addr = (uintptr_t)pc;
+	int rv;
+
+	if (len == 0)
+		return 0;
+
+	// A return address points after the call instruction, which might
+	// belong to the next function if call was the last instruction
+	if (is_retaddr)
+		addr--;
+
+	if (!dladdr((void*)addr, &info) || !info.dli_fname) {
+		rv = snprintf(str, len, "0x%lx", (unsigned long)addr);
+	} else if (info.dli_sname) {
+		rv = snprintf(str, len, "%s", info.dli_sname);
+	} else {
+		modname = strrchr(info.dli_fname, '/');
+		modname = modname ? modname+1 : info.dli_fname;
+		rv = snprintf(str, len, "%s+0x%lx", modname,
+		              (unsigned long)(addr - (uintptr_t)info.dli_fbase));
+	}
+
+	if (rv < 0)
+		return 0;
+
+	return ((size_t)rv < len) ? rv : (int)len-1;
+}
+
+
+/**
+ * write_folded_stack() - write one line of folded stack output
+ * @fd:         file descriptor to which the line must be written
+ * @sample:     sample holding the call stack
+ * @count:      number of time the call stack has been sampled
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+static
+int write_folded_stack(int fd, const struct sample* sample, int count)
+{
+	char line[SAMPLER_MAX_DEPTH*128 + 32];
+	size_t len = 0, avail;
+	int i;
+
+	// Print from the outermost caller to the sampled function. The last
+	// 32 bytes are kept for the count. If the frames do not fit, the line
+	// is truncated with a "..." marker.
+	for (i = sample->depth-1; i >= 0; i--) {
+		avail = sizeof(line) - 32 - len;
+		if (avail <= 1) {
+			len += sprintf(line+len, "...");
+			break;
+		}
+
+		len += format_frame(sample->pc[i], i != 0, line+len, avail);
+		if (i != 0)
+			line[len++] = ';';
+	}
+
+	len += sprintf(line+len, " %i\n", count);
+	return full_write(fd, line, len);
+}
+
+
+/**
+ * trim_invalid_frames() - drop the frames that do not point to code
+ * @sample:     sample whose call stack must be checked
+ *
+ * When a function in the call stack has been compiled without frame
+ * pointer, the frame chain can be followed through unrelated data. The
+ * first return address which does not belong to any loaded module marks
+ * the beginning of such garbage: the call stack is truncated there.
+ */
+static
+void trim_invalid_frames(struct sample* sample)
+{
+	Dl_info info;
+	int i;
+
+	for (i = 1; i < sample->depth; i++) {
+		if (!dladdr(sample->pc[i], &info)) {
+			sample->depth = i;
+			break;
+		}
+	}
+}
+
+
+/**
+ * write_folded_output() - aggregate samples and write them
+ * @fd:         file descriptor to which the result must be written
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ */
+static
+int write_folded_output(int fd)
+{
+	struct sample** sorted;
+	struct thread_buffer* buf;
+	int i, j, num, num_drop, count, rv = 0;
+
+	num = 0;
+	num_drop = 0;
+	for (i = 0; i < num_thread_buffers; i++) {
+		num += thread_buffers[i].num_sample;
+		num_drop += thread_buffers[i].num_drop;
+	}
+
+	if (num_drop)
+		mm_log_warn("%i samples dropped (thread buffer full)",
+		            num_drop);
+
+	if (num == 0)
+		return 0;
+
+	sorted = malloc(num * sizeof(*sorted));
+	if (!sorted) {
+		mm_raise_from_errno("Cannot allocate sample list");
+		return -1;
+	}
+
+	num = 0;
+	for (i = 0; i < num_thread_buffers; i++) {
+		buf = &thread_buffers[i];
+		for (j = 0; j < buf->num_sample; j++) {
+			trim_invalid_frames(&buf->samples[j]);
+			sorted[num++] = &buf->samples[j];
+		}
+	}
+
+	// Identical stacks become consecutive once sorted
+	qsort(sorted, num, sizeof(*sorted), cmp_samples);
+	for (i = 0; i < num && rv == 0; i += count) {
+		count = 1;
+		while (i+count < num && !cmp_samples(&sorted[i], &sorted[i+count]))
+			count++;
+
+		rv = write_folded_stack(fd, sorted[i], count);
+	}
+
+	free(sorted);
+	return rv;
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           API implementation                           *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_sampler_start() - start statistical sampling of the process
+ * @freq_hz:    sampling frequency in Hz of CPU time of each thread
+ *
+ * Start sampling all threads running in the process at the time of the
+ * call. Each thread is interrupted with SIGPROF by a timer measuring its
+ * own CPU time, every 1/@freq_hz second of CPU time. A thread that does not
+ * consume CPU is then never sampled. At each interruption, the program
+ * counter and up to 32 frames of call stack are recorded into a buffer
+ * private to the thread. If this buffer becomes full, the subsequent
+ * samples of the thread are dropped.
+ *
+ * Threads created after the call to mm_sampler_start() are not sampled.
+ *
+ * The sampler must be stopped with mm_sampler_stop() which will report the
+ * result. While it is running, the process must not install its own handler
+ * of SIGPROF.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular MM_EWRONGSTATE if the sampler is already
+ * running, EINVAL if @freq_hz is not in the range [1, 10000] and ENOTSUP if
+ * the platform does not support the sampler.
+ */
+API_EXPORTED
+int mm_sampler_start(int freq_hz)
+{
+	struct sigaction sa = {.sa_flags = SA_SIGINFO|SA_RESTART};
+	uintptr_t record[2];
+	int64_t period_ns;
+	int i;
+
+	if (__atomic_load_n(&sampler_running, __ATOMIC_SEQ_CST)
+	    || thread_buffers)
+		return mm_raise_error(MM_EWRONGSTATE, "sampler already started");
+
+	if (freq_hz <= 0 || freq_hz > SAMPLER_MAX_FREQ)
+		return mm_raise_error(EINVAL, "Invalid frequency %i Hz",
+		                      freq_hz);
+
+	period_ns = NS_IN_SEC / freq_hz;
+
+	// Frames can only be followed if memory can be safely probed
+	can_read_frames = 1;
+	if (read_frame((uintptr_t)record, record))
+		can_read_frames = 0;
+
+	if (list_process_threads())
+		return -1;
+
+	sa.sa_sigaction = sigprof_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, &prev_sigprof_action);
+	__atomic_store_n(&sampler_running, 1, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < num_thread_buffers; i++) {
+		if (setup_thread_sampling(&thread_buffers[i], period_ns)) {
+			mm_raise_from_errno("Cannot setup sampling of thread %i",
+			                    thread_buffers[i].tid);
+			teardown_sampling();
+			free_thread_buffers();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_sampler_stop() - stop sampling and write result
+ * @fd:         file descriptor to which the result must be written
+ *
+ * Stop the sampling started by mm_sampler_start(), aggregate the samples of
+ * all threads and write them in folded stack format on @fd. If @fd is
+ * negative, the result is discarded.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. In particular MM_EWRONGSTATE if the sampler is not running.
+ */
+API_EXPORTED
+int mm_sampler_stop(int fd)
+{
+	int rv = 0;
+
+	if (!thread_buffers)
+		return mm_raise_error(MM_EWRONGSTATE, "sampler not started");
+
+	teardown_sampling();
+
+	if (fd >= 0)
+		rv = write_folded_output(fd);
+
+	free_thread_buffers();
+	return rv;
+}
+
+
+#else /* !__linux__ */
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_sampler_start(int freq_hz)
+{
+	(void)freq_hz;
+	return mm_raise_error(ENOTSUP, "sampler not supported on platform");
+}
+
+
+/* doc in linux implementation */
+API_EXPORTED
+int mm_sampler_stop(int fd)
+{
+	(void)fd;
+	return mm_raise_error(MM_EWRONGSTATE, "sampler not started");
+}
+
+#endif /* !__linux__ */
@@ -0,0 +1,205 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+
+/**
+ * DOC: semaphore
+ *
+ * The semaphore keeps its value in a 32bit word which is decremented by
+ * the waiters with an atomic compare and swap and incremented by the
+ * posters with an atomic addition: when the semaphore is not contended,
+ * neither mm_thr_sem_post() nor mm_thr_sem_wait() make any system call.
+ *
+ * When the value is null, a waiter registers itself in the waiter count
+ * and sleeps on the value word with the futex layer. A poster wakes one
+ * waiter only if the waiter count is not null.
+ */
+
+
+/**
+ * try_decrement() - attempt to decrement the value of a semaphore
+ * @sem:        initialized semaphore
+ *
+ * Return: true if the value has been decremented, false if the value is 0.
+ */
+static
+bool try_decrement(mm_thr_sem_t* sem)
+{
+	uint32_t value;
+
+	value = mm_atomic_load_u32(&sem->value, MM_ATOMIC_RELAXED);
+	while (value > 0) {
+		if (mm_atomic_cas_u32(&sem->value, &value, value - 1,
+		                      MM_ATOMIC_ACQUIRE))
+			return true;
+	}
+
+	return false;
+}
+
+
+static
+int sem_wait_until(mm_thr_sem_t* sem, const struct mm_timespec* abstime)
+{
+	int ret = 0;
+
+	if (try_decrement(sem))
+		return 0;
+
+	mm_atomic_fetch_add_u32(&sem->nwaiter, 1, MM_ATOMIC_SEQ_CST);
+
+	while (!try_decrement(sem)) {
+		if (ret)
+			break;
+
+		ret = futex_wait(&sem->value, 0, sem->flags, abstime);
+	}
+
+	mm_atomic_fetch_sub_u32(&sem->nwaiter, 1, MM_ATOMIC_RELAXED);
+
+	// On timeout, the last attempt to decrement has failed
+	return (ret && !try_decrement(sem)) ? ret : 0;
+}
+
+
+/**
+ * mm_thr_sem_init() - Initialize a semaphore
+ * @sem:        semaphore to initialize
+ * @value:      initial value of the semaphore
+ * @flags:      OR-combination of flags indicating the type of @sem
+ *
+ * Use this function to initialize @sem with the value @value. The type of
+ * semaphore is controlled by @flags which must contains one or several of
+ * the following:
+ *
+ * - MM_THR_PSHARED: init a semaphore shareable by other processes.
+ * - MM_THR_WAIT_MONOTONIC: the clock base used in mm_thr_sem_timedwait()
+ *   is MM_CLK_MONOTONIC instead of the default MM_CLK_REALTIME.
+ *
+ * Return: 0 in case of success, EINVAL if @value exceeds
+ * MM_THR_SEM_VALUE_MAX.
+ */
+API_EXPORTED
+int mm_thr_sem_init(mm_thr_sem_t* sem, unsigned int value, int flags)
+{
+	if (value > MM_THR_SEM_VALUE_MAX) {
+		mm_raise_error(EINVAL, "semaphore value %u too large", value);
+		return EINVAL;
+	}
+
+	sem->flags = flags;
+	sem->value = value;
+	sem->nwaiter = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_sem_post() - increment a semaphore
+ * @sem:        initialized semaphore
+ *
+ * This function increments the value of @sem. If threads were blocked
+ * waiting for @sem, one of them is woken up.
+ *
+ * Return: 0 in case of success, EOVERFLOW if the maximum value of @sem
+ * would be exceeded.
+ */
+API_EXPORTED
+int mm_thr_sem_post(mm_thr_sem_t* sem)
+{
+	uint32_t value;
+
+	value = mm_atomic_load_u32(&sem->value, MM_ATOMIC_RELAXED);
+	do {
+		if (value >= MM_THR_SEM_VALUE_MAX) {
+			mm_raise_error(EOVERFLOW, "semaphore value overflow");
+			return EOVERFLOW;
+		}
+	} while (!mm_atomic_cas_u32(&sem->value, &value, value + 1,
+	                            MM_ATOMIC_SEQ_CST));
+
+	if (mm_atomic_load_u32(&sem->nwaiter, MM_ATOMIC_SEQ_CST))
+		futex_wake(&sem->value, 1, sem->flags);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_sem_wait() - decrement a semaphore
+ * @sem:        initialized semaphore
+ *
+ * This function decrements the value of @sem. If the value is 0, the
+ * calling thread blocks until another thread posts @sem.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_sem_wait(mm_thr_sem_t* sem)
+{
+	return sem_wait_until(sem, NULL);
+}
+
+
+/**
+ * mm_thr_sem_trywait() - try to decrement a semaphore
+ * @sem:        initialized semaphore
+ *
+ * This function is the same as mm_thr_sem_wait() excepting that it returns
+ * immediately if the value of @sem is 0.
+ *
+ * Return: 0 if @sem has been decremented, EAGAIN otherwise.
+ */
+API_EXPORTED
+int mm_thr_sem_trywait(mm_thr_sem_t* sem)
+{
+	return try_decrement(sem) ? 0 : EAGAIN;
+}
+
+
+/**
+ * mm_thr_sem_timedwait() - decrement a semaphore with timeout
+ * @sem:        initialized semaphore
+ * @abstime:    absolute time indicating the timeout
+ *
+ * This function is the same as mm_thr_sem_wait() excepting that it returns
+ * if @sem cannot be decremented before @abstime. The clock of @abstime is
+ * MM_CLK_MONOTONIC if @sem has been initialized with MM_THR_WAIT_MONOTONIC,
+ * MM_CLK_REALTIME otherwise.
+ *
+ * Return: 0 if @sem has been decremented, ETIMEDOUT if @abstime has been
+ * reached before, EINVAL if @abstime is not a valid time.
+ */
+API_EXPORTED
+int mm_thr_sem_timedwait(mm_thr_sem_t* sem, const struct mm_timespec* abstime)
+{
+	return sem_wait_until(sem, abstime);
+}
+
+
+/**
+ * mm_thr_sem_deinit() - cleanup an initialized semaphore
+ * @sem:        initialized semaphore to destroy
+ *
+ * It is undefined behavior to destroy a semaphore on which threads are
+ * blocked.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_sem_deinit(mm_thr_sem_t* sem)
+{
+	(void)sem;
+	return 0;
+}
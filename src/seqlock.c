@@ -0,0 +1,330 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "futex-internal.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmthread.h"
+#include "spinwait.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#define READER_SPIN_COUNT       64      // checks before yielding the CPU
+
+/**
+ * DOC: sequence lock
+ *
+ * A sequence lock protects data that is read much more often than it is
+ * written, typically a snapshot of a state updated at regular interval by
+ * one writer and read by many threads or processes. Readers never block the
+ * writer and do not write anything in the lock: they read the data
+ * optimistically and retry if a write has happened meanwhile.
+ *
+ * The lock is a sequence counter which is odd while a write is in
+ * progress. A writer makes the counter odd with mm_thr_seqlock_write_begin()
+ * and even again with mm_thr_seqlock_write_end(). A reader gets the
+ * counter with mm_thr_seqlock_read_begin(), which waits for it to be even,
+ * reads the data and calls mm_thr_seqlock_read_retry(): if the counter has
+ * changed, the data read may be inconsistent and must be read again::
+ *
+ *   do {
+ *           seq = mm_thr_seqlock_read_begin(&lock);
+ *           mm_thr_seqlock_read(&lock, &copy, &shared->status,
+ *                               sizeof(copy));
+ *   } while (mm_thr_seqlock_read_retry(&lock, seq));
+ *
+ * Since the data may be modified while it is read, a reader must not
+ * follow pointers nor use the values it reads before the read has been
+ * validated. The copy helpers mm_thr_seqlock_read() and
+ * mm_thr_seqlock_write() access the data with relaxed atomic operations,
+ * which makes the concurrent accesses well defined. They access the data
+ * by 64bit or 32bit words if the buffers and length are aligned
+ * accordingly.
+ *
+ * Writers are serialized by the lock: a writer waiting for another one to
+ * finish spins for a short while and then sleeps with the futex layer.
+ * Readers waiting for a write to finish only spin and yield the CPU, since
+ * registering a sleeper would require them to write in the lock.
+ *
+ * Initialized with MM_THR_PSHARED, a sequence lock can be placed in shared
+ * memory along with the data it protects and used by several processes.
+ */
+
+
+static
+void yield_cpu(void)
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+
+/**
+ * copy_relaxed() - copy memory with relaxed atomic accesses
+ * @dst:        destination buffer
+ * @src:        source buffer
+ * @len:        number of bytes to copy
+ *
+ * Access @dst and @src with the largest word size allowed by their
+ * alignment and @len. Remaining bytes are accessed through volatile
+ * pointers.
+ */
+static
+void copy_relaxed(void* dst, const void* src, size_t len)
+{
+	uintptr_t align = (uintptr_t)dst | (uintptr_t)src | len;
+	uint64_t* d64 = dst;
+	const uint64_t* s64 = src;
+	uint32_t* d32 = dst;
+	const uint32_t* s32 = src;
+	volatile unsigned char* d8 = dst;
+	const volatile unsigned char* s8 = src;
+	uint64_t val64;
+	uint32_t val32;
+	size_t i;
+
+	if (align % 8 == 0) {
+		for (i = 0; i < len / 8; i++) {
+			val64 = mm_atomic_load_u64(&s64[i], MM_ATOMIC_RELAXED);
+			mm_atomic_store_u64(&d64[i], val64, MM_ATOMIC_RELAXED);
+		}
+
+		return;
+	}
+
+	if (align % 4 == 0) {
+		for (i = 0; i < len / 4; i++) {
+			val32 = mm_atomic_load_u32(&s32[i], MM_ATOMIC_RELAXED);
+			mm_atomic_store_u32(&d32[i], val32, MM_ATOMIC_RELAXED);
+		}
+
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		d8[i] = s8[i];
+}
+
+
+/**
+ * mm_thr_seqlock_init() - Initialize a sequence lock
+ * @seqlock:    sequence lock to initialize
+ * @flags:      OR-combination of flags indicating the type of @seqlock
+ *
+ * Use this function to initialize @seqlock. The type of lock is controlled
+ * by @flags which can contain MM_THR_PSHARED to init a lock shareable by
+ * other processes.
+ *
+ * If 0 is passed, a call to this function could have been avoided if
+ * @seqlock had been statically initialized with MM_THR_SEQLOCK_INITIALIZER.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_seqlock_init(mm_thr_seqlock_t* seqlock, int flags)
+{
+	seqlock->flags = flags;
+	seqlock->seq = 0;
+	seqlock->nwaiter = 0;
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_seqlock_write_begin() - start updating data protected by a lock
+ * @seqlock:    initialized sequence lock
+ *
+ * Mark the start of a write of the data protected by @seqlock. If another
+ * writer is in progress, the function blocks until it is finished. Readers
+ * started after this call will retry until mm_thr_seqlock_write_end() is
+ * called.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_seqlock_write_begin(mm_thr_seqlock_t* seqlock)
+{
+	uint32_t seq;
+	int count, backoff;
+
+	count = 0;
+	backoff = 1;
+	seq = mm_atomic_load_u32(&seqlock->seq, MM_ATOMIC_RELAXED);
+	while (1) {
+		if (!(seq & 1)) {
+			if (mm_atomic_cas_u32(&seqlock->seq, &seq, seq + 1,
+			                      MM_ATOMIC_ACQUIRE))
+				break;
+
+			continue;
+		}
+
+		if (count++ < SPIN_MAX_COUNT) {
+			spin_backoff(&backoff);
+		} else {
+			mm_atomic_fetch_add_u32(&seqlock->nwaiter, 1,
+			                        MM_ATOMIC_SEQ_CST);
+			futex_wait(&seqlock->seq, seq, seqlock->flags, NULL);
+			mm_atomic_fetch_sub_u32(&seqlock->nwaiter, 1,
+			                        MM_ATOMIC_RELAXED);
+		}
+
+		seq = mm_atomic_load_u32(&seqlock->seq, MM_ATOMIC_RELAXED);
+	}
+
+	// The odd sequence must be visible before any update of the data
+	mm_atomic_fence(MM_ATOMIC_RELEASE);
+	return 0;
+}
+
+
+/**
+ * mm_thr_seqlock_write_end() - finish updating data protected by a lock
+ * @seqlock:    sequence lock whose write has been started
+ *
+ * Mark the end of the write started with mm_thr_seqlock_write_begin(). The
+ * updated data is published to the readers and a writer waiting for the
+ * lock is woken up.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_seqlock_write_end(mm_thr_seqlock_t* seqlock)
+{
+	mm_atomic_fetch_add_u32(&seqlock->seq, 1, MM_ATOMIC_SEQ_CST);
+
+	if (mm_atomic_load_u32(&seqlock->nwaiter, MM_ATOMIC_SEQ_CST))
+		futex_wake(&seqlock->seq, 1, seqlock->flags);
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_seqlock_read_begin() - start reading data protected by a lock
+ * @seqlock:    initialized sequence lock
+ *
+ * Get the sequence number to be passed to mm_thr_seqlock_read_retry() once
+ * the data has been read. If a write is in progress, the function waits
+ * for it to finish. This function does not modify @seqlock.
+ *
+ * Return: the sequence number at the start of the read.
+ */
+API_EXPORTED
+unsigned int mm_thr_seqlock_read_begin(const mm_thr_seqlock_t* seqlock)
+{
+	uint32_t seq;
+	int count = 0;
+
+	while (1) {
+		seq = mm_atomic_load_u32(&seqlock->seq, MM_ATOMIC_ACQUIRE);
+		if (!(seq & 1))
+			return seq;
+
+		if (++count < READER_SPIN_COUNT) {
+			mm_cpu_relax();
+		} else {
+			yield_cpu();
+			count = 0;
+		}
+	}
+}
+
+
+/**
+ * mm_thr_seqlock_read_retry() - test whether a read must be retried
+ * @seqlock:    initialized sequence lock
+ * @seq:        sequence number returned by mm_thr_seqlock_read_begin()
+ *
+ * Validate the data read since mm_thr_seqlock_read_begin() returned @seq.
+ * This function does not modify @seqlock.
+ *
+ * Return: 0 if no write has happened during the read, hence if the data
+ * read is consistent. Otherwise a non zero value is returned and the data
+ * must be read again.
+ */
+API_EXPORTED
+int mm_thr_seqlock_read_retry(const mm_thr_seqlock_t* seqlock,
+                              unsigned int seq)
+{
+	// The data loads must be done before the sequence is checked again
+	mm_atomic_fence(MM_ATOMIC_ACQUIRE);
+
+	return mm_atomic_load_u32(&seqlock->seq, MM_ATOMIC_RELAXED) != seq;
+}
+
+
+/**
+ * mm_thr_seqlock_read() - copy data protected by a sequence lock
+ * @seqlock:    initialized sequence lock
+ * @dst:        buffer receiving the copy
+ * @src:        protected data to read
+ * @len:        number of bytes to copy
+ *
+ * Copy @len bytes of @src in @dst while a writer may concurrently update
+ * @src. It must be called between mm_thr_seqlock_read_begin() and
+ * mm_thr_seqlock_read_retry(), and @dst may only be used if the latter
+ * returns 0.
+ *
+ * If @src, @dst and @len are multiple of 8 (or 4), the data is copied by
+ * 64bit (or 32bit) words, each one being read atomically.
+ */
+API_EXPORTED
+void mm_thr_seqlock_read(const mm_thr_seqlock_t* seqlock, void* dst,
+                         const void* src, size_t len)
+{
+	(void)seqlock;
+	copy_relaxed(dst, src, len);
+}
+
+
+/**
+ * mm_thr_seqlock_write() - update data protected by a sequence lock
+ * @seqlock:    sequence lock whose write has been started
+ * @dst:        protected data to update
+ * @src:        buffer holding the new value
+ * @len:        number of bytes to copy
+ *
+ * Copy @len bytes of @src in @dst while readers may concurrently read
+ * @dst. It must be called between mm_thr_seqlock_write_begin() and
+ * mm_thr_seqlock_write_end().
+ */
+API_EXPORTED
+void mm_thr_seqlock_write(mm_thr_seqlock_t* seqlock, void* dst,
+                          const void* src, size_t len)
+{
+	(void)seqlock;
+	copy_relaxed(dst, src, len);
+}
+
+
+/**
+ * mm_thr_seqlock_deinit() - cleanup an initialized sequence lock
+ * @seqlock:    initialized sequence lock to destroy
+ *
+ * It is undefined behavior to destroy a lock on which a write is in
+ * progress.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thr_seqlock_deinit(mm_thr_seqlock_t* seqlock)
+{
+	(void)seqlock;
+	return 0;
+}
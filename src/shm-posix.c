@@ -460,3 +460,117 @@ int mm_shm_unlink(const char* name)
 
 	return 0;
 }
+
+
+/**
+ * mm_mlock() - lock pages of memory in RAM
+ * @addr:       starting address of the memory range to lock
+ * @len:        length of the memory range
+ *
+ * Lock the pages containing a part of the range [@addr, @addr+@len) in RAM,
+ * so that accessing them never incurs a page fault. This is typically used
+ * by latency sensitive threads on the data they access.
+ *
+ * The amount of memory that can be locked is limited by the system (on
+ * Linux, by RLIMIT_MEMLOCK for unprivileged processes).
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. If the process lacks privileges or the limit of locked
+ * memory is reached, the error is EPERM or ENOMEM.
+ */
+API_EXPORTED
+int mm_mlock(const void* addr, size_t len)
+{
+	if (mlock(addr, len))
+		return mm_raise_from_errno("mlock(%p, %zu) failed", addr, len);
+
+	return 0;
+}
+
+
+/**
+ * mm_munlock() - unlock pages of memory
+ * @addr:       starting address of the memory range to unlock
+ * @len:        length of the memory range
+ *
+ * Unlock the pages containing a part of the range [@addr, @addr+@len),
+ * allowing them to be paged out again.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_munlock(const void* addr, size_t len)
+{
+	if (munlock(addr, len))
+		return mm_raise_from_errno("munlock(%p, %zu) failed",
+		                           addr, len);
+
+	return 0;
+}
+
+
+/**
+ * mm_mlockall() - lock all the memory of the process in RAM
+ * @flags:      OR-combination of MM_MLOCK_CURRENT and MM_MLOCK_FUTURE
+ *
+ * If @flags contains MM_MLOCK_CURRENT, all the pages currently mapped in
+ * the process are locked in RAM. If it contains MM_MLOCK_FUTURE, the pages
+ * mapped in the future (heap growth, new mappings, new thread stacks) will
+ * be locked as well. Combined with mm_thr_prefault_stack(), this removes
+ * the page faults from the latency sensitive code path.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ *
+ * Errors:
+ * In case of failure, the error number reported in the error state
+ * indicates the origin of failure :
+ *
+ * %EINVAL
+ *   @flags is 0 or contains unknown flags.
+ * %EPERM
+ *   The process lacks the privileges to lock memory.
+ * %ENOMEM
+ *   The limit of locked memory of the process would be exceeded.
+ * %ENOTSUP
+ *   Locking the memory is not supported on the platform.
+ */
+API_EXPORTED
+int mm_mlockall(int flags)
+{
+	int mcl_flags = 0;
+
+	if (!flags || (flags & ~(MM_MLOCK_CURRENT | MM_MLOCK_FUTURE)))
+		return mm_raise_error(EINVAL, "invalid flags 0x%08x", flags);
+
+	if (flags & MM_MLOCK_CURRENT)
+		mcl_flags |= MCL_CURRENT;
+
+	if (flags & MM_MLOCK_FUTURE)
+		mcl_flags |= MCL_FUTURE;
+
+	if (mlockall(mcl_flags))
+		return mm_raise_from_errno("mlockall() failed");
+
+	return 0;
+}
+
+
+/**
+ * mm_munlockall() - unlock all the memory of the process
+ *
+ * Unlock all the pages of the process and cancel the effect of a previous
+ * call to mm_mlockall() with MM_MLOCK_FUTURE.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. On platforms not supporting it, ENOTSUP is returned.
+ */
+API_EXPORTED
+int mm_munlockall(void)
+{
+	if (munlockall())
+		return mm_raise_from_errno("munlockall() failed");
+
+	return 0;
+}
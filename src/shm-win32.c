@@ -219,3 +219,46 @@ int mm_shm_unlink(const char* name)
 
 	return mm_unlink(filename);
 }
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_mlock(const void* addr, size_t len)
+{
+	if (!VirtualLock((void*)addr, len))
+		return mm_raise_from_w32err("VirtualLock(%p, %zu) failed",
+		                            addr, len);
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_munlock(const void* addr, size_t len)
+{
+	if (!VirtualUnlock((void*)addr, len))
+		return mm_raise_from_w32err("VirtualUnlock(%p, %zu) failed",
+		                            addr, len);
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_mlockall(int flags)
+{
+	if (!flags || (flags & ~(MM_MLOCK_CURRENT | MM_MLOCK_FUTURE)))
+		return mm_raise_error(EINVAL, "invalid flags 0x%08x", flags);
+
+	return mm_raise_error(ENOTSUP, "mlockall not supported on Windows");
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_munlockall(void)
+{
+	return mm_raise_error(ENOTSUP, "munlockall not supported on Windows");
+}
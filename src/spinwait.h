@@ -0,0 +1,74 @@
+/*
+   @mindmaze_header@
+*/
+#ifndef SPINWAIT_H
+#define SPINWAIT_H
+
+#include "mmatomic.h"
+
+#define SPIN_MAX_COUNT          100     // max number of lock attempts
+#define SPIN_BACKOFF_MAX        64      // max number of pause per attempt
+
+/**
+ * DOC: adaptive spinning
+ *
+ * A thread failing to acquire a lock held for a short time is better off
+ * spinning for a while than going to sleep: the wake-up latency is
+ * typically much larger than the critical section. However spinning too
+ * long wastes CPU that the lock owner may need.
+ *
+ * The number of attempts is bounded by an estimate of the number of
+ * attempts that have been needed so far to get the lock (similar to the
+ * adaptive mutex of glibc): the limit is twice the estimate plus a small
+ * constant, capped at SPIN_MAX_COUNT. Between attempts, the CPU is relaxed
+ * with an exponentially increasing number of pause instructions (capped at
+ * SPIN_BACKOFF_MAX) to reduce the contention on the cache line of the lock.
+ */
+
+
+/**
+ * spin_max_count() - get the maximum number of lock attempts
+ * @estimate:   current estimate of number of attempts needed to get a lock
+ *
+ * Return: the number of attempts to try before blocking
+ */
+static inline
+int spin_max_count(int estimate)
+{
+	int max_count = 2*estimate + 10;
+
+	return (max_count < SPIN_MAX_COUNT) ? max_count : SPIN_MAX_COUNT;
+}
+
+
+/**
+ * spin_update_estimate() - update the estimate of attempts needed
+ * @estimate:   current estimate of number of attempts needed to get a lock
+ * @count:      number of attempts done in the last spin
+ *
+ * Return: the new estimate of attempts needed to get the lock
+ */
+static inline
+int spin_update_estimate(int estimate, int count)
+{
+	return estimate + (count - estimate) / 8;
+}
+
+
+/**
+ * spin_backoff() - relax the CPU and increase the next backoff
+ * @backoff:    pointer to the number of pause to execute (initially 1)
+ */
+static inline
+void spin_backoff(int* backoff)
+{
+	int i;
+
+	for (i = 0; i < *backoff; i++)
+		mm_cpu_relax();
+
+	if (*backoff < SPIN_BACKOFF_MAX)
+		*backoff *= 2;
+}
+
+#endif /* SPINWAIT_H */
@@ -0,0 +1,22 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef THREAD_LOCAL_H
+#define THREAD_LOCAL_H
+
+/*
+ * thread_local is a C11 keyword only when <threads.h> is included, and
+ * this header is not available on all supported platforms. Fallback to the
+ * compiler specific attribute.
+ */
+#ifndef thread_local
+#  if defined (__GNUC__)
+#    define thread_local __thread
+#  elif defined (_MSC_VER)
+#    define thread_local __declspec(thread)
+#  else
+#    error Do not know how to specify thread local attribute
+#  endif
+#endif
+
+#endif /* ifndef THREAD_LOCAL_H */
@@ -5,13 +5,146 @@
 # include <config.h>
 #endif
 
+#define _GNU_SOURCE             // for pthread_*affinity_np and CPU_SET
 
 #include "mmthread.h"
+#include "lockstat.h"
 #include "mmerrno.h"
 #include "mmlog.h"
+#include "spinwait.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#define THREAD_NAME_MAXLEN      15  // 16 bytes including null on Linux
+
+#if defined (__GLIBC__)   // PTHREAD_MUTEX_ADAPTIVE_NP is an enum, not a macro
+#  define HAVE_ADAPTIVE_MUTEX   1
+#else
+#  define HAVE_ADAPTIVE_MUTEX   0
+#endif
+
+#if defined (_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+#  define HAVE_PRIO_INHERIT     1
+#else
+#  define HAVE_PRIO_INHERIT     0
+#endif
+
+
+#if HAVE_ADAPTIVE_MUTEX
+#define NUM_ROBUST_ADAPTIVE     256     // must be a power of 2
+#define MUTEX_DELETED           ((void*)1)
+#define HASH_MULT               UINT64_C(0x9E3779B97F4A7C15)
+
+/**
+ * struct robust_adaptive - robust adaptive mutex initialized by the process
+ * @mutex:              address of the mutex, NULL if the slot has never
+ *                      been used, MUTEX_DELETED if it has been released
+ * @spin_estimate:      number of attempts needed so far to get the mutex
+ *
+ * glibc spins on contended adaptive mutexes only if they are not robust.
+ * Since MM_THR_PSHARED mutexes are robust, the spinning of those must be
+ * done by mmlib. The layout of pthread_mutex_t cannot hold this state, so
+ * the mutexes initialized with MM_THR_ADAPTIVE and MM_THR_PSHARED are
+ * recorded by mm_thr_mutex_init() in a fixed size hash table.
+ */
+struct robust_adaptive {
+	mm_atomic_ptr_t mutex;
+	int32_t spin_estimate;
+};
+
+static struct robust_adaptive robust_adaptives[NUM_ROBUST_ADAPTIVE];
+static int32_t num_robust_adaptive;
+
+
+static
+unsigned int hash_mutex(const mm_thr_mutex_t* mutex)
+{
+	return (unsigned int)(((uint64_t)(uintptr_t)mutex * HASH_MULT) >> 32);
+}
+
+
+/**
+ * find_robust_adaptive() - get the slot of a robust adaptive mutex
+ * @mutex:      initialized mutex
+ *
+ * Return: the slot of @mutex if it has been initialized with
+ * MM_THR_ADAPTIVE and MM_THR_PSHARED by the calling process, NULL
+ * otherwise.
+ */
+static
+struct robust_adaptive* find_robust_adaptive(const mm_thr_mutex_t* mutex)
+{
+	struct robust_adaptive* slot;
+	unsigned int i, idx;
+	void* val;
+
+	// Nothing to look up in the common case
+	if (!mm_atomic_load_i32(&num_robust_adaptive, MM_ATOMIC_RELAXED))
+		return NULL;
+
+	idx = hash_mutex(mutex);
+	for (i = 0; i < NUM_ROBUST_ADAPTIVE; i++) {
+		slot = &robust_adaptives[(idx + i) & (NUM_ROBUST_ADAPTIVE - 1)];
+		val = mm_atomic_load_ptr(&slot->mutex, MM_ATOMIC_RELAXED);
+		if (val == mutex)
+			return slot;
+
+		if (val == NULL)
+			break;
+	}
+
+	return NULL;
+}
+
+
+static
+void register_robust_adaptive(const mm_thr_mutex_t* mutex)
+{
+	struct robust_adaptive* slot;
+	unsigned int i, idx;
+	void* val;
+
+	idx = hash_mutex(mutex);
+	for (i = 0; i < NUM_ROBUST_ADAPTIVE; i++) {
+		slot = &robust_adaptives[(idx + i) & (NUM_ROBUST_ADAPTIVE - 1)];
+		val = mm_atomic_load_ptr(&slot->mutex, MM_ATOMIC_RELAXED);
+		if (val != NULL && val != MUTEX_DELETED)
+			continue;
+
+		mm_atomic_store_i32(&slot->spin_estimate, 0,
+		                    MM_ATOMIC_RELAXED);
+		if (mm_atomic_cas_ptr(&slot->mutex, &val, (void*)mutex,
+		                      MM_ATOMIC_RELAXED)) {
+			mm_atomic_fetch_add_i32(&num_robust_adaptive, 1,
+			                        MM_ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	mm_log_debug("Too many robust adaptive mutexes, %p will not spin",
+	             mutex);
+}
+
+
+static
+void unregister_robust_adaptive(const mm_thr_mutex_t* mutex)
+{
+	struct robust_adaptive* slot;
+
+	slot = find_robust_adaptive(mutex);
+	if (!slot)
+		return;
+
+	mm_atomic_store_ptr(&slot->mutex, MUTEX_DELETED, MM_ATOMIC_RELAXED);
+	mm_atomic_fetch_sub_i32(&num_robust_adaptive, 1, MM_ATOMIC_RELAXED);
+}
+#endif /* HAVE_ADAPTIVE_MUTEX */
 
 
 /**
@@ -25,6 +158,29 @@
  * MM_THR_PSHARED: init a mutex shareable by other processes. When a mutex
  * is process shared, it is also a robust mutex.
  *
+ * MM_THR_ADAPTIVE: init an adaptive mutex. When the mutex is contended,
+ * mm_thr_mutex_lock() spins for a while with exponential backoff before
+ * blocking, the number of attempts being bounded and tuned according to
+ * the number of attempts that previous locks have needed. This reduces
+ * the latency of contended locks protecting short critical sections. It
+ * can be combined with MM_THR_PSHARED: in this case, only the process
+ * that has initialized the mutex spins, the other processes block
+ * immediately. On platforms where it is not supported, the flag is
+ * ignored.
+ *
+ * MM_THR_LOCKSTAT: instrument the contended acquisitions of the mutex. The
+ * resulting statistics are reported by mm_thr_lockstat_dump(). The
+ * uncontended acquisitions are not affected.
+ *
+ * MM_THR_PRIO_INHERIT: init a priority inheritance mutex. While a thread
+ * holds the mutex, it runs at the highest priority of the threads blocked
+ * on it, which prevents a high priority thread from being delayed by
+ * medium priority threads preempting the owner (priority inversion). On
+ * Linux, the mutex is then based on PI futexes. It can be combined with
+ * MM_THR_PSHARED (the mutex is then also robust). Combined with
+ * MM_THR_ADAPTIVE, the mutex does not spin. On Windows, the flag is
+ * ignored.
+ *
  * If no flags is provided, the type of initialized mutex just a normal
  * mutex and a call to this function could be avoided if the data pointed by
  * @mutex has been statically initialized with MM_MTX_INITIALIZER.
@@ -43,6 +199,13 @@
  * EINVAL
  *   @flags set the robust mutex attribute without the process-shared
  *   attribute.
+ *
+ * ENOTSUP
+ *   @flags contains MM_THR_PRIO_INHERIT and priority inheritance is not
+ *   supported by the platform.
+ *
+ * The error returned by the underlying pthread implementation may also be
+ * returned if the priority inheritance protocol cannot be set.
  */
 API_EXPORTED
 int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
@@ -53,6 +216,12 @@ int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
 	if (flags) {
 		pthread_mutexattr_init(&attr);
 
+#if HAVE_ADAPTIVE_MUTEX
+		if (flags & MM_THR_ADAPTIVE)
+			pthread_mutexattr_settype(&attr,
+			                          PTHREAD_MUTEX_ADAPTIVE_NP);
+#endif
+
 		if (flags & MM_THR_PSHARED) {
 			pthread_mutexattr_setpshared(&attr,
 			                             PTHREAD_PROCESS_SHARED);
@@ -64,6 +233,25 @@ int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
 			mm_log_warn("Process shared mutex are supposed to be "
 			            "robust as well. But I do not how to have "
 			            "a robust mutex on this platform");
+#endif
+		}
+
+		if (flags & MM_THR_PRIO_INHERIT) {
+#if HAVE_PRIO_INHERIT
+			ret = pthread_mutexattr_setprotocol(
+				&attr, PTHREAD_PRIO_INHERIT);
+			if (ret) {
+				pthread_mutexattr_destroy(&attr);
+				mm_raise_error(ret, "Cannot set priority "
+				               "inheritance: %s",
+				               strerror(ret));
+				return ret;
+			}
+#else
+			pthread_mutexattr_destroy(&attr);
+			mm_raise_error(ENOTSUP, "priority inheritance mutex "
+			               "not supported on this platform");
+			return ENOTSUP;
 #endif
 		}
 	}
@@ -76,7 +264,83 @@ int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
 	if (flags)
 		pthread_mutexattr_destroy(&attr);
 
-	return ret;
+	if (ret)
+		return ret;
+
+	if (flags & MM_THR_LOCKSTAT)
+		lockstat_register(mutex);
+
+#if HAVE_ADAPTIVE_MUTEX
+	// Forget a mutex previously initialized at the same address and
+	// deinitialized by another process
+	unregister_robust_adaptive(mutex);
+	if ((flags & MM_THR_ADAPTIVE) && (flags & MM_THR_PSHARED)
+	    && !(flags & MM_THR_PRIO_INHERIT))
+		register_robust_adaptive(mutex);
+#endif
+
+	return 0;
+}
+
+
+#if HAVE_ADAPTIVE_MUTEX
+/**
+ * robust_adaptive_lock() - lock a robust adaptive mutex
+ * @mutex:      initialized mutex
+ * @slot:       slot of @mutex in the table of robust adaptive mutexes
+ *
+ * Try to acquire @mutex with bounded spinning before blocking.
+ *
+ * Return: same as mm_thr_mutex_lock()
+ */
+static
+int robust_adaptive_lock(mm_thr_mutex_t* mutex, struct robust_adaptive* slot)
+{
+	int ret, count, max_count, backoff, estimate;
+
+	ret = pthread_mutex_trylock(mutex);
+	if (ret != EBUSY)
+		return ret;
+
+	estimate = mm_atomic_load_i32(&slot->spin_estimate, MM_ATOMIC_RELAXED);
+	max_count = spin_max_count(estimate);
+	backoff = 1;
+	for (count = 1; count < max_count; count++) {
+		spin_backoff(&backoff);
+		ret = pthread_mutex_trylock(mutex);
+		if (ret != EBUSY)
+			break;
+	}
+
+	mm_atomic_store_i32(&slot->spin_estimate,
+	                    spin_update_estimate(estimate, count),
+	                    MM_ATOMIC_RELAXED);
+	if (ret != EBUSY)
+		return ret;
+
+	return pthread_mutex_lock(mutex);
+}
+#endif /* HAVE_ADAPTIVE_MUTEX */
+
+
+/**
+ * contended_lock() - lock a mutex that may be already locked
+ * @mutex:      initialized mutex
+ *
+ * Return: same as mm_thr_mutex_lock()
+ */
+static
+int contended_lock(mm_thr_mutex_t* mutex)
+{
+#if HAVE_ADAPTIVE_MUTEX
+	struct robust_adaptive* slot;
+
+	slot = find_robust_adaptive(mutex);
+	if (slot)
+		return robust_adaptive_lock(mutex, slot);
+#endif
+
+	return pthread_mutex_lock(mutex);
 }
 
 
@@ -121,7 +385,22 @@ int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
 API_EXPORTED
 int mm_thr_mutex_lock(mm_thr_mutex_t* mutex)
 {
-	return pthread_mutex_lock(mutex);
+	struct lockstat_wait wait;
+	int ret;
+
+	if (lockstat_is_active()) {
+		ret = pthread_mutex_trylock(mutex);
+		if (ret != EBUSY)
+			return ret;
+
+		if (lockstat_begin_wait(&wait, mutex, LOCKSTAT_CALLER())) {
+			ret = contended_lock(mutex);
+			lockstat_end_wait(&wait, ret == 0 || ret == EOWNERDEAD);
+			return ret;
+		}
+	}
+
+	return contended_lock(mutex);
 }
 
 
@@ -246,6 +525,9 @@ int mm_thr_mutex_consistent(mm_thr_mutex_t* mutex)
 API_EXPORTED
 int mm_thr_mutex_unlock(mm_thr_mutex_t* mutex)
 {
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	return pthread_mutex_unlock(mutex);
 }
 
@@ -269,6 +551,13 @@ int mm_thr_mutex_unlock(mm_thr_mutex_t* mutex)
 API_EXPORTED
 int mm_thr_mutex_deinit(mm_thr_mutex_t* mutex)
 {
+	if (lockstat_is_active())
+		lockstat_unregister(mutex);
+
+#if HAVE_ADAPTIVE_MUTEX
+	unregister_robust_adaptive(mutex);
+#endif
+
 	return pthread_mutex_destroy(mutex);
 }
 
@@ -364,6 +653,9 @@ int mm_thr_cond_init(mm_thr_cond_t* cond, int flags)
 API_EXPORTED
 int mm_thr_cond_wait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex)
 {
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	return pthread_cond_wait(cond, mutex);
 }
 
@@ -409,6 +701,9 @@ API_EXPORTED
 int mm_thr_cond_timedwait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex,
                           const struct mm_timespec* abstime)
 {
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	return pthread_cond_timedwait(cond, mutex,
 	                              (const struct timespec*)abstime);
 }
@@ -610,3 +905,363 @@ mm_thread_t mm_thr_self(void)
 {
 	return pthread_self();
 }
+
+
+/**************************************************************************
+ *                                                                        *
+ *                     Extended thread attributes                         *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * struct named_thread_start - data to start a thread setting its name
+ * @proc:       routine to execute in the thread
+ * @arg:        argument passed to @proc
+ * @name:       name of the thread (possibly truncated)
+ */
+struct named_thread_start {
+	void* (* proc)(void*);
+	void* arg;
+	char name[THREAD_NAME_MAXLEN+1];
+};
+
+
+static
+void set_self_name(const char* name)
+{
+#if defined (__linux__)
+	pthread_setname_np(pthread_self(), name);
+#elif defined (__APPLE__)
+	pthread_setname_np(name);
+#else
+	(void)name;
+#endif
+}
+
+
+/**
+ * named_thread_proc() - thread routine setting the name of the thread
+ * @data:       pointer to struct named_thread_start allocated on heap
+ *
+ * The name is set by the thread itself before running the actual routine
+ * so that a detached thread cannot have terminated when the name is set
+ * (and on some platforms, a thread can only name itself).
+ *
+ * Return: the value returned by the actual thread routine
+ */
+static
+void* named_thread_proc(void* data)
+{
+	struct named_thread_start start;
+
+	start = *(struct named_thread_start*)data;
+	free(data);
+
+	set_self_name(start.name);
+	return start.proc(start.arg);
+}
+
+
+#ifdef __linux__
+static
+void cpuset_to_native(cpu_set_t* native, const struct mm_cpuset* set)
+{
+	int i;
+
+	CPU_ZERO(native);
+	for (i = 0; i < MM_CPUSET_SIZE && i < CPU_SETSIZE; i++) {
+		if (mm_cpuset_isset(set, i))
+			CPU_SET(i, native);
+	}
+}
+
+
+static
+void cpuset_from_native(struct mm_cpuset* set, const cpu_set_t* native)
+{
+	int i;
+
+	mm_cpuset_zero(set);
+	for (i = 0; i < MM_CPUSET_SIZE && i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, native))
+			mm_cpuset_set(set, i);
+	}
+}
+#endif /* __linux__ */
+
+
+/**
+ * setup_pthread_attr() - translate mmlib thread attributes into pthread's
+ * @pattr:      initialized pthread attributes to configure
+ * @attr:       mmlib thread attributes
+ *
+ * Return: 0 in case of success, the error code otherwise with error state
+ * set accordingly.
+ */
+static
+int setup_pthread_attr(pthread_attr_t* pattr, const struct mm_thr_attr* attr)
+{
+	int ret;
+#ifdef __linux__
+	cpu_set_t cpuset;
+#endif
+
+	if (attr->stacksize) {
+		ret = pthread_attr_setstacksize(pattr, attr->stacksize);
+		if (ret) {
+			mm_raise_error(ret, "invalid stack size %zu: %s",
+			               attr->stacksize, strerror(ret));
+			return ret;
+		}
+	}
+
+	if (attr->guardsize) {
+		ret = pthread_attr_setguardsize(pattr, attr->guardsize);
+		if (ret) {
+			mm_raise_error(ret, "invalid guard size %zu: %s",
+			               attr->guardsize, strerror(ret));
+			return ret;
+		}
+	}
+
+	if (attr->flags & MM_THR_DETACHED)
+		pthread_attr_setdetachstate(pattr, PTHREAD_CREATE_DETACHED);
+
+	if (attr->cpuset) {
+#ifdef __linux__
+		cpuset_to_native(&cpuset, attr->cpuset);
+		ret = pthread_attr_setaffinity_np(pattr, sizeof(cpuset),
+		                                  &cpuset);
+		if (ret) {
+			mm_raise_error(ret, "invalid cpu set: %s",
+			               strerror(ret));
+			return ret;
+		}
+#else
+		mm_raise_error(ENOTSUP, "CPU affinity not supported");
+		return ENOTSUP;
+#endif
+	}
+
+	return 0;
+}
+
+
+/**
+ * mm_thr_create_ex() - thread creation with attributes
+ * @thread:     location to store the ID of the new thread. If NULL, the
+ *              thread is created detached.
+ * @proc:       routine to execute in the thread
+ * @arg:        argument passed to @proc
+ * @attr:       attributes of the thread to create (can be NULL)
+ *
+ * This function is the same as mm_thr_create() excepting that it allows to
+ * control the creation of the thread with the attributes pointed to by
+ * @attr (see &struct mm_thr_attr):
+ *
+ * - the size of the stack of the thread (@attr->stacksize). This allows
+ *   to reduce the memory footprint of processes with many threads. The size
+ *   must be at least the minimum supported by the system.
+ * - the size of the guard area protecting against stack overflow
+ *   (@attr->guardsize). This is ignored on Windows.
+ * - the set of CPUs the thread is allowed to run on (@attr->cpuset). On
+ *   Windows, only the first 64 CPUs are considered. Not supported on POSIX
+ *   systems other than Linux.
+ * - the name of the thread (@attr->name) which is displayed by debuggers
+ *   and profilers. On Linux, the name is truncated to 15 characters.
+ * - whether the thread is created detached (MM_THR_DETACHED in
+ *   @attr->flags), in which case mm_thr_join() or mm_thr_detach() must not
+ *   be called for it.
+ *
+ * Return: 0 in case of success, otherwise the associated error code with
+ * error state set accordingly. %ENOTSUP is returned if one the attributes
+ * is not supported on the platform.
+ */
+API_EXPORTED
+int mm_thr_create_ex(mm_thread_t* thread, void* (*proc)(void*), void* arg,
+                     const struct mm_thr_attr* attr)
+{
+	static const struct mm_thr_attr default_attr;
+	pthread_attr_t pattr;
+	pthread_t thid;
+	struct named_thread_start* start = NULL;
+	int ret;
+
+	// Without attributes and ID, the thread is created detached
+	if (!attr) {
+		if (thread)
+			return mm_thr_create(thread, proc, arg);
+
+		attr = &default_attr;
+	}
+
+	pthread_attr_init(&pattr);
+	ret = setup_pthread_attr(&pattr, attr);
+	if (ret)
+		goto exit;
+
+	// Nobody can join the thread if its ID is not returned
+	if (!thread)
+		pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
+
+	if (attr->name) {
+		start = malloc(sizeof(*start));
+		if (!start) {
+			ret = errno;
+			mm_raise_from_errno("Cannot allocate thread "
+			                    "start data");
+			goto exit;
+		}
+
+		start->proc = proc;
+		start->arg = arg;
+		strncpy(start->name, attr->name, THREAD_NAME_MAXLEN);
+		start->name[THREAD_NAME_MAXLEN] = '\0';
+
+		proc = named_thread_proc;
+		arg = start;
+	}
+
+	ret = pthread_create(&thid, &pattr, proc, arg);
+	if (ret) {
+		free(start);
+		mm_raise_error(ret, "Failed creating thread: %s",
+		               strerror(ret));
+		goto exit;
+	}
+
+	if (thread)
+		*thread = thid;
+
+exit:
+	pthread_attr_destroy(&pattr);
+	return ret;
+}
+
+
+/**
+ * mm_thr_setaffinity() - set the CPU affinity of the calling thread
+ * @cpuset:     set of CPUs on which the calling thread is allowed to run
+ *
+ * This function restricts the calling thread to run only on the CPUs of
+ * @cpuset. On Windows, only the first 64 CPUs are considered.
+ *
+ * Return: 0 in case of success, otherwise the associated error code with
+ * error state set accordingly. %EINVAL is returned if @cpuset does not
+ * contain any CPU available to the process and %ENOTSUP if CPU affinity is
+ * not supported on the platform.
+ */
+API_EXPORTED
+int mm_thr_setaffinity(const struct mm_cpuset* cpuset)
+{
+#ifdef __linux__
+	cpu_set_t native;
+	int ret;
+
+	cpuset_to_native(&native, cpuset);
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(native), &native);
+	if (ret)
+		mm_raise_error(ret, "Failed to set thread affinity: %s",
+		               strerror(ret));
+
+	return ret;
+#else
+	(void)cpuset;
+	mm_raise_error(ENOTSUP, "CPU affinity not supported");
+	return ENOTSUP;
+#endif
+}
+
+
+/**
+ * mm_thr_getaffinity() - get the CPU affinity of the calling thread
+ * @cpuset:     location receiving the set of CPUs on which the calling
+ *              thread is allowed to run
+ *
+ * Return: 0 in case of success, otherwise the associated error code with
+ * error state set accordingly. %ENOTSUP is returned if CPU affinity is not
+ * supported on the platform.
+ */
+API_EXPORTED
+int mm_thr_getaffinity(struct mm_cpuset* cpuset)
+{
+#ifdef __linux__
+	cpu_set_t native;
+	int ret;
+
+	ret = pthread_getaffinity_np(pthread_self(), sizeof(native), &native);
+	if (ret) {
+		mm_raise_error(ret, "Failed to get thread affinity: %s",
+		               strerror(ret));
+		return ret;
+	}
+
+	cpuset_from_native(cpuset, &native);
+	return 0;
+#else
+	(void)cpuset;
+	mm_raise_error(ENOTSUP, "CPU affinity not supported");
+	return ENOTSUP;
+#endif
+}
+
+
+/**
+ * mm_thr_set_sched() - set the scheduling policy and priority of a thread
+ * @thread:     thread whose scheduling must be changed
+ * @policy:     MM_SCHED_OTHER, MM_SCHED_FIFO or MM_SCHED_RR
+ * @prio:       static priority of @thread within @policy
+ *
+ * MM_SCHED_OTHER is the default time-sharing policy, in which case @prio
+ * must be 0. MM_SCHED_FIFO and MM_SCHED_RR are the real-time policies: a
+ * thread under those runs as soon as it is ready, preempting the threads
+ * of lower priority. With MM_SCHED_FIFO, it runs until it blocks or yields
+ * the CPU, while with MM_SCHED_RR, it shares the CPU in time slices with
+ * the threads of same priority. On Linux, the real-time priorities range
+ * from 1 (lowest) to 99.
+ *
+ * Setting a real-time policy usually requires privileges (on Linux,
+ * CAP_SYS_NICE or a RLIMIT_RTPRIO limit allowing @prio).
+ *
+ * On Windows, MM_SCHED_FIFO and MM_SCHED_RR are both mapped to a thread
+ * priority above normal, highest or time critical depending on whether
+ * @prio is lower than 33, lower than 66 or not.
+ *
+ * Return: 0 in case of success, otherwise the associated error code with
+ * error state set accordingly. %EPERM is returned if the process lacks the
+ * privileges required and %EINVAL if @policy or @prio is invalid.
+ */
+API_EXPORTED
+int mm_thr_set_sched(mm_thread_t thread, int policy, int prio)
+{
+	struct sched_param param = {.sched_priority = prio};
+	int native_policy, ret;
+
+	switch (policy) {
+	case MM_SCHED_OTHER: native_policy = SCHED_OTHER; break;
+	case MM_SCHED_FIFO: native_policy = SCHED_FIFO; break;
+	case MM_SCHED_RR: native_policy = SCHED_RR; break;
+	default:
+		mm_raise_error(EINVAL, "invalid scheduling policy %i",
+		               policy);
+		return EINVAL;
+	}
+
+	if (prio < sched_get_priority_min(native_policy)
+	    || prio > sched_get_priority_max(native_policy)) {
+		mm_raise_error(EINVAL, "invalid priority %i for policy %i",
+		               prio, policy);
+		return EINVAL;
+	}
+
+	ret = pthread_setschedparam(thread, native_policy, &param);
+	if (ret == EPERM) {
+		mm_raise_error(ret, "Not allowed to set scheduling policy %i "
+		               "with priority %i", policy, prio);
+	} else if (ret) {
+		mm_raise_error(ret, "Failed to set thread scheduling: %s",
+		               strerror(ret));
+	}
+
+	return ret;
+}
@@ -10,16 +10,20 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <process.h>
+#include <uchar.h>
 
 
+#include "mmlib.h"
 #include "mmthread.h"
 #include "mmerrno.h"
 #include "mmtime.h"
 #include "mmlog.h"
+#include "mmatomic.h"
 #include "pshared-lock.h"
-#include "atomic-win32.h"
 #include "error-internal.h"
+#include "lockstat.h"
 #include "mutex-lockval.h"
+#include "spinwait.h"
 #include "utils-win32.h"
 
 #ifdef _MSC_VER
@@ -191,7 +195,8 @@ void thread_local_data_on_exit(void)
 	// cleaned up now
 	self = data->thread;
 	if (self) {
-		prev_state = atomic_fetch_add(&self->state, STATE_STOPPED);
+		prev_state = mm_atomic_fetch_add_i64(&self->state, STATE_STOPPED,
+		                                     MM_ATOMIC_SEQ_CST);
 		if (prev_state & STATE_DETACHED)
 			destroy_mm_thread_data(self);
 	}
@@ -351,13 +356,13 @@ bool register_waiter_in_mtx(int64_t* restrict lock, int64_t* restrict poldval,
 		// is rescheduled
 		if (UNLIKELY(is_mtx_waiterlist_full(*poldval))) {
 			Sleep(1);
-			*poldval = atomic_load(lock);
+			*poldval = mm_atomic_load_i64(lock, MM_ATOMIC_SEQ_CST);
 			return false;
 		}
 
 		// try to update the waiter count
 		newval = (*poldval & ~MTX_WAITER_TID_MASK) + incval;
-		if (atomic_cmp_exchange(lock, poldval, newval))
+		if (mm_atomic_cas_i64(lock, poldval, newval, MM_ATOMIC_SEQ_CST))
 			break;
 
 		if (is_mtx_unrecoverable(*poldval))
@@ -369,7 +374,9 @@ bool register_waiter_in_mtx(int64_t* restrict lock, int64_t* restrict poldval,
 
 	// Now that robust data has been updated, we can release the waiter
 	// count lock
-	*poldval = atomic_fetch_sub(lock, mtx_lockval(0, tid, 0)) & ~MTX_WAITER_TID_MASK;
+	*poldval = mm_atomic_fetch_sub_i64(lock, mtx_lockval(0, tid, 0),
+	                                   MM_ATOMIC_SEQ_CST);
+	*poldval &= ~MTX_WAITER_TID_MASK;
 
 	return true;
 }
@@ -484,7 +491,8 @@ int pshared_mtx_lock(struct mm_thr_mutex_pshared* mutex)
 		// Try to get the lock. New value is the current number of
 		// waiter observed + the thread ID of this thread
 		newval = oldval + incval;
-		if (LIKELY(atomic_cmp_exchange(lockptr, &oldval, newval))) {
+		if (LIKELY(mm_atomic_cas_i64(lockptr, &oldval, newval,
+		                             MM_ATOMIC_SEQ_CST))) {
 			break;  // we got the lock
 		}
 
@@ -508,7 +516,8 @@ int pshared_mtx_lock(struct mm_thr_mutex_pshared* mutex)
 
 		// We are ready to wait
 		pshared_wait_on_lock(lockref, shlock, 1, NULL);
-		oldval = atomic_load(lockptr) & ~MTX_OWNER_TID_MASK;
+		oldval = mm_atomic_load_i64(lockptr, MM_ATOMIC_SEQ_CST);
+		oldval &= ~MTX_OWNER_TID_MASK;
 	}
 
 	return finish_mtx_lock(robust_data, true, oldval);
@@ -546,7 +555,8 @@ int pshared_mtx_trylock(struct mm_thr_mutex_pshared * mutex)
 	// particularly necessary for robust mutex that need recovery (the need
 	// recover bit is then set)
 	for (i = 0; i < 2; i++) {
-		if (atomic_cmp_exchange(&mutex->lock, &oldval, newval)) {
+		if (mm_atomic_cas_i64(&mutex->lock, &oldval, newval,
+		                      MM_ATOMIC_SEQ_CST)) {
 			locked = 1;
 			break;
 		}
@@ -591,7 +601,8 @@ int pshared_mtx_unlock(struct mm_thr_mutex_pshared * mutex)
 	robust_data = pshared_get_robust_data(lockref);
 
 	// Check that inconsistent state has been removed by now
-	if (is_mtx_ownerdead(atomic_load(&mutex->lock))) {
+	if (is_mtx_ownerdead(mm_atomic_load_i64(&mutex->lock,
+	                                        MM_ATOMIC_SEQ_CST))) {
 		unlock_val -= MTX_OWNER_TID_MASK;
 		unrecoverable = 1;
 	}
@@ -601,7 +612,8 @@ int pshared_mtx_unlock(struct mm_thr_mutex_pshared * mutex)
 	// Do actual unlock (This is performed by subtracting the Thread ID
 	// from the lock value. After this one, the owner part of the lock shall
 	// be null, thus indicating that no one hold the lock
-	oldval = atomic_fetch_sub(&mutex->lock, unlock_val);
+	oldval = mm_atomic_fetch_sub_i64(&mutex->lock, unlock_val,
+	                                 MM_ATOMIC_SEQ_CST);
 
 	// Wake up a waiter if there is any
 	if (is_mtx_waited(oldval)) {
@@ -631,12 +643,13 @@ int pshared_mtx_consistent(struct mm_thr_mutex_pshared * mutex)
 {
 	int64_t lockval;
 
-	lockval = atomic_load(&mutex->lock);
+	lockval = mm_atomic_load_i64(&mutex->lock, MM_ATOMIC_SEQ_CST);
 
 	if (!is_mtx_ownerdead(lockval))
 		return EINVAL;
 
-	atomic_sub(&mutex->lock, MTX_NEED_RECOVER_MASK);
+	(void)mm_atomic_fetch_sub_i64(&mutex->lock, MTX_NEED_RECOVER_MASK,
+	                              MM_ATOMIC_SEQ_CST);
 	return 0;
 }
 
@@ -677,7 +690,8 @@ int pshared_cond_wait(struct mm_thr_cond_pshared * cond,
 		timeout_ptr = &timeout;
 	}
 
-	wakeup_val = atomic_fetch_add(&cond->waiter_seq, 1);
+	wakeup_val = mm_atomic_fetch_add_i64(&cond->waiter_seq, 1,
+	                                     MM_ATOMIC_SEQ_CST);
 
 	mm_thr_mutex_unlock(mutex);
 	wait_ret = pshared_wait_on_lock(lockref, shlock, wakeup_val, timeout_ptr);
@@ -709,15 +723,16 @@ int pshared_cond_signal(struct mm_thr_cond_pshared * cond)
 	int64_t wakeup_val, waiter_val, num_waiter;
 	struct shared_lock shlock = {.key = cond->pshared_key};
 
-	waiter_val = atomic_load(&cond->waiter_seq);
-	wakeup_val = atomic_load(&cond->wakeup_seq);
+	waiter_val = mm_atomic_load_i64(&cond->waiter_seq, MM_ATOMIC_SEQ_CST);
+	wakeup_val = mm_atomic_load_i64(&cond->wakeup_seq, MM_ATOMIC_SEQ_CST);
 	num_waiter = waiter_val - wakeup_val;
 
 	if (num_waiter <= 0)
 		return 0;
 
 	lockref = get_thread_lockref_data();
-	wakeup_val = atomic_fetch_add(&cond->wakeup_seq, 1);
+	wakeup_val = mm_atomic_fetch_add_i64(&cond->wakeup_seq, 1,
+	                                     MM_ATOMIC_SEQ_CST);
 	pshared_wake_lock(lockref, shlock, wakeup_val, 1);
 
 	return 0;
@@ -740,15 +755,16 @@ int pshared_cond_broadcast(struct mm_thr_cond_pshared * cond)
 	int64_t wakeup_val, waiter_val, num_waiter;
 	struct shared_lock shlock = {.key = cond->pshared_key};
 
-	waiter_val = atomic_load(&cond->waiter_seq);
-	wakeup_val = atomic_load(&cond->wakeup_seq);
+	waiter_val = mm_atomic_load_i64(&cond->waiter_seq, MM_ATOMIC_SEQ_CST);
+	wakeup_val = mm_atomic_load_i64(&cond->wakeup_seq, MM_ATOMIC_SEQ_CST);
 	num_waiter = waiter_val - wakeup_val;
 
 	if (num_waiter <= 0)
 		return 0;
 
 	lockref = get_thread_lockref_data();
-	wakeup_val = atomic_fetch_add(&cond->wakeup_seq, num_waiter);
+	wakeup_val = mm_atomic_fetch_add_i64(&cond->wakeup_seq, num_waiter,
+	                                     MM_ATOMIC_SEQ_CST);
 	wakeup_val += num_waiter - 1;
 	pshared_wake_lock(lockref, shlock, wakeup_val, num_waiter);
 
@@ -830,10 +846,88 @@ int mm_thr_cond_is_pshared(mm_thr_cond_t * cond)
 }
 
 
-/* doc in posix implementation */
-API_EXPORTED
-int mm_thr_mutex_lock(mm_thr_mutex_t* mutex)
+static
+int mm_thr_mutex_is_adaptive(mm_thr_mutex_t * mutex)
+{
+	/*  pshared and srw flag fields are aliased */
+	return (mutex->pshared.flag & MM_THR_ADAPTIVE);
+}
+
+
+/**
+ * try_lock_once() - attempt to lock a mutex without blocking
+ * @mutex:      initialized mutex
+ *
+ * Return: EBUSY if @mutex is locked by another thread, the return value of
+ * mm_thr_mutex_lock() otherwise.
+ */
+static
+int try_lock_once(mm_thr_mutex_t* mutex)
+{
+	if (mm_thr_mutex_is_pshared(mutex))
+		return pshared_mtx_trylock(&mutex->pshared);
+
+	if (!TryAcquireSRWLockExclusive((SRWLOCK*)(&mutex->srw.srw_lock)))
+		return EBUSY;
+
+	return 0;
+}
+
+
+/**
+ * adaptive_spin_lock() - spin a bounded number of times to lock a mutex
+ * @mutex:      initialized mutex with MM_THR_ADAPTIVE flag
+ *
+ * The estimate of attempts needed to get the lock is stored in the
+ * padding field of @mutex (aliased in pshared and srw).
+ *
+ * Return: EBUSY if @mutex could not be acquired, the return value of
+ * mm_thr_mutex_lock() otherwise.
+ */
+static
+int adaptive_spin_lock(mm_thr_mutex_t* mutex)
 {
+	int ret, count, max_count, backoff, estimate;
+
+	ret = try_lock_once(mutex);
+	if (ret != EBUSY)
+		return ret;
+
+	estimate = mm_atomic_load_i32(&mutex->pshared.padding,
+	                              MM_ATOMIC_RELAXED);
+	max_count = spin_max_count(estimate);
+	backoff = 1;
+	for (count = 1; count < max_count; count++) {
+		spin_backoff(&backoff);
+		ret = try_lock_once(mutex);
+		if (ret != EBUSY)
+			break;
+	}
+
+	mm_atomic_store_i32(&mutex->pshared.padding,
+	                    spin_update_estimate(estimate, count),
+	                    MM_ATOMIC_RELAXED);
+	return ret;
+}
+
+
+/**
+ * contended_lock() - lock a mutex that may be already locked
+ * @mutex:      initialized mutex
+ *
+ * Return: same as mm_thr_mutex_lock()
+ */
+static
+int contended_lock(mm_thr_mutex_t* mutex)
+{
+	int ret;
+
+	if (mm_thr_mutex_is_adaptive(mutex)) {
+		ret = adaptive_spin_lock(mutex);
+		if (ret != EBUSY)
+			return ret;
+	}
+
 	if (mm_thr_mutex_is_pshared(mutex))
 		return pshared_mtx_lock(&mutex->pshared);
 
@@ -842,6 +936,29 @@ int mm_thr_mutex_lock(mm_thr_mutex_t* mutex)
 }
 
 
+/* doc in posix implementation */
+API_EXPORTED
+int mm_thr_mutex_lock(mm_thr_mutex_t* mutex)
+{
+	struct lockstat_wait wait;
+	int ret;
+
+	if (lockstat_is_active()) {
+		ret = try_lock_once(mutex);
+		if (ret != EBUSY)
+			return ret;
+
+		if (lockstat_begin_wait(&wait, mutex, LOCKSTAT_CALLER())) {
+			ret = contended_lock(mutex);
+			lockstat_end_wait(&wait, ret == 0 || ret == EOWNERDEAD);
+			return ret;
+		}
+	}
+
+	return contended_lock(mutex);
+}
+
+
 /* doc in posix implementation */
 API_EXPORTED
 int mm_thr_mutex_trylock(mm_thr_mutex_t* mutex)
@@ -870,6 +987,9 @@ int mm_thr_mutex_consistent(mm_thr_mutex_t* mutex)
 API_EXPORTED
 int mm_thr_mutex_unlock(mm_thr_mutex_t* mutex)
 {
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	if (mm_thr_mutex_is_pshared(mutex))
 		return pshared_mtx_unlock(&mutex->pshared);
 
@@ -882,7 +1002,9 @@ int mm_thr_mutex_unlock(mm_thr_mutex_t* mutex)
 API_EXPORTED
 int mm_thr_mutex_deinit(mm_thr_mutex_t* mutex)
 {
-	(void)mutex;
+	if (lockstat_is_active())
+		lockstat_unregister(mutex);
+
 	return 0;
 }
 
@@ -893,6 +1015,10 @@ int mm_thr_mutex_init(mm_thr_mutex_t* mutex, int flags)
 {
 	/* pshared and srw flag fields are aliased */
 	mutex->pshared.flag = flags;
+	mutex->pshared.padding = 0;
+
+	if (flags & MM_THR_LOCKSTAT)
+		lockstat_register(mutex);
 
 	if (mm_thr_mutex_is_pshared(mutex))
 		return pshared_mtx_init(&mutex->pshared);
@@ -959,6 +1085,9 @@ int mm_thr_cond_wait(mm_thr_cond_t* cond, mm_thr_mutex_t* mutex)
 	CONDITION_VARIABLE* cv = (CONDITION_VARIABLE*)(&cond->srw.cv);
 	SRWLOCK* srwlock = (SRWLOCK*)(&mutex->srw.srw_lock);
 
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	return sleep_win32cv(cv, srwlock, INFINITE);
 }
 
@@ -984,6 +1113,9 @@ int mm_thr_cond_timedwait(mm_thr_cond_t* _cond, mm_thr_mutex_t* mutex,
 	cv = (CONDITION_VARIABLE*)(&cond->cv);
 	srwlock = (SRWLOCK*)(&mutex->srw.srw_lock);
 
+	if (lockstat_is_active())
+		lockstat_release(mutex);
+
 	// Find the type of clock to use for timeout
 	clk_id = CLOCK_REALTIME;
 	if (cond->flag & WAITCLK_FLAG_MONOTONIC)
@@ -1148,7 +1280,8 @@ int mm_thr_create(mm_thread_t* thread, void* (*proc)(void*), void* arg)
 API_EXPORTED
 int mm_thr_join(mm_thread_t thread, void** value_ptr)
 {
-	if (atomic_load(&thread->state) & STATE_DETACHED) {
+	if (mm_atomic_load_i64(&thread->state, MM_ATOMIC_SEQ_CST)
+	    & STATE_DETACHED) {
 		mm_raise_error(EINVAL, "The thread is detached");
 		return EINVAL;
 	}
@@ -1170,7 +1303,8 @@ int mm_thr_detach(mm_thread_t thread)
 	int64_t prev_state;
 
 	// Add detached state
-	prev_state = atomic_fetch_add(&thread->state, STATE_DETACHED);
+	prev_state = mm_atomic_fetch_add_i64(&thread->state, STATE_DETACHED,
+	                                     MM_ATOMIC_SEQ_CST);
 	if (prev_state & STATE_DETACHED) {
 		mm_raise_error(EINVAL, "The thread is already detached");
 		return EINVAL;
@@ -1207,3 +1341,204 @@ mm_thread_t mm_thr_self(void)
 
 	return self;
 }
+
+
+/**************************************************************************
+ *                                                                        *
+ *                     Extended thread attributes                         *
+ *                                                                        *
+ **************************************************************************/
+
+typedef HRESULT (WINAPI * SetThreadDescriptionProc)(HANDLE, PCWSTR);
+
+/**
+ * set_thread_name() - set the description of a thread
+ * @hnd:        handle of the thread
+ * @name:       UTF-8 name of the thread
+ *
+ * SetThreadDescription() is available only from Windows 10 1607, hence it
+ * is loaded dynamically and the name is silently not set if unavailable.
+ */
+static
+void set_thread_name(HANDLE hnd, const char* name)
+{
+	union {
+		SetThreadDescriptionProc set_desc;
+		FARPROC farproc;
+	} cast_fn;
+	char16_t* name_u16;
+	int len;
+
+	cast_fn.farproc = GetProcAddress(GetModuleHandle("kernel32.dll"),
+	                                 "SetThreadDescription");
+	if (!cast_fn.farproc)
+		return;
+
+	len = get_utf16_buffer_len_from_utf8(name);
+	if (len < 0)
+		return;
+
+	name_u16 = mm_malloca(len * sizeof(*name_u16));
+	if (!name_u16)
+		return;
+
+	conv_utf8_to_utf16(name_u16, len, name);
+	cast_fn.set_desc(hnd, name_u16);
+	mm_freea(name_u16);
+}
+
+
+static
+DWORD_PTR cpuset_to_mask(const struct mm_cpuset* cpuset)
+{
+	return (DWORD_PTR)cpuset->bits[0];
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_thr_create_ex(mm_thread_t* thread, void* (*proc)(void*), void* arg,
+                     const struct mm_thr_attr* attr)
+{
+	static const struct mm_thr_attr default_attr;
+	struct mm_thread* th;
+	unsigned int flags;
+
+	// Without attributes and ID, the thread is created detached
+	if (!attr) {
+		if (thread)
+			return mm_thr_create(thread, proc, arg);
+
+		attr = &default_attr;
+	}
+
+	th = create_mm_thread_data();
+	if (!th)
+		return errno;
+
+	// Mark thread as joinable and register the thread routine
+	th->state &= ~STATE_DETACHED;
+	th->routine = proc;
+	th->arg = arg;
+
+	// Create suspended to apply affinity and name before it runs
+	flags = CREATE_SUSPENDED;
+	if (attr->stacksize)
+		flags |= STACK_SIZE_PARAM_IS_A_RESERVATION;
+
+	th->hnd = (HANDLE)_beginthreadex(NULL, (unsigned int)attr->stacksize,
+	                                 thread_proc_wrapper, th, flags, NULL);
+	if (!th->hnd) {
+		mm_raise_from_errno("Failed to begin thread");
+		destroy_mm_thread_data(th);
+		return errno;
+	}
+
+	if (attr->cpuset
+	    && !SetThreadAffinityMask(th->hnd, cpuset_to_mask(attr->cpuset))) {
+		mm_raise_from_w32err("invalid cpu set");
+		TerminateThread(th->hnd, 0);
+		CloseHandle(th->hnd);
+		destroy_mm_thread_data(th);
+		return EINVAL;
+	}
+
+	if (attr->name)
+		set_thread_name(th->hnd, attr->name);
+
+	ResumeThread(th->hnd);
+
+	// Nobody can join the thread if the handle is not returned
+	if ((attr->flags & MM_THR_DETACHED) || !thread)
+		mm_thr_detach(th);
+	else
+		*thread = th;
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_thr_setaffinity(const struct mm_cpuset* cpuset)
+{
+	if (!SetThreadAffinityMask(GetCurrentThread(),
+	                           cpuset_to_mask(cpuset))) {
+		mm_raise_from_w32err("Failed to set thread affinity");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_thr_getaffinity(struct mm_cpuset* cpuset)
+{
+	DWORD_PTR proc_mask, sys_mask, mask;
+	HANDLE self = GetCurrentThread();
+
+	// There is no GetThreadAffinityMask(): setting the affinity returns
+	// the previous one, which is then restored.
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &proc_mask, &sys_mask)
+	    || !(mask = SetThreadAffinityMask(self, proc_mask))) {
+		mm_raise_from_w32err("Failed to get thread affinity");
+		return EINVAL;
+	}
+
+	SetThreadAffinityMask(self, mask);
+
+	mm_cpuset_zero(cpuset);
+	cpuset->bits[0] = mask;
+	return 0;
+}
+
+
+/* doc in posix implementation */
+API_EXPORTED
+int mm_thr_set_sched(mm_thread_t thread, int policy, int prio)
+{
+	int native_prio, errnum;
+
+	switch (policy) {
+	case MM_SCHED_OTHER:
+		if (prio != 0)
+			goto invalid_prio;
+
+		native_prio = THREAD_PRIORITY_NORMAL;
+		break;
+
+	case MM_SCHED_FIFO:
+	case MM_SCHED_RR:
+		if (prio < 1 || prio > 99)
+			goto invalid_prio;
+
+		if (prio < 33)
+			native_prio = THREAD_PRIORITY_ABOVE_NORMAL;
+		else if (prio < 66)
+			native_prio = THREAD_PRIORITY_HIGHEST;
+		else
+			native_prio = THREAD_PRIORITY_TIME_CRITICAL;
+
+		break;
+
+	default:
+		mm_raise_error(EINVAL, "invalid scheduling policy %i",
+		               policy);
+		return EINVAL;
+	}
+
+	if (!SetThreadPriority(thread->hnd, native_prio)) {
+		errnum = get_errcode_from_w32err(GetLastError());
+		mm_raise_from_w32err("Failed to set thread priority");
+		return errnum;
+	}
+
+	return 0;
+
+invalid_prio:
+	mm_raise_error(EINVAL, "invalid priority %i for policy %i",
+	               prio, policy);
+	return EINVAL;
+}
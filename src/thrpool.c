@@ -0,0 +1,975 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "thread-local.h"
+#include "topology-internal.h"
+
+#define CACHELINE_SIZE          64
+#define DEQUE_INITIAL_SIZE      256
+#define NUM_SPIN_ROUND          64
+#define GROUP_HELP_WAIT_NS      1000000
+
+/**
+ * DOC: thread pool
+ *
+ * A thread pool runs the submitted tasks on a fixed set of worker threads,
+ * which avoids to oversubscribe the CPUs when several components need to
+ * run work concurrently.
+ *
+ * Each worker owns a Chase-Lev work-stealing deque. A task submitted from
+ * a worker (ie by a running task) is pushed on the deque of this worker,
+ * which pops its own tasks in LIFO order. When its deque is empty, a
+ * worker takes the tasks submitted from outside of the pool, which are
+ * queued in a shared FIFO, and then tries to steal the oldest task of the
+ * deque of another worker. Only when no task can be found after several
+ * rounds, a worker goes to sleep on a condition variable. A submission
+ * wakes a sleeping worker only if there are any, so that the producers
+ * do not pay the cost of a system call while all workers are busy.
+ *
+ * The completion of the tasks can be waited for by task group (see
+ * mm_thrpool_group_create()) or for the whole pool with
+ * mm_thrpool_drain().
+ */
+
+/**
+ * struct mm_thrpool_group - group of tasks whose completion can be waited
+ * @pending:    number of tasks of the group not completed yet
+ * @mtx:        lock protecting the transition of @pending to 0
+ * @cond:       condition signaled when @pending reaches 0
+ */
+struct mm_thrpool_group {
+	int64_t pending;
+	mm_thr_mutex_t mtx;
+	mm_thr_cond_t cond;
+};
+
+/**
+ * struct task - task submitted to the pool
+ * @proc:       function to execute
+ * @arg:        argument passed to @proc
+ * @grp:        group of the task (may be NULL)
+ * @next:       next task in the queue of tasks submitted from outside
+ */
+struct task {
+	void (* proc)(void*);
+	void* arg;
+	struct mm_thrpool_group* grp;
+	struct task* next;
+};
+
+/**
+ * struct deque_array - circular buffer of a work-stealing deque
+ * @size:       number of elements in @buf (power of 2)
+ * @prev:       array previously used by the deque (freed with the deque)
+ * @buf:        elements of the array
+ */
+struct deque_array {
+	int64_t size;
+	struct deque_array* prev;
+	struct task* buf[];
+};
+
+/**
+ * struct deque - Chase-Lev work-stealing deque
+ * @top:        index of the oldest element, incremented by thieves
+ * @bottom:     index of the next element to push, modified by the owner
+ * @array:      circular buffer holding the elements
+ *
+ * @top and @bottom are placed on different cache lines since they are
+ * modified by different threads.
+ */
+struct deque {
+	int64_t top;
+	char pad1[CACHELINE_SIZE - sizeof(int64_t)];
+	int64_t bottom;
+	struct deque_array* array;
+	char pad2[CACHELINE_SIZE - sizeof(int64_t) - sizeof(void*)];
+};
+
+/**
+ * struct worker - worker thread of a pool
+ * @dq:         deque of tasks submitted by the worker
+ * @pool:       pool the worker belongs to
+ * @thid:       thread ID of the worker
+ * @rng:        state of random generator used to select steal victims
+ * @index:      index of the worker in the pool
+ */
+struct worker {
+	struct deque dq;
+	struct mm_thrpool* pool;
+	mm_thread_t thid;
+	uint32_t rng;
+	int index;
+};
+
+/**
+ * struct mm_thrpool - thread pool
+ * @all:        group of all tasks of the pool
+ * @mtx:        lock protecting the queue of external tasks and the sleep
+ * @cond:       condition signaled to wake up idle workers
+ * @inject_head: first task submitted from outside the pool
+ * @inject_tail: last task submitted from outside the pool
+ * @num_inject: number of tasks in the queue of external tasks
+ * @num_idle:   number of workers sleeping or about to sleep
+ * @closing:    if non zero, no task can be submitted from outside
+ * @discard:    if non zero, the pending tasks are dropped
+ * @stop:       if non zero, the workers must terminate when idle
+ * @num_worker: number of workers
+ * @workers:    array of @num_worker workers
+ */
+struct mm_thrpool {
+	struct mm_thrpool_group all;
+	mm_thr_mutex_t mtx;
+	mm_thr_cond_t cond;
+	struct task* inject_head;
+	struct task* inject_tail;
+	int64_t num_inject;
+	int num_idle;
+	int closing;
+	int discard;
+	int stop;
+	int num_worker;
+	struct worker** workers;
+};
+
+static thread_local struct worker* curr_worker;
+
+
+/**************************************************************************
+ *                                                                        *
+ *                        Work-stealing deque                             *
+ *                                                                        *
+ **************************************************************************/
+/*
+ * The implementation follows the C11 formulation of the Chase-Lev deque
+ * given in "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * by N.M. Lê, A. Pop, A. Cohen and F. Zappa Nardelli (PPoPP 2013).
+ */
+
+static
+struct deque_array* deque_array_create(int64_t size)
+{
+	struct deque_array* a;
+
+	a = malloc(sizeof(*a) + size*sizeof(a->buf[0]));
+	if (!a)
+		return NULL;
+
+	a->size = size;
+	a->prev = NULL;
+	return a;
+}
+
+
+static
+int deque_init(struct deque* dq)
+{
+	dq->top = 0;
+	dq->bottom = 0;
+	dq->array = deque_array_create(DEQUE_INITIAL_SIZE);
+	if (!dq->array)
+		return mm_raise_from_errno("cannot allocate deque");
+
+	return 0;
+}
+
+
+static
+void deque_deinit(struct deque* dq)
+{
+	struct deque_array *a, *prev;
+
+	for (a = dq->array; a != NULL; a = prev) {
+		prev = a->prev;
+		free(a);
+	}
+}
+
+
+/**
+ * deque_grow() - double the size of deque array
+ * @dq:         deque whose array must grow
+ * @a:          current array of @dq
+ * @top:        current top index
+ * @bottom:     current bottom index
+ *
+ * The previous array is not freed since thieves might still read it. It
+ * is kept linked to the new one and freed when the deque is deinitialized.
+ *
+ * Returns: the new array, NULL in case of allocation failure
+ */
+static
+struct deque_array* deque_grow(struct deque* dq, struct deque_array* a,
+                               int64_t top, int64_t bottom)
+{
+	struct deque_array* new_a;
+	struct task* elt;
+	int64_t i;
+
+	new_a = deque_array_create(2*a->size);
+	if (!new_a)
+		return NULL;
+
+	for (i = top; i < bottom; i++) {
+		elt = __atomic_load_n(&a->buf[i & (a->size-1)],
+		                      __ATOMIC_RELAXED);
+		new_a->buf[i & (new_a->size-1)] = elt;
+	}
+
+	new_a->prev = a;
+	__atomic_store_n(&dq->array, new_a, __ATOMIC_RELEASE);
+	return new_a;
+}
+
+
+/**
+ * deque_push() - push a task at the bottom of the deque (owner only)
+ * @dq:         deque of the calling worker
+ * @task:       task to push
+ *
+ * Returns: 0 in case of success, -1 if the deque could not grow
+ */
+static
+int deque_push(struct deque* dq, struct task* task)
+{
+	int64_t b, t;
+	struct deque_array* a;
+
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+	t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+
+	if (b - t > a->size - 1) {
+		a = deque_grow(dq, a, t, b);
+		if (!a)
+			return mm_raise_from_errno("cannot grow deque");
+	}
+
+	__atomic_store_n(&a->buf[b & (a->size-1)], task, __ATOMIC_RELAXED);
+	__atomic_store_n(&dq->bottom, b+1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+/**
+ * deque_take() - pop the most recent task of the deque (owner only)
+ * @dq:         deque of the calling worker
+ *
+ * Returns: the task taken, NULL if the deque is empty
+ */
+static
+struct task* deque_take(struct deque* dq)
+{
+	int64_t b, t;
+	struct deque_array* a;
+	struct task* task;
+
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+	a = __atomic_load_n(&dq->array, __ATOMIC_RELAXED);
+	__atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+	if (t > b) {
+		// Deque was empty
+		__atomic_store_n(&dq->bottom, b+1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	task = __atomic_load_n(&a->buf[b & (a->size-1)], __ATOMIC_RELAXED);
+	if (t == b) {
+		// Last element: race against thieves
+		if (!__atomic_compare_exchange_n(&dq->top, &t, t+1, 0,
+		                                 __ATOMIC_SEQ_CST,
+		                                 __ATOMIC_RELAXED))
+			task = NULL;
+
+		__atomic_store_n(&dq->bottom, b+1, __ATOMIC_RELAXED);
+	}
+
+	return task;
+}
+
+
+/**
+ * deque_steal() - steal the oldest task of a deque (any thread)
+ * @dq:         deque to steal from
+ * @task:       location receiving the task stolen
+ *
+ * Returns: 0 if a task has been stolen, 1 if the deque is empty, -1 if
+ * the steal has lost a race and should be retried later.
+ */
+static
+int deque_steal(struct deque* dq, struct task** task)
+{
+	int64_t b, t;
+	struct deque_array* a;
+
+	t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+	if (t >= b)
+		return 1;
+
+	a = __atomic_load_n(&dq->array, __ATOMIC_ACQUIRE);
+	*task = __atomic_load_n(&a->buf[t & (a->size-1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&dq->top, &t, t+1, 0,
+	                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return -1;
+
+	return 0;
+}
+
+
+static
+int deque_is_empty(struct deque* dq)
+{
+	int64_t b, t;
+
+	t = __atomic_load_n(&dq->top, __ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_SEQ_CST);
+
+	return (t >= b);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                             Task groups                                *
+ *                                                                        *
+ **************************************************************************/
+
+static
+void group_init(struct mm_thrpool_group* grp)
+{
+	grp->pending = 0;
+	mm_thr_mutex_init(&grp->mtx, 0);
+	mm_thr_cond_init(&grp->cond, 0);
+}
+
+
+static
+void group_deinit(struct mm_thrpool_group* grp)
+{
+	mm_thr_cond_deinit(&grp->cond);
+	mm_thr_mutex_deinit(&grp->mtx);
+}
+
+
+/**
+ * group_task_done() - account the completion of a task of a group
+ * @grp:        group of the completed task
+ *
+ * The last decrement is done while holding the group lock, so that a
+ * waiter cannot observe the group complete (and possibly destroy it)
+ * before this function has stopped accessing it.
+ */
+static
+void group_task_done(struct mm_thrpool_group* grp)
+{
+	int64_t pending;
+
+	pending = __atomic_load_n(&grp->pending, __ATOMIC_RELAXED);
+	while (pending > 1) {
+		if (__atomic_compare_exchange_n(&grp->pending, &pending,
+		                                pending-1, 0,
+		                                __ATOMIC_RELEASE,
+		                                __ATOMIC_RELAXED))
+			return;
+	}
+
+	mm_thr_mutex_lock(&grp->mtx);
+	if (__atomic_sub_fetch(&grp->pending, 1, __ATOMIC_RELEASE) == 0)
+		mm_thr_cond_broadcast(&grp->cond);
+
+	mm_thr_mutex_unlock(&grp->mtx);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                            Worker threads                              *
+ *                                                                        *
+ **************************************************************************/
+
+static
+uint32_t worker_rand(struct worker* w)
+{
+	uint32_t x = w->rng;
+
+	// xorshift32
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	w->rng = x;
+	return x;
+}
+
+
+/**
+ * inject_pop() - get the oldest task submitted from outside of the pool
+ * @pool:       pool whose queue must be used
+ *
+ * Returns: the task dequeued, NULL if the queue is empty
+ */
+static
+struct task* inject_pop(struct mm_thrpool* pool)
+{
+	struct task* task;
+
+	if (__atomic_load_n(&pool->num_inject, __ATOMIC_RELAXED) == 0)
+		return NULL;
+
+	mm_thr_mutex_lock(&pool->mtx);
+
+	task = pool->inject_head;
+	if (task) {
+		pool->inject_head = task->next;
+		if (!pool->inject_head)
+			pool->inject_tail = NULL;
+
+		__atomic_sub_fetch(&pool->num_inject, 1, __ATOMIC_RELAXED);
+	}
+
+	mm_thr_mutex_unlock(&pool->mtx);
+
+	return task;
+}
+
+
+/**
+ * find_task() - search a task to execute
+ * @w:          worker searching a task
+ *
+ * Returns: the task found, NULL if none has been found
+ */
+static
+struct task* find_task(struct worker* w)
+{
+	struct mm_thrpool* pool = w->pool;
+	struct task* task;
+	int i, start, num, retry;
+
+	task = deque_take(&w->dq);
+	if (task)
+		return task;
+
+	task = inject_pop(pool);
+	if (task)
+		return task;
+
+	// Try steal from other workers starting from a random one
+	num = pool->num_worker;
+	do {
+		retry = 0;
+		start = worker_rand(w) % num;
+		for (i = 0; i < num; i++) {
+			if ((start + i) % num == w->index)
+				continue;
+
+			switch (deque_steal(&pool->workers[(start+i)%num]->dq,
+			                    &task)) {
+			case 0: return task;
+			case -1: retry = 1; break;
+			default: break;
+			}
+		}
+	} while (retry);
+
+	return NULL;
+}
+
+
+/**
+ * pool_has_work() - test whether a task is pending in the pool
+ * @pool:       pool to test
+ *
+ * Must be called with pool lock held.
+ *
+ * Returns: non zero if a task is available in the pool
+ */
+static
+int pool_has_work(struct mm_thrpool* pool)
+{
+	int i;
+
+	if (pool->inject_head)
+		return 1;
+
+	for (i = 0; i < pool->num_worker; i++) {
+		if (!deque_is_empty(&pool->workers[i]->dq))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * wake_idle_worker() - wake one worker if some are sleeping
+ * @pool:       pool whose worker must be woken up
+ *
+ * To be called after a task has been pushed on a deque. The full barrier
+ * pairs with the one implied by the increment of @pool->num_idle in
+ * worker_wait(): either the pusher sees the worker idle, or the worker
+ * sees the task pushed.
+ */
+static
+void wake_idle_worker(struct mm_thrpool* pool)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->num_idle, __ATOMIC_RELAXED) == 0)
+		return;
+
+	mm_thr_mutex_lock(&pool->mtx);
+	mm_thr_cond_signal(&pool->cond);
+	mm_thr_mutex_unlock(&pool->mtx);
+}
+
+
+/**
+ * worker_wait() - sleep until work is available in the pool
+ * @pool:       pool of the calling worker
+ *
+ * Returns: 0 if some work might be available, 1 if the worker must stop.
+ */
+static
+int worker_wait(struct mm_thrpool* pool)
+{
+	int must_stop = 0;
+
+	mm_thr_mutex_lock(&pool->mtx);
+	__atomic_fetch_add(&pool->num_idle, 1, __ATOMIC_SEQ_CST);
+
+	while (!pool_has_work(pool)) {
+		if (pool->stop) {
+			must_stop = 1;
+			break;
+		}
+
+		mm_thr_cond_wait(&pool->cond, &pool->mtx);
+	}
+
+	__atomic_fetch_sub(&pool->num_idle, 1, __ATOMIC_RELAXED);
+	mm_thr_mutex_unlock(&pool->mtx);
+
+	return must_stop;
+}
+
+
+/**
+ * run_task() - execute a task and account its completion
+ * @pool:       pool executing the task
+ * @task:       task to run
+ *
+ * If the pool is being destroyed with MM_THRPOOL_DISCARD, the task is
+ * only accounted as completed without being executed.
+ */
+static
+void run_task(struct mm_thrpool* pool, struct task* task)
+{
+	struct mm_thrpool_group* grp = task->grp;
+
+	if (!__atomic_load_n(&pool->discard, __ATOMIC_RELAXED))
+		task->proc(task->arg);
+
+	free(task);
+
+	if (grp)
+		group_task_done(grp);
+
+	group_task_done(&pool->all);
+}
+
+
+static
+void* worker_proc(void* arg)
+{
+	struct worker* w = arg;
+	struct mm_thrpool* pool = w->pool;
+	struct task* task;
+	int i;
+
+	curr_worker = w;
+
+	while (1) {
+		// Spin a bit before going to sleep
+		for (i = 0; i < NUM_SPIN_ROUND; i++) {
+			task = find_task(w);
+			if (task)
+				break;
+		}
+
+		if (task) {
+			run_task(pool, task);
+			continue;
+		}
+
+		if (worker_wait(pool))
+			break;
+	}
+
+	curr_worker = NULL;
+	return NULL;
+}
+
+
+static
+void destroy_workers(struct mm_thrpool* pool, int num_running)
+{
+	int i;
+
+	mm_thr_mutex_lock(&pool->mtx);
+	pool->stop = 1;
+	mm_thr_cond_broadcast(&pool->cond);
+	mm_thr_mutex_unlock(&pool->mtx);
+
+	for (i = 0; i < num_running; i++)
+		mm_thr_join(pool->workers[i]->thid, NULL);
+
+	for (i = 0; i < pool->num_worker; i++) {
+		if (!pool->workers[i])
+			continue;
+
+		deque_deinit(&pool->workers[i]->dq);
+		mm_aligned_free(pool->workers[i]);
+	}
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           API implementation                           *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_thrpool_create() - create a thread pool
+ * @num_worker: number of worker threads. If 0 or negative, one worker per
+ *              online CPU is created.
+ *
+ * This function creates a pool of @num_worker threads executing the tasks
+ * submitted with mm_thrpool_submit(). The pool must be destroyed with
+ * mm_thrpool_destroy() when it is no longer needed.
+ *
+ * Return: pointer to the new pool in case of success, NULL otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+struct mm_thrpool* mm_thrpool_create(int num_worker)
+{
+	struct mm_thrpool* pool;
+	struct worker* w;
+	int i, num_running = 0;
+
+	if (num_worker <= 0)
+		num_worker = get_num_cpu();
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		mm_raise_from_errno("cannot allocate thread pool");
+		return NULL;
+	}
+
+	pool->workers = calloc(num_worker, sizeof(*pool->workers));
+	if (!pool->workers) {
+		mm_raise_from_errno("cannot allocate workers");
+		free(pool);
+		return NULL;
+	}
+
+	pool->num_worker = num_worker;
+	group_init(&pool->all);
+	mm_thr_mutex_init(&pool->mtx, 0);
+	mm_thr_cond_init(&pool->cond, 0);
+
+	// Allocate all workers before starting any since a running worker
+	// may access the deque of any other worker
+	for (i = 0; i < num_worker; i++) {
+		w = mm_aligned_alloc(CACHELINE_SIZE, sizeof(*w));
+		if (!w)
+			goto error;
+
+		memset(w, 0, sizeof(*w));
+		if (deque_init(&w->dq)) {
+			mm_aligned_free(w);
+			goto error;
+		}
+
+		w->pool = pool;
+		w->index = i;
+		w->rng = 2654435761U * (i+1);
+		pool->workers[i] = w;
+	}
+
+	for (i = 0; i < num_worker; i++) {
+		w = pool->workers[i];
+		if (mm_thr_create(&w->thid, worker_proc, w))
+			goto error;
+
+		num_running++;
+	}
+
+	return pool;
+
+error:
+	destroy_workers(pool, num_running);
+	mm_thr_cond_deinit(&pool->cond);
+	mm_thr_mutex_deinit(&pool->mtx);
+	group_deinit(&pool->all);
+	free(pool->workers);
+	free(pool);
+	return NULL;
+}
+
+
+/**
+ * mm_thrpool_destroy() - shutdown and destroy a thread pool
+ * @pool:       pool to destroy (may be NULL)
+ * @flags:      0 or MM_THRPOOL_DISCARD
+ *
+ * This function stops the acceptance of new tasks submitted from outside
+ * the pool, waits for the completion of the pending tasks (including the
+ * ones they submit), terminates the worker threads and frees the resources
+ * of @pool.
+ *
+ * If @flags contains MM_THRPOOL_DISCARD, the tasks which have not started
+ * yet are not executed: they are only accounted as completed so that the
+ * waiters of their group are released. The tasks already running are
+ * waited for though.
+ *
+ * This function must not be called from a task of @pool.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_thrpool_destroy(struct mm_thrpool* pool, int flags)
+{
+	if (!pool)
+		return 0;
+
+	if (curr_worker && curr_worker->pool == pool)
+		return mm_raise_error(EDEADLK, "cannot destroy thread pool "
+		                      "from one of its tasks");
+
+	__atomic_store_n(&pool->closing, 1, __ATOMIC_RELEASE);
+	if (flags & MM_THRPOOL_DISCARD)
+		__atomic_store_n(&pool->discard, 1, __ATOMIC_RELAXED);
+
+	mm_thrpool_drain(pool);
+	destroy_workers(pool, pool->num_worker);
+
+	mm_thr_cond_deinit(&pool->cond);
+	mm_thr_mutex_deinit(&pool->mtx);
+	group_deinit(&pool->all);
+	free(pool->workers);
+	free(pool);
+	return 0;
+}
+
+
+/**
+ * mm_thrpool_submit() - submit a task to a thread pool
+ * @pool:       pool which must execute the task
+ * @grp:        group the task belongs to (may be NULL)
+ * @proc:       function to execute
+ * @arg:        argument passed to @proc
+ *
+ * This function queues the execution of @proc(@arg) in @pool. If @grp is
+ * not NULL, the task is accounted in the group @grp whose completion can
+ * be waited with mm_thrpool_group_wait().
+ *
+ * The function can be called by any thread, including by the tasks
+ * running in @pool. In this latter case, the new task is queued to the
+ * current worker and may be stolen by other idle workers.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly. The error %MM_EWRONGSTATE is reported if @pool is being
+ * destroyed and the task is not submitted from one of its tasks.
+ */
+API_EXPORTED
+int mm_thrpool_submit(struct mm_thrpool* pool, struct mm_thrpool_group* grp,
+                      void (* proc)(void*), void* arg)
+{
+	struct worker* w = curr_worker;
+	struct task* task;
+	int from_worker;
+
+	from_worker = (w && w->pool == pool);
+	if (!from_worker && __atomic_load_n(&pool->closing, __ATOMIC_ACQUIRE))
+		return mm_raise_error(MM_EWRONGSTATE, "thread pool is being "
+		                      "destroyed");
+
+	task = malloc(sizeof(*task));
+	if (!task)
+		return mm_raise_from_errno("cannot allocate task");
+
+	task->proc = proc;
+	task->arg = arg;
+	task->grp = grp;
+	task->next = NULL;
+
+	if (grp)
+		__atomic_add_fetch(&grp->pending, 1, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&pool->all.pending, 1, __ATOMIC_RELAXED);
+
+	if (from_worker && deque_push(&w->dq, task) == 0) {
+		wake_idle_worker(pool);
+		return 0;
+	}
+
+	// Submitted from outside (or the deque could not grow)
+	mm_thr_mutex_lock(&pool->mtx);
+
+	if (pool->inject_tail)
+		pool->inject_tail->next = task;
+	else
+		pool->inject_head = task;
+
+	pool->inject_tail = task;
+	__atomic_add_fetch(&pool->num_inject, 1, __ATOMIC_RELAXED);
+
+	if (pool->num_idle)
+		mm_thr_cond_signal(&pool->cond);
+
+	mm_thr_mutex_unlock(&pool->mtx);
+
+	return 0;
+}
+
+
+/**
+ * mm_thrpool_drain() - wait for the completion of all tasks of a pool
+ * @pool:       pool to drain
+ *
+ * This function blocks until all the tasks submitted to @pool, including
+ * the ones submitted while waiting, have completed. It must not be called
+ * from a task of @pool.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_thrpool_drain(struct mm_thrpool* pool)
+{
+	if (curr_worker && curr_worker->pool == pool)
+		return mm_raise_error(EDEADLK, "cannot drain thread pool "
+		                      "from one of its tasks");
+
+	return mm_thrpool_group_wait(&pool->all);
+}
+
+
+/**
+ * mm_thrpool_group_create() - create a group of tasks
+ *
+ * This function creates an empty group of tasks. Tasks are added to the
+ * group when submitted with mm_thrpool_submit(). A group may collect tasks
+ * submitted to different pools. When no longer needed, the group must be
+ * destroyed with mm_thrpool_group_destroy().
+ *
+ * Return: pointer to the new group in case of success, NULL otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+struct mm_thrpool_group* mm_thrpool_group_create(void)
+{
+	struct mm_thrpool_group* grp;
+
+	grp = malloc(sizeof(*grp));
+	if (!grp) {
+		mm_raise_from_errno("cannot allocate task group");
+		return NULL;
+	}
+
+	group_init(grp);
+	return grp;
+}
+
+
+/**
+ * mm_thrpool_group_destroy() - destroy a group of tasks
+ * @grp:        group to destroy (may be NULL)
+ *
+ * The group must not have pending tasks, ie, mm_thrpool_group_wait() must
+ * have returned since the last submission in @grp.
+ */
+API_EXPORTED
+void mm_thrpool_group_destroy(struct mm_thrpool_group* grp)
+{
+	if (!grp)
+		return;
+
+	group_deinit(grp);
+	free(grp);
+}
+
+
+/**
+ * mm_thrpool_group_wait() - wait for the completion of a group of tasks
+ * @grp:        group to wait
+ *
+ * This function blocks until all the tasks submitted in @grp so far have
+ * completed. It may be called from a task running in a pool: in such a
+ * case, the calling worker executes other pending tasks of its pool while
+ * waiting instead of blocking, which prevents the deadlock that would
+ * occur if all workers were waiting.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_thrpool_group_wait(struct mm_thrpool_group* grp)
+{
+	struct worker* w = curr_worker;
+	struct task* task;
+	struct mm_timespec ts;
+
+	if (!w) {
+		mm_thr_mutex_lock(&grp->mtx);
+		while (__atomic_load_n(&grp->pending, __ATOMIC_ACQUIRE))
+			mm_thr_cond_wait(&grp->cond, &grp->mtx);
+
+		mm_thr_mutex_unlock(&grp->mtx);
+		return 0;
+	}
+
+	while (__atomic_load_n(&grp->pending, __ATOMIC_ACQUIRE)) {
+		task = find_task(w);
+		if (task) {
+			run_task(w->pool, task);
+			continue;
+		}
+
+		// Nothing to help with: sleep a bit since the tasks of the
+		// group may be executed by other workers
+		mm_gettime(MM_CLK_REALTIME, &ts);
+		mm_timeadd_ns(&ts, GROUP_HELP_WAIT_NS);
+		mm_thr_mutex_lock(&grp->mtx);
+		if (__atomic_load_n(&grp->pending, __ATOMIC_ACQUIRE))
+			mm_thr_cond_timedwait(&grp->cond, &grp->mtx, &ts);
+
+		mm_thr_mutex_unlock(&grp->mtx);
+	}
+
+	// The last completion may still be in the critical section of the
+	// group lock: wait for it to finish before the group can be destroyed
+	mm_thr_mutex_lock(&grp->mtx);
+	mm_thr_mutex_unlock(&grp->mtx);
+
+	return 0;
+}
@@ -0,0 +1,721 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "thread-local.h"
+
+/**
+ * DOC: timers
+ *
+ * A timer (struct mm_timer) calls a function once its expiration time has
+ * been reached, and then possibly again at a fixed period. All the timers
+ * of the process are served by a single dispatcher thread, started when
+ * the first timer is created and stopped when the last one is destroyed.
+ * The callbacks are called one at a time from this thread: they must be
+ * short and must not block, otherwise they delay the other timers.
+ *
+ * The armed timers are sorted in a hierarchical timing wheel. The time is
+ * divided into ticks of 65.536us. The first level of the wheel has 256
+ * slots of one tick each, covering the next 16.7ms. Each of the 4 upper
+ * levels has 64 slots, each slot covering the whole span of the level
+ * below: the wheel covers about 78 hours, farther timers are parked in the
+ * last slot until they get closer. A timer is armed or cancelled in
+ * constant time, whatever the number of timers, by linking it in or
+ * unlinking it from the slot of its expiration. When the first level has
+ * made a full turn, the timers of the next slot of the upper level are
+ * redistributed in the levels below.
+ *
+ * The tick only sorts the timers: the dispatcher sleeps until the exact
+ * expiration of the next timer, so the callbacks are not delayed up to the
+ * next tick. Between two expirations, the dispatcher does not wake up at
+ * each tick but skips over the empty slots.
+ *
+ * The delay between the expiration time and the actual call of the
+ * callback (the jitter) is recorded for each timer and can be retrieved
+ * with mm_timer_get_stats().
+ */
+
+#define TICK_SHIFT              16
+#define LVL0_BITS               8
+#define LVL0_SIZE               (1 << LVL0_BITS)
+#define LVL0_MASK               (LVL0_SIZE - 1)
+#define LVLN_BITS               6
+#define LVLN_SIZE               (1 << LVLN_BITS)
+#define LVLN_MASK               (LVLN_SIZE - 1)
+#define NUM_LVLN                4
+#define WHEEL_MAX_DELTA         (UINT64_C(1) << (LVL0_BITS+NUM_LVLN*LVLN_BITS))
+#define NO_TICK                 UINT64_MAX
+
+/**
+ * struct mm_timer - timer served by the dispatcher thread
+ * @next:       next timer in the same wheel slot
+ * @pprev:      pointer to the link pointing to this timer, NULL if the
+ *              timer is not armed
+ * @exp_ns:     next expiration time (in ns of MM_CLK_MONOTONIC)
+ * @period_ns:  period of the timer, 0 if not periodic
+ * @clock_id:   clock of the expiration times passed to mm_timer_arm()
+ * @cb:         function called at expiration
+ * @arg:        argument passed to @cb
+ * @num_expiry: number of calls to @cb
+ * @num_overrun: number of periods skipped
+ * @sum_jitter_ns: sum of the delays of the calls to @cb
+ * @max_jitter_ns: largest delay of the calls to @cb
+ */
+struct mm_timer {
+	struct mm_timer* next;
+	struct mm_timer** pprev;
+	int64_t exp_ns;
+	int64_t period_ns;
+	clockid_t clock_id;
+	mm_timer_cb cb;
+	void* arg;
+	int64_t num_expiry;
+	int64_t num_overrun;
+	int64_t sum_jitter_ns;
+	int64_t max_jitter_ns;
+};
+
+/**
+ * struct timer_wheel - hierarchical timing wheel
+ * @tick:       current tick: all timers expiring before have been fired
+ * @lvl0:       slots of the first level, one per tick
+ * @lvln:       slots of the upper levels
+ */
+struct timer_wheel {
+	uint64_t tick;
+	struct mm_timer* lvl0[LVL0_SIZE];
+	struct mm_timer* lvln[NUM_LVLN][LVLN_SIZE];
+};
+
+/**
+ * struct timer_service - state of the dispatcher thread
+ * @mtx:        lock protecting the wheel and the armed timers
+ * @cond:       condition signaled when the dispatcher must wake up
+ * @idle_cond:  condition signaled when a callback returns
+ * @thid:       dispatcher thread
+ * @stop:       set when the dispatcher must exit
+ * @wakeup_ns:  time until which the dispatcher is sleeping, INT64_MIN if
+ *              it is not sleeping
+ * @running:    timer whose callback is being called, NULL if none
+ * @wheel:      wheel sorting the armed timers
+ */
+struct timer_service {
+	mm_thr_mutex_t mtx;
+	mm_thr_cond_t cond;
+	mm_thr_cond_t idle_cond;
+	mm_thread_t thid;
+	int stop;
+	int64_t wakeup_ns;
+	struct mm_timer* running;
+	struct timer_wheel wheel;
+};
+
+static struct timer_service service = {.mtx = MM_THR_MUTEX_INITIALIZER};
+static mm_thr_mutex_t lifecycle_lock = MM_THR_MUTEX_INITIALIZER;
+static int num_timer;
+static thread_local int in_dispatcher;
+
+
+static
+int64_t get_monotonic_ns(void)
+{
+	struct mm_timespec ts;
+
+	mm_gettime(MM_CLK_MONOTONIC, &ts);
+	return ts.tv_sec * (int64_t)NS_IN_SEC + ts.tv_nsec;
+}
+
+
+static
+int is_valid_timespec(const struct mm_timespec* ts)
+{
+	return (ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < NS_IN_SEC);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       Timing wheel implementation                      *
+ *                                                                        *
+ **************************************************************************/
+
+static
+void timer_link(struct mm_timer** slot, struct mm_timer* timer)
+{
+	timer->next = *slot;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+
+static
+void timer_unlink(struct mm_timer* timer)
+{
+	if (!timer->pprev)
+		return;
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+
+/**
+ * wheel_insert() - link a timer in the slot of its expiration
+ * @w:          timing wheel
+ * @timer:      timer not linked in any slot
+ *
+ * The slot is selected from the distance between the expiration of @timer
+ * and the current tick: the farther, the higher the level.
+ */
+static
+void wheel_insert(struct timer_wheel* w, struct mm_timer* timer)
+{
+	struct mm_timer** slot;
+	uint64_t exp_tick, delta;
+	int lvl, shift;
+
+	exp_tick = 0;
+	if (timer->exp_ns > 0)
+		exp_tick = (uint64_t)timer->exp_ns >> TICK_SHIFT;
+
+	if (exp_tick < w->tick)
+		exp_tick = w->tick;
+
+	delta = exp_tick - w->tick;
+	if (delta < LVL0_SIZE) {
+		timer_link(&w->lvl0[exp_tick & LVL0_MASK], timer);
+		return;
+	}
+
+	// Park too far timers in the farthest slot. They are inserted again
+	// each time the slot is cascaded.
+	if (delta >= WHEEL_MAX_DELTA) {
+		delta = WHEEL_MAX_DELTA - 1;
+		exp_tick = w->tick + delta;
+	}
+
+	shift = LVL0_BITS;
+	for (lvl = 0; delta >= (UINT64_C(1) << (shift + LVLN_BITS)); lvl++)
+		shift += LVLN_BITS;
+
+	slot = &w->lvln[lvl][(exp_tick >> shift) & LVLN_MASK];
+	timer_link(slot, timer);
+}
+
+
+/**
+ * wheel_cascade() - redistribute upper level slots reached by current tick
+ * @w:          timing wheel
+ *
+ * When the current tick is a multiple of the span of a slot of level n, the
+ * slot of level n+1 containing the current tick holds only timers expiring
+ * within the span of this level: they are inserted again in lower levels.
+ */
+static
+void wheel_cascade(struct timer_wheel* w)
+{
+	struct mm_timer * timer, * next;
+	int lvl, shift, idx;
+
+	shift = LVL0_BITS;
+	for (lvl = 0; lvl < NUM_LVLN; lvl++) {
+		if (w->tick & ((UINT64_C(1) << shift) - 1))
+			break;
+
+		idx = (w->tick >> shift) & LVLN_MASK;
+		timer = w->lvln[lvl][idx];
+		w->lvln[lvl][idx] = NULL;
+		for (; timer; timer = next) {
+			next = timer->next;
+			timer->pprev = NULL;
+			timer->next = NULL;
+			wheel_insert(w, timer);
+		}
+
+		shift += LVLN_BITS;
+	}
+}
+
+
+/**
+ * wheel_next_tick() - get the next tick at which the wheel has work
+ * @w:          timing wheel
+ *
+ * Return: the first tick after the current one whose first level slot is
+ * not empty or at which a non empty upper level slot must be cascaded,
+ * NO_TICK if the wheel is empty.
+ */
+static
+uint64_t wheel_next_tick(const struct timer_wheel* w)
+{
+	uint64_t next = NO_TICK;
+	uint64_t base, tick;
+	int i, lvl, shift;
+
+	for (i = 1; i < LVL0_SIZE; i++) {
+		if (w->lvl0[(w->tick + i) & LVL0_MASK]) {
+			next = w->tick + i;
+			break;
+		}
+	}
+
+	shift = LVL0_BITS;
+	for (lvl = 0; lvl < NUM_LVLN; lvl++) {
+		base = w->tick >> shift;
+		for (i = 1; i <= LVLN_SIZE; i++) {
+			if (!w->lvln[lvl][(base + i) & LVLN_MASK])
+				continue;
+
+			tick = (base + i) << shift;
+			if (tick < next)
+				next = tick;
+
+			break;
+		}
+
+		shift += LVLN_BITS;
+	}
+
+	return next;
+}
+
+
+/**
+ * wheel_pop_due() - unlink the next timer whose expiration has passed
+ * @w:          timing wheel
+ * @now:        current time in ns of MM_CLK_MONOTONIC
+ *
+ * Advance the current tick of @w up to @now, skipping over the empty
+ * slots, and stop at the first slot holding timers due.
+ *
+ * Return: the timer with the earliest expiration if any is due, NULL
+ * otherwise.
+ */
+static
+struct mm_timer* wheel_pop_due(struct timer_wheel* w, int64_t now)
+{
+	struct mm_timer * timer, * due;
+	uint64_t target, next;
+
+	target = (uint64_t)now >> TICK_SHIFT;
+	while (1) {
+		due = NULL;
+		timer = w->lvl0[w->tick & LVL0_MASK];
+		for (; timer; timer = timer->next) {
+			if (timer->exp_ns <= now
+			    && (!due || timer->exp_ns < due->exp_ns))
+				due = timer;
+		}
+
+		if (due) {
+			timer_unlink(due);
+			return due;
+		}
+
+		if (w->tick >= target)
+			return NULL;
+
+		next = wheel_next_tick(w);
+		w->tick = (next < target) ? next : target;
+		wheel_cascade(w);
+	}
+}
+
+
+/**
+ * wheel_next_expiry() - get the time at which the dispatcher must wake up
+ * @w:          timing wheel whose current slot has no timer due
+ *
+ * Return: the earliest expiration in the current slot if not empty, the
+ * start of the next tick at which the wheel has work otherwise, INT64_MAX
+ * if the wheel is empty.
+ */
+static
+int64_t wheel_next_expiry(const struct timer_wheel* w)
+{
+	struct mm_timer* timer;
+	int64_t exp_ns = INT64_MAX;
+	uint64_t next;
+
+	timer = w->lvl0[w->tick & LVL0_MASK];
+	for (; timer; timer = timer->next) {
+		if (timer->exp_ns < exp_ns)
+			exp_ns = timer->exp_ns;
+	}
+
+	if (exp_ns != INT64_MAX)
+		return exp_ns;
+
+	next = wheel_next_tick(w);
+	if (next == NO_TICK)
+		return INT64_MAX;
+
+	return (int64_t)(next << TICK_SHIFT);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                           Dispatcher thread                            *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * fire_timer() - call the callback of an expired timer
+ * @svc:        timer service, locked by the dispatcher
+ * @timer:      timer unlinked from the wheel
+ * @now:        current time in ns of MM_CLK_MONOTONIC
+ *
+ * A periodic timer is armed again before the callback is called, so that
+ * it can be cancelled from the callback. The lock of @svc is released
+ * while the callback runs.
+ */
+static
+void fire_timer(struct timer_service* svc, struct mm_timer* timer,
+                int64_t now)
+{
+	int64_t jitter, num_skip;
+
+	jitter = now - timer->exp_ns;
+	timer->num_expiry++;
+	timer->sum_jitter_ns += jitter;
+	if (jitter > timer->max_jitter_ns)
+		timer->max_jitter_ns = jitter;
+
+	if (timer->period_ns) {
+		num_skip = jitter / timer->period_ns;
+		timer->num_overrun += num_skip;
+		timer->exp_ns += (num_skip + 1) * timer->period_ns;
+		wheel_insert(&svc->wheel, timer);
+	}
+
+	svc->running = timer;
+	mm_thr_mutex_unlock(&svc->mtx);
+
+	timer->cb(timer->arg);
+
+	mm_thr_mutex_lock(&svc->mtx);
+	svc->running = NULL;
+	mm_thr_cond_broadcast(&svc->idle_cond);
+}
+
+
+static
+void wait_until(struct timer_service* svc, int64_t wakeup_ns)
+{
+	struct mm_timespec ts;
+
+	svc->wakeup_ns = wakeup_ns;
+
+	if (wakeup_ns == INT64_MAX) {
+		mm_thr_cond_wait(&svc->cond, &svc->mtx);
+	} else {
+		ts.tv_sec = wakeup_ns / NS_IN_SEC;
+		ts.tv_nsec = wakeup_ns % NS_IN_SEC;
+		mm_thr_cond_timedwait(&svc->cond, &svc->mtx, &ts);
+	}
+
+	svc->wakeup_ns = INT64_MIN;
+}
+
+
+static
+void* dispatcher_proc(void* arg)
+{
+	struct timer_service* svc = &service;
+	struct mm_timer* timer;
+	int64_t now;
+
+	(void)arg;
+	in_dispatcher = 1;
+
+	mm_thr_mutex_lock(&svc->mtx);
+
+	while (!svc->stop) {
+		now = get_monotonic_ns();
+		timer = wheel_pop_due(&svc->wheel, now);
+		if (timer) {
+			fire_timer(svc, timer, now);
+			continue;
+		}
+
+		wait_until(svc, wheel_next_expiry(&svc->wheel));
+	}
+
+	mm_thr_mutex_unlock(&svc->mtx);
+
+	return NULL;
+}
+
+
+static
+int start_service(struct timer_service* svc)
+{
+	mm_thr_cond_init(&svc->cond, MM_THR_WAIT_MONOTONIC);
+	mm_thr_cond_init(&svc->idle_cond, 0);
+
+	memset(&svc->wheel, 0, sizeof(svc->wheel));
+	svc->wheel.tick = (uint64_t)get_monotonic_ns() >> TICK_SHIFT;
+	svc->stop = 0;
+	svc->wakeup_ns = INT64_MIN;
+	svc->running = NULL;
+
+	if (mm_thr_create(&svc->thid, dispatcher_proc, NULL)) {
+		mm_thr_cond_deinit(&svc->idle_cond);
+		mm_thr_cond_deinit(&svc->cond);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static
+void stop_service(struct timer_service* svc)
+{
+	mm_thr_mutex_lock(&svc->mtx);
+	svc->stop = 1;
+	mm_thr_cond_signal(&svc->cond);
+	mm_thr_mutex_unlock(&svc->mtx);
+
+	mm_thr_join(svc->thid, NULL);
+
+	mm_thr_cond_deinit(&svc->idle_cond);
+	mm_thr_cond_deinit(&svc->cond);
+}
+
+
+/**************************************************************************
+ *                                                                        *
+ *                               Timer API                                *
+ *                                                                        *
+ **************************************************************************/
+
+/**
+ * mm_timer_create() - create a timer
+ * @clock_id:   clock of the expiration times, MM_CLK_MONOTONIC or
+ *              MM_CLK_REALTIME
+ * @cb:         function to call when the timer expires
+ * @arg:        argument passed to @cb
+ *
+ * Create a disarmed timer which calls @cb from the dispatcher thread when
+ * it expires. The timer is armed with mm_timer_arm(). The dispatcher thread
+ * is started if this is the first timer of the process.
+ *
+ * Return: pointer to the timer in case of success, NULL otherwise with
+ * error state set accordingly.
+ */
+API_EXPORTED
+struct mm_timer* mm_timer_create(clockid_t clock_id, mm_timer_cb cb,
+                                 void* arg)
+{
+	struct mm_timer* timer;
+	int rv = 0;
+
+	if (clock_id != MM_CLK_MONOTONIC && clock_id != MM_CLK_REALTIME) {
+		mm_raise_error(EINVAL, "Unsupported clock id for timer: %i",
+		               (int)clock_id);
+		return NULL;
+	}
+
+	if (!cb) {
+		mm_raise_error(EINVAL, "Timer callback cannot be NULL");
+		return NULL;
+	}
+
+	timer = malloc(sizeof(*timer));
+	if (!timer) {
+		mm_raise_from_errno("Cannot allocate timer");
+		return NULL;
+	}
+
+	*timer = (struct mm_timer) {
+		.clock_id = clock_id,
+		.cb = cb,
+		.arg = arg,
+	};
+
+	mm_thr_mutex_lock(&lifecycle_lock);
+	if (num_timer == 0)
+		rv = start_service(&service);
+
+	if (rv == 0)
+		num_timer++;
+
+	mm_thr_mutex_unlock(&lifecycle_lock);
+
+	if (rv) {
+		free(timer);
+		return NULL;
+	}
+
+	return timer;
+}
+
+
+/**
+ * mm_timer_destroy() - disarm and free a timer
+ * @timer:      timer to destroy (may be NULL)
+ *
+ * Cancel @timer as mm_timer_cancel() does and free it. If this is the last
+ * timer of the process, the dispatcher thread is stopped. This function
+ * must not be called from a timer callback.
+ */
+API_EXPORTED
+void mm_timer_destroy(struct mm_timer* timer)
+{
+	if (!timer)
+		return;
+
+	mm_timer_cancel(timer);
+
+	mm_thr_mutex_lock(&lifecycle_lock);
+	if (--num_timer == 0)
+		stop_service(&service);
+
+	mm_thr_mutex_unlock(&lifecycle_lock);
+
+	free(timer);
+}
+
+
+/**
+ * mm_timer_arm() - set the expiration of a timer
+ * @timer:      timer to arm
+ * @flags:      0 or MM_TIMER_ABSTIME
+ * @value:      expiration time
+ * @period:     period of the timer, NULL or zero for a one-shot timer
+ *
+ * Arm @timer to expire at @value. If @flags contains MM_TIMER_ABSTIME,
+ * @value is an absolute time of the clock of @timer, otherwise it is an
+ * interval from now. If @period is not zero, the timer expires again every
+ * @period after the first expiration. If the callback is called too late
+ * for one or several periods, these periods are skipped and accounted as
+ * overruns in the statistics of the timer.
+ *
+ * The timers are sorted in the time base of MM_CLK_MONOTONIC: an absolute
+ * time of MM_CLK_REALTIME is converted when the timer is armed, a later
+ * change of the system time is not taken into account.
+ *
+ * If @timer was already armed, its previous expiration is replaced. This
+ * function may be called from a timer callback.
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set
+ * accordingly.
+ */
+API_EXPORTED
+int mm_timer_arm(struct mm_timer* timer, int flags,
+                 const struct mm_timespec* value,
+                 const struct mm_timespec* period)
+{
+	struct timer_service* svc = &service;
+	struct mm_timespec now;
+	int64_t exp_ns;
+
+	if (!is_valid_timespec(value)
+	    || (period && !is_valid_timespec(period))) {
+		mm_raise_error(EINVAL, "Invalid timer expiration or period");
+		return -1;
+	}
+
+	exp_ns = get_monotonic_ns();
+	if (flags & MM_TIMER_ABSTIME) {
+		mm_gettime(timer->clock_id, &now);
+		exp_ns += mm_timediff_ns(value, &now);
+	} else {
+		exp_ns += value->tv_sec * (int64_t)NS_IN_SEC + value->tv_nsec;
+	}
+
+	mm_thr_mutex_lock(&svc->mtx);
+
+	timer_unlink(timer);
+	timer->exp_ns = exp_ns;
+	timer->period_ns = 0;
+	if (period)
+		timer->period_ns = period->tv_sec * (int64_t)NS_IN_SEC
+		                   + period->tv_nsec;
+
+	wheel_insert(&svc->wheel, timer);
+
+	// Wake up the dispatcher if it sleeps past the new expiration
+	if (exp_ns < svc->wakeup_ns)
+		mm_thr_cond_signal(&svc->cond);
+
+	mm_thr_mutex_unlock(&svc->mtx);
+
+	return 0;
+}
+
+
+/**
+ * mm_timer_cancel() - disarm a timer
+ * @timer:      timer to disarm
+ *
+ * Disarm @timer if it is armed. If the callback of @timer is running, this
+ * function waits for it to return, unless it is called from a timer
+ * callback. Once this function has returned, the callback will not be
+ * called until the timer is armed again.
+ *
+ * Return: 0
+ */
+API_EXPORTED
+int mm_timer_cancel(struct mm_timer* timer)
+{
+	struct timer_service* svc = &service;
+
+	mm_thr_mutex_lock(&svc->mtx);
+
+	timer_unlink(timer);
+	while (svc->running == timer && !in_dispatcher)
+		mm_thr_cond_wait(&svc->idle_cond, &svc->mtx);
+
+	mm_thr_mutex_unlock(&svc->mtx);
+
+	return 0;
+}
+
+
+/**
+ * mm_timer_get_stats() - get the expiration statistics of a timer
+ * @timer:      timer whose statistics must be retrieved
+ * @stats:      structure receiving the statistics
+ *
+ * Retrieve the number of calls of the callback of @timer since its
+ * creation, the number of periods skipped and the jitter of the calls,
+ * ie the delay between each expiration time and the call of the callback.
+ */
+API_EXPORTED
+void mm_timer_get_stats(struct mm_timer* timer, struct mm_timer_stats* stats)
+{
+	struct timer_service* svc = &service;
+
+	mm_thr_mutex_lock(&svc->mtx);
+
+	stats->num_expiry = timer->num_expiry;
+	stats->num_overrun = timer->num_overrun;
+	stats->max_jitter_ns = timer->max_jitter_ns;
+	stats->mean_jitter_ns = 0;
+	if (timer->num_expiry)
+		stats->mean_jitter_ns = timer->sum_jitter_ns
+		                        / timer->num_expiry;
+
+	mm_thr_mutex_unlock(&svc->mtx);
+}
@@ -0,0 +1,35 @@
+/*
+ * @mindmaze_header@
+ */
+#ifndef TOPOLOGY_INTERNAL_H
+#define TOPOLOGY_INTERNAL_H
+
+#include "mmthread.h"
+
+/*
+ * read_cpu_topology() - read the topology of the online CPUs from the system
+ * @cpus:       array of MM_CPUSET_SIZE elements receiving the CPUs
+ *
+ * Implemented in the platform specific files. The CPUs must be reported in
+ * increasing order of index. For each CPU, the fields of @cpus other than
+ * cpu are filled with keys identifying the domain instances: two CPUs
+ * sharing a domain must have the same key, lower than MM_CPUSET_SIZE. A
+ * key of -1 means unknown. The keys are turned into dense ids by the
+ * caller. If the system does not provide the topology, each CPU must be
+ * reported as its own core.
+ *
+ * Return: the number of CPUs written in @cpus (at least 1)
+ */
+int read_cpu_topology(struct mm_cpu_info* cpus);
+
+/*
+ * get_num_cpu() - get the number of online CPUs
+ *
+ * Implemented in the platform specific files. Unlike read_cpu_topology(),
+ * this is cheap and not bounded by MM_CPUSET_SIZE.
+ *
+ * Return: the number of online CPUs (at least 1)
+ */
+int get_num_cpu(void);
+
+#endif /* TOPOLOGY_INTERNAL_H */
@@ -0,0 +1,268 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmthread.h"
+#include "topology-internal.h"
+
+#define SYSFS_CPU_DIR   "/sys/devices/system/cpu"
+
+
+/**
+ * read_sysfs() - read a small text file
+ * @path:       path of the file
+ * @buf:        buffer receiving the null-terminated content
+ * @size:       size of @buf
+ *
+ * Return: 0 in case of success, -1 otherwise
+ */
+static
+int read_sysfs(const char* path, char* buf, size_t size)
+{
+	ssize_t rsz;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	rsz = read(fd, buf, size - 1);
+	close(fd);
+	if (rsz <= 0)
+		return -1;
+
+	buf[rsz] = '\0';
+	return 0;
+}
+
+
+/**
+ * read_sysfs_int() - read an integer from a sysfs file
+ * @path:       path of the file
+ * @defval:     value to return if the file cannot be read
+ *
+ * Return: the integer read in the file, @defval if it cannot be read
+ */
+static
+int read_sysfs_int(const char* path, int defval)
+{
+	char buf[32];
+
+	if (read_sysfs(path, buf, sizeof(buf)))
+		return defval;
+
+	return atoi(buf);
+}
+
+
+/**
+ * parse_cpu_list() - parse a list of CPUs as written by the kernel
+ * @str:        list of CPUs, for example "0-3,8,10-11"
+ * @set:        CPU set receiving the CPUs of the list
+ *
+ * Return: the lowest CPU of the list, -1 if it is empty or invalid
+ */
+static
+int parse_cpu_list(const char* str, struct mm_cpuset* set)
+{
+	char* end;
+	long first, last, cpu, lowest = -1;
+
+	mm_cpuset_zero(set);
+	while (*str >= '0' && *str <= '9') {
+		first = strtol(str, &end, 10);
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		if (first < 0 || last >= MM_CPUSET_SIZE || first > last)
+			return -1;
+
+		for (cpu = first; cpu <= last; cpu++)
+			mm_cpuset_set(set, cpu);
+
+		if (lowest < 0 || first < lowest)
+			lowest = first;
+
+		str = (*end == ',') ? end + 1 : end;
+	}
+
+	return lowest;
+}
+
+
+/**
+ * read_sysfs_first_cpu() - read the lowest CPU of a CPU list file
+ * @path:       path of a file containing a list of CPUs
+ *
+ * Return: the lowest CPU of the list, -1 if it cannot be read
+ */
+static
+int read_sysfs_first_cpu(const char* path)
+{
+	struct mm_cpuset set;
+	char buf[4096];
+
+	if (read_sysfs(path, buf, sizeof(buf)))
+		return -1;
+
+	return parse_cpu_list(buf, &set);
+}
+
+
+/**
+ * read_cpu_node() - find the NUMA node of a CPU
+ * @cpu:        index of the CPU
+ *
+ * Return: the NUMA node of @cpu, 0 if the system does not report it
+ */
+static
+int read_cpu_node(int cpu)
+{
+	char path[128];
+	DIR* dir;
+	struct dirent* entry;
+	int node = 0;
+
+	sprintf(path, SYSFS_CPU_DIR "/cpu%i", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	// The node is exposed as a link named after it in the CPU folder
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "node", 4) == 0
+		    && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+
+/**
+ * read_cpu_caches() - find the L2 and L3 caches of a CPU
+ * @info:       CPU whose cache keys must be filled
+ *
+ * A cache is identified by the lowest CPU sharing it.
+ */
+static
+void read_cpu_caches(struct mm_cpu_info* info)
+{
+	char path[128], type[32];
+	int index, level, key;
+
+	info->l2 = -1;
+	info->l3 = -1;
+
+	for (index = 0; ; index++) {
+		sprintf(path, SYSFS_CPU_DIR "/cpu%i/cache/index%i/level",
+		        info->cpu, index);
+		level = read_sysfs_int(path, -1);
+		if (level < 0)
+			break;
+
+		sprintf(path, SYSFS_CPU_DIR "/cpu%i/cache/index%i/type",
+		        info->cpu, index);
+		if (read_sysfs(path, type, sizeof(type))
+		    || strncmp(type, "Instruction", 11) == 0)
+			continue;
+
+		sprintf(path,
+		        SYSFS_CPU_DIR "/cpu%i/cache/index%i/shared_cpu_list",
+		        info->cpu, index);
+		key = read_sysfs_first_cpu(path);
+		if (level == 2)
+			info->l2 = key;
+		else if (level == 3)
+			info->l3 = key;
+	}
+}
+
+
+/**
+ * read_cpu_info() - read the topology of a CPU from sysfs
+ * @info:       CPU whose keys must be filled (@info->cpu must be set)
+ */
+static
+void read_cpu_info(struct mm_cpu_info* info)
+{
+	char path[128];
+	int key;
+
+	// A core is identified by its lowest SMT sibling
+	sprintf(path, SYSFS_CPU_DIR "/cpu%i/topology/thread_siblings_list",
+	        info->cpu);
+	key = read_sysfs_first_cpu(path);
+	info->core = (key < 0) ? info->cpu : key;
+
+	sprintf(path, SYSFS_CPU_DIR "/cpu%i/topology/physical_package_id",
+	        info->cpu);
+	key = read_sysfs_int(path, 0);
+	info->package = (key < 0) ? 0 : key;
+
+	info->node = read_cpu_node(info->cpu);
+	read_cpu_caches(info);
+}
+
+
+/* doc in topology-internal.h */
+LOCAL_SYMBOL
+int get_num_cpu(void)
+{
+	long num;
+
+	num = sysconf(_SC_NPROCESSORS_ONLN);
+	return (num > 0) ? num : 1;
+}
+
+
+/* doc in topology-internal.h */
+LOCAL_SYMBOL
+int read_cpu_topology(struct mm_cpu_info* cpus)
+{
+	struct mm_cpuset online;
+	char buf[4096];
+	int cpu, num_online, num = 0;
+
+	if (read_sysfs(SYSFS_CPU_DIR "/online", buf, sizeof(buf))
+	    || parse_cpu_list(buf, &online) < 0) {
+		// No sysfs: report the CPUs as cores without any topology
+		num_online = get_num_cpu();
+		if (num_online > MM_CPUSET_SIZE)
+			num_online = MM_CPUSET_SIZE;
+
+		for (cpu = 0; cpu < num_online; cpu++) {
+			cpus[cpu] = (struct mm_cpu_info) {
+				.cpu = cpu, .core = cpu,
+				.l2 = -1, .l3 = -1,
+			};
+		}
+
+		return num_online;
+	}
+
+	for (cpu = 0; cpu < MM_CPUSET_SIZE; cpu++) {
+		if (!mm_cpuset_isset(&online, cpu))
+			continue;
+
+		cpus[num].cpu = cpu;
+		read_cpu_info(&cpus[num]);
+		num++;
+	}
+
+	return num;
+}
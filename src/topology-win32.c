@@ -0,0 +1,168 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <windows.h>
+#include <stdlib.h>
+
+#include "mmthread.h"
+#include "topology-internal.h"
+
+#define MAX_GROUP_CPU   64
+
+
+/**
+ * set_key_from_mask() - set the key of the CPUs of a processor group mask
+ * @keys:       array of MAX_GROUP_CPU keys indexed by CPU
+ * @gmask:      group affinity of the domain instance
+ * @key:        key to set
+ *
+ * Only the CPUs of the first processor group are considered.
+ */
+static
+void set_key_from_mask(int* keys, const GROUP_AFFINITY* gmask, int key)
+{
+	int cpu;
+
+	if (gmask->Group != 0)
+		return;
+
+	for (cpu = 0; cpu < MAX_GROUP_CPU; cpu++) {
+		if (gmask->Mask & ((KAFFINITY)1 << cpu))
+			keys[cpu] = key;
+	}
+}
+
+
+/* doc in topology-internal.h */
+LOCAL_SYMBOL
+int get_num_cpu(void)
+{
+	SYSTEM_INFO sysinfo;
+
+	GetSystemInfo(&sysinfo);
+	return (sysinfo.dwNumberOfProcessors > 0)
+	       ? (int)sysinfo.dwNumberOfProcessors : 1;
+}
+
+
+/**
+ * read_fallback_topology() - report the CPUs as cores without topology
+ * @cpus:       array receiving the CPUs
+ *
+ * Return: the number of CPUs written in @cpus
+ */
+static
+int read_fallback_topology(struct mm_cpu_info* cpus)
+{
+	int cpu, num;
+
+	num = get_num_cpu();
+	if (num > MAX_GROUP_CPU)
+		num = MAX_GROUP_CPU;
+
+	for (cpu = 0; cpu < num; cpu++) {
+		cpus[cpu] = (struct mm_cpu_info) {
+			.cpu = cpu, .core = cpu,
+			.l2 = -1, .l3 = -1,
+		};
+	}
+
+	return num;
+}
+
+
+/* doc in topology-internal.h */
+LOCAL_SYMBOL
+int read_cpu_topology(struct mm_cpu_info* cpus)
+{
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* info;
+	char* buf;
+	char* ptr;
+	DWORD len = 0;
+	WORD i;
+	int cpu, num = 0, num_core = 0, num_package = 0, num_cache = 0;
+	int core[MAX_GROUP_CPU], package[MAX_GROUP_CPU], node[MAX_GROUP_CPU];
+	int l2[MAX_GROUP_CPU], l3[MAX_GROUP_CPU];
+
+	GetLogicalProcessorInformationEx(RelationAll, NULL, &len);
+	buf = malloc(len);
+	if (!buf || !GetLogicalProcessorInformationEx(RelationAll,
+	                                              (void*)buf, &len)) {
+		free(buf);
+		return read_fallback_topology(cpus);
+	}
+
+	for (cpu = 0; cpu < MAX_GROUP_CPU; cpu++) {
+		core[cpu] = package[cpu] = -1;
+		node[cpu] = l2[cpu] = l3[cpu] = -1;
+	}
+
+	// Each entry describes one instance of a domain with the mask of its
+	// CPUs: the rank of the entry in its domain is used as key
+	for (ptr = buf; ptr < buf + len; ptr += info->Size) {
+		info = (void*)ptr;
+		switch (info->Relationship) {
+		case RelationProcessorCore:
+			set_key_from_mask(core, &info->Processor.GroupMask[0],
+			                  num_core++);
+			break;
+
+		case RelationProcessorPackage:
+			for (i = 0; i < info->Processor.GroupCount; i++)
+				set_key_from_mask(package,
+				                  &info->Processor.GroupMask[i],
+				                  num_package);
+
+			num_package++;
+			break;
+
+		case RelationNumaNode:
+			set_key_from_mask(node, &info->NumaNode.GroupMask,
+			                  info->NumaNode.NodeNumber);
+			break;
+
+		case RelationCache:
+			if (info->Cache.Type == CacheInstruction)
+				break;
+
+			if (info->Cache.Level == 2)
+				set_key_from_mask(l2, &info->Cache.GroupMask,
+				                  num_cache++);
+			else if (info->Cache.Level == 3)
+				set_key_from_mask(l3, &info->Cache.GroupMask,
+				                  num_cache++);
+
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	free(buf);
+
+	// The CPUs of the first group are those which belong to a core
+	for (cpu = 0; cpu < MAX_GROUP_CPU; cpu++) {
+		if (core[cpu] < 0)
+			continue;
+
+		cpus[num] = (struct mm_cpu_info) {
+			.cpu = cpu,
+			.core = core[cpu],
+			.package = package[cpu] < 0 ? 0 : package[cpu],
+			.node = node[cpu] < 0 ? 0 : node[cpu],
+			.l2 = l2[cpu],
+			.l3 = l3[cpu],
+		};
+		num++;
+	}
+
+	if (!num)
+		return read_fallback_topology(cpus);
+
+	return num;
+}
@@ -0,0 +1,227 @@
+/*
+ * @mindmaze_header@
+ */
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmthread.h"
+#include "topology-internal.h"
+
+#define NUM_CPU_DOMAIN  5
+
+/**
+ * DOC: CPU topology
+ *
+ * Placing the threads of an application well requires to know how the
+ * logical CPUs relate to each other: two SMT siblings share the execution
+ * units of a physical core, the cores of a package often share a L3 cache,
+ * and the memory is closer to the CPUs of some NUMA node than to the
+ * others. mm_cpu_topology_get() reports for each online logical CPU the
+ * core, package, NUMA node and L2 and L3 caches it belongs to.
+ *
+ * The topology is read from the system at the first call (from
+ * /sys/devices/system/cpu on Linux) and cached for the lifetime of the
+ * process: CPUs brought online or offline afterwards are not reported.
+ *
+ * mm_cpu_topology_cpuset() and mm_cpu_topology_spread() build CPU sets out
+ * of the topology which can be passed to mm_thr_setaffinity() or in the
+ * attributes of mm_thr_create_ex(). For example, a pool of compute bound
+ * threads typically gets one CPU per physical core with:
+ *
+ * .. code-block:: c
+ *
+ *    mm_cpu_topology_spread(&cpuset, MM_CPU_DOMAIN_CORE);
+ *
+ * On Windows, only the first 64 CPUs are reported.
+ */
+
+static struct mm_cpu_info cpu_infos[MM_CPUSET_SIZE];
+static struct mm_cpu_topology topology = {.cpus = cpu_infos};
+static mm_thr_once_t topology_once = MM_THR_ONCE_INIT;
+
+
+/**
+ * domain_id() - get the id of a CPU in a topology domain
+ * @info:       CPU whose id must be retrieved
+ * @domain:     MM_CPU_DOMAIN_* value (must be valid)
+ *
+ * Return: pointer to the id field of @info associated with @domain
+ */
+static
+int* domain_id(struct mm_cpu_info* info, int domain)
+{
+	switch (domain) {
+	case MM_CPU_DOMAIN_CORE: return &info->core;
+	case MM_CPU_DOMAIN_PACKAGE: return &info->package;
+	case MM_CPU_DOMAIN_NODE: return &info->node;
+	case MM_CPU_DOMAIN_L2: return &info->l2;
+	default: return &info->l3;
+	}
+}
+
+
+static
+int* domain_count(int domain)
+{
+	switch (domain) {
+	case MM_CPU_DOMAIN_CORE: return &topology.num_core;
+	case MM_CPU_DOMAIN_PACKAGE: return &topology.num_package;
+	case MM_CPU_DOMAIN_NODE: return &topology.num_node;
+	case MM_CPU_DOMAIN_L2: return &topology.num_l2;
+	default: return &topology.num_l3;
+	}
+}
+
+
+/**
+ * densify_domain() - replace the keys of a domain by dense ids
+ * @domain:     MM_CPU_DOMAIN_* value
+ *
+ * Each distinct key reported by the system for @domain is replaced by an
+ * id numbered from 0 in the order of the lowest CPU sharing the key. The
+ * unknown keys are set to -1.
+ */
+static
+void densify_domain(int domain)
+{
+	int key_to_id[MM_CPUSET_SIZE];
+	int i, key, num_id = 0;
+	int* id;
+
+	for (i = 0; i < MM_CPUSET_SIZE; i++)
+		key_to_id[i] = -1;
+
+	for (i = 0; i < topology.num_cpu; i++) {
+		id = domain_id(&cpu_infos[i], domain);
+		key = *id;
+		if (key < 0 || key >= MM_CPUSET_SIZE) {
+			*id = -1;
+			continue;
+		}
+
+		if (key_to_id[key] < 0)
+			key_to_id[key] = num_id++;
+
+		*id = key_to_id[key];
+	}
+
+	*domain_count(domain) = num_id;
+}
+
+
+static
+void init_topology(void)
+{
+	int domain;
+
+	topology.num_cpu = read_cpu_topology(cpu_infos);
+	for (domain = 0; domain < NUM_CPU_DOMAIN; domain++)
+		densify_domain(domain);
+}
+
+
+/**
+ * mm_cpu_topology_get() - get the topology of the online CPUs
+ *
+ * The topology is read from the system at the first call and the same
+ * object is returned at the subsequent calls. This function is thread-safe.
+ *
+ * If the system does not expose the topology, each online CPU is reported
+ * as a core of its own, in package 0 and NUMA node 0, with unknown caches.
+ *
+ * Return: pointer to the topology of the machine. It must not be modified
+ * and remains valid until the library is unloaded.
+ */
+API_EXPORTED
+const struct mm_cpu_topology* mm_cpu_topology_get(void)
+{
+	mm_thr_once(&topology_once, init_topology);
+	return &topology;
+}
+
+
+/**
+ * mm_cpu_topology_cpuset() - get the CPUs of a domain instance
+ * @set:        CPU set receiving the result
+ * @domain:     MM_CPU_DOMAIN_CORE, MM_CPU_DOMAIN_PACKAGE,
+ *              MM_CPU_DOMAIN_NODE, MM_CPU_DOMAIN_L2 or MM_CPU_DOMAIN_L3
+ * @id:         id of the instance of @domain
+ *
+ * Set @set to the CPUs belonging to the instance @id of @domain, for
+ * example the SMT siblings of core @id or the CPUs of NUMA node @id.
+ *
+ * Return: the number of CPUs in @set in case of success, -1 otherwise with
+ * error state set accordingly. The error is EINVAL if @domain is invalid or
+ * if @id is negative or not lower than the number of instances of @domain.
+ */
+API_EXPORTED
+int mm_cpu_topology_cpuset(struct mm_cpuset* set, int domain, int id)
+{
+	int i, num = 0;
+
+	mm_thr_once(&topology_once, init_topology);
+
+	if (domain < 0 || domain >= NUM_CPU_DOMAIN)
+		return mm_raise_error(EINVAL, "invalid CPU domain %i", domain);
+
+	if (id < 0 || id >= *domain_count(domain))
+		return mm_raise_error(EINVAL, "invalid id %i for CPU domain %i",
+		                      id, domain);
+
+	mm_cpuset_zero(set);
+	for (i = 0; i < topology.num_cpu; i++) {
+		if (*domain_id(&cpu_infos[i], domain) != id)
+			continue;
+
+		mm_cpuset_set(set, cpu_infos[i].cpu);
+		num++;
+	}
+
+	return num;
+}
+
+
+/**
+ * mm_cpu_topology_spread() - get one CPU per instance of a domain
+ * @set:        CPU set receiving the result
+ * @domain:     MM_CPU_DOMAIN_CORE, MM_CPU_DOMAIN_PACKAGE,
+ *              MM_CPU_DOMAIN_NODE, MM_CPU_DOMAIN_L2 or MM_CPU_DOMAIN_L3
+ *
+ * Set @set to the lowest CPU of each instance of @domain. With
+ * MM_CPU_DOMAIN_CORE, @set contains one CPU per physical core, ie, no SMT
+ * siblings: threads placed on those CPUs do not compete for the execution
+ * units of a core. With MM_CPU_DOMAIN_L3, the threads placed on @set do
+ * not share their last level cache.
+ *
+ * Return: the number of CPUs in @set in case of success, -1 otherwise with
+ * error state set accordingly. The error is EINVAL if @domain is invalid.
+ * If the instances of @domain are unknown, @set is empty.
+ */
+API_EXPORTED
+int mm_cpu_topology_spread(struct mm_cpuset* set, int domain)
+{
+	int i, id, num = 0;
+
+	mm_thr_once(&topology_once, init_topology);
+
+	if (domain < 0 || domain >= NUM_CPU_DOMAIN)
+		return mm_raise_error(EINVAL, "invalid CPU domain %i", domain);
+
+	// Ids are numbered in the order of the lowest CPU of each instance
+	mm_cpuset_zero(set);
+	for (i = 0; i < topology.num_cpu; i++) {
+		id = *domain_id(&cpu_infos[i], domain);
+		if (id != num)
+			continue;
+
+		mm_cpuset_set(set, cpu_infos[i].cpu);
+		num++;
+	}
+
+	return num;
+}
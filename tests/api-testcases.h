@@ -8,7 +8,23 @@
 
 TCase* create_allocation_tcase(void);
 TCase* create_time_tcase(void);
+TCase* create_timer_tcase(void);
 TCase* create_thread_tcase(void);
+TCase* create_thrpool_tcase(void);
+TCase* create_rwlock_tcase(void);
+TCase* create_sem_tcase(void);
+TCase* create_barrier_tcase(void);
+TCase* create_queue_tcase(void);
+TCase* create_atomic_tcase(void);
+TCase* create_lockstat_tcase(void);
+TCase* create_seqlock_tcase(void);
+TCase* create_qlock_tcase(void);
+TCase* create_ebr_tcase(void);
+TCase* create_evloop_tcase(void);
+TCase* create_topology_tcase(void);
+TCase* create_pcpu_tcase(void);
+TCase* create_profile_tcase(void);
+TCase* create_mcond_tcase(void);
 TCase* create_file_tcase(void);
 TCase* create_socket_tcase(void);
 TCase* create_ipc_tcase(void);
@@ -0,0 +1,135 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+
+#define NUM_THREAD      8
+#define NUM_ITER        100000
+
+static uint32_t counter32;
+static uint64_t counter64;
+static int64_t cas_counter;
+
+
+START_TEST(ops_32)
+{
+	uint32_t u = 5, expected;
+	int32_t i = -5;
+
+	ck_assert_int_eq(mm_atomic_load_u32(&u, MM_ATOMIC_ACQUIRE), 5);
+	mm_atomic_store_u32(&u, 10, MM_ATOMIC_RELEASE);
+	ck_assert_int_eq(u, 10);
+	ck_assert_int_eq(mm_atomic_exchange_u32(&u, 3, MM_ATOMIC_ACQ_REL), 10);
+	ck_assert_int_eq(mm_atomic_fetch_add_u32(&u, 4, MM_ATOMIC_SEQ_CST), 3);
+	ck_assert_int_eq(mm_atomic_fetch_sub_u32(&u, 2, MM_ATOMIC_RELAXED), 7);
+	ck_assert_int_eq(mm_atomic_fetch_or_u32(&u, 0x10, MM_ATOMIC_RELAXED), 5);
+	ck_assert_int_eq(mm_atomic_fetch_and_u32(&u, 0x11, MM_ATOMIC_RELAXED),
+	                 0x15);
+	ck_assert_int_eq(u, 0x11);
+
+	expected = 0;
+	ck_assert(!mm_atomic_cas_u32(&u, &expected, 1, MM_ATOMIC_SEQ_CST));
+	ck_assert_int_eq(expected, 0x11);
+	ck_assert(mm_atomic_cas_u32(&u, &expected, 1, MM_ATOMIC_SEQ_CST));
+	ck_assert_int_eq(u, 1);
+
+	ck_assert_int_eq(mm_atomic_fetch_add_i32(&i, -3, MM_ATOMIC_SEQ_CST), -5);
+	ck_assert_int_eq(mm_atomic_load_i32(&i, MM_ATOMIC_RELAXED), -8);
+}
+END_TEST
+
+
+START_TEST(ops_64_ptr)
+{
+	uint64_t u = UINT64_C(1) << 40;
+	int64_t i = INT64_MIN;
+	int a, b;
+	void* ptr = &a;
+	void* expected = &b;
+
+	ck_assert(mm_atomic_fetch_add_u64(&u, 1, MM_ATOMIC_SEQ_CST)
+	          == UINT64_C(1) << 40);
+	ck_assert(mm_atomic_load_u64(&u, MM_ATOMIC_ACQUIRE)
+	          == (UINT64_C(1) << 40) + 1);
+	ck_assert(mm_atomic_fetch_sub_i64(&i, -1, MM_ATOMIC_SEQ_CST)
+	          == INT64_MIN);
+	ck_assert(i == INT64_MIN + 1);
+
+	ck_assert(!mm_atomic_cas_ptr(&ptr, &expected, NULL, MM_ATOMIC_SEQ_CST));
+	ck_assert(expected == &a);
+	ck_assert(mm_atomic_cas_ptr(&ptr, &expected, &b, MM_ATOMIC_SEQ_CST));
+	ck_assert(mm_atomic_exchange_ptr(&ptr, NULL, MM_ATOMIC_SEQ_CST) == &b);
+	ck_assert(mm_atomic_load_ptr(&ptr, MM_ATOMIC_ACQUIRE) == NULL);
+}
+END_TEST
+
+
+static
+void* increment_proc(void* arg)
+{
+	int64_t val;
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_atomic_fetch_add_u32(&counter32, 1, MM_ATOMIC_RELAXED);
+		mm_atomic_fetch_add_u64(&counter64, 2, MM_ATOMIC_RELAXED);
+
+		val = mm_atomic_load_i64(&cas_counter, MM_ATOMIC_RELAXED);
+		while (!mm_atomic_cas_i64(&cas_counter, &val, val + 1,
+		                          MM_ATOMIC_RELAXED))
+			mm_cpu_relax();
+	}
+
+	return NULL;
+}
+
+
+START_TEST(concurrent_increment)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	counter32 = 0;
+	counter64 = 0;
+	cas_counter = 0;
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], increment_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(counter32, NUM_THREAD * NUM_ITER);
+	ck_assert(counter64 == 2 * NUM_THREAD * NUM_ITER);
+	ck_assert(cas_counter == NUM_THREAD * NUM_ITER);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_atomic_tcase(void)
+{
+	TCase *tc = tcase_create("atomic");
+	tcase_add_test(tc, ops_32);
+	tcase_add_test(tc, ops_64_ptr);
+	tcase_add_test(tc, concurrent_increment);
+
+	return tc;
+}
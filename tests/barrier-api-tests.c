@@ -0,0 +1,229 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdatomic.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "sync-testlib.h"
+#include "threaddata-manipulation.h"
+
+#define NUM_THREAD      8
+#define NUM_PHASE       2000
+#define TIMEOUT_MS      50
+#define NUM_PROC        4
+#define NUM_PROC_PHASE  200
+#define WAIT_MAX_MS     10000
+
+static mm_thr_barrier_t barrier;
+static mm_thr_latch_t latch;
+static atomic_int num_serial;
+static atomic_int num_done;
+static atomic_int failed;
+static atomic_int phase_data[NUM_THREAD];
+
+
+static
+void count_serial(int ret)
+{
+	if (ret == MM_THR_BARRIER_SERIAL_THREAD)
+		atomic_fetch_add(&num_serial, 1);
+	else if (ret != 0)
+		atomic_store(&failed, 1);
+}
+
+
+/*
+ * Each thread publishes the phase number, meets the others at the barrier
+ * and checks that all threads have published the same phase.
+ */
+static
+void* phase_proc(void* arg)
+{
+	int id = *(int*)arg;
+	int i, j;
+
+	for (i = 0; i < NUM_PHASE; i++) {
+		atomic_store(&phase_data[id], i);
+		count_serial(mm_thr_barrier_wait(&barrier));
+
+		for (j = 0; j < NUM_THREAD; j++) {
+			if (atomic_load(&phase_data[j]) != i)
+				atomic_store(&failed, 1);
+		}
+
+		count_serial(mm_thr_barrier_wait(&barrier));
+	}
+
+	return NULL;
+}
+
+
+START_TEST(barrier_phases)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int ids[NUM_THREAD];
+	int i;
+
+	atomic_store(&num_serial, 0);
+	atomic_store(&failed, 0);
+	ck_assert(mm_thr_barrier_init(&barrier, NUM_THREAD,
+	                              sync_type_flags[_i]) == 0);
+
+	for (i = 0; i < NUM_THREAD; i++) {
+		ids[i] = i;
+		mm_thr_create(&thids[i], phase_proc, &ids[i]);
+	}
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&failed), 0);
+	ck_assert_int_eq(atomic_load(&num_serial), 2*NUM_PHASE);
+	mm_thr_barrier_deinit(&barrier);
+}
+END_TEST
+
+
+START_TEST(barrier_single_thread)
+{
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	ck_assert(mm_thr_barrier_init(&barrier, 0, 0) == EINVAL);
+
+	ck_assert(mm_thr_barrier_init(&barrier, 1, 0) == 0);
+	ck_assert(mm_thr_barrier_wait(&barrier) == MM_THR_BARRIER_SERIAL_THREAD);
+	ck_assert(mm_thr_barrier_wait(&barrier) == MM_THR_BARRIER_SERIAL_THREAD);
+	mm_thr_barrier_deinit(&barrier);
+}
+END_TEST
+
+
+static
+void* latch_waiter_proc(void* arg)
+{
+	(void)arg;
+
+	mm_thr_latch_wait(&latch);
+	atomic_fetch_add(&num_done, 1);
+
+	return NULL;
+}
+
+
+START_TEST(latch_count_down)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	atomic_store(&num_done, 0);
+	mm_thr_latch_init(&latch, NUM_THREAD, sync_type_flags[_i]);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], latch_waiter_proc, NULL);
+
+	// No waiter must be released before the count reaches 0
+	for (i = 0; i < NUM_THREAD; i++) {
+		mm_relative_sleep_ms(5);
+		ck_assert_int_eq(atomic_load(&num_done), 0);
+		ck_assert(mm_thr_latch_trywait(&latch) == EAGAIN);
+		ck_assert(mm_thr_latch_count_down(&latch, 1) == 0);
+	}
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&num_done), NUM_THREAD);
+
+	// Once released, the latch stays released
+	ck_assert(mm_thr_latch_trywait(&latch) == 0);
+	ck_assert(mm_thr_latch_wait(&latch) == 0);
+	mm_thr_latch_deinit(&latch);
+}
+END_TEST
+
+
+START_TEST(latch_timedwait)
+{
+	struct mm_timespec deadline;
+	int flags = sync_type_flags[_i] | MM_THR_WAIT_MONOTONIC;
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	mm_thr_latch_init(&latch, 2, flags);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_latch_timedwait(&latch, &deadline) == ETIMEDOUT);
+
+	ck_assert(mm_thr_latch_count_down(&latch, 3) == EINVAL);
+	ck_assert(mm_thr_latch_count_down(&latch, 2) == 0);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_latch_timedwait(&latch, &deadline) == 0);
+	mm_thr_latch_deinit(&latch);
+}
+END_TEST
+
+
+/*
+ * Children processes go through phases synchronized by a shared barrier
+ * and notify the parent through a shared latch when they are done.
+ */
+START_TEST(barrier_latch_pshared_process)
+{
+	struct barrier_data* bdata;
+	struct mm_timespec deadline;
+	mm_pid_t pids[NUM_PROC];
+	int shm_fd, num_proc;
+
+	bdata = map_shared_page(&shm_fd);
+	ck_assert(bdata != NULL);
+
+	bdata->num_iter = NUM_PROC_PHASE;
+	bdata->num_runner = NUM_PROC;
+	mm_thr_barrier_init(&bdata->barrier, NUM_PROC, MM_THR_PSHARED);
+	mm_thr_latch_init(&bdata->done, NUM_PROC,
+	                  MM_THR_PSHARED | MM_THR_WAIT_MONOTONIC);
+
+	num_proc = spawn_shared_runners(pids, NUM_PROC, "run_barrier_data",
+	                                shm_fd);
+	ck_assert_int_eq(num_proc, NUM_PROC);
+
+	get_deadline(&deadline, WAIT_MAX_MS);
+	ck_assert(mm_thr_latch_timedwait(&bdata->done, &deadline) == 0);
+
+	ck_assert_int_eq(wait_shared_runners(pids, num_proc), 0);
+	ck_assert_int_eq(bdata->count, NUM_PROC * NUM_PROC_PHASE);
+	ck_assert(!bdata->failed);
+
+	mm_thr_latch_deinit(&bdata->done);
+	mm_thr_barrier_deinit(&bdata->barrier);
+	mm_unmap(bdata);
+	mm_close(shm_fd);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_barrier_tcase(void)
+{
+	TCase *tc = tcase_create("barrier");
+	tcase_add_loop_test(tc, barrier_phases, 0, MM_NELEM(sync_type_flags));
+	tcase_add_test(tc, barrier_single_thread);
+	tcase_add_loop_test(tc, latch_count_down, 0, MM_NELEM(sync_type_flags));
+	tcase_add_loop_test(tc, latch_timedwait, 0, MM_NELEM(sync_type_flags));
+	tcase_add_test(tc, barrier_latch_pshared_process);
+
+	return tc;
+}
@@ -0,0 +1,957 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmargparse.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define TEST_LOCK_REFEREE_SERVER_BIN    TOP_BUILDDIR"/src/"LT_OBJDIR"/lock-referee.exe"
+
+/*************************************************************************
+ *                                                                       *
+ *                 Lock and synchronization benchmark                    *
+ *                                                                       *
+ *************************************************************************/
+
+/*
+ * For each selected primitive, thread count and critical section length,
+ * the workers acquire and release the primitive in a loop during a fixed
+ * duration. The throughput (number of operations per second) and the
+ * percentiles of the latency of acquisition are reported in JSON.
+ *
+ * All the state shared by the workers (the primitive, the control flags
+ * and the results) lives in a shared memory mapping, so that the workers
+ * can be threads of this process or processes spawned from this
+ * executable (--process option).
+ */
+
+#define MAX_WORKER              64
+#define MAX_SAMPLE              8192    // latencies kept per worker
+#define MAX_LIST                16
+#define SHM_CHILD_FD            3
+
+#define DEFAULT_PRIMITIVES      "all"
+#define DEFAULT_THREADS         "1,2,4,8,16"
+#define DEFAULT_CS_LENS         "0,64,1024"
+#define DEFAULT_DURATION_MS     200
+
+enum prim_type {
+	PRIM_MUTEX,
+	PRIM_QLOCK,
+	PRIM_RWLOCK_READ,
+	PRIM_RWLOCK_WRITE,
+	PRIM_PINGPONG,
+	PRIM_COND_BROADCAST,
+	PRIM_MCOND_BROADCAST,
+};
+
+union bench_lock {
+	mm_thr_mutex_t mtx;
+	mm_thr_qlock_t qlock;
+	mm_thr_rwlock_t rwlock;
+};
+
+/**
+ * struct pingpong - state shared by a pair of ping-pong workers
+ * @mtx:        mutex protecting @turn
+ * @cond:       condition signaled when @turn changes
+ * @turn:       index in the pair (0 or 1) of the worker whose turn it is
+ * @shared_var: variable updated when the turn is taken
+ */
+struct pingpong {
+	mm_thr_mutex_t mtx;
+	mm_thr_cond_t cond;
+	int turn;
+	int64_t shared_var;
+};
+
+/**
+ * struct broadcast - state shared by workers meeting in rounds
+ * @mtx:        mutex protecting @arrived and @round
+ * @cond:       condition broadcast at the end of a round if
+ *              PRIM_COND_BROADCAST
+ * @mcond:      condition broadcast at the end of a round if
+ *              PRIM_MCOND_BROADCAST
+ * @num_worker: number of workers taking part in the rounds
+ * @arrived:    number of workers arrived in the current round
+ * @round:      index of the current round
+ */
+struct broadcast {
+	mm_thr_mutex_t mtx;
+	mm_thr_cond_t cond;
+	mm_thr_mcond_t mcond;
+	int num_worker;
+	int arrived;
+	int64_t round;
+};
+
+/**
+ * struct worker_result - measures of one worker
+ * @num_op:     number of operations done
+ * @max_ns:     largest latency observed
+ * @samples:    ring buffer of the last latencies observed (in ns)
+ */
+struct worker_result {
+	int64_t num_op;
+	int64_t max_ns;
+	uint32_t samples[MAX_SAMPLE];
+};
+
+/**
+ * struct bench_shared - state shared by the workers of a run
+ * @prim_index: index of the primitive benchmarked in prim_list
+ * @flags:      flags used to init the primitive
+ * @cs_len:     length of critical section (iterations of busy loop)
+ * @num_ready:  number of workers ready to start
+ * @start:      set when the workers can start
+ * @stop:       set when the workers must stop
+ * @shared_var: variable accessed in the critical section
+ * @lock:       lock benchmarked if not PRIM_PINGPONG nor broadcast
+ * @pairs:      pairs of workers if PRIM_PINGPONG
+ * @bcast:      rounds of workers if PRIM_COND_BROADCAST or
+ *              PRIM_MCOND_BROADCAST
+ * @results:    measures of each worker
+ */
+struct bench_shared {
+	int prim_index;
+	int flags;
+	int cs_len;
+	int32_t num_ready;
+	int32_t start;
+	int32_t stop;
+	int64_t shared_var;
+	union bench_lock lock;
+	struct pingpong pairs[MAX_WORKER/2];
+	struct broadcast bcast;
+	struct worker_result results[MAX_WORKER];
+};
+
+/**
+ * struct primitive - primitive benchmarked
+ * @name:       name of the primitive as selected on command line
+ * @type:       type of the primitive
+ * @flags:      flags used to init the primitive
+ * @can_pshared: non zero if it supports MM_THR_PSHARED
+ */
+struct primitive {
+	const char* name;
+	enum prim_type type;
+	int flags;
+	int can_pshared;
+};
+
+struct run_result {
+	int64_t num_op;
+	double throughput;
+	double mean_ns;
+	int64_t percentiles[4];
+	int64_t max_ns;
+};
+
+static const double percentile_values[] = {50.0, 90.0, 99.0, 99.9};
+static const char* percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+/**
+ * struct config - configuration of the benchmark
+ * @exec_path:  path of this executable, used to spawn worker processes
+ * @duration_ms: duration of each run
+ * @use_process: if non zero, workers are processes instead of threads
+ * @shm_fd:     file descriptor of the shared memory
+ * @out:        stream receiving the JSON report
+ * @is_first:   non zero until the first result has been reported
+ */
+struct config {
+	const char* exec_path;
+	int duration_ms;
+	int use_process;
+	int shm_fd;
+	FILE* out;
+	int is_first;
+};
+
+static struct config cfg = {
+	.duration_ms = DEFAULT_DURATION_MS,
+	.is_first = 1,
+};
+
+static struct bench_shared* shared;
+
+
+static const struct primitive prim_list[] = {
+	{"mutex", PRIM_MUTEX, 0, 1},
+	{"mutex-adaptive", PRIM_MUTEX, MM_THR_ADAPTIVE, 1},
+	{"mutex-pshared", PRIM_MUTEX, MM_THR_PSHARED, 1},
+	{"mutex-pshared-adaptive", PRIM_MUTEX,
+	 MM_THR_PSHARED | MM_THR_ADAPTIVE, 1},
+	{"qlock", PRIM_QLOCK, 0, 0},
+	{"rwlock-read", PRIM_RWLOCK_READ, 0, 1},
+	{"rwlock-write", PRIM_RWLOCK_WRITE, 0, 1},
+	{"condvar-pingpong", PRIM_PINGPONG, 0, 1},
+	{"condvar-broadcast", PRIM_COND_BROADCAST, 0, 1},
+	{"mcond-broadcast", PRIM_MCOND_BROADCAST, 0, 1},
+};
+
+
+static
+int64_t now_ns(void)
+{
+	struct mm_timespec ts;
+
+	mm_gettime(MM_CLK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static
+void record_latency(struct worker_result* res, int64_t latency)
+{
+	res->samples[res->num_op % MAX_SAMPLE] = (latency > UINT32_MAX)
+	                                         ? UINT32_MAX : latency;
+	if (latency > res->max_ns)
+		res->max_ns = latency;
+
+	res->num_op++;
+}
+
+
+/**
+ * critical_section() - simulate work done while holding a primitive
+ * @len:        number of CPU pause to execute
+ * @var:        shared variable to access
+ * @is_write:   if non zero, @var is incremented, otherwise it is read
+ */
+static
+void critical_section(int len, int64_t* var, int is_write)
+{
+	volatile int64_t* vvar = var;
+	int i;
+
+	for (i = 0; i < len; i++)
+		mm_cpu_relax();
+
+	if (is_write)
+		(*vvar)++;
+	else
+		(void)*vvar;
+}
+
+
+static
+int must_stop(void)
+{
+	return mm_atomic_load_i32(&shared->stop, MM_ATOMIC_RELAXED);
+}
+
+
+static
+void bench_lock(enum prim_type type, union bench_lock* lock)
+{
+	switch (type) {
+	case PRIM_MUTEX:
+		mm_thr_mutex_lock(&lock->mtx);
+		break;
+	case PRIM_QLOCK:
+		mm_thr_qlock_lock(&lock->qlock);
+		break;
+	case PRIM_RWLOCK_READ:
+		mm_thr_rwlock_rdlock(&lock->rwlock);
+		break;
+	case PRIM_RWLOCK_WRITE:
+		mm_thr_rwlock_wrlock(&lock->rwlock);
+		break;
+	default:
+		break;
+	}
+}
+
+
+static
+void bench_unlock(enum prim_type type, union bench_lock* lock)
+{
+	switch (type) {
+	case PRIM_MUTEX:
+		mm_thr_mutex_unlock(&lock->mtx);
+		break;
+	case PRIM_QLOCK:
+		mm_thr_qlock_unlock(&lock->qlock);
+		break;
+	case PRIM_RWLOCK_READ:
+	case PRIM_RWLOCK_WRITE:
+		mm_thr_rwlock_unlock(&lock->rwlock);
+		break;
+	default:
+		break;
+	}
+}
+
+
+static
+void run_lock_worker(enum prim_type type, struct worker_result* res)
+{
+	int64_t t0, t1;
+
+	while (!must_stop()) {
+		t0 = now_ns();
+		bench_lock(type, &shared->lock);
+		t1 = now_ns();
+		critical_section(shared->cs_len, &shared->shared_var,
+		                 type != PRIM_RWLOCK_READ);
+		bench_unlock(type, &shared->lock);
+
+		record_latency(res, t1 - t0);
+	}
+}
+
+
+/*
+ * The two workers of a pair wait for their turn and pass it to the other
+ * one. The latency measured is the time between the request of the turn
+ * and the wakeup with the turn acquired.
+ */
+static
+void run_pingpong_worker(int index, struct worker_result* res)
+{
+	struct pingpong* pair = &shared->pairs[index / 2];
+	int side = index % 2;
+	int64_t t0, t1;
+
+	while (1) {
+		t0 = now_ns();
+		mm_thr_mutex_lock(&pair->mtx);
+		while (pair->turn != side && !must_stop())
+			mm_thr_cond_wait(&pair->cond, &pair->mtx);
+
+		if (must_stop()) {
+			mm_thr_mutex_unlock(&pair->mtx);
+			break;
+		}
+
+		t1 = now_ns();
+		critical_section(shared->cs_len, &pair->shared_var, 1);
+		pair->turn = !side;
+		mm_thr_cond_signal(&pair->cond);
+		mm_thr_mutex_unlock(&pair->mtx);
+
+		record_latency(res, t1 - t0);
+	}
+}
+
+
+/*
+ * The workers meet at the end of each round: the last one to arrive starts
+ * the next round and broadcasts the condition, the others wait for it. The
+ * latency measured is the time between the arrival in the round and the
+ * wakeup with the mutex reacquired.
+ */
+static
+void run_broadcast_worker(enum prim_type type, struct worker_result* res)
+{
+	struct broadcast* bcast = &shared->bcast;
+	int64_t t0, t1, round;
+
+	while (1) {
+		t0 = now_ns();
+		mm_thr_mutex_lock(&bcast->mtx);
+		round = bcast->round;
+		if (++bcast->arrived == bcast->num_worker) {
+			bcast->arrived = 0;
+			bcast->round++;
+			if (type == PRIM_MCOND_BROADCAST)
+				mm_thr_mcond_broadcast(&bcast->mcond);
+			else
+				mm_thr_cond_broadcast(&bcast->cond);
+		}
+
+		while (bcast->round == round && !must_stop()) {
+			if (type == PRIM_MCOND_BROADCAST)
+				mm_thr_mcond_wait(&bcast->mcond, &bcast->mtx);
+			else
+				mm_thr_cond_wait(&bcast->cond, &bcast->mtx);
+		}
+
+		if (must_stop()) {
+			mm_thr_mutex_unlock(&bcast->mtx);
+			break;
+		}
+
+		t1 = now_ns();
+		critical_section(shared->cs_len, &shared->shared_var, 1);
+		mm_thr_mutex_unlock(&bcast->mtx);
+
+		record_latency(res, t1 - t0);
+	}
+}
+
+
+static
+void run_worker(int index)
+{
+	const struct primitive* prim = &prim_list[shared->prim_index];
+	struct worker_result* res = &shared->results[index];
+
+	mm_atomic_fetch_add_i32(&shared->num_ready, 1, MM_ATOMIC_SEQ_CST);
+	while (!mm_atomic_load_i32(&shared->start, MM_ATOMIC_ACQUIRE))
+		mm_relative_sleep_ms(1);
+
+	switch (prim->type) {
+	case PRIM_PINGPONG:
+		run_pingpong_worker(index, res);
+		break;
+	case PRIM_COND_BROADCAST:
+	case PRIM_MCOND_BROADCAST:
+		run_broadcast_worker(prim->type, res);
+		break;
+	default:
+		run_lock_worker(prim->type, res);
+		break;
+	}
+}
+
+
+static
+void* worker_thread_proc(void* arg)
+{
+	run_worker((int)(intptr_t)arg);
+	return NULL;
+}
+
+
+static
+void init_primitive(const struct primitive* prim, int num_worker)
+{
+	union bench_lock* lock = &shared->lock;
+	int i;
+
+	switch (prim->type) {
+	case PRIM_MUTEX:
+		mm_thr_mutex_init(&lock->mtx, shared->flags);
+		return;
+	case PRIM_QLOCK:
+		mm_thr_qlock_init(&lock->qlock, shared->flags);
+		return;
+	case PRIM_RWLOCK_READ:
+	case PRIM_RWLOCK_WRITE:
+		mm_thr_rwlock_init(&lock->rwlock, shared->flags);
+		return;
+	case PRIM_COND_BROADCAST:
+	case PRIM_MCOND_BROADCAST:
+		mm_thr_mutex_init(&shared->bcast.mtx, shared->flags);
+		mm_thr_cond_init(&shared->bcast.cond, shared->flags);
+		mm_thr_mcond_init(&shared->bcast.mcond, shared->flags);
+		shared->bcast.num_worker = num_worker;
+		return;
+	default:
+		break;
+	}
+
+	for (i = 0; i < num_worker / 2; i++) {
+		mm_thr_mutex_init(&shared->pairs[i].mtx, shared->flags);
+		mm_thr_cond_init(&shared->pairs[i].cond, shared->flags);
+		shared->pairs[i].turn = 0;
+	}
+}
+
+
+static
+void deinit_primitive(const struct primitive* prim, int num_worker)
+{
+	union bench_lock* lock = &shared->lock;
+	int i;
+
+	switch (prim->type) {
+	case PRIM_MUTEX:
+		mm_thr_mutex_deinit(&lock->mtx);
+		return;
+	case PRIM_QLOCK:
+		mm_thr_qlock_deinit(&lock->qlock);
+		return;
+	case PRIM_RWLOCK_READ:
+	case PRIM_RWLOCK_WRITE:
+		mm_thr_rwlock_deinit(&lock->rwlock);
+		return;
+	case PRIM_COND_BROADCAST:
+	case PRIM_MCOND_BROADCAST:
+		mm_thr_mcond_deinit(&shared->bcast.mcond);
+		mm_thr_cond_deinit(&shared->bcast.cond);
+		mm_thr_mutex_deinit(&shared->bcast.mtx);
+		return;
+	default:
+		break;
+	}
+
+	for (i = 0; i < num_worker / 2; i++) {
+		mm_thr_cond_deinit(&shared->pairs[i].cond);
+		mm_thr_mutex_deinit(&shared->pairs[i].mtx);
+	}
+}
+
+
+/*
+ * Workers of ping-pong blocked in a wait must be woken up to notice the
+ * stop request.
+ */
+static
+void wake_pingpong_workers(int num_worker)
+{
+	int i;
+
+	for (i = 0; i < num_worker / 2; i++) {
+		mm_thr_mutex_lock(&shared->pairs[i].mtx);
+		mm_thr_cond_broadcast(&shared->pairs[i].cond);
+		mm_thr_mutex_unlock(&shared->pairs[i].mtx);
+	}
+}
+
+
+/*
+ * Same for the workers waiting for the end of a round: the last worker
+ * of the round may have stopped before arriving.
+ */
+static
+void wake_broadcast_workers(void)
+{
+	struct broadcast* bcast = &shared->bcast;
+
+	mm_thr_mutex_lock(&bcast->mtx);
+	mm_thr_cond_broadcast(&bcast->cond);
+	mm_thr_mcond_broadcast(&bcast->mcond);
+	mm_thr_mutex_unlock(&bcast->mtx);
+}
+
+
+static
+int spawn_worker_process(mm_pid_t* pid, int index)
+{
+	struct mm_remap_fd fdmap = {
+		.child_fd = SHM_CHILD_FD,
+		.parent_fd = cfg.shm_fd,
+	};
+	char child_opt[32];
+	char* argv[] = {(char*)cfg.exec_path, child_opt, NULL};
+
+	sprintf(child_opt, "--child=%i", index);
+	return mm_spawn(pid, cfg.exec_path, 1, &fdmap, 0, argv, NULL);
+}
+
+
+static
+int cmp_u32(const void* a, const void* b)
+{
+	uint32_t va = *(const uint32_t*)a;
+	uint32_t vb = *(const uint32_t*)b;
+
+	return (va > vb) - (va < vb);
+}
+
+
+/**
+ * compute_result() - aggregate the results of the workers of a run
+ * @result:     structure receiving the result of the run
+ * @num_worker: number of workers of the run
+ * @duration_ns: duration of the run
+ *
+ * Return: 0 in case of success, -1 otherwise with error state set.
+ */
+static
+int compute_result(struct run_result* result, int num_worker,
+                   int64_t duration_ns)
+{
+	struct worker_result* res;
+	uint32_t* samples;
+	int64_t num_sample, num, i, sum;
+	int w, p;
+
+	memset(result, 0, sizeof(*result));
+	samples = malloc(num_worker * MAX_SAMPLE * sizeof(*samples));
+	if (!samples)
+		return mm_raise_from_errno("Cannot allocate latency samples");
+
+	num_sample = 0;
+	for (w = 0; w < num_worker; w++) {
+		res = &shared->results[w];
+		num = (res->num_op < MAX_SAMPLE) ? res->num_op : MAX_SAMPLE;
+		memcpy(samples + num_sample, res->samples,
+		       num * sizeof(*samples));
+		num_sample += num;
+
+		result->num_op += res->num_op;
+		if (res->max_ns > result->max_ns)
+			result->max_ns = res->max_ns;
+	}
+
+	result->throughput = result->num_op * 1.0e9 / duration_ns;
+	if (num_sample == 0)
+		goto exit;
+
+	qsort(samples, num_sample, sizeof(*samples), cmp_u32);
+
+	sum = 0;
+	for (i = 0; i < num_sample; i++)
+		sum += samples[i];
+
+	result->mean_ns = (double)sum / num_sample;
+	for (p = 0; p < MM_NELEM(percentile_values); p++) {
+		i = (int64_t)(percentile_values[p] * (num_sample - 1) / 100.0);
+		result->percentiles[p] = samples[i];
+	}
+
+exit:
+	free(samples);
+	return 0;
+}
+
+
+/**
+ * run_bench() - run a benchmark configuration
+ * @prim:       primitive to benchmark
+ * @num_worker: number of concurrent workers
+ * @cs_len:     length of the critical section
+ * @result:     structure receiving the result of the run
+ *
+ * Return: 0 in case of success, -1 otherwise.
+ */
+static
+int run_bench(const struct primitive* prim, int num_worker, int cs_len,
+              struct run_result* result)
+{
+	mm_thread_t thids[MAX_WORKER];
+	mm_pid_t pids[MAX_WORKER];
+	int64_t start_ts, stop_ts;
+	int i, num_started, rv = 0;
+
+	memset(shared, 0, sizeof(*shared));
+	shared->prim_index = prim - prim_list;
+	shared->flags = prim->flags;
+	if (cfg.use_process)
+		shared->flags |= MM_THR_PSHARED;
+
+	shared->cs_len = cs_len;
+	init_primitive(prim, num_worker);
+
+	for (i = 0; i < num_worker; i++) {
+		if (cfg.use_process)
+			rv = spawn_worker_process(&pids[i], i);
+		else
+			rv = mm_thr_create(&thids[i], worker_thread_proc,
+			                   (void*)(intptr_t)i);
+
+		if (rv != 0)
+			break;
+	}
+
+	num_started = i;
+	if (rv == 0) {
+		while (mm_atomic_load_i32(&shared->num_ready, MM_ATOMIC_SEQ_CST)
+		       != num_worker)
+			mm_relative_sleep_ms(1);
+	}
+
+	start_ts = now_ns();
+	mm_atomic_store_i32(&shared->start, 1, MM_ATOMIC_RELEASE);
+	if (rv == 0)
+		mm_relative_sleep_ms(cfg.duration_ms);
+
+	mm_atomic_store_i32(&shared->stop, 1, MM_ATOMIC_SEQ_CST);
+	stop_ts = now_ns();
+	if (prim->type == PRIM_PINGPONG)
+		wake_pingpong_workers(num_worker);
+	else if (prim->type == PRIM_COND_BROADCAST
+	         || prim->type == PRIM_MCOND_BROADCAST)
+		wake_broadcast_workers();
+
+	for (i = 0; i < num_started; i++) {
+		if (cfg.use_process)
+			mm_wait_process(pids[i], NULL);
+		else
+			mm_thr_join(thids[i], NULL);
+	}
+
+	deinit_primitive(prim, num_worker);
+	if (rv != 0)
+		return -1;
+
+	return compute_result(result, num_worker, stop_ts - start_ts);
+}
+
+
+static
+void print_result(const struct primitive* prim, int num_worker, int cs_len,
+                  const struct run_result* result)
+{
+	FILE* out = cfg.out;
+	int p;
+
+	fprintf(out, "%s\n    {\"primitive\": \"%s\", \"workers\": %i, "
+	        "\"worker_type\": \"%s\", \"cs_len\": %i,\n",
+	        cfg.is_first ? "" : ",", prim->name, num_worker,
+	        cfg.use_process ? "process" : "thread", cs_len);
+	fprintf(out, "     \"ops\": %lli, \"throughput\": %.1f,\n",
+	        (long long)result->num_op, result->throughput);
+	fprintf(out, "     \"latency_ns\": {\"mean\": %.1f",
+	        result->mean_ns);
+	for (p = 0; p < MM_NELEM(percentile_names); p++)
+		fprintf(out, ", \"%s\": %lli", percentile_names[p],
+		        (long long)result->percentiles[p]);
+
+	fprintf(out, ", \"max\": %lli}}", (long long)result->max_ns);
+	fflush(out);
+	cfg.is_first = 0;
+}
+
+
+/**
+ * run_primitive() - run and report the benchmarks of a primitive
+ * @prim:       primitive to benchmark
+ * @num_workers: array of the numbers of workers to try
+ * @num_nw:     number of element in @num_workers
+ * @cs_lens:    array of the critical section lengths to try
+ * @num_cs:     number of element in @cs_lens
+ *
+ * Return: 0 in case of success, -1 otherwise.
+ */
+static
+int run_primitive(const struct primitive* prim,
+                  const int* num_workers, int num_nw,
+                  const int* cs_lens, int num_cs)
+{
+	struct run_result result;
+	int i, j;
+
+	if (cfg.use_process && !prim->can_pshared)
+		return 0;
+
+	for (i = 0; i < num_nw; i++) {
+		// ping-pong needs pairs of workers
+		if (prim->type == PRIM_PINGPONG && num_workers[i] % 2)
+			continue;
+
+		for (j = 0; j < num_cs; j++) {
+			if (run_bench(prim, num_workers[i], cs_lens[j],
+			              &result)) {
+				mm_print_lasterror("%s benchmark failed",
+				                   prim->name);
+				return -1;
+			}
+
+			print_result(prim, num_workers[i], cs_lens[j], &result);
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * parse_int_list() - parse comma separated list of positive integers
+ * @str:        string to parse
+ * @values:     array of MAX_LIST elements receiving the values
+ *
+ * Return: number of values parsed, -1 if @str is invalid.
+ */
+static
+int parse_int_list(const char* str, int* values)
+{
+	char* end;
+	long val;
+	int num = 0;
+
+	while (*str) {
+		val = strtol(str, &end, 10);
+		if (end == str || val < 0 || val > INT32_MAX || num == MAX_LIST
+		    || (*end != ',' && *end != '\0'))
+			return -1;
+
+		values[num++] = val;
+		str = (*end == ',') ? end + 1 : end;
+	}
+
+	return num;
+}
+
+
+/**
+ * parse_prim_list() - parse comma separated list of primitive names
+ * @str:        string to parse ("all" selects every primitive)
+ * @selected:   array of MM_NELEM(prim_list) flags set for the primitives
+ *              selected
+ *
+ * Return: 0 in case of success, -1 if a name is unknown.
+ */
+static
+int parse_prim_list(const char* str, int* selected)
+{
+	size_t len;
+	int i, found;
+
+	while (*str) {
+		len = strcspn(str, ",");
+		found = 0;
+		for (i = 0; i < MM_NELEM(prim_list); i++) {
+			if ((len == 3 && !strncmp(str, "all", len))
+			    || (strlen(prim_list[i].name) == len
+			        && !strncmp(str, prim_list[i].name, len))) {
+				selected[i] = 1;
+				found = 1;
+			}
+		}
+
+		if (!found) {
+			fprintf(stderr, "unknown primitive: %.*s\n",
+			        (int)len, str);
+			return -1;
+		}
+
+		str += len;
+		if (*str == ',')
+			str++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Entry point of a worker process: the shared memory is inherited at
+ * SHM_CHILD_FD.
+ */
+static
+int run_child(int index)
+{
+	shared = mm_mapfile(SHM_CHILD_FD, 0, sizeof(*shared),
+	                    MM_MAP_RDWR|MM_MAP_SHARED);
+	if (!shared) {
+		mm_print_lasterror("cannot map shared memory");
+		return EXIT_FAILURE;
+	}
+
+	run_worker(index);
+	mm_unmap(shared);
+	return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const char* primitives = DEFAULT_PRIMITIVES;
+	const char* threads = DEFAULT_THREADS;
+	const char* cs_lens = DEFAULT_CS_LENS;
+	const char* output = NULL;
+	const char* use_process = NULL;
+	int child_index = -1;
+	struct mm_arg_opt optv[] = {
+		{"p|primitives", MM_OPT_NEEDSTR, NULL, {.sptr = &primitives},
+		 "Comma separated list of primitives to benchmark (\"all\" "
+		 "selects every one). @LIST defaults to " DEFAULT_PRIMITIVES
+		 "."},
+		{"t|threads", MM_OPT_NEEDSTR, NULL, {.sptr = &threads},
+		 "Comma separated @LIST of number of concurrent workers. "
+		 "Defaults to " DEFAULT_THREADS "."},
+		{"c|cs-len", MM_OPT_NEEDSTR, NULL, {.sptr = &cs_lens},
+		 "Comma separated @LIST of critical section lengths (in "
+		 "number of CPU pause). Defaults to " DEFAULT_CS_LENS "."},
+		{"d|duration", MM_OPT_NEEDINT, NULL, {.iptr = &cfg.duration_ms},
+		 "Duration of each run in @MS milliseconds."},
+		{"o|output", MM_OPT_NEEDSTR, NULL, {.sptr = &output},
+		 "Write the JSON report in @FILE instead of standard output."},
+		{"process", MM_OPT_NOVAL, "set", {.sptr = &use_process},
+		 "Run the workers in separate processes sharing the "
+		 "primitive. Primitives are then initialized with "
+		 "MM_THR_PSHARED."},
+		{"child", MM_OPT_NEEDINT, NULL, {.iptr = &child_index},
+		 "Internal use: run as worker @INDEX of a parent process."},
+	};
+	struct mm_arg_parser parser = {
+		.optv = optv,
+		.num_opt = MM_NELEM(optv),
+		.args_doc = "[options]",
+		.doc = "Benchmark lock and synchronization primitives and "
+		       "report throughput and latency percentiles in JSON.",
+		.execname = argv[0],
+	};
+	int selected[MM_NELEM(prim_list)] = {0};
+	int thread_list[MAX_LIST], cs_list[MAX_LIST];
+	int num_thread, num_cs, i, fd;
+
+#if _WIN32
+	mm_setenv("MMLIB_LOCKREF_BIN", TEST_LOCK_REFEREE_SERVER_BIN, 1);
+#endif
+
+	if (mm_arg_parse(&parser, argc, argv) < 0)
+		return EXIT_FAILURE;
+
+	if (child_index >= 0)
+		return run_child(child_index);
+
+	num_thread = parse_int_list(threads, thread_list);
+	num_cs = parse_int_list(cs_lens, cs_list);
+	if (num_thread <= 0 || num_cs <= 0 || cfg.duration_ms <= 0
+	    || parse_prim_list(primitives, selected)) {
+		fprintf(stderr, "invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < num_thread; i++) {
+		if (thread_list[i] < 1 || thread_list[i] > MAX_WORKER) {
+			fprintf(stderr, "number of workers must be in "
+			        "[1-%i]\n", MAX_WORKER);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fd = mm_anon_shm();
+	if (fd < 0 || mm_ftruncate(fd, sizeof(*shared))) {
+		mm_print_lasterror("cannot create shared memory");
+		return EXIT_FAILURE;
+	}
+
+	shared = mm_mapfile(fd, 0, sizeof(*shared), MM_MAP_RDWR|MM_MAP_SHARED);
+	if (!shared) {
+		mm_print_lasterror("cannot map shared memory");
+		return EXIT_FAILURE;
+	}
+
+	cfg.out = stdout;
+	if (output && !(cfg.out = fopen(output, "w"))) {
+		perror("cannot open output file");
+		return EXIT_FAILURE;
+	}
+
+	cfg.exec_path = argv[0];
+	cfg.use_process = (use_process != NULL);
+	cfg.shm_fd = fd;
+
+	fprintf(cfg.out, "{\"benchmark\": \"lock\", \"duration_ms\": %i, "
+	        "\"results\": [", cfg.duration_ms);
+
+	for (i = 0; i < MM_NELEM(prim_list); i++) {
+		if (!selected[i])
+			continue;
+
+		if (run_primitive(&prim_list[i], thread_list, num_thread,
+		                  cs_list, num_cs))
+			return EXIT_FAILURE;
+	}
+
+	fprintf(cfg.out, "\n]}\n");
+
+	if (cfg.out != stdout)
+		fclose(cfg.out);
+
+	mm_unmap(shared);
+	mm_close(fd);
+	return EXIT_SUCCESS;
+}
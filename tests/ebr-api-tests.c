@@ -0,0 +1,267 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmebr.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define NUM_THREAD      8
+#define NUM_OP          20000
+#define NUM_NODE        (NUM_THREAD * NUM_OP + 16)
+
+#define NODE_LIVE       0
+#define NODE_FREED      1
+
+/*
+ * Nodes are taken from a pool and never reused, so the stack below does
+ * not suffer from the ABA problem: the test only checks that a node is not
+ * "freed" while a thread may still access it.
+ */
+struct node {
+	struct node* next;
+	int32_t state;
+};
+
+static struct node* node_pool;
+static int32_t num_allocated;
+static int32_t num_freed;
+static int32_t failed;
+static mm_atomic_ptr_t stack_top;
+
+static int32_t in_section;
+static int32_t may_leave;
+
+
+static
+void free_node(void* ptr)
+{
+	struct node* node = ptr;
+
+	mm_atomic_store_i32(&node->state, NODE_FREED, MM_ATOMIC_RELAXED);
+	mm_atomic_fetch_add_i32(&num_freed, 1, MM_ATOMIC_RELAXED);
+}
+
+
+static
+struct node* alloc_node(void)
+{
+	struct node* node;
+
+	node = &node_pool[mm_atomic_fetch_add_i32(&num_allocated, 1,
+	                                          MM_ATOMIC_RELAXED)];
+	node->state = NODE_LIVE;
+	return node;
+}
+
+
+static
+void check_node(struct node* node)
+{
+	if (mm_atomic_load_i32(&node->state, MM_ATOMIC_RELAXED) != NODE_LIVE)
+		mm_atomic_store_i32(&failed, 1, MM_ATOMIC_RELAXED);
+}
+
+
+static
+void push(struct node* node)
+{
+	void* top;
+
+	top = mm_atomic_load_ptr(&stack_top, MM_ATOMIC_RELAXED);
+	do {
+		node->next = top;
+	} while (!mm_atomic_cas_ptr(&stack_top, &top, node,
+	                            MM_ATOMIC_RELEASE));
+}
+
+
+static
+struct node* pop(void)
+{
+	struct node* top;
+	struct node* next;
+
+	mm_ebr_enter();
+
+	top = mm_atomic_load_ptr(&stack_top, MM_ATOMIC_ACQUIRE);
+	while (top) {
+		check_node(top);
+		next = top->next;
+		if (mm_atomic_cas_ptr(&stack_top, (void**)&top, next,
+		                      MM_ATOMIC_ACQUIRE))
+			break;
+	}
+
+	mm_ebr_exit();
+	return top;
+}
+
+
+static
+void setup(void)
+{
+	node_pool = calloc(NUM_NODE, sizeof(*node_pool));
+	num_allocated = 0;
+	num_freed = 0;
+	failed = 0;
+	stack_top = NULL;
+}
+
+
+static
+void teardown(void)
+{
+	free(node_pool);
+	node_pool = NULL;
+}
+
+
+/*
+ * Retire a node allocated just for this purpose and wait for it to be
+ * freed. All nodes retired before by any thread can then be freed.
+ */
+static
+void flush_retired(void)
+{
+	mm_ebr_retire(alloc_node(), free_node);
+	mm_ebr_synchronize();
+}
+
+
+START_TEST(retire_and_synchronize)
+{
+	struct node* node = alloc_node();
+
+	ck_assert(mm_ebr_register() == 0);
+
+	// Nested critical sections
+	mm_ebr_enter();
+	mm_ebr_enter();
+	ck_assert(mm_ebr_retire(node, free_node) == 0);
+	mm_ebr_exit();
+	mm_ebr_reclaim();
+	mm_ebr_reclaim();
+	ck_assert_int_eq(node->state, NODE_LIVE);
+	mm_ebr_exit();
+
+	mm_ebr_synchronize();
+	ck_assert_int_eq(node->state, NODE_FREED);
+	ck_assert_int_eq(num_freed, 1);
+
+	mm_ebr_unregister();
+}
+END_TEST
+
+
+static
+void* blocking_reader_proc(void* arg)
+{
+	(void)arg;
+
+	mm_ebr_enter();
+	mm_atomic_store_i32(&in_section, 1, MM_ATOMIC_SEQ_CST);
+	while (!mm_atomic_load_i32(&may_leave, MM_ATOMIC_SEQ_CST))
+		mm_relative_sleep_ms(1);
+
+	mm_ebr_exit();
+	return NULL;
+}
+
+
+START_TEST(reader_delays_reclaim)
+{
+	struct node* node = alloc_node();
+	mm_thread_t thid;
+	int i;
+
+	in_section = 0;
+	may_leave = 0;
+	mm_thr_create(&thid, blocking_reader_proc, NULL);
+	while (!mm_atomic_load_i32(&in_section, MM_ATOMIC_SEQ_CST))
+		mm_relative_sleep_ms(1);
+
+	mm_ebr_retire(node, free_node);
+	for (i = 0; i < 100; i++)
+		mm_ebr_reclaim();
+
+	ck_assert_int_eq(node->state, NODE_LIVE);
+
+	mm_atomic_store_i32(&may_leave, 1, MM_ATOMIC_SEQ_CST);
+	mm_thr_join(thid, NULL);
+
+	mm_ebr_synchronize();
+	ck_assert_int_eq(node->state, NODE_FREED);
+}
+END_TEST
+
+
+static
+void* stress_proc(void* arg)
+{
+	struct node* node;
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_OP; i++) {
+		push(alloc_node());
+		node = pop();
+		if (node)
+			mm_ebr_retire(node, free_node);
+	}
+
+	// Exit with retired nodes not yet freed: they must be taken over
+	return NULL;
+}
+
+
+START_TEST(stress)
+{
+	mm_thread_t thids[NUM_THREAD];
+	struct node* node;
+	int i;
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], stress_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(failed, 0);
+
+	while ((node = pop()))
+		mm_ebr_retire(node, free_node);
+
+	flush_retired();
+	ck_assert_int_eq(num_freed, num_allocated);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_ebr_tcase(void)
+{
+	TCase *tc = tcase_create("ebr");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, retire_and_synchronize);
+	tcase_add_test(tc, reader_delays_reclaim);
+	tcase_add_test(tc, stress);
+
+	return tc;
+}
@@ -0,0 +1,513 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmevloop.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define EVLOOP_IPC_ADDR         "mmlib-evloop-test"
+#define TIMER_DELAY_MS          10
+#define NUM_PERIOD              5
+#define NUM_TASK                100
+#define WAIT_MAX_MS             1000
+
+/**
+ * struct event_record - record of the calls of an event loop callback
+ * @count:      number of calls
+ * @id:         fd, timer ID or signal received in the last call
+ * @revents:    events reported in the last call for a fd
+ * @other_fd:   fd to unregister in the callback, -1 if none
+ */
+struct event_record {
+	int count;
+	int id;
+	int revents;
+	int other_fd;
+};
+
+static struct mm_evloop* loop;
+
+
+#if defined (__linux__)
+
+static
+void record_fd_event(struct mm_evloop* evloop, int fd, int revents,
+                     void* data)
+{
+	struct event_record* rec = data;
+
+	ck_assert(evloop == loop);
+	rec->count++;
+	rec->id = fd;
+	rec->revents = revents;
+
+	if (rec->other_fd >= 0) {
+		mm_evloop_del_fd(evloop, rec->other_fd);
+		rec->other_fd = -1;
+	}
+}
+
+
+static
+void record_event(struct mm_evloop* evloop, int id, void* data)
+{
+	struct event_record* rec = data;
+
+	ck_assert(evloop == loop);
+	rec->count++;
+	rec->id = id;
+}
+
+
+static
+void setup(void)
+{
+	loop = mm_evloop_create();
+	ck_assert(loop != NULL);
+}
+
+
+static
+void teardown(void)
+{
+	mm_evloop_destroy(loop);
+	loop = NULL;
+}
+
+
+START_TEST(invalid_args)
+{
+	struct event_record rec = {.other_fd = -1};
+	int fd, pipefd[2];
+
+	ck_assert(mm_pipe(pipefd) == 0);
+
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], 0x100,
+	                           record_fd_event, &rec) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN, NULL, NULL)
+	          == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_evloop_add_fd(loop, -1, MM_EV_IN, record_fd_event, &rec)
+	          == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EBADF);
+
+	ck_assert(mm_evloop_mod_fd(loop, pipefd[0], MM_EV_IN) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOENT);
+	ck_assert(mm_evloop_del_fd(loop, pipefd[0]) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOENT);
+
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN,
+	                           record_fd_event, &rec) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN,
+	                           record_fd_event, &rec) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EEXIST);
+
+	// A fd is not a timer
+	ck_assert(mm_evloop_del_timer(loop, pipefd[0]) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOENT);
+	ck_assert(mm_evloop_del_fd(loop, pipefd[0]) == 0);
+
+	// Regular files cannot be polled
+	fd = mm_open("evloop-test-file", O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+	ck_assert(mm_evloop_add_fd(loop, fd, MM_EV_IN,
+	                           record_fd_event, &rec) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EPERM);
+	mm_close(fd);
+	mm_unlink("evloop-test-file");
+
+	ck_assert(mm_evloop_add_signal(loop, 0, record_event, &rec) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_evloop_del_signal(loop, SIGUSR2) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOENT);
+
+	mm_close(pipefd[0]);
+	mm_close(pipefd[1]);
+}
+END_TEST
+
+
+START_TEST(pipe_level_triggered)
+{
+	struct event_record rec = {.other_fd = -1};
+	int pipefd[2];
+	char buf[2];
+
+	ck_assert(mm_pipe(pipefd) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN,
+	                           record_fd_event, &rec) == 0);
+
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 0);
+
+	mm_write(pipefd[1], "ab", 2);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec.id, pipefd[0]);
+	ck_assert(rec.revents & MM_EV_IN);
+
+	// Still readable: reported again
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 1);
+	ck_assert_int_eq(rec.count, 2);
+
+	mm_read(pipefd[0], buf, sizeof(buf));
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 0);
+
+	// Closing the write end is reported as hang up
+	mm_close(pipefd[1]);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert(rec.revents & MM_EV_HUP);
+
+	ck_assert(mm_evloop_del_fd(loop, pipefd[0]) == 0);
+	mm_close(pipefd[0]);
+}
+END_TEST
+
+
+START_TEST(pipe_edge_triggered)
+{
+	struct event_record rec = {.other_fd = -1};
+	int pipefd[2];
+
+	ck_assert(mm_pipe(pipefd) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN | MM_EV_ET,
+	                           record_fd_event, &rec) == 0);
+
+	mm_write(pipefd[1], "a", 1);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+
+	// No new data: not reported again even if not read
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 0);
+
+	mm_write(pipefd[1], "b", 1);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec.count, 2);
+
+	ck_assert(mm_evloop_del_fd(loop, pipefd[0]) == 0);
+	mm_close(pipefd[0]);
+	mm_close(pipefd[1]);
+}
+END_TEST
+
+
+START_TEST(modify_fd)
+{
+	struct event_record rec = {.other_fd = -1};
+	int pipefd[2];
+
+	ck_assert(mm_pipe(pipefd) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[1], MM_EV_OUT,
+	                           record_fd_event, &rec) == 0);
+
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert(rec.revents & MM_EV_OUT);
+
+	ck_assert(mm_evloop_mod_fd(loop, pipefd[1], MM_EV_IN) == 0);
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 0);
+
+	ck_assert(mm_evloop_mod_fd(loop, pipefd[1], MM_EV_OUT) == 0);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+
+	ck_assert(mm_evloop_del_fd(loop, pipefd[1]) == 0);
+	mm_close(pipefd[0]);
+	mm_close(pipefd[1]);
+}
+END_TEST
+
+
+/*
+ * Both fds are ready in the same iteration, and the callback of each one
+ * unregisters the other: only one of the callbacks must be called.
+ */
+START_TEST(del_during_dispatch)
+{
+	struct event_record rec1, rec2;
+	int pipe1[2], pipe2[2];
+
+	ck_assert(mm_pipe(pipe1) == 0);
+	ck_assert(mm_pipe(pipe2) == 0);
+	rec1 = (struct event_record) {.other_fd = pipe2[1]};
+	rec2 = (struct event_record) {.other_fd = pipe1[1]};
+
+	ck_assert(mm_evloop_add_fd(loop, pipe1[1], MM_EV_OUT,
+	                           record_fd_event, &rec1) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipe2[1], MM_EV_OUT,
+	                           record_fd_event, &rec2) == 0);
+
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec1.count + rec2.count, 1);
+
+	mm_close(pipe1[0]);
+	mm_close(pipe1[1]);
+	mm_close(pipe2[0]);
+	mm_close(pipe2[1]);
+}
+END_TEST
+
+
+START_TEST(ipc_connection)
+{
+	struct event_record rec = {.other_fd = -1};
+	struct mm_ipc_srv* srv;
+	struct iovec iov = {.iov_base = "hello", .iov_len = 6};
+	struct mm_ipc_msg msg = {.iov = &iov, .num_iov = 1};
+	char buf[16];
+	int client_fd, server_fd;
+
+	srv = mm_ipc_srv_create(EVLOOP_IPC_ADDR);
+	ck_assert(srv != NULL);
+	client_fd = mm_ipc_connect(EVLOOP_IPC_ADDR);
+	ck_assert(client_fd >= 0);
+	server_fd = mm_ipc_srv_accept(srv);
+	ck_assert(server_fd >= 0);
+
+	ck_assert(mm_evloop_add_fd(loop, server_fd, MM_EV_IN,
+	                           record_fd_event, &rec) == 0);
+	ck_assert(mm_ipc_sendmsg(client_fd, &msg) == 6);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec.id, server_fd);
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	ck_assert(mm_ipc_recvmsg(server_fd, &msg) == 6);
+	ck_assert_str_eq(buf, "hello");
+
+	ck_assert(mm_evloop_del_fd(loop, server_fd) == 0);
+	mm_close(server_fd);
+	mm_close(client_fd);
+	mm_ipc_srv_destroy(srv);
+}
+END_TEST
+
+
+START_TEST(socket_accept)
+{
+	struct event_record rec = {.other_fd = -1};
+	struct sockaddr_in addr = {.sin_family = AF_INET};
+	socklen_t addrlen = sizeof(addr);
+	int listen_fd, client_fd, conn_fd;
+
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listen_fd = mm_socket(AF_INET, SOCK_STREAM, 0);
+	ck_assert(listen_fd >= 0);
+	ck_assert(mm_bind(listen_fd, (struct sockaddr*)&addr, addrlen) == 0);
+	ck_assert(mm_getsockname(listen_fd, (struct sockaddr*)&addr,
+	                         &addrlen) == 0);
+	ck_assert(mm_listen(listen_fd, 1) == 0);
+
+	ck_assert(mm_evloop_add_fd(loop, listen_fd, MM_EV_IN,
+	                           record_fd_event, &rec) == 0);
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 0);
+
+	client_fd = mm_socket(AF_INET, SOCK_STREAM, 0);
+	ck_assert(mm_connect(client_fd, (struct sockaddr*)&addr, addrlen)
+	          == 0);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec.id, listen_fd);
+
+	conn_fd = mm_accept(listen_fd, NULL, NULL);
+	ck_assert(conn_fd >= 0);
+
+	ck_assert(mm_evloop_del_fd(loop, listen_fd) == 0);
+	mm_close(conn_fd);
+	mm_close(client_fd);
+	mm_close(listen_fd);
+}
+END_TEST
+
+
+START_TEST(timer_oneshot)
+{
+	struct event_record rec = {.other_fd = -1};
+	struct mm_timespec value = {.tv_nsec = TIMER_DELAY_MS * 1000000};
+	struct mm_timespec start, end;
+	int id;
+
+	id = mm_evloop_add_timer(loop, MM_CLK_MONOTONIC, record_event, &rec);
+	ck_assert(id >= 0);
+
+	// Disarmed timer must not expire
+	ck_assert_int_eq(mm_evloop_run_once(loop, 2 * TIMER_DELAY_MS), 0);
+
+	mm_gettime(MM_CLK_MONOTONIC, &start);
+	ck_assert(mm_evloop_arm_timer(loop, id, 0, &value, NULL) == 0);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	mm_gettime(MM_CLK_MONOTONIC, &end);
+	ck_assert_int_eq(rec.id, id);
+	ck_assert(mm_timediff_ms(&end, &start) >= TIMER_DELAY_MS);
+
+	ck_assert_int_eq(mm_evloop_run_once(loop, 2 * TIMER_DELAY_MS), 0);
+
+	ck_assert(mm_evloop_del_timer(loop, id) == 0);
+	ck_assert(mm_evloop_arm_timer(loop, id, 0, &value, NULL) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOENT);
+}
+END_TEST
+
+
+START_TEST(timer_periodic)
+{
+	struct event_record rec = {.other_fd = -1};
+	struct mm_timespec value;
+	struct mm_timespec period = {.tv_nsec = TIMER_DELAY_MS * 1000000};
+	int id;
+
+	id = mm_evloop_add_timer(loop, MM_CLK_REALTIME, record_event, &rec);
+	ck_assert(id >= 0);
+
+	mm_gettime(MM_CLK_REALTIME, &value);
+	mm_timeadd_ms(&value, TIMER_DELAY_MS);
+	ck_assert(mm_evloop_arm_timer(loop, id, MM_TIMER_ABSTIME,
+	                              &value, &period) == 0);
+
+	while (rec.count < NUM_PERIOD)
+		ck_assert(mm_evloop_run_once(loop, WAIT_MAX_MS) > 0);
+
+	ck_assert(mm_evloop_del_timer(loop, id) == 0);
+}
+END_TEST
+
+
+START_TEST(signal_delivery)
+{
+	struct event_record rec = {.other_fd = -1};
+	sigset_t mask;
+
+	ck_assert(mm_evloop_add_signal(loop, SIGUSR1, record_event, &rec)
+	          == 0);
+	ck_assert(mm_evloop_add_signal(loop, SIGUSR1, record_event, &rec)
+	          == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EEXIST);
+
+	raise(SIGUSR1);
+	ck_assert_int_eq(mm_evloop_run_once(loop, WAIT_MAX_MS), 1);
+	ck_assert_int_eq(rec.id, SIGUSR1);
+
+	// The signal must be unblocked once unregistered
+	ck_assert(mm_evloop_del_signal(loop, SIGUSR1) == 0);
+	pthread_sigmask(SIG_BLOCK, NULL, &mask);
+	ck_assert(!sigismember(&mask, SIGUSR1));
+}
+END_TEST
+
+
+static
+void count_task(struct mm_evloop* evloop, void* data)
+{
+	int* count = data;
+
+	(void)evloop;
+	(*count)++;
+}
+
+
+static
+void* post_tasks_proc(void* arg)
+{
+	int i;
+
+	for (i = 0; i < NUM_TASK; i++)
+		mm_evloop_post(loop, count_task, arg);
+
+	mm_evloop_stop(loop);
+	return NULL;
+}
+
+
+START_TEST(post_and_stop)
+{
+	mm_thread_t thid;
+	int count = 0;
+
+	mm_thr_create(&thid, post_tasks_proc, &count);
+
+	// Tasks posted before the stop request must have been run
+	ck_assert(mm_evloop_run(loop) == 0);
+	ck_assert_int_eq(count, NUM_TASK);
+	mm_thr_join(thid, NULL);
+}
+END_TEST
+
+
+START_TEST(stop_before_run)
+{
+	struct event_record rec = {.other_fd = -1};
+	int pipefd[2];
+	int count = 0;
+
+	ck_assert(mm_pipe(pipefd) == 0);
+	ck_assert(mm_evloop_add_fd(loop, pipefd[0], MM_EV_IN,
+	                           record_fd_event, &rec) == 0);
+	mm_write(pipefd[1], "a", 1);
+	ck_assert(mm_evloop_post(loop, count_task, &count) == 0);
+
+	// Posted task is run but events are not waited for
+	mm_evloop_stop(loop);
+	ck_assert(mm_evloop_run(loop) == 0);
+	ck_assert_int_eq(count, 1);
+	ck_assert_int_eq(rec.count, 0);
+
+	// The stop request has been consumed
+	ck_assert_int_eq(mm_evloop_run_once(loop, 0), 1);
+	ck_assert_int_eq(rec.count, 1);
+
+	ck_assert(mm_evloop_del_fd(loop, pipefd[0]) == 0);
+	mm_close(pipefd[0]);
+	mm_close(pipefd[1]);
+}
+END_TEST
+
+#else /* !__linux__ */
+
+START_TEST(not_supported)
+{
+	ck_assert(mm_evloop_create() == NULL);
+	ck_assert_int_eq(mm_get_lasterror_number(), ENOTSUP);
+}
+END_TEST
+
+#endif /* !__linux__ */
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_evloop_tcase(void)
+{
+	TCase *tc = tcase_create("evloop");
+
+#if defined (__linux__)
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, invalid_args);
+	tcase_add_test(tc, pipe_level_triggered);
+	tcase_add_test(tc, pipe_edge_triggered);
+	tcase_add_test(tc, modify_fd);
+	tcase_add_test(tc, del_during_dispatch);
+	tcase_add_test(tc, ipc_connection);
+	tcase_add_test(tc, socket_accept);
+	tcase_add_test(tc, timer_oneshot);
+	tcase_add_test(tc, timer_periodic);
+	tcase_add_test(tc, signal_delivery);
+	tcase_add_test(tc, post_and_stop);
+	tcase_add_test(tc, stop_before_run);
+#else
+	tcase_add_test(tc, not_supported);
+#endif
+
+	return tc;
+}
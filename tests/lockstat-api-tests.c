@@ -0,0 +1,222 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmlib.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define HOLD_TIME_MS    50
+
+static mm_thr_mutex_t mutex;
+static int32_t holder_ready;
+
+
+/*
+ * Write the lock statistics report in a memory file and return it in
+ * @report
+ */
+static
+void get_report(char* report, size_t len)
+{
+	ssize_t rsz;
+	int fd;
+
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	ck_assert(mm_thr_lockstat_dump(fd) == 0);
+	mm_seek(fd, 0, SEEK_SET);
+	rsz = mm_read(fd, report, len - 1);
+	ck_assert(rsz > 0);
+	report[rsz] = '\0';
+	mm_close(fd);
+}
+
+
+/*
+ * Find the line of @lock in the lock statistics report and parse its
+ * values. Return 0 if found, -1 otherwise.
+ */
+static
+int get_lock_stats(const void* lock, int64_t* count, int64_t* wait_us,
+                   int64_t* hold_us)
+{
+	char report[4096], lockstr[32], caller[128];
+	int64_t max_wait_us;
+	char* line;
+	void* addr;
+
+	get_report(report, sizeof(report));
+
+	// Skip header line
+	line = strchr(report, '\n');
+	while (line && line[1] != '\0') {
+		line++;
+		if (sscanf(line, "%31s %127s %" SCNi64 " %" SCNi64 " %" SCNi64
+		           " %" SCNi64, lockstr, caller, count, wait_us,
+		           &max_wait_us, hold_us) == 6
+		    && sscanf(lockstr, "%p", &addr) == 1
+		    && addr == lock)
+			return 0;
+
+		line = strchr(line, '\n');
+	}
+
+	return -1;
+}
+
+
+static
+void* holder_proc(void* arg)
+{
+	(void)arg;
+
+	mm_thr_mutex_lock(&mutex);
+	mm_atomic_store_i32(&holder_ready, 1, MM_ATOMIC_SEQ_CST);
+	mm_relative_sleep_ms(HOLD_TIME_MS);
+	mm_thr_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+
+/*
+ * Acquire @mutex while another thread holds it for HOLD_TIME_MS, then hold
+ * it for HOLD_TIME_MS
+ */
+static
+void run_contended_lock(void)
+{
+	mm_thread_t thid;
+
+	mm_atomic_store_i32(&holder_ready, 0, MM_ATOMIC_SEQ_CST);
+	mm_thr_create(&thid, holder_proc, NULL);
+	while (!mm_atomic_load_i32(&holder_ready, MM_ATOMIC_SEQ_CST))
+		mm_relative_sleep_ms(1);
+
+	mm_thr_mutex_lock(&mutex);
+	mm_relative_sleep_ms(HOLD_TIME_MS);
+	mm_thr_mutex_unlock(&mutex);
+
+	mm_thr_join(thid, NULL);
+}
+
+
+START_TEST(contended_lock)
+{
+	int64_t count, wait_us, hold_us;
+
+	mm_thr_lockstat_reset();
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+
+	run_contended_lock();
+
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == 0);
+	ck_assert_int_eq(count, 1);
+	ck_assert(wait_us >= (HOLD_TIME_MS / 2) * 1000);
+	ck_assert(hold_us >= (HOLD_TIME_MS / 2) * 1000);
+
+	mm_thr_mutex_deinit(&mutex);
+}
+END_TEST
+
+
+START_TEST(uncontended_lock)
+{
+	int64_t count, wait_us, hold_us;
+	int i;
+
+	mm_thr_lockstat_reset();
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+
+	for (i = 0; i < 100; i++) {
+		mm_thr_mutex_lock(&mutex);
+		mm_thr_mutex_unlock(&mutex);
+	}
+
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == -1);
+
+	mm_thr_mutex_deinit(&mutex);
+}
+END_TEST
+
+
+START_TEST(deinit_lock)
+{
+	int64_t count, wait_us, hold_us;
+
+	mm_thr_lockstat_reset();
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+	run_contended_lock();
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == 0);
+	mm_thr_mutex_deinit(&mutex);
+
+	// Statistics must not be inherited by a lock at the same address
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == -1);
+	mm_thr_mutex_deinit(&mutex);
+
+	// Instrumentation might be enabled for all locks by environment
+	if (mm_getenv("MM_LOCKSTAT", NULL))
+		return;
+
+	// A lock initialized twice must be unregistered by a single deinit
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_LOCKSTAT) == 0);
+	mm_thr_mutex_deinit(&mutex);
+
+	ck_assert(mm_thr_mutex_init(&mutex, 0) == 0);
+	run_contended_lock();
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == -1);
+	mm_thr_mutex_deinit(&mutex);
+}
+END_TEST
+
+
+START_TEST(not_instrumented)
+{
+	int64_t count, wait_us, hold_us;
+
+	// Instrumentation might be enabled for all locks by environment
+	if (mm_getenv("MM_LOCKSTAT", NULL))
+		return;
+
+	mm_thr_lockstat_reset();
+	ck_assert(mm_thr_mutex_init(&mutex, 0) == 0);
+
+	run_contended_lock();
+
+	ck_assert(get_lock_stats(&mutex, &count, &wait_us, &hold_us) == -1);
+
+	mm_thr_mutex_deinit(&mutex);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_lockstat_tcase(void)
+{
+	TCase *tc = tcase_create("lockstat");
+	tcase_add_test(tc, contended_lock);
+	tcase_add_test(tc, uncontended_lock);
+	tcase_add_test(tc, deinit_lock);
+	tcase_add_test(tc, not_instrumented);
+
+	return tc;
+}
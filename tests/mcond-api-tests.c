@@ -0,0 +1,289 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define NUM_THREAD      16
+#define NUM_ROUND       500
+#define TIMEOUT_MS      50
+
+static const int mcond_flags[] = {
+	0,
+	MM_THR_PSHARED,
+	MM_THR_WAIT_MONOTONIC,
+};
+
+/**
+ * struct round_data - state of threads meeting in rounds
+ * @mutex:      mutex protecting the other fields
+ * @cond:       condition broadcast at the end of each round
+ * @num_thread: number of threads taking part in the rounds
+ * @arrived:    number of threads arrived in the current round
+ * @round:      index of the current round
+ * @tickets:    number of wakeups which can be consumed
+ */
+struct round_data {
+	mm_thr_mutex_t mutex;
+	mm_thr_mcond_t cond;
+	int num_thread;
+	int arrived;
+	int round;
+	int tickets;
+};
+
+static struct round_data data;
+
+
+static
+void init_data(int flags, int num_thread)
+{
+	mm_thr_mutex_init(&data.mutex, flags & MM_THR_PSHARED);
+	ck_assert(mm_thr_mcond_init(&data.cond, flags) == 0);
+	data.num_thread = num_thread;
+	data.arrived = 0;
+	data.round = 0;
+	data.tickets = 0;
+}
+
+
+static
+void deinit_data(void)
+{
+	mm_thr_mcond_deinit(&data.cond);
+	mm_thr_mutex_deinit(&data.mutex);
+}
+
+
+static
+void wait_num_waiter(int num)
+{
+	while ((int)mm_atomic_load_u32(&data.cond.nwaiter, MM_ATOMIC_SEQ_CST)
+	       != num)
+		mm_relative_sleep_ms(1);
+}
+
+
+START_TEST(init_flags)
+{
+	mm_thr_mcond_t cond = MM_THR_MCOND_INITIALIZER;
+
+	ck_assert(mm_thr_mcond_signal(&cond) == 0);
+	ck_assert(mm_thr_mcond_broadcast(&cond) == 0);
+	ck_assert(mm_thr_mcond_deinit(&cond) == 0);
+
+	ck_assert(mm_thr_mcond_init(&cond, MM_THR_PSHARED
+	                            | MM_THR_WAIT_MONOTONIC) == 0);
+	mm_thr_mcond_deinit(&cond);
+
+	ck_assert(mm_thr_mcond_init(&cond, MM_THR_ADAPTIVE) == EINVAL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
+START_TEST(timedwait_timeout)
+{
+	int flags = mcond_flags[_i];
+	struct mm_timespec start, abstime;
+	int clk_id;
+
+	init_data(flags, 1);
+	clk_id = (flags & MM_THR_WAIT_MONOTONIC) ? MM_CLK_MONOTONIC
+	                                         : MM_CLK_REALTIME;
+
+	mm_gettime(clk_id, &start);
+	abstime = start;
+	mm_timeadd_ms(&abstime, TIMEOUT_MS);
+
+	mm_thr_mutex_lock(&data.mutex);
+	ck_assert(mm_thr_mcond_timedwait(&data.cond, &data.mutex, &abstime)
+	          == ETIMEDOUT);
+
+	// The mutex must be held again after the timeout
+	ck_assert(mm_thr_mutex_trylock(&data.mutex) != 0);
+	ck_assert(mm_thr_mutex_unlock(&data.mutex) == 0);
+
+	mm_gettime(clk_id, &start);
+	ck_assert(mm_timediff_ns(&start, &abstime) >= 0);
+
+	deinit_data();
+}
+END_TEST
+
+
+static
+void* consume_ticket_proc(void* arg)
+{
+	(void)arg;
+
+	mm_thr_mutex_lock(&data.mutex);
+	while (data.tickets == 0)
+		mm_thr_mcond_wait(&data.cond, &data.mutex);
+
+	data.tickets--;
+	mm_thr_mutex_unlock(&data.mutex);
+
+	return NULL;
+}
+
+
+START_TEST(signal_one_by_one)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	init_data(mcond_flags[_i], NUM_THREAD);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], consume_ticket_proc, NULL);
+
+	wait_num_waiter(NUM_THREAD);
+
+	for (i = 0; i < NUM_THREAD; i++) {
+		mm_thr_mutex_lock(&data.mutex);
+		data.tickets++;
+		mm_thr_mcond_signal(&data.cond);
+		mm_thr_mutex_unlock(&data.mutex);
+	}
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(data.tickets, 0);
+	deinit_data();
+}
+END_TEST
+
+
+static
+void* wait_round_proc(void* arg)
+{
+	int round;
+
+	(void)arg;
+
+	mm_thr_mutex_lock(&data.mutex);
+	round = data.round;
+	while (data.round == round)
+		mm_thr_mcond_wait(&data.cond, &data.mutex);
+
+	mm_thr_mutex_unlock(&data.mutex);
+
+	return NULL;
+}
+
+
+/*
+ * Broadcast while holding the mutex: on Linux, the waiters must have been
+ * requeued instead of being all woken up.
+ */
+START_TEST(broadcast_handoff)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	init_data(mcond_flags[_i], NUM_THREAD);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], wait_round_proc, NULL);
+
+	wait_num_waiter(NUM_THREAD);
+	mm_relative_sleep_ms(TIMEOUT_MS);
+
+	mm_thr_mutex_lock(&data.mutex);
+	data.round++;
+	mm_thr_mcond_broadcast(&data.cond);
+#ifdef __linux__
+	ck_assert(mm_atomic_load_u32(&data.cond.nhandoff, MM_ATOMIC_SEQ_CST)
+	          > 0);
+#endif
+	mm_thr_mutex_unlock(&data.mutex);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(data.cond.nwaiter, 0);
+	ck_assert_int_eq(data.cond.nhandoff, 0);
+	deinit_data();
+}
+END_TEST
+
+
+static
+void* meet_rounds_proc(void* arg)
+{
+	int i, round;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ROUND; i++) {
+		mm_thr_mutex_lock(&data.mutex);
+		round = data.round;
+		if (++data.arrived == data.num_thread) {
+			data.arrived = 0;
+			data.round++;
+			mm_thr_mcond_broadcast(&data.cond);
+		} else {
+			while (data.round == round)
+				mm_thr_mcond_wait(&data.cond, &data.mutex);
+		}
+
+		mm_thr_mutex_unlock(&data.mutex);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Threads meet at the end of each round: a lost wakeup would make the
+ * test hang.
+ */
+START_TEST(broadcast_rounds)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	init_data(mcond_flags[_i], NUM_THREAD);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], meet_rounds_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(data.round, NUM_ROUND);
+	deinit_data();
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_mcond_tcase(void)
+{
+	TCase *tc = tcase_create("mcond");
+	tcase_add_test(tc, init_flags);
+	tcase_add_loop_test(tc, timedwait_timeout, 0, MM_NELEM(mcond_flags));
+	tcase_add_loop_test(tc, signal_one_by_one, 0, MM_NELEM(mcond_flags));
+	tcase_add_loop_test(tc, broadcast_handoff, 0, MM_NELEM(mcond_flags));
+	tcase_add_loop_test(tc, broadcast_rounds, 0, MM_NELEM(mcond_flags));
+
+	return tc;
+}
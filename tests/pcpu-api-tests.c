@@ -0,0 +1,200 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpcpu.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+
+#define NUM_THREAD      8
+#define NUM_ITER        100000
+#define DUMP_FILE       "pcpu-dump.txt"
+
+static struct mm_pcpu_counter* shared_counter;
+
+struct registry_entry {
+	char name[32];
+	int64_t value;
+};
+
+struct registry_data {
+	struct registry_entry entries[16];
+	int num;
+};
+
+
+START_TEST(add_read)
+{
+	struct mm_pcpu_counter* counter;
+
+	counter = mm_pcpu_counter_create("add_read");
+	ck_assert(counter != NULL);
+	ck_assert(mm_pcpu_counter_read(counter) == 0);
+
+	mm_pcpu_counter_add(counter, 1);
+	mm_pcpu_counter_add(counter, 41);
+	ck_assert(mm_pcpu_counter_read(counter) == 42);
+
+	mm_pcpu_counter_add(counter, -50);
+	ck_assert(mm_pcpu_counter_read(counter) == -8);
+
+	mm_pcpu_counter_destroy(counter);
+	mm_pcpu_counter_destroy(NULL);
+
+	ck_assert(mm_pcpu_counter_create(NULL) == NULL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
+static
+void* increment_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER; i++)
+		mm_pcpu_counter_add(shared_counter, 1);
+
+	return NULL;
+}
+
+
+START_TEST(concurrent_add)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	shared_counter = mm_pcpu_counter_create("concurrent_add");
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], increment_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert(mm_pcpu_counter_read(shared_counter)
+	          == (int64_t)NUM_THREAD * NUM_ITER);
+
+	mm_pcpu_counter_destroy(shared_counter);
+}
+END_TEST
+
+
+static
+void record_counter(const char* name, int64_t value, void* data)
+{
+	struct registry_data* reg = data;
+
+	if (reg->num == MM_NELEM(reg->entries))
+		return;
+
+	strncpy(reg->entries[reg->num].name, name,
+	        sizeof(reg->entries[0].name) - 1);
+	reg->entries[reg->num].value = value;
+	reg->num++;
+}
+
+
+START_TEST(registry)
+{
+	struct mm_pcpu_counter* counters[3];
+	struct registry_data reg = {.num = 0};
+
+	counters[0] = mm_pcpu_counter_create("first");
+	counters[1] = mm_pcpu_counter_create("second");
+	counters[2] = mm_pcpu_counter_create("third");
+	mm_pcpu_counter_add(counters[0], 1);
+	mm_pcpu_counter_add(counters[1], 2);
+	mm_pcpu_counter_add(counters[2], 3);
+
+	mm_pcpu_counter_foreach(record_counter, &reg);
+	ck_assert_int_eq(reg.num, 3);
+	ck_assert_str_eq(reg.entries[0].name, "first");
+	ck_assert(reg.entries[0].value == 1);
+	ck_assert_str_eq(reg.entries[1].name, "second");
+	ck_assert(reg.entries[1].value == 2);
+	ck_assert_str_eq(reg.entries[2].name, "third");
+	ck_assert(reg.entries[2].value == 3);
+
+	// Remove the last counter, then check new ones are appended at end
+	mm_pcpu_counter_destroy(counters[2]);
+	counters[2] = mm_pcpu_counter_create("fourth");
+	mm_pcpu_counter_destroy(counters[0]);
+
+	memset(&reg, 0, sizeof(reg));
+	mm_pcpu_counter_foreach(record_counter, &reg);
+	ck_assert_int_eq(reg.num, 2);
+	ck_assert_str_eq(reg.entries[0].name, "second");
+	ck_assert_str_eq(reg.entries[1].name, "fourth");
+	ck_assert(reg.entries[1].value == 0);
+
+	mm_pcpu_counter_destroy(counters[1]);
+	mm_pcpu_counter_destroy(counters[2]);
+
+	memset(&reg, 0, sizeof(reg));
+	mm_pcpu_counter_foreach(record_counter, &reg);
+	ck_assert_int_eq(reg.num, 0);
+}
+END_TEST
+
+
+START_TEST(dump)
+{
+	struct mm_pcpu_counter* msgs;
+	struct mm_pcpu_counter* bytes;
+	char buf[128];
+	ssize_t rsz;
+	int fd;
+
+	msgs = mm_pcpu_counter_create("msgs");
+	bytes = mm_pcpu_counter_create("bytes");
+	mm_pcpu_counter_add(msgs, 12);
+	mm_pcpu_counter_add(bytes, -4096);
+
+	fd = mm_open(DUMP_FILE, O_CREAT|O_TRUNC|O_RDWR, S_IRUSR|S_IWUSR);
+	ck_assert(fd >= 0);
+	ck_assert(mm_pcpu_counter_dump(fd) == 0);
+
+	mm_seek(fd, 0, SEEK_SET);
+	rsz = mm_read(fd, buf, sizeof(buf) - 1);
+	ck_assert(rsz > 0);
+	buf[rsz] = '\0';
+	ck_assert_str_eq(buf, "msgs: 12\nbytes: -4096\n");
+
+	mm_close(fd);
+	mm_unlink(DUMP_FILE);
+	mm_pcpu_counter_destroy(msgs);
+	mm_pcpu_counter_destroy(bytes);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_pcpu_tcase(void)
+{
+	TCase *tc = tcase_create("pcpu");
+	tcase_add_test(tc, add_read);
+	tcase_add_test(tc, concurrent_add);
+	tcase_add_test(tc, registry);
+	tcase_add_test(tc, dump);
+
+	return tc;
+}
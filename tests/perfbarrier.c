@@ -0,0 +1,165 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+/*************************************************************************
+ *                                                                       *
+ *                          Performance tests                            *
+ *                                                                       *
+ *************************************************************************/
+
+#define NUM_ROUND_DEFAULT       10000
+#define MAX_THREAD              64
+
+static int num_round = NUM_ROUND_DEFAULT;
+
+
+/*
+ * Baseline barrier built on a mutex and a condition variable
+ */
+struct cond_barrier {
+	mm_thr_mutex_t mutex;
+	mm_thr_cond_t cond;
+	int count;
+	int arrived;
+	int generation;
+};
+
+
+static
+void cond_barrier_init(struct cond_barrier* b, int count)
+{
+	mm_thr_mutex_init(&b->mutex, 0);
+	mm_thr_cond_init(&b->cond, 0);
+	b->count = count;
+	b->arrived = 0;
+	b->generation = 0;
+}
+
+
+static
+void cond_barrier_deinit(struct cond_barrier* b)
+{
+	mm_thr_cond_deinit(&b->cond);
+	mm_thr_mutex_deinit(&b->mutex);
+}
+
+
+static
+void cond_barrier_wait(struct cond_barrier* b)
+{
+	int gen;
+
+	mm_thr_mutex_lock(&b->mutex);
+	gen = b->generation;
+	if (++b->arrived == b->count) {
+		b->arrived = 0;
+		b->generation++;
+		mm_thr_cond_broadcast(&b->cond);
+	} else {
+		while (gen == b->generation)
+			mm_thr_cond_wait(&b->cond, &b->mutex);
+	}
+
+	mm_thr_mutex_unlock(&b->mutex);
+}
+
+
+static mm_thr_barrier_t barrier;
+static struct cond_barrier cbarrier;
+
+
+static
+void* barrier_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < num_round; i++)
+		mm_thr_barrier_wait(&barrier);
+
+	return NULL;
+}
+
+
+static
+void* cond_barrier_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < num_round; i++)
+		cond_barrier_wait(&cbarrier);
+
+	return NULL;
+}
+
+
+/*
+ * Run @proc in @num_thread threads (including the calling one) and return
+ * the mean duration of a barrier round in nanoseconds.
+ */
+static
+int64_t run_rounds(int num_thread, void* (*proc)(void*))
+{
+	mm_thread_t thids[MAX_THREAD];
+	struct mm_timespec start, stop;
+	int i;
+
+	mm_gettime(MM_CLK_MONOTONIC, &start);
+
+	for (i = 1; i < num_thread; i++)
+		mm_thr_create(&thids[i], proc, NULL);
+
+	proc(NULL);
+
+	for (i = 1; i < num_thread; i++)
+		mm_thr_join(thids[i], NULL);
+
+	mm_gettime(MM_CLK_MONOTONIC, &stop);
+
+	return mm_timediff_ns(&stop, &start) / num_round;
+}
+
+
+int main(int argc, char* argv[])
+{
+	int64_t barrier_ns, cond_ns;
+	int num_thread;
+
+	if (argc > 1)
+		num_round = atoi(argv[1]);
+
+	printf("num_round=%i\n", num_round);
+	printf("%8s %20s %20s\n", "threads", "barrier (ns/round)",
+	       "cond (ns/round)");
+
+	for (num_thread = 2; num_thread <= MAX_THREAD; num_thread *= 2) {
+		mm_thr_barrier_init(&barrier, num_thread, 0);
+		barrier_ns = run_rounds(num_thread, barrier_proc);
+		mm_thr_barrier_deinit(&barrier);
+
+		cond_barrier_init(&cbarrier, num_thread);
+		cond_ns = run_rounds(num_thread, cond_barrier_proc);
+		cond_barrier_deinit(&cbarrier);
+
+		printf("%8i %20lli %20lli\n", num_thread,
+		       (long long)barrier_ns, (long long)cond_ns);
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -23,12 +23,20 @@
  *                                                                       *
  *************************************************************************/
 
-struct perf_data {
+union perf_lock {
 	mm_thr_mutex_t mtx;
+	mm_thr_qlock_t qlock;
+};
+
+struct perf_data {
+	union perf_lock lock;
 	int iter;
-	char fill_up[64-sizeof(mm_thr_mutex_t)+sizeof(int)];
+	char fill_up[64-sizeof(union perf_lock)+sizeof(int)];
 };
 
+// Not a mutex flag: select mm_thr_qlock_t instead of mm_thr_mutex_t
+#define PERF_QLOCK      0x40000000
+
 #define NUM_ITERATION	10000
 #define NUM_THREAD_PER_LOCK_DEFAULT	16
 #define NUM_LOCK_DEFAULT		4
@@ -37,6 +45,48 @@ struct perf_data {
 static struct perf_data data_array[32];
 static int num_lock = NUM_LOCK_DEFAULT;
 static int num_thread_per_lock = NUM_THREAD_PER_LOCK_DEFAULT;
+static int use_qlock;
+
+
+static
+void perf_lock_init(union perf_lock* lock, int flags)
+{
+	use_qlock = flags & PERF_QLOCK;
+	if (use_qlock)
+		mm_thr_qlock_init(&lock->qlock, flags & ~PERF_QLOCK);
+	else
+		mm_thr_mutex_init(&lock->mtx, flags);
+}
+
+
+static
+void perf_lock_lock(union perf_lock* lock)
+{
+	if (use_qlock)
+		mm_thr_qlock_lock(&lock->qlock);
+	else
+		mm_thr_mutex_lock(&lock->mtx);
+}
+
+
+static
+void perf_lock_unlock(union perf_lock* lock)
+{
+	if (use_qlock)
+		mm_thr_qlock_unlock(&lock->qlock);
+	else
+		mm_thr_mutex_unlock(&lock->mtx);
+}
+
+
+static
+void perf_lock_deinit(union perf_lock* lock)
+{
+	if (use_qlock)
+		mm_thr_qlock_deinit(&lock->qlock);
+	else
+		mm_thr_mutex_deinit(&lock->mtx);
+}
 
 static
 void* lock_perf_routine(void* arg)
@@ -49,7 +99,7 @@ void* lock_perf_routine(void* arg)
 	for (i = 0; i < NUM_ITERATION; i++) {
 		data = &data_array[ind];
 
-		mm_thr_mutex_lock(&data->mtx);
+		perf_lock_lock(&data->lock);
 		if (ind == 0)
 			mm_toc();
 
@@ -58,7 +108,7 @@ void* lock_perf_routine(void* arg)
 		if (ind == 0)
 			mm_tic();
 
-		mm_thr_mutex_unlock(&data->mtx);
+		perf_lock_unlock(&data->lock);
 
 		if (++ind == num_lock)
 			ind = 0;
@@ -79,8 +129,8 @@ int run_perf_lock_contended(int flags)
 	mm_profile_reset(0);
 
 	for (i = 0; i < num_lock; i++) {
-		mm_thr_mutex_init(&data_array[i].mtx, flags);
-		mm_thr_mutex_lock(&data_array[i].mtx);
+		perf_lock_init(&data_array[i].lock, flags);
+		perf_lock_lock(&data_array[i].lock);
 	}
 
 	// Spawn threads
@@ -91,12 +141,12 @@ int run_perf_lock_contended(int flags)
 
 	mm_relative_sleep_ms(100);
 
-	// Unlock mutex now
+	// Unlock locks now
 	for (i = 0; i < num_lock; i++) {
 		if (i == 0)
 			mm_tic();
 
-		mm_thr_mutex_unlock(&data_array[i].mtx);
+		perf_lock_unlock(&data_array[i].lock);
 	}
 
 	// Wait until all theads have finished
@@ -104,7 +154,7 @@ int run_perf_lock_contended(int flags)
 		mm_thr_join(thids[i], NULL);
 
 	for (i = 0; i < num_lock; i++)
-		mm_thr_mutex_deinit(&data_array[0].mtx);
+		perf_lock_deinit(&data_array[i].lock);
 
 	printf("\ncontended case with flags=0x%08x:\n", flags);
 	fflush(stdout);
@@ -120,16 +170,16 @@ int run_perf_lock_uncontended(int flags)
 
 	mm_profile_reset(0);
 
-	mm_thr_mutex_init(&data_array[0].mtx, flags);
+	perf_lock_init(&data_array[0].lock, flags);
 
 	for (i = 0; i < NUM_ITERATION; i++) {
 		mm_tic();
-		mm_thr_mutex_lock(&data_array[0].mtx);
-		mm_thr_mutex_unlock(&data_array[0].mtx);
+		perf_lock_lock(&data_array[0].lock);
+		perf_lock_unlock(&data_array[0].lock);
 		mm_toc();
 	}
 
-	mm_thr_mutex_deinit(&data_array[0].mtx);
+	perf_lock_deinit(&data_array[0].lock);
 
 	printf("\nuncontended case with flags=0x%08x\n", flags);
 	fflush(stdout);
@@ -154,12 +204,18 @@ int main(int argc, char* argv[])
 	       num_lock, num_thread_per_lock);
 
 	run_perf_lock_uncontended(0);
+	run_perf_lock_uncontended(MM_THR_ADAPTIVE);
 	run_perf_lock_uncontended(MM_THR_PSHARED);
+	run_perf_lock_uncontended(MM_THR_PSHARED | MM_THR_ADAPTIVE);
+	run_perf_lock_uncontended(PERF_QLOCK);
 
 	printf("\n\n");
 
 	run_perf_lock_contended(0);
+	run_perf_lock_contended(MM_THR_ADAPTIVE);
 	run_perf_lock_contended(MM_THR_PSHARED);
+	run_perf_lock_contended(MM_THR_PSHARED | MM_THR_ADAPTIVE);
+	run_perf_lock_contended(PERF_QLOCK);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,170 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmprofile.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+/*************************************************************************
+ *                                                                       *
+ *                          Performance tests                            *
+ *                                                                       *
+ *************************************************************************/
+
+#define NUM_TASK_DEFAULT        2000
+#define TASK_DURATION_DEFAULT   20      // in microseconds
+#define MAX_THREAD_BATCH        256
+#define NUM_ROUND               10
+
+static int num_task = NUM_TASK_DEFAULT;
+static int task_duration_us = TASK_DURATION_DEFAULT;
+
+
+static
+void busy_work(void* arg)
+{
+	struct mm_timespec start, now;
+	volatile int x = 1;
+
+	(void)arg;
+
+	mm_gettime(MM_CLK_CPU_THREAD, &start);
+	do {
+		x *= 3;
+		mm_gettime(MM_CLK_CPU_THREAD, &now);
+	} while (mm_timediff_us(&now, &start) < task_duration_us);
+}
+
+
+static
+void* busy_work_thread(void* arg)
+{
+	busy_work(arg);
+	return NULL;
+}
+
+
+/*
+ * Baseline: each task is run in its own thread. Threads are spawned by
+ * batches to avoid exhausting the system resources.
+ */
+static
+void run_thread_per_task(void)
+{
+	mm_thread_t thids[MAX_THREAD_BATCH];
+	int i, j, batch;
+
+	for (i = 0; i < num_task; i += batch) {
+		batch = num_task - i;
+		if (batch > MAX_THREAD_BATCH)
+			batch = MAX_THREAD_BATCH;
+
+		for (j = 0; j < batch; j++)
+			mm_thr_create(&thids[j], busy_work_thread, NULL);
+
+		for (j = 0; j < batch; j++)
+			mm_thr_join(thids[j], NULL);
+	}
+}
+
+
+static
+void run_pool_flat(struct mm_thrpool* pool)
+{
+	int i;
+
+	for (i = 0; i < num_task; i++)
+		mm_thrpool_submit(pool, NULL, busy_work, NULL);
+
+	mm_thrpool_drain(pool);
+}
+
+
+struct split_data {
+	struct mm_thrpool* pool;
+	int num;
+};
+
+
+/*
+ * Recursively split the work in 2 halves submitted from the workers, so
+ * that the load is balanced by work stealing.
+ */
+static
+void split_work(void* arg)
+{
+	struct split_data* data = arg;
+	struct split_data sub[2];
+	struct mm_thrpool_group* grp;
+	int i;
+
+	if (data->num <= 1) {
+		busy_work(NULL);
+		return;
+	}
+
+	grp = mm_thrpool_group_create();
+	sub[0] = (struct split_data) {data->pool, data->num / 2};
+	sub[1] = (struct split_data) {data->pool, data->num - data->num / 2};
+	for (i = 0; i < 2; i++)
+		mm_thrpool_submit(data->pool, grp, split_work, &sub[i]);
+
+	mm_thrpool_group_wait(grp);
+	mm_thrpool_group_destroy(grp);
+}
+
+
+static
+void run_pool_nested(struct mm_thrpool* pool)
+{
+	struct split_data data = {.pool = pool, .num = num_task};
+
+	mm_thrpool_submit(pool, NULL, split_work, &data);
+	mm_thrpool_drain(pool);
+}
+
+
+int main(int argc, char* argv[])
+{
+	struct mm_thrpool* pool;
+	int i;
+
+	if (argc > 1)
+		num_task = atoi(argv[1]);
+
+	if (argc > 2)
+		task_duration_us = atoi(argv[2]);
+
+	printf("num_task=%i task_duration=%ius\n", num_task, task_duration_us);
+
+	pool = mm_thrpool_create(0);
+	if (!pool)
+		return EXIT_FAILURE;
+
+	mm_profile_reset(0);
+	for (i = 0; i < NUM_ROUND; i++) {
+		mm_tic();
+		run_thread_per_task();
+		mm_toc_label("thread per task");
+		run_pool_flat(pool);
+		mm_toc_label("pool (flat)");
+		run_pool_nested(pool);
+		mm_toc_label("pool (nested)");
+	}
+
+	printf("\n");
+	fflush(stdout);
+	mm_profile_print(PROF_MEAN|PROF_MIN|PROF_MAX, 1);
+
+	mm_thrpool_destroy(pool, 0);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,592 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+// Test the profiling macros as they are expanded in profiling builds
+#define MM_PROFILE_ENABLE
+
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmprofile.h"
+#include "mmsysio.h"
+#include "mmtime.h"
+#include "profile-shared.h"
+
+#define NUM_ITER        16
+#define SHORT_NS        200000
+#define LONG_NS         (2*SHORT_NS)
+#define SHARED_PROFILE_NAME     "/mmlib-test-profile"
+#define PROF_TOP_BIN    TOP_BUILDDIR "/src/mmprof-top" EXEEXT
+
+
+/*
+ * Spend at least @duration_ns of CPU time in the calling thread. Since the
+ * thread is busy all along, this is also a lower bound of the wall clock
+ * time spent.
+ */
+static NOINLINE
+void burn_cpu(int64_t duration_ns)
+{
+	struct mm_timespec start, ts;
+
+	mm_gettime(MM_CLK_CPU_THREAD, &start);
+	do {
+		mm_gettime(MM_CLK_CPU_THREAD, &ts);
+	} while (mm_timediff_ns(&ts, &start) < duration_ns);
+}
+
+
+/*
+ * Write the profile report with @mask in a memory file and return it in
+ * @report
+ */
+static
+void get_report(int mask, char* report, size_t len)
+{
+	ssize_t rsz;
+	int fd;
+
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	ck_assert(mm_profile_print(mask, fd) == 0);
+	mm_seek(fd, 0, SEEK_SET);
+	rsz = mm_read(fd, report, len - 1);
+	ck_assert(rsz > 0);
+	report[rsz] = '\0';
+	mm_close(fd);
+}
+
+
+/*
+ * Run NUM_ITER iterations of 2 labelled measure points whose durations
+ * are respectively SHORT_NS and LONG_NS. The last iteration is accounted
+ * by the final report written in @report.
+ */
+static
+void run_labelled(char* report, size_t len)
+{
+	int i;
+
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		burn_cpu(SHORT_NS);
+		mm_toc_label("short");
+		burn_cpu(LONG_NS);
+		mm_toc_label("long");
+	}
+
+	get_report(PROF_DEFAULT, report, len);
+}
+
+
+/*
+ * Check that the statistics of @point are consistent and that the
+ * measure is at least @min_ns
+ */
+static
+void check_point_stats(int point, int64_t min_ns)
+{
+	int64_t min, max, mean;
+
+	min = mm_profile_get_data(point, PROF_MIN);
+	max = mm_profile_get_data(point, PROF_MAX);
+	mean = mm_profile_get_data(point, PROF_MEAN);
+
+	// toc overhead is subtracted from each measure, hence the margin
+	ck_assert_int_ge(min, min_ns - min_ns/10);
+	ck_assert_int_le(min, mean);
+	ck_assert_int_le(mean, max);
+}
+
+
+static const int clock_flags[] = {0, PROF_RESET_CPUCLOCK};
+
+START_TEST(timing_stats)
+{
+	char report[4096];
+
+	mm_profile_reset(clock_flags[_i]);
+	run_labelled(report, sizeof(report));
+
+	check_point_stats(0, SHORT_NS);
+	check_point_stats(1, LONG_NS);
+
+	// Measure points are successive: the longer part must show
+	ck_assert_int_gt(mm_profile_get_data(1, PROF_MIN),
+	                 mm_profile_get_data(0, PROF_MIN));
+}
+END_TEST
+
+
+START_TEST(invalid_data_request)
+{
+	char report[4096];
+
+	mm_profile_reset(0);
+	run_labelled(report, sizeof(report));
+
+	// Only 2 measure points have been recorded
+	ck_assert_int_eq(mm_profile_get_data(2, PROF_MEAN), -1);
+
+	// Only one type can be requested at once
+	ck_assert_int_eq(mm_profile_get_data(0, PROF_MIN|PROF_MAX), -1);
+
+	// Resource usage has not been enabled
+	ck_assert_int_eq(mm_profile_get_data(0, PROF_MINFLT), -1);
+}
+END_TEST
+
+
+START_TEST(print_labels)
+{
+	char report[4096];
+	char* line;
+	int num_lines = 0;
+
+	mm_profile_reset(0);
+	run_labelled(report, sizeof(report));
+
+	ck_assert(strstr(report, "mean") != NULL);
+	ck_assert(strstr(report, "toc overhead") != NULL);
+
+	// header, separator, 2 measure points and toc overhead
+	for (line = report; (line = strchr(line, '\n')); line++)
+		num_lines++;
+
+	ck_assert_int_eq(num_lines, 5);
+	line = strstr(report, "short |");
+	ck_assert(line != NULL);
+	ck_assert(strstr(line, " long |") != NULL);
+}
+END_TEST
+
+
+START_TEST(keep_label)
+{
+	char report[4096];
+	int i;
+
+	mm_profile_reset(0);
+	run_labelled(report, sizeof(report));
+
+	// With label kept, unlabelled points inherit previous labels
+	mm_profile_reset(PROF_RESET_KEEPLABEL);
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		mm_toc();
+		mm_toc();
+	}
+	get_report(PROF_DEFAULT, report, sizeof(report));
+	ck_assert(strstr(report, "short |") != NULL);
+	ck_assert(strstr(report, "long |") != NULL);
+
+	// Otherwise measure points are numbered
+	mm_profile_reset(0);
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		mm_toc();
+		mm_toc();
+	}
+	get_report(PROF_DEFAULT, report, sizeof(report));
+	ck_assert(strstr(report, "short") == NULL);
+	ck_assert(strstr(report, "1 |") != NULL);
+	ck_assert(strstr(report, "2 |") != NULL);
+}
+END_TEST
+
+
+START_TEST(rusage)
+{
+	char report[4096];
+	size_t off, buflen = 256*4096;
+	volatile char* buf;
+	int i;
+
+	mm_profile_reset(PROF_RESET_RUSAGE);
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		buf = malloc(buflen);
+		ck_assert(buf != NULL);
+		mm_toc_label("alloc");
+		// volatile prevents the writes to be optimized away
+		for (off = 0; off < buflen; off += 4096)
+			buf[off] = i;
+
+		mm_toc_label("touch pages");
+		free((void*)buf);
+		mm_toc_label("free");
+	}
+	get_report(PROF_DEFAULT|PROF_RUSAGE, report, sizeof(report));
+
+	ck_assert(strstr(report, "touch pages") != NULL);
+	ck_assert_int_ge(mm_profile_get_data(1, PROF_MINFLT), 0);
+	ck_assert_int_ge(mm_profile_get_data(0, PROF_VCSW), 0);
+
+#if defined (__linux__)
+	// Touching a fresh large allocation must fault in pages
+	ck_assert_int_gt(mm_profile_get_data(1, PROF_MINFLT), 0);
+#endif
+
+	// RSS has not been requested at reset
+	ck_assert_int_eq(mm_profile_get_data(1, PROF_RSS), -1);
+}
+END_TEST
+
+
+/*
+ * Profiled scope left early if @early is non zero. In such a case, the
+ * measure at scope exit is close to 0, otherwise it is at least LONG_NS.
+ */
+static
+void profiled_scope(int early)
+{
+	MM_PROFILE_SCOPE("scope");
+
+	burn_cpu(SHORT_NS);
+	MM_PROFILE_TOC("inner");
+	if (early)
+		return;
+
+	burn_cpu(LONG_NS);
+}
+
+
+START_TEST(macro_scope)
+{
+	char report[4096];
+	int i;
+
+	MM_PROFILE_RESET(0);
+	for (i = 0; i < NUM_ITER; i++)
+		profiled_scope(i % 2);
+
+	get_report(PROF_DEFAULT, report, sizeof(report));
+	ck_assert(strstr(report, "inner |") != NULL);
+	ck_assert(strstr(report, "scope |") != NULL);
+
+	// Scope exit is the 2nd point, whatever the exit path
+	ck_assert_int_eq(mm_profile_get_data(2, PROF_MEAN), -1);
+	check_point_stats(0, SHORT_NS);
+	ck_assert_int_lt(mm_profile_get_data(1, PROF_MIN), SHORT_NS);
+	ck_assert_int_ge(mm_profile_get_data(1, PROF_MAX),
+	                 LONG_NS - LONG_NS/10);
+}
+END_TEST
+
+
+START_TEST(label_static)
+{
+	static char static_label[] = "initial";
+	char label[] = "copied";
+	char report[4096];
+	int i;
+
+	mm_profile_reset(0);
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		mm_toc_label(label);
+		mm_toc_label_static(static_label);
+	}
+
+	// Only the label passed to mm_toc_label() has been copied
+	strcpy(label, "xxxxxx");
+	strcpy(static_label, "changed");
+	get_report(PROF_DEFAULT, report, sizeof(report));
+	ck_assert(strstr(report, "copied |") != NULL);
+	ck_assert(strstr(report, "changed |") != NULL);
+	ck_assert(strstr(report, "initial") == NULL);
+}
+END_TEST
+
+
+#define LONG_LABEL \
+	"0123456789012345678901234567890123456789012345678901234567890123" \
+	"456789"
+
+START_TEST(label_static_too_long)
+{
+	char report[4096];
+	char* line;
+	int i;
+
+	mm_profile_reset(0);
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_tic();
+		mm_toc_label_static(LONG_LABEL);
+	}
+
+	// The label is not copied, hence it is truncated at display
+	get_report(PROF_DEFAULT, report, sizeof(report));
+	line = strstr(report, "\n0123");
+	ck_assert(line != NULL);
+	ck_assert(strncmp(line+1, LONG_LABEL, 63) == 0);
+	ck_assert(strncmp(line+64, " |", 2) == 0);
+}
+END_TEST
+
+
+/*
+ * Map the segment of the shared profile and return the slot in use. The
+ * segment has been created by the test, hence the calling process is the
+ * only one attached.
+ */
+static
+const struct profshm_proc* get_shared_slot(struct profshm_segment** seg)
+{
+	const struct profshm_proc* slot = NULL;
+	int i, fd;
+
+	fd = mm_shm_open(SHARED_PROFILE_NAME, O_RDONLY, 0);
+	ck_assert(fd >= 0);
+	*seg = mm_mapfile(fd, 0, sizeof(**seg), MM_MAP_READ|MM_MAP_SHARED);
+	mm_close(fd);
+	ck_assert(*seg != NULL);
+	ck_assert_int_eq((*seg)->magic, PROFSHM_MAGIC);
+
+	for (i = 0; i < (*seg)->max_proc; i++) {
+		if (!(*seg)->procs[i].pid)
+			continue;
+
+		ck_assert(slot == NULL);
+		slot = &(*seg)->procs[i];
+	}
+
+	ck_assert(slot != NULL);
+	return slot;
+}
+
+
+START_TEST(shared_stats)
+{
+	char report[4096];
+	struct profshm_segment* seg;
+	const struct profshm_proc* slot;
+	const struct profshm_point* pt;
+	int flags;
+
+	// Remove leftover of a previous failed run
+	flags = mm_error_set_flags(MM_ERROR_SET, MM_ERROR_IGNORE);
+	mm_shm_unlink(SHARED_PROFILE_NAME);
+	mm_error_set_flags(flags, MM_ERROR_IGNORE);
+
+	ck_assert(mm_profile_attach_shared(SHARED_PROFILE_NAME) == 0);
+
+	mm_profile_reset(0);
+	run_labelled(report, sizeof(report));
+
+	slot = get_shared_slot(&seg);
+	ck_assert_int_eq(slot->num_iter, NUM_ITER);
+	ck_assert_int_eq(slot->num_points, 2);
+
+	pt = &slot->points[0];
+	ck_assert_int_eq(pt->label_len, strlen("short"));
+	ck_assert(memcmp(pt->label, "short", pt->label_len) == 0);
+	ck_assert_int_eq(pt->min, mm_profile_get_data(0, PROF_MIN));
+	ck_assert_int_eq(pt->max, mm_profile_get_data(0, PROF_MAX));
+
+	pt = &slot->points[1];
+	ck_assert(memcmp(pt->label, "long", pt->label_len) == 0);
+	ck_assert_int_eq(pt->sum / NUM_ITER,
+	                 mm_profile_get_data(1, PROF_MEAN));
+
+	// Reset must be reflected in shared memory
+	mm_profile_reset(PROF_RESET_KEEPLABEL);
+	ck_assert_int_eq(slot->num_iter, 0);
+	ck_assert_int_eq(slot->points[0].label_len, strlen("short"));
+
+	mm_unmap(seg);
+	mm_profile_detach_shared();
+	ck_assert(mm_shm_unlink(SHARED_PROFILE_NAME) == 0);
+}
+END_TEST
+
+
+/*
+ * Fill the slot @index of @seg with the statistics of a process @pid named
+ * @name whose points are labelled "alpha" and "beta"
+ */
+static
+void set_shared_proc(struct profshm_segment* seg, int index, int64_t pid,
+                     const char* name, int64_t num_iter,
+                     const int64_t alpha[4], const int64_t beta[4])
+{
+	struct profshm_proc* slot = &seg->procs[index];
+	const int64_t* values[] = {alpha, beta};
+	const char* labels[] = {"alpha", "beta"};
+	struct profshm_point* pt;
+	int i;
+
+	slot->pid = pid;
+	slot->num_iter = num_iter;
+	slot->num_points = 2;
+	slot->name_len = strlen(name);
+	memcpy(slot->name, name, slot->name_len);
+
+	for (i = 0; i < 2; i++) {
+		pt = &slot->points[i];
+		pt->sum = values[i][0];
+		pt->min = values[i][1];
+		pt->max = values[i][2];
+		pt->median = values[i][3];
+		pt->label_len = strlen(labels[i]);
+		memcpy(pt->label, labels[i], pt->label_len);
+	}
+}
+
+
+/*
+ * Check that mmprof-top reports the statistics of a shared profile
+ * segment of known content per process and aggregated over processes
+ */
+START_TEST(prof_top_output)
+{
+	// sum, min, max, median
+	const int64_t alpha_a[4] = {10000, 500, 2000, 1000};
+	const int64_t beta_a[4] = {200000, 15000, 30000, 20000};
+	const int64_t alpha_b[4] = {60000, 100, 5000, 2000};
+	const int64_t beta_b[4] = {300000, 7000, 20000, 10000};
+	char* argv[] = {PROF_TOP_BIN, "-b", "-n", "1",
+	                SHARED_PROFILE_NAME, NULL};
+	struct mm_remap_fd fd_map;
+	struct profshm_segment* seg;
+	char report[4096];
+	char* aggr;
+	mm_pid_t pid;
+	ssize_t rsz;
+	int fd, status, flags;
+
+	flags = mm_error_set_flags(MM_ERROR_SET, MM_ERROR_IGNORE);
+	mm_shm_unlink(SHARED_PROFILE_NAME);
+	mm_error_set_flags(flags, MM_ERROR_IGNORE);
+
+	// Create the segment as a publishing process would
+	fd = mm_shm_open(SHARED_PROFILE_NAME, O_RDWR|O_CREAT|O_EXCL,
+	                 S_IRUSR|S_IWUSR);
+	ck_assert(fd >= 0);
+	ck_assert(mm_ftruncate(fd, sizeof(*seg)) == 0);
+	seg = mm_mapfile(fd, 0, sizeof(*seg), MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	ck_assert(seg != NULL);
+
+	seg->version = PROFSHM_VERSION;
+	seg->max_proc = PROFSHM_MAX_PROC;
+	seg->num_point = PROFSHM_NUM_POINT;
+	set_shared_proc(seg, 0, 1111, "proc-a", 10, alpha_a, beta_a);
+	set_shared_proc(seg, 5, 2222, "proc-b", 30, alpha_b, beta_b);
+	seg->magic = PROFSHM_MAGIC;
+
+	// Run a single refresh with output captured in a memory file
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	fd_map = (struct mm_remap_fd) {.child_fd = 1, .parent_fd = fd};
+	ck_assert(mm_spawn(&pid, argv[0], 1, &fd_map, 0, argv, NULL) == 0);
+	ck_assert(mm_wait_process(pid, &status) == 0);
+	ck_assert_int_eq(status, MM_WSTATUS_EXITED);
+
+	mm_seek(fd, 0, SEEK_SET);
+	rsz = mm_read(fd, report, sizeof(report) - 1);
+	ck_assert(rsz > 0);
+	report[rsz] = '\0';
+	mm_close(fd);
+	mm_unmap(seg);
+	ck_assert(mm_shm_unlink(SHARED_PROFILE_NAME) == 0);
+
+	ck_assert(strstr(report, "profile " SHARED_PROFILE_NAME
+	                         ": 2 process(es)\n") != NULL);
+
+	// Per process statistics: mean is sum divided by iterations
+	ck_assert(strstr(report, "pid 1111 (proc-a): 10 iterations\n"));
+	ck_assert(strstr(report, "pid 2222 (proc-b): 30 iterations\n"));
+	ck_assert(strstr(report, "alpha |        10 |   1000.00 ns |"
+	                         "    500.00 ns |   2000.00 ns |"
+	                         "   1000.00 ns |\n"));
+	ck_assert(strstr(report, " beta |        30 |     10.00 us |"
+	                         "   7000.00 ns |     20.00 us |"
+	                         "     10.00 us |\n"));
+
+	// Points with the same label are merged over processes
+	aggr = strstr(report, "aggregated over all processes\n");
+	ck_assert(aggr != NULL);
+	ck_assert(strstr(aggr, "alpha |         2 |   1750.00 ns |"
+	                       "    100.00 ns |   5000.00 ns |"
+	                       "     70.00 us |\n"));
+	ck_assert(strstr(aggr, " beta |         2 |     12.50 us |"
+	                       "   7000.00 ns |     30.00 us |"
+	                       "    500.00 us |\n"));
+}
+END_TEST
+
+
+START_TEST(sampler_output)
+{
+	char report[16384];
+	char *line, *eol, *countstr;
+	int fd, count, total = 0;
+	ssize_t rsz;
+
+	if (mm_sampler_start(1000)) {
+		// Sampling is not available on all platforms
+		ck_assert_int_eq(mm_get_lasterror_number(), ENOTSUP);
+		fprintf(stderr, "Skipping sampler test: not supported\n");
+		return;
+	}
+
+	burn_cpu(100000000);
+
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	ck_assert(mm_sampler_stop(fd) == 0);
+	mm_seek(fd, 0, SEEK_SET);
+	rsz = mm_read(fd, report, sizeof(report) - 1);
+	ck_assert(rsz > 0);
+	report[rsz] = '\0';
+	mm_close(fd);
+
+	// Each line is a folded call stack followed by its sample count
+	for (line = report; *line; line = eol + 1) {
+		eol = strchr(line, '\n');
+		ck_assert(eol != NULL);
+		*eol = '\0';
+		countstr = strrchr(line, ' ');
+		ck_assert(countstr != NULL && countstr != line);
+		count = atoi(countstr + 1);
+		ck_assert_int_gt(count, 0);
+		total += count;
+	}
+
+	// 100ms of CPU sampled every 1ms
+	ck_assert_int_ge(total, 10);
+}
+END_TEST
+
+
+LOCAL_SYMBOL
+TCase* create_profile_tcase(void)
+{
+	TCase* tc = tcase_create("profile");
+
+	tcase_add_loop_test(tc, timing_stats, 0, MM_NELEM(clock_flags));
+	tcase_add_test(tc, invalid_data_request);
+	tcase_add_test(tc, print_labels);
+	tcase_add_test(tc, keep_label);
+	tcase_add_test(tc, rusage);
+	tcase_add_test(tc, macro_scope);
+	tcase_add_test(tc, label_static);
+	tcase_add_test(tc, label_static_too_long);
+	tcase_add_test(tc, shared_stats);
+	tcase_add_test(tc, prof_top_output);
+	tcase_add_test(tc, sampler_output);
+
+	return tc;
+}
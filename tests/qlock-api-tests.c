@@ -0,0 +1,190 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define NUM_THREAD      16
+#define NUM_ITER        20000
+
+static mm_thr_qlock_t qlock;
+static int64_t counter;
+static int32_t order[NUM_THREAD];
+static int32_t num_acquired;
+
+
+START_TEST(lock_trylock)
+{
+	mm_thr_qlock_t lock = MM_THR_QLOCK_INITIALIZER;
+
+	ck_assert(mm_thr_qlock_trylock(&lock) == 0);
+	ck_assert(mm_thr_qlock_trylock(&lock) == EBUSY);
+	ck_assert(mm_thr_qlock_unlock(&lock) == 0);
+
+	ck_assert(mm_thr_qlock_lock(&lock) == 0);
+	ck_assert(mm_thr_qlock_trylock(&lock) == EBUSY);
+	ck_assert(mm_thr_qlock_unlock(&lock) == 0);
+
+	ck_assert(mm_thr_qlock_deinit(&lock) == 0);
+}
+END_TEST
+
+
+START_TEST(init_flags)
+{
+	mm_thr_qlock_t lock;
+
+	ck_assert(mm_thr_qlock_init(&lock, 0) == 0);
+	mm_thr_qlock_deinit(&lock);
+
+	ck_assert(mm_thr_qlock_init(&lock, MM_THR_PSHARED) == EINVAL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
+START_TEST(unordered_unlock)
+{
+	mm_thr_qlock_t locks[4];
+	int i;
+
+	for (i = 0; i < MM_NELEM(locks); i++) {
+		mm_thr_qlock_init(&locks[i], 0);
+		ck_assert(mm_thr_qlock_lock(&locks[i]) == 0);
+	}
+
+	// Unlock in an order which is not the reverse of locking
+	mm_thr_qlock_unlock(&locks[1]);
+	mm_thr_qlock_unlock(&locks[3]);
+	mm_thr_qlock_unlock(&locks[0]);
+	ck_assert(mm_thr_qlock_trylock(&locks[1]) == 0);
+	mm_thr_qlock_unlock(&locks[2]);
+	mm_thr_qlock_unlock(&locks[1]);
+
+	for (i = 0; i < MM_NELEM(locks); i++) {
+		ck_assert(mm_thr_qlock_trylock(&locks[i]) == 0);
+		mm_thr_qlock_unlock(&locks[i]);
+		mm_thr_qlock_deinit(&locks[i]);
+	}
+}
+END_TEST
+
+
+static
+void* increment_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_thr_qlock_lock(&qlock);
+		counter++;
+		mm_thr_qlock_unlock(&qlock);
+	}
+
+	return NULL;
+}
+
+
+START_TEST(mutual_exclusion)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	mm_thr_qlock_init(&qlock, 0);
+	counter = 0;
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], increment_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert(counter == NUM_THREAD * NUM_ITER);
+	mm_thr_qlock_deinit(&qlock);
+}
+END_TEST
+
+
+static
+void* record_order_proc(void* arg)
+{
+	intptr_t id = (intptr_t)arg;
+	int32_t rank;
+
+	mm_thr_qlock_lock(&qlock);
+	rank = mm_atomic_fetch_add_i32(&num_acquired, 1, MM_ATOMIC_RELAXED);
+	order[rank] = id;
+	mm_thr_qlock_unlock(&qlock);
+
+	return NULL;
+}
+
+
+/*
+ * Queue the threads one after the other while the lock is held and check
+ * that they get the lock in the order they have been queued.
+ */
+START_TEST(fifo_order)
+{
+	mm_thread_t thids[NUM_THREAD];
+	void* tail;
+	intptr_t i;
+
+	mm_thr_qlock_init(&qlock, 0);
+	num_acquired = 0;
+
+	mm_thr_qlock_lock(&qlock);
+	for (i = 0; i < NUM_THREAD; i++) {
+		tail = mm_atomic_load_ptr(&qlock.tail, MM_ATOMIC_ACQUIRE);
+		mm_thr_create(&thids[i], record_order_proc, (void*)i);
+
+		// Wait for the thread to be queued
+		while (mm_atomic_load_ptr(&qlock.tail, MM_ATOMIC_ACQUIRE)
+		       == tail)
+			mm_relative_sleep_ms(1);
+	}
+
+	mm_thr_qlock_unlock(&qlock);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(num_acquired, NUM_THREAD);
+	for (i = 0; i < NUM_THREAD; i++)
+		ck_assert_int_eq(order[i], i);
+
+	mm_thr_qlock_deinit(&qlock);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_qlock_tcase(void)
+{
+	TCase *tc = tcase_create("qlock");
+	tcase_add_test(tc, lock_trylock);
+	tcase_add_test(tc, init_flags);
+	tcase_add_test(tc, unordered_unlock);
+	tcase_add_test(tc, mutual_exclusion);
+	tcase_add_test(tc, fifo_order);
+
+	return tc;
+}
@@ -0,0 +1,361 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmqueue.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "sync-testlib.h"
+#include "threaddata-manipulation.h"
+
+#define CAPACITY        64
+#define NUM_PRODUCER    4
+#define NUM_CONSUMER    4
+#define NUM_ELT         20000
+#define TIMEOUT_MS      50
+#define NUM_PROC        4
+#define NUM_PROC_ELT    2000
+#define PROC_CAPACITY   32
+#define WAIT_MAX_MS     10000
+
+static
+int queue_type_flags[] = {
+	MM_QUEUE_SPSC,
+	MM_QUEUE_MPMC,
+	MM_QUEUE_SPSC | MM_QUEUE_PSHARED,
+	MM_QUEUE_MPMC | MM_QUEUE_PSHARED,
+};
+
+struct elt {
+	int32_t producer;
+	int32_t index;
+	char payload[12];
+};
+
+static struct mm_queue* queue;
+static atomic_int failed;
+static atomic_llong sum;
+static atomic_int num_consumed;
+
+
+START_TEST(fifo_order)
+{
+	struct elt e;
+	int i;
+
+	queue = mm_queue_create(CAPACITY, sizeof(e), queue_type_flags[_i]);
+	ck_assert(queue != NULL);
+
+	ck_assert(mm_queue_dequeue(queue, &e) == EAGAIN);
+
+	for (i = 0; i < CAPACITY; i++) {
+		e = (struct elt) {.producer = 0, .index = i};
+		ck_assert(mm_queue_enqueue(queue, &e) == 0);
+	}
+
+	ck_assert(mm_queue_enqueue(queue, &e) == EAGAIN);
+
+	// Go around the ring several times
+	for (i = 0; i < 5*CAPACITY; i++) {
+		ck_assert(mm_queue_dequeue(queue, &e) == 0);
+		ck_assert_int_eq(e.index, i);
+		e.index = i + CAPACITY;
+		ck_assert(mm_queue_enqueue(queue, &e) == 0);
+	}
+
+	for (i = 0; i < CAPACITY; i++) {
+		ck_assert(mm_queue_dequeue(queue, &e) == 0);
+		ck_assert_int_eq(e.index, 5*CAPACITY + i);
+	}
+
+	ck_assert(mm_queue_dequeue(queue, &e) == EAGAIN);
+	mm_queue_destroy(queue);
+}
+END_TEST
+
+
+START_TEST(batch)
+{
+	int in[CAPACITY + 10], out[CAPACITY + 10];
+	int i;
+
+	for (i = 0; i < MM_NELEM(in); i++)
+		in[i] = i;
+
+	queue = mm_queue_create(CAPACITY, sizeof(int), queue_type_flags[_i]);
+	ck_assert(queue != NULL);
+
+	ck_assert_int_eq(mm_queue_enqueue_batch(queue, in, 10), 10);
+
+	// Only the remaining capacity must be filled
+	ck_assert_int_eq(mm_queue_enqueue_batch(queue, in + 10, CAPACITY),
+	                 CAPACITY - 10);
+	ck_assert_int_eq(mm_queue_enqueue_batch(queue, in, 1), 0);
+
+	ck_assert_int_eq(mm_queue_dequeue_batch(queue, out, 5), 5);
+	ck_assert_int_eq(mm_queue_dequeue_batch(queue, out + 5, MM_NELEM(out)),
+	                 CAPACITY - 5);
+	ck_assert_int_eq(mm_queue_dequeue_batch(queue, out, 1), 0);
+
+	for (i = 0; i < CAPACITY; i++)
+		ck_assert_int_eq(out[i], i);
+
+	mm_queue_destroy(queue);
+}
+END_TEST
+
+
+START_TEST(invalid_init)
+{
+	struct mm_queue* queue;
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+
+	ck_assert(mm_queue_create(0, 4, 0) == NULL);
+	ck_assert(mm_get_lasterror_number() == EINVAL);
+	ck_assert(mm_queue_create(CAPACITY + 1, 4, 0) == NULL);
+	ck_assert(mm_get_lasterror_number() == EINVAL);
+	ck_assert(mm_queue_create(CAPACITY, 0, MM_QUEUE_MPMC) == NULL);
+	ck_assert(mm_get_lasterror_number() == EINVAL);
+	ck_assert(mm_queue_sizeof(CAPACITY + 1, 4, 0) == 0);
+	ck_assert(mm_get_lasterror_number() == EINVAL);
+
+	// init reports the error in its return value like other operations
+	queue = mm_queue_create(CAPACITY, 4, 0);
+	ck_assert(queue != NULL);
+	ck_assert(mm_queue_init(queue, 3, 4, 0) == EINVAL);
+	ck_assert(mm_queue_init(queue, CAPACITY, 0, 0) == EINVAL);
+	mm_queue_destroy(queue);
+}
+END_TEST
+
+
+START_TEST(timedwait)
+{
+	struct mm_timespec deadline;
+	int val = 42;
+	int i;
+
+	queue = mm_queue_create(2, sizeof(int),
+	                        queue_type_flags[_i] | MM_QUEUE_WAIT_MONOTONIC);
+	ck_assert(queue != NULL);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_queue_dequeue_wait(queue, &val, &deadline) == ETIMEDOUT);
+
+	for (i = 0; i < 2; i++)
+		ck_assert(mm_queue_enqueue_wait(queue, &val, NULL) == 0);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_queue_enqueue_wait(queue, &val, &deadline) == ETIMEDOUT);
+
+	mm_queue_destroy(queue);
+}
+END_TEST
+
+
+static
+void* producer_proc(void* arg)
+{
+	struct elt e = {.producer = (intptr_t)arg};
+	int i;
+
+	for (i = 0; i < NUM_ELT; i++) {
+		e.index = i;
+		mm_queue_enqueue_wait(queue, &e, NULL);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Consume until NUM_ELT elements from each producer have been received.
+ * The elements of a given producer must be received in order if there is
+ * a single consumer.
+ */
+static
+void* consumer_proc(void* arg)
+{
+	int last_index[NUM_PRODUCER];
+	int num_consumer = (intptr_t)arg;
+	int total = num_consumer == 1 ? NUM_ELT : NUM_ELT * NUM_PRODUCER;
+	struct elt e;
+	int i;
+
+	for (i = 0; i < NUM_PRODUCER; i++)
+		last_index[i] = -1;
+
+	while (atomic_fetch_add(&num_consumed, 1) < total) {
+		mm_queue_dequeue_wait(queue, &e, NULL);
+		atomic_fetch_add(&sum, e.index);
+
+		if (num_consumer == 1) {
+			if (e.index != last_index[e.producer] + 1)
+				atomic_store(&failed, 1);
+
+			last_index[e.producer] = e.index;
+		}
+	}
+
+	return NULL;
+}
+
+
+START_TEST(concurrent_transfer)
+{
+	int flags = queue_type_flags[_i];
+	mm_thread_t prod_thids[NUM_PRODUCER];
+	mm_thread_t cons_thids[NUM_CONSUMER];
+	int i, num_prod, num_cons;
+	long long expected;
+
+	num_prod = (flags & MM_QUEUE_MPMC) ? NUM_PRODUCER : 1;
+	num_cons = (flags & MM_QUEUE_MPMC) ? NUM_CONSUMER : 1;
+
+	atomic_store(&failed, 0);
+	atomic_store(&sum, 0);
+	atomic_store(&num_consumed, 0);
+	queue = mm_queue_create(CAPACITY, sizeof(struct elt), flags);
+	ck_assert(queue != NULL);
+
+	for (i = 0; i < num_cons; i++)
+		mm_thr_create(&cons_thids[i], consumer_proc,
+		              (void*)(intptr_t)num_cons);
+
+	for (i = 0; i < num_prod; i++)
+		mm_thr_create(&prod_thids[i], producer_proc, (void*)(intptr_t)i);
+
+	for (i = 0; i < num_prod; i++)
+		mm_thr_join(prod_thids[i], NULL);
+
+	for (i = 0; i < num_cons; i++)
+		mm_thr_join(cons_thids[i], NULL);
+
+	expected = (long long)num_prod * NUM_ELT * (NUM_ELT - 1) / 2;
+	ck_assert_int_eq(atomic_load(&failed), 0);
+	ck_assert(atomic_load(&sum) == expected);
+
+	mm_queue_destroy(queue);
+}
+END_TEST
+
+
+/*
+ * Map the same shared memory twice: elements enqueued through one mapping
+ * must be dequeued through the other one
+ */
+START_TEST(shared_mapping)
+{
+	int flags = queue_type_flags[_i] | MM_QUEUE_PSHARED;
+	struct mm_queue *q1, *q2;
+	size_t size;
+	int i, val, fd;
+
+	size = mm_queue_sizeof(CAPACITY, sizeof(int), flags);
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	mm_ftruncate(fd, size);
+	q1 = mm_mapfile(fd, 0, size, MM_MAP_RDWR|MM_MAP_SHARED);
+	q2 = mm_mapfile(fd, 0, size, MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	ck_assert(q1 != NULL && q2 != NULL && q1 != q2);
+
+	ck_assert(mm_queue_init(q1, CAPACITY, sizeof(int), flags) == 0);
+
+	for (i = 0; i < 3*CAPACITY; i++) {
+		ck_assert(mm_queue_enqueue(q1, &i) == 0);
+		ck_assert(mm_queue_dequeue(q2, &val) == 0);
+		ck_assert_int_eq(val, i);
+	}
+
+	ck_assert(mm_queue_dequeue(q1, &val) == EAGAIN);
+
+	mm_unmap(q2);
+	mm_unmap(q1);
+}
+END_TEST
+
+
+/*
+ * Children processes produce in a queue located in shared memory while the
+ * parent consumes: each producer sequence must be received in order.
+ */
+START_TEST(pshared_process)
+{
+	int flags = MM_QUEUE_MPMC | MM_QUEUE_PSHARED | MM_QUEUE_WAIT_MONOTONIC;
+	struct queue_data* qdata;
+	struct mm_queue* queue;
+	struct mm_timespec deadline;
+	mm_pid_t pids[NUM_PROC];
+	int next_val[NUM_PROC] = {0};
+	int i, val, id, shm_fd, num_proc, num_received = 0;
+
+	ck_assert(MM_CACHELINE_SIZE
+	          + mm_queue_sizeof(PROC_CAPACITY, sizeof(int), flags)
+	          <= MM_PAGESZ);
+
+	qdata = map_shared_page(&shm_fd);
+	ck_assert(qdata != NULL);
+
+	qdata->num_iter = NUM_PROC_ELT;
+	qdata->wait_max_ms = WAIT_MAX_MS;
+	queue = queue_data_get_queue(qdata);
+	ck_assert(mm_queue_init(queue, PROC_CAPACITY, sizeof(int), flags) == 0);
+
+	num_proc = spawn_shared_runners(pids, NUM_PROC, "run_queue_data",
+	                                shm_fd);
+
+	get_deadline(&deadline, WAIT_MAX_MS);
+	for (i = 0; i < num_proc * NUM_PROC_ELT; i++) {
+		if (mm_queue_dequeue_wait(queue, &val, &deadline))
+			break;
+
+		id = val / NUM_PROC_ELT;
+		ck_assert(id >= 0 && id < num_proc);
+		ck_assert_int_eq(val % NUM_PROC_ELT, next_val[id]++);
+		num_received++;
+	}
+
+	ck_assert_int_eq(wait_shared_runners(pids, num_proc), 0);
+	ck_assert_int_eq(num_proc, NUM_PROC);
+	ck_assert_int_eq(num_received, NUM_PROC * NUM_PROC_ELT);
+	ck_assert(mm_queue_dequeue(queue, &val) == EAGAIN);
+
+	mm_unmap(qdata);
+	mm_close(shm_fd);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_queue_tcase(void)
+{
+	TCase *tc = tcase_create("queue");
+	tcase_add_loop_test(tc, fifo_order, 0, MM_NELEM(queue_type_flags));
+	tcase_add_loop_test(tc, batch, 0, MM_NELEM(queue_type_flags));
+	tcase_add_test(tc, invalid_init);
+	tcase_add_loop_test(tc, timedwait, 0, MM_NELEM(queue_type_flags));
+	tcase_add_loop_test(tc, concurrent_transfer, 0, MM_NELEM(queue_type_flags));
+	tcase_add_loop_test(tc, shared_mapping, 0, 2);
+	tcase_add_test(tc, pshared_process);
+
+	return tc;
+}
@@ -0,0 +1,353 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdatomic.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "sync-testlib.h"
+
+#define NUM_READER      8
+#define NUM_WRITER      4
+#define NUM_ITER        20000
+#define TIMEOUT_MS      50
+
+static
+int rwlock_type_flags[] = {
+	0,
+	MM_THR_PREFER_WRITER,
+	MM_THR_PSHARED,
+	MM_THR_PSHARED | MM_THR_PREFER_WRITER,
+};
+
+static mm_thr_rwlock_t lock;
+static atomic_int num_inside;
+static atomic_int failed;
+static int data[2];
+
+
+/*
+ * Each reader waits inside the read lock until all the readers are in:
+ * this succeeds only if the readers hold the lock concurrently
+ */
+static
+void* concurrent_reader_proc(void* arg)
+{
+	struct mm_timespec now, start;
+
+	(void)arg;
+
+	mm_thr_rwlock_rdlock(&lock);
+	atomic_fetch_add(&num_inside, 1);
+
+	mm_gettime(MM_CLK_MONOTONIC, &start);
+	while (atomic_load(&num_inside) < NUM_READER) {
+		mm_gettime(MM_CLK_MONOTONIC, &now);
+		if (mm_timediff_ms(&now, &start) > 5000) {
+			atomic_store(&failed, 1);
+			break;
+		}
+
+		mm_relative_sleep_ms(1);
+	}
+
+	mm_thr_rwlock_unlock(&lock);
+	return NULL;
+}
+
+
+START_TEST(concurrent_readers)
+{
+	mm_thread_t thids[NUM_READER];
+	int i;
+
+	atomic_store(&num_inside, 0);
+	atomic_store(&failed, 0);
+	mm_thr_rwlock_init(&lock, rwlock_type_flags[_i]);
+
+	for (i = 0; i < NUM_READER; i++)
+		mm_thr_create(&thids[i], concurrent_reader_proc, NULL);
+
+	for (i = 0; i < NUM_READER; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&failed), 0);
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+static
+void* reader_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_thr_rwlock_rdlock(&lock);
+		if (data[0] != data[1])
+			atomic_store(&failed, 1);
+
+		mm_thr_rwlock_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+
+static
+void* writer_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER / 10; i++) {
+		mm_thr_rwlock_wrlock(&lock);
+		if (atomic_fetch_add(&num_inside, 1) != 0)
+			atomic_store(&failed, 1);
+
+		data[0]++;
+		mm_relative_sleep_us(1);
+		data[1]++;
+
+		atomic_fetch_sub(&num_inside, 1);
+		mm_thr_rwlock_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+
+START_TEST(writer_exclusion)
+{
+	mm_thread_t thids[NUM_READER + NUM_WRITER];
+	int i;
+
+	atomic_store(&num_inside, 0);
+	atomic_store(&failed, 0);
+	data[0] = data[1] = 0;
+	mm_thr_rwlock_init(&lock, rwlock_type_flags[_i]);
+
+	for (i = 0; i < NUM_READER; i++)
+		mm_thr_create(&thids[i], reader_proc, NULL);
+
+	for (i = 0; i < NUM_WRITER; i++)
+		mm_thr_create(&thids[NUM_READER + i], writer_proc, NULL);
+
+	for (i = 0; i < MM_NELEM(thids); i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&failed), 0);
+	ck_assert_int_eq(data[0], NUM_WRITER * (NUM_ITER / 10));
+	ck_assert_int_eq(data[1], data[0]);
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+static
+void* trylock_proc(void* arg)
+{
+	int* results = arg;
+
+	results[0] = mm_thr_rwlock_tryrdlock(&lock);
+	if (results[0] == 0)
+		mm_thr_rwlock_unlock(&lock);
+
+	results[1] = mm_thr_rwlock_trywrlock(&lock);
+	if (results[1] == 0)
+		mm_thr_rwlock_unlock(&lock);
+
+	return NULL;
+}
+
+
+START_TEST(trylock)
+{
+	mm_thread_t thid;
+	int results[2];
+
+	mm_thr_rwlock_init(&lock, rwlock_type_flags[_i]);
+
+	// Unlocked: both must succeed
+	mm_thr_create(&thid, trylock_proc, results);
+	mm_thr_join(thid, NULL);
+	ck_assert_int_eq(results[0], 0);
+	ck_assert_int_eq(results[1], 0);
+
+	// Read locked: only read lock must succeed
+	mm_thr_rwlock_rdlock(&lock);
+	mm_thr_create(&thid, trylock_proc, results);
+	mm_thr_join(thid, NULL);
+	mm_thr_rwlock_unlock(&lock);
+	ck_assert_int_eq(results[0], 0);
+	ck_assert_int_eq(results[1], EBUSY);
+
+	// Write locked: both must fail
+	mm_thr_rwlock_wrlock(&lock);
+	mm_thr_create(&thid, trylock_proc, results);
+	mm_thr_join(thid, NULL);
+	mm_thr_rwlock_unlock(&lock);
+	ck_assert_int_eq(results[0], EBUSY);
+	ck_assert_int_eq(results[1], EBUSY);
+
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+static
+void* timedlock_proc(void* arg)
+{
+	int* results = arg;
+	struct mm_timespec deadline;
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	results[0] = mm_thr_rwlock_timedrdlock(&lock, &deadline);
+	if (results[0] == 0)
+		mm_thr_rwlock_unlock(&lock);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	results[1] = mm_thr_rwlock_timedwrlock(&lock, &deadline);
+	if (results[1] == 0)
+		mm_thr_rwlock_unlock(&lock);
+
+	return NULL;
+}
+
+
+START_TEST(timedlock)
+{
+	mm_thread_t thid;
+	int results[2];
+
+	mm_thr_rwlock_init(&lock,
+	                   rwlock_type_flags[_i] | MM_THR_WAIT_MONOTONIC);
+
+	mm_thr_rwlock_rdlock(&lock);
+	mm_thr_create(&thid, timedlock_proc, results);
+	mm_thr_join(thid, NULL);
+	mm_thr_rwlock_unlock(&lock);
+	ck_assert_int_eq(results[0], 0);
+	ck_assert_int_eq(results[1], ETIMEDOUT);
+
+	mm_thr_rwlock_wrlock(&lock);
+	mm_thr_create(&thid, timedlock_proc, results);
+	mm_thr_join(thid, NULL);
+	mm_thr_rwlock_unlock(&lock);
+	ck_assert_int_eq(results[0], ETIMEDOUT);
+	ck_assert_int_eq(results[1], ETIMEDOUT);
+
+	// Lock must be usable after timeouts
+	ck_assert_int_eq(mm_thr_rwlock_trywrlock(&lock), 0);
+	mm_thr_rwlock_unlock(&lock);
+
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+static
+void* invalid_timedlock_proc(void* arg)
+{
+	int* results = arg;
+	struct mm_timespec deadline;
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	deadline.tv_nsec = NS_IN_SEC;
+	results[0] = mm_thr_rwlock_timedrdlock(&lock, &deadline);
+	results[1] = mm_thr_rwlock_timedwrlock(&lock, &deadline);
+
+	return NULL;
+}
+
+
+/*
+ * A malformed timeout must be reported instead of being waited forever
+ */
+START_TEST(timedlock_invalid)
+{
+	mm_thread_t thid;
+	int results[2];
+
+	mm_thr_rwlock_init(&lock,
+	                   rwlock_type_flags[_i] | MM_THR_WAIT_MONOTONIC);
+
+	mm_thr_rwlock_wrlock(&lock);
+	mm_thr_create(&thid, invalid_timedlock_proc, results);
+	mm_thr_join(thid, NULL);
+	mm_thr_rwlock_unlock(&lock);
+	ck_assert_int_eq(results[0], EINVAL);
+	ck_assert_int_eq(results[1], EINVAL);
+
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+static
+void* blocked_writer_proc(void* arg)
+{
+	(void)arg;
+
+	mm_thr_rwlock_wrlock(&lock);
+	atomic_store(&num_inside, 1);
+	mm_thr_rwlock_unlock(&lock);
+
+	return NULL;
+}
+
+
+START_TEST(writer_preference)
+{
+	mm_thread_t thid;
+
+	atomic_store(&num_inside, 0);
+	mm_thr_rwlock_init(&lock, MM_THR_PREFER_WRITER);
+
+	mm_thr_rwlock_rdlock(&lock);
+	mm_thr_create(&thid, blocked_writer_proc, NULL);
+	mm_relative_sleep_ms(TIMEOUT_MS);
+
+	// The waiting writer must prevent new readers
+	ck_assert_int_eq(mm_thr_rwlock_tryrdlock(&lock), EBUSY);
+	ck_assert_int_eq(atomic_load(&num_inside), 0);
+
+	mm_thr_rwlock_unlock(&lock);
+	mm_thr_join(thid, NULL);
+	ck_assert_int_eq(atomic_load(&num_inside), 1);
+
+	mm_thr_rwlock_deinit(&lock);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_rwlock_tcase(void)
+{
+	TCase *tc = tcase_create("rwlock");
+	tcase_add_loop_test(tc, concurrent_readers, 0, MM_NELEM(rwlock_type_flags));
+	tcase_add_loop_test(tc, writer_exclusion, 0, MM_NELEM(rwlock_type_flags));
+	tcase_add_loop_test(tc, trylock, 0, MM_NELEM(rwlock_type_flags));
+	tcase_add_loop_test(tc, timedlock, 0, MM_NELEM(rwlock_type_flags));
+	tcase_add_loop_test(tc, timedlock_invalid,
+	                    0, MM_NELEM(rwlock_type_flags));
+	tcase_add_test(tc, writer_preference);
+
+	return tc;
+}
@@ -0,0 +1,269 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdatomic.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+#include "sync-testlib.h"
+#include "threaddata-manipulation.h"
+
+#define NUM_THREAD      8
+#define NUM_PROC        4
+#define NUM_PROC_ITER   1000
+#define WAIT_MAX_MS     5000
+#define NUM_ITER        10000
+#define TIMEOUT_MS      50
+
+static mm_thr_sem_t sem;
+static mm_thr_event_t event;
+static atomic_int num_done;
+
+
+/**************************************************************************
+ *                                                                        *
+ *                            semaphore tests                             *
+ *                                                                        *
+ **************************************************************************/
+static
+void* consumer_proc(void* arg)
+{
+	int i;
+
+	(void)arg;
+
+	for (i = 0; i < NUM_ITER; i++) {
+		mm_thr_sem_wait(&sem);
+		atomic_fetch_add(&num_done, 1);
+	}
+
+	return NULL;
+}
+
+
+START_TEST(sem_producer_consumer)
+{
+	mm_thread_t thids[NUM_THREAD];
+	int i;
+
+	atomic_store(&num_done, 0);
+	ck_assert(mm_thr_sem_init(&sem, 0, sync_type_flags[_i]) == 0);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], consumer_proc, NULL);
+
+	for (i = 0; i < NUM_THREAD * NUM_ITER; i++)
+		ck_assert(mm_thr_sem_post(&sem) == 0);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&num_done), NUM_THREAD * NUM_ITER);
+	ck_assert(mm_thr_sem_trywait(&sem) == EAGAIN);
+	mm_thr_sem_deinit(&sem);
+}
+END_TEST
+
+
+START_TEST(sem_trywait_timedwait)
+{
+	struct mm_timespec deadline;
+	int flags = sync_type_flags[_i] | MM_THR_WAIT_MONOTONIC;
+
+	ck_assert(mm_thr_sem_init(&sem, 1, flags) == 0);
+
+	ck_assert(mm_thr_sem_trywait(&sem) == 0);
+	ck_assert(mm_thr_sem_trywait(&sem) == EAGAIN);
+
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_sem_timedwait(&sem, &deadline) == ETIMEDOUT);
+
+	mm_thr_sem_post(&sem);
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_sem_timedwait(&sem, &deadline) == 0);
+
+	mm_thr_sem_deinit(&sem);
+}
+END_TEST
+
+
+START_TEST(sem_value_limits)
+{
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+
+	ck_assert(mm_thr_sem_init(&sem, MM_THR_SEM_VALUE_MAX + 1u, 0) == EINVAL);
+
+	ck_assert(mm_thr_sem_init(&sem, MM_THR_SEM_VALUE_MAX, 0) == 0);
+	ck_assert(mm_thr_sem_post(&sem) == EOVERFLOW);
+	ck_assert(mm_thr_sem_trywait(&sem) == 0);
+	ck_assert(mm_thr_sem_post(&sem) == 0);
+	mm_thr_sem_deinit(&sem);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                              event tests                               *
+ *                                                                        *
+ **************************************************************************/
+static
+void* event_waiter_proc(void* arg)
+{
+	(void)arg;
+
+	mm_thr_event_wait(&event);
+	atomic_fetch_add(&num_done, 1);
+
+	return NULL;
+}
+
+
+START_TEST(event_manual_reset)
+{
+	mm_thread_t thids[NUM_THREAD];
+	struct mm_timespec deadline;
+	int i;
+
+	atomic_store(&num_done, 0);
+	mm_thr_event_init(&event, sync_type_flags[_i] | MM_THR_WAIT_MONOTONIC);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], event_waiter_proc, NULL);
+
+	mm_relative_sleep_ms(TIMEOUT_MS);
+	ck_assert_int_eq(atomic_load(&num_done), 0);
+
+	// All waiters must be released and the event stays signaled
+	mm_thr_event_set(&event);
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&num_done), NUM_THREAD);
+	ck_assert(mm_thr_event_wait(&event) == 0);
+
+	mm_thr_event_reset(&event);
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_event_timedwait(&event, &deadline) == ETIMEDOUT);
+
+	mm_thr_event_deinit(&event);
+}
+END_TEST
+
+
+START_TEST(event_auto_reset)
+{
+	mm_thread_t thids[NUM_THREAD];
+	struct mm_timespec deadline;
+	int i;
+
+	atomic_store(&num_done, 0);
+	mm_thr_event_init(&event, sync_type_flags[_i] | MM_THR_AUTORESET
+	                  | MM_THR_WAIT_MONOTONIC);
+
+	// Signal without waiter must be kept for the next waiter only
+	mm_thr_event_set(&event);
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_event_timedwait(&event, &deadline) == 0);
+	get_deadline(&deadline, TIMEOUT_MS);
+	ck_assert(mm_thr_event_timedwait(&event, &deadline) == ETIMEDOUT);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], event_waiter_proc, NULL);
+
+	// Each set must release exactly one waiter
+	for (i = 0; i < NUM_THREAD; i++) {
+		mm_thr_event_set(&event);
+		while (atomic_load(&num_done) != i+1)
+			mm_relative_sleep_ms(1);
+
+		mm_relative_sleep_ms(5);
+		ck_assert_int_eq(atomic_load(&num_done), i+1);
+	}
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	mm_thr_event_deinit(&event);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                         cross-process tests                            *
+ *                                                                        *
+ **************************************************************************/
+/*
+ * Children processes wait for a shared event and post a shared semaphore
+ * that the parent decrements.
+ */
+START_TEST(sem_event_pshared_process)
+{
+	struct sem_event_data* sdata;
+	struct mm_timespec deadline;
+	mm_pid_t pids[NUM_PROC];
+	int i, shm_fd, num_proc, num_decrement = 0;
+
+	sdata = map_shared_page(&shm_fd);
+	ck_assert(sdata != NULL);
+
+	sdata->num_iter = NUM_PROC_ITER;
+	mm_thr_event_init(&sdata->start, MM_THR_PSHARED);
+	mm_thr_sem_init(&sdata->sem, 0, MM_THR_PSHARED|MM_THR_WAIT_MONOTONIC);
+
+	num_proc = spawn_shared_runners(pids, NUM_PROC, "run_sem_event_data",
+	                                shm_fd);
+
+	// Nothing can be posted before the event is set
+	mm_relative_sleep_ms(TIMEOUT_MS);
+	ck_assert(mm_thr_sem_trywait(&sdata->sem) == EAGAIN);
+	mm_thr_event_set(&sdata->start);
+
+	get_deadline(&deadline, WAIT_MAX_MS);
+	for (i = 0; i < num_proc * NUM_PROC_ITER; i++) {
+		if (mm_thr_sem_timedwait(&sdata->sem, &deadline))
+			break;
+
+		num_decrement++;
+	}
+
+	ck_assert_int_eq(wait_shared_runners(pids, num_proc), 0);
+	ck_assert_int_eq(num_proc, NUM_PROC);
+	ck_assert_int_eq(num_decrement, NUM_PROC * NUM_PROC_ITER);
+	ck_assert(mm_thr_sem_trywait(&sdata->sem) == EAGAIN);
+
+	mm_thr_sem_deinit(&sdata->sem);
+	mm_thr_event_deinit(&sdata->start);
+	mm_unmap(sdata);
+	mm_close(shm_fd);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_sem_tcase(void)
+{
+	TCase *tc = tcase_create("sem");
+	tcase_add_loop_test(tc, sem_producer_consumer, 0, MM_NELEM(sync_type_flags));
+	tcase_add_loop_test(tc, sem_trywait_timedwait, 0, MM_NELEM(sync_type_flags));
+	tcase_add_test(tc, sem_value_limits);
+	tcase_add_loop_test(tc, event_manual_reset, 0, MM_NELEM(sync_type_flags));
+	tcase_add_loop_test(tc, event_auto_reset, 0, MM_NELEM(sync_type_flags));
+	tcase_add_test(tc, sem_event_pshared_process);
+
+	return tc;
+}
@@ -0,0 +1,229 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmlib.h"
+#include "mmpredefs.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "sync-testlib.h"
+
+#define NUM_READER      4
+#define NUM_WRITER      4
+#define NUM_WRITE       20000
+
+struct snapshot {
+	uint64_t seq;
+	uint64_t values[7];
+};
+
+struct shared_data {
+	mm_thr_seqlock_t lock;
+	struct snapshot snapshot;
+};
+
+static struct shared_data* writer_data;
+static struct shared_data* reader_data;
+static int32_t failed;
+static int32_t done;
+
+
+/*
+ * Map the same shared memory twice, the writers and the readers using
+ * different mappings
+ */
+static
+void map_shared_data(int flags)
+{
+	int fd;
+
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	mm_ftruncate(fd, sizeof(*writer_data));
+	writer_data = mm_mapfile(fd, 0, sizeof(*writer_data),
+	                         MM_MAP_RDWR|MM_MAP_SHARED);
+	reader_data = mm_mapfile(fd, 0, sizeof(*reader_data),
+	                         MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	ck_assert(writer_data != NULL && reader_data != NULL);
+
+	ck_assert(mm_thr_seqlock_init(&writer_data->lock, flags) == 0);
+}
+
+
+static
+void unmap_shared_data(void)
+{
+	mm_thr_seqlock_deinit(&writer_data->lock);
+	mm_unmap(reader_data);
+	mm_unmap(writer_data);
+}
+
+
+START_TEST(sequence)
+{
+	mm_thr_seqlock_t lock = MM_THR_SEQLOCK_INITIALIZER;
+	unsigned int seq;
+
+	seq = mm_thr_seqlock_read_begin(&lock);
+	ck_assert(!mm_thr_seqlock_read_retry(&lock, seq));
+
+	mm_thr_seqlock_write_begin(&lock);
+	ck_assert(mm_thr_seqlock_read_retry(&lock, seq));
+	mm_thr_seqlock_write_end(&lock);
+
+	ck_assert(mm_thr_seqlock_read_retry(&lock, seq));
+	seq = mm_thr_seqlock_read_begin(&lock);
+	ck_assert(!mm_thr_seqlock_read_retry(&lock, seq));
+}
+END_TEST
+
+
+static
+void* reader_proc(void* arg)
+{
+	mm_thr_seqlock_t* lock = &reader_data->lock;
+	struct snapshot copy;
+	uint64_t last_seq = 0;
+	unsigned int seq;
+	bool is_valid;
+	int i;
+
+	(void)arg;
+
+	while (!mm_atomic_load_i32(&done, MM_ATOMIC_ACQUIRE)) {
+		do {
+			seq = mm_thr_seqlock_read_begin(lock);
+			mm_thr_seqlock_read(lock, &copy, &reader_data->snapshot,
+			                    sizeof(copy));
+		} while (mm_thr_seqlock_read_retry(lock, seq));
+
+		// Snapshot must be consistent and not go backward
+		is_valid = (copy.seq >= last_seq);
+		for (i = 0; i < MM_NELEM(copy.values); i++) {
+			if (copy.values[i] != copy.seq * (i+1))
+				is_valid = false;
+		}
+
+		if (!is_valid)
+			mm_atomic_store_i32(&failed, 1, MM_ATOMIC_RELAXED);
+
+		last_seq = copy.seq;
+	}
+
+	return NULL;
+}
+
+
+START_TEST(concurrent_snapshot)
+{
+	mm_thread_t thids[NUM_READER];
+	struct snapshot update;
+	uint64_t i;
+	int j;
+
+	map_shared_data(sync_type_flags[_i]);
+	failed = 0;
+	done = 0;
+
+	for (j = 0; j < NUM_READER; j++)
+		mm_thr_create(&thids[j], reader_proc, NULL);
+
+	for (i = 1; i <= NUM_WRITE; i++) {
+		update.seq = i;
+		for (j = 0; j < MM_NELEM(update.values); j++)
+			update.values[j] = i * (j+1);
+
+		mm_thr_seqlock_write_begin(&writer_data->lock);
+		mm_thr_seqlock_write(&writer_data->lock,
+		                     &writer_data->snapshot, &update,
+		                     sizeof(update));
+		mm_thr_seqlock_write_end(&writer_data->lock);
+	}
+
+	mm_atomic_store_i32(&done, 1, MM_ATOMIC_RELEASE);
+	for (j = 0; j < NUM_READER; j++)
+		mm_thr_join(thids[j], NULL);
+
+	ck_assert_int_eq(failed, 0);
+	ck_assert(reader_data->snapshot.seq == NUM_WRITE);
+
+	unmap_shared_data();
+}
+END_TEST
+
+
+static
+void* writer_proc(void* arg)
+{
+	struct shared_data* data = arg;
+	uint64_t val;
+	int i;
+
+	for (i = 0; i < NUM_WRITE; i++) {
+		mm_thr_seqlock_write_begin(&data->lock);
+		val = mm_atomic_load_u64(&data->snapshot.seq,
+		                         MM_ATOMIC_RELAXED);
+		mm_atomic_store_u64(&data->snapshot.seq, val + 1,
+		                    MM_ATOMIC_RELAXED);
+		mm_thr_seqlock_write_end(&data->lock);
+	}
+
+	return NULL;
+}
+
+
+START_TEST(concurrent_writers)
+{
+	int flags = sync_type_flags[_i];
+	mm_thread_t thids[NUM_WRITER];
+	struct shared_data* data;
+	int i;
+
+	map_shared_data(flags);
+
+	// If process shared, writers are spread over both mappings
+	for (i = 0; i < NUM_WRITER; i++) {
+		data = writer_data;
+		if ((flags & MM_THR_PSHARED) && (i % 2))
+			data = reader_data;
+
+		mm_thr_create(&thids[i], writer_proc, data);
+	}
+
+	for (i = 0; i < NUM_WRITER; i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert(writer_data->snapshot.seq == NUM_WRITER * NUM_WRITE);
+
+	unmap_shared_data();
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_seqlock_tcase(void)
+{
+	TCase *tc = tcase_create("seqlock");
+	tcase_add_test(tc, sequence);
+	tcase_add_loop_test(tc, concurrent_snapshot,
+	                    0, MM_NELEM(sync_type_flags));
+	tcase_add_loop_test(tc, concurrent_writers,
+	                    0, MM_NELEM(sync_type_flags));
+
+	return tc;
+}
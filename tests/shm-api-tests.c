@@ -223,6 +223,55 @@ START_TEST(multiple_maps_test)
 END_TEST
 #undef N
 
+
+START_TEST(mlock_test)
+{
+	char* buf;
+	int fd, rv;
+
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	ck_assert(mm_ftruncate(fd, 4 * MM_PAGESZ) == 0);
+	buf = mm_mapfile(fd, 0, 4 * MM_PAGESZ, MM_MAP_RDWR|MM_MAP_SHARED);
+	ck_assert(buf != NULL);
+
+	// Locking may fail if it exceeds the allowed locked memory limit
+	rv = mm_mlock(buf, 4 * MM_PAGESZ);
+	if (rv == 0)
+		ck_assert(mm_munlock(buf, 4 * MM_PAGESZ) == 0);
+	else
+		ck_assert(mm_get_lasterror_number() == ENOMEM
+		          || mm_get_lasterror_number() == EPERM);
+
+	ck_assert(mm_mlockall(0x100) == -1);
+	ck_assert(mm_get_lasterror_number() == EINVAL);
+
+	mm_unmap(buf);
+	mm_close(fd);
+}
+END_TEST
+
+
+START_TEST(mlockall_test)
+{
+	int rv;
+
+	rv = mm_mlockall(MM_MLOCK_CURRENT|MM_MLOCK_FUTURE);
+	if (rv == 0) {
+		ck_assert(mm_munlockall() == 0);
+		return;
+	}
+
+#ifdef _WIN32
+	ck_assert(mm_get_lasterror_number() == ENOTSUP);
+#else
+	ck_assert(mm_get_lasterror_number() == ENOMEM
+	          || mm_get_lasterror_number() == EPERM);
+#endif
+}
+END_TEST
+
+
 LOCAL_SYMBOL
 TCase* create_shm_tcase(void)
 {
@@ -239,6 +288,8 @@ TCase* create_shm_tcase(void)
 	tcase_add_test(tc, mapfile_invalid_offset_test);
 	tcase_add_test(tc, invalid_unmap_test);
 	tcase_add_test(tc, multiple_maps_test);
+	tcase_add_test(tc, mlock_test);
+	tcase_add_test(tc, mlockall_test);
 
 	return tc;
 }
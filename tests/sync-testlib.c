@@ -0,0 +1,102 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "mmlib.h"
+#include "mmsysio.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#include "sync-testlib.h"
+#include "tests-child-proc.h"
+
+const int sync_type_flags[NUM_SYNC_TYPE] = {0, MM_THR_PSHARED};
+
+
+/**
+ * get_deadline() - get a timeout in MM_CLK_MONOTONIC
+ * @ts:         timespec receiving the timeout
+ * @delay_ms:   delay in milliseconds from now of the timeout
+ */
+void get_deadline(struct mm_timespec* ts, int delay_ms)
+{
+	mm_gettime(MM_CLK_MONOTONIC, ts);
+	mm_timeadd_ms(ts, delay_ms);
+}
+
+
+/**
+ * map_shared_page() - map a page of anonymous memory shareable by children
+ * @shm_fd:     pointer to the variable receiving the fd of the memory
+ *
+ * Return: the address of the page, NULL in case of failure. Once done,
+ * the page must be unmapped and *@shm_fd closed.
+ */
+void* map_shared_page(int* shm_fd)
+{
+	void* map;
+
+	*shm_fd = mm_anon_shm();
+	if (*shm_fd == -1)
+		return NULL;
+
+	if (mm_ftruncate(*shm_fd, MM_PAGESZ)
+	    || !(map = mm_mapfile(*shm_fd, 0, MM_PAGESZ,
+	                          MM_MAP_RDWR|MM_MAP_SHARED))) {
+		mm_close(*shm_fd);
+		*shm_fd = -1;
+		return NULL;
+	}
+
+	return map;
+}
+
+
+/**
+ * spawn_shared_runners() - run a function in several child processes
+ * @pids:       array receiving the pid of the children
+ * @num:        number of children to spawn
+ * @fn_name:    name of the function exported by tests-child-proc to run
+ * @shm_fd:     fd of the page returned by map_shared_page()
+ *
+ * Each child maps the page of @shm_fd and passes its address to @fn_name.
+ *
+ * Return: the number of children spawned
+ */
+int spawn_shared_runners(mm_pid_t* pids, int num, char* fn_name, int shm_fd)
+{
+	struct mm_remap_fd fdmap = {.child_fd = 3, .parent_fd = shm_fd};
+	char* argv[] = {TESTS_CHILD_BIN, fn_name, "mapfile-3-4096", NULL};
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (mm_spawn(&pids[i], argv[0], 1, &fdmap, 0, argv, NULL))
+			break;
+	}
+
+	return i;
+}
+
+
+/**
+ * wait_shared_runners() - wait for the end of spawned children
+ * @pids:       array of the pid of the children
+ * @num:        number of children spawned
+ *
+ * Return: the number of children which have not exited with 0
+ */
+int wait_shared_runners(const mm_pid_t* pids, int num)
+{
+	int i, status, num_failed = 0;
+
+	for (i = 0; i < num; i++) {
+		if (mm_wait_process(pids[i], &status)
+		    || status != MM_WSTATUS_EXITED)
+			num_failed++;
+	}
+
+	return num_failed;
+}
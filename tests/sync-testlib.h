@@ -0,0 +1,21 @@
+/*
+   @mindmaze_header@
+*/
+#ifndef SYNC_TESTLIB_H
+#define SYNC_TESTLIB_H
+
+#include "mmsysio.h"
+#include "mmtime.h"
+
+#define NUM_SYNC_TYPE   2
+
+// flags of the synchronization objects tested in private and shared mode
+extern const int sync_type_flags[NUM_SYNC_TYPE];
+
+void get_deadline(struct mm_timespec* ts, int delay_ms);
+
+void* map_shared_page(int* shm_fd);
+int spawn_shared_runners(mm_pid_t* pids, int num, char* fn_name, int shm_fd);
+int wait_shared_runners(const mm_pid_t* pids, int num);
+
+#endif
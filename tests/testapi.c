@@ -21,7 +21,23 @@ Suite* api_suite(void)
 
 	suite_add_tcase(s, create_allocation_tcase());
 	suite_add_tcase(s, create_time_tcase());
+	suite_add_tcase(s, create_timer_tcase());
 	suite_add_tcase(s, create_thread_tcase());
+	suite_add_tcase(s, create_thrpool_tcase());
+	suite_add_tcase(s, create_rwlock_tcase());
+	suite_add_tcase(s, create_sem_tcase());
+	suite_add_tcase(s, create_barrier_tcase());
+	suite_add_tcase(s, create_queue_tcase());
+	suite_add_tcase(s, create_atomic_tcase());
+	suite_add_tcase(s, create_lockstat_tcase());
+	suite_add_tcase(s, create_seqlock_tcase());
+	suite_add_tcase(s, create_qlock_tcase());
+	suite_add_tcase(s, create_ebr_tcase());
+	suite_add_tcase(s, create_evloop_tcase());
+	suite_add_tcase(s, create_topology_tcase());
+	suite_add_tcase(s, create_pcpu_tcase());
+	suite_add_tcase(s, create_profile_tcase());
+	suite_add_tcase(s, create_mcond_tcase());
 	suite_add_tcase(s, create_file_tcase());
 	suite_add_tcase(s, create_socket_tcase());
 	suite_add_tcase(s, create_ipc_tcase());
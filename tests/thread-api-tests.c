@@ -6,13 +6,24 @@
 #endif
 
 #include <check.h>
+#include <limits.h>
 #include <stdatomic.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#endif
 
 #include "api-testcases.h"
+#include "mmerrno.h"
 #include "mmpredefs.h"
 #include "mmsysio.h"
 #include "mmthread.h"
 #include "mmtime.h"
+#include "sync-testlib.h"
 #include "tests-child-proc.h"
 #include "threaddata-manipulation.h"
 
@@ -22,10 +33,14 @@
 static
 int mutex_type_flags[] = {
 	0,
+	MM_THR_ADAPTIVE,
+	MM_THR_PRIO_INHERIT,
 	MM_THR_PSHARED,
+	MM_THR_PSHARED | MM_THR_ADAPTIVE,
+	MM_THR_PSHARED | MM_THR_PRIO_INHERIT,
 };
 #define NUM_MUTEX_TYPE	MM_NELEM(mutex_type_flags)
-#define FIRST_PSHARED_MUTEX_TYPE	1
+#define FIRST_PSHARED_MUTEX_TYPE	3
 
 static
 void* simple_write_proc(void* arg)
@@ -517,6 +532,546 @@ START_TEST(concurrent_once)
 END_TEST
 
 
+/**************************************************************************
+ *                                                                        *
+ *                    Extended thread attributes tests                    *
+ *                                                                        *
+ **************************************************************************/
+#define SMALL_STACK_SIZE        (64*1024)
+
+static atomic_int num_detached_done;
+
+static
+int first_cpu(const struct mm_cpuset* cpuset)
+{
+	int i;
+
+	for (i = 0; i < MM_CPUSET_SIZE; i++) {
+		if (mm_cpuset_isset(cpuset, i))
+			return i;
+	}
+
+	return -1;
+}
+
+
+static
+void* get_affinity_proc(void* data)
+{
+	struct mm_cpuset* cpuset = data;
+
+	if (mm_thr_getaffinity(cpuset))
+		mm_cpuset_zero(cpuset);
+
+	return cpuset;
+}
+
+
+static
+void* detached_proc(void* data)
+{
+	(void)data;
+
+	atomic_fetch_add(&num_detached_done, 1);
+	return NULL;
+}
+
+
+START_TEST(create_ex_attrs)
+{
+	struct mm_cpuset cpuset, thr_cpuset;
+	struct mm_thr_attr attr = {
+		.stacksize = SMALL_STACK_SIZE,
+		.guardsize = SMALL_STACK_SIZE / 16,
+		.name = "mmlib test thread with long name",
+	};
+	mm_thread_t thid;
+	void* retval = NULL;
+	int cpu;
+
+	// If affinity is supported, restrict thread to first usable CPU
+	if (mm_thr_getaffinity(&cpuset) == 0) {
+		cpu = first_cpu(&cpuset);
+		ck_assert(cpu >= 0);
+		mm_cpuset_zero(&cpuset);
+		mm_cpuset_set(&cpuset, cpu);
+		attr.cpuset = &cpuset;
+	}
+
+	ck_assert(mm_thr_create_ex(&thid, get_affinity_proc,
+	                           &thr_cpuset, &attr) == 0);
+	ck_assert(mm_thr_join(thid, &retval) == 0);
+	ck_assert(retval == &thr_cpuset);
+
+	if (attr.cpuset)
+		ck_assert(!memcmp(&thr_cpuset, &cpuset, sizeof(cpuset)));
+
+	// Same without attributes must behave as mm_thr_create()
+	ck_assert(mm_thr_create_ex(&thid, get_affinity_proc,
+	                           &thr_cpuset, NULL) == 0);
+	ck_assert(mm_thr_join(thid, &retval) == 0);
+	ck_assert(retval == &thr_cpuset);
+}
+END_TEST
+
+
+START_TEST(create_ex_detached)
+{
+	struct mm_thr_attr attr = {.flags = MM_THR_DETACHED, .name = "detached"};
+	int i;
+
+	atomic_store(&num_detached_done, 0);
+
+	for (i = 0; i < NUM_CONCURRENCY; i++)
+		ck_assert(mm_thr_create_ex(NULL, detached_proc, NULL, &attr) == 0);
+
+	for (i = 0; i < 1000; i++) {
+		if (atomic_load(&num_detached_done) == NUM_CONCURRENCY)
+			break;
+
+		mm_relative_sleep_ms(1);
+	}
+
+	ck_assert_int_eq(atomic_load(&num_detached_done), NUM_CONCURRENCY);
+}
+END_TEST
+
+
+/*
+ * A thread whose ID is not returned cannot be joined: it must be created
+ * detached even if not requested by the attributes
+ */
+START_TEST(create_ex_null_thread)
+{
+	struct mm_thr_attr attr = {.name = "not returned"};
+	int i;
+
+	atomic_store(&num_detached_done, 0);
+
+	for (i = 0; i < NUM_CONCURRENCY; i++) {
+		ck_assert(mm_thr_create_ex(NULL, detached_proc,
+		                           NULL, &attr) == 0);
+		ck_assert(mm_thr_create_ex(NULL, detached_proc,
+		                           NULL, NULL) == 0);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (atomic_load(&num_detached_done) == 2 * NUM_CONCURRENCY)
+			break;
+
+		mm_relative_sleep_ms(1);
+	}
+
+	ck_assert_int_eq(atomic_load(&num_detached_done), 2 * NUM_CONCURRENCY);
+}
+END_TEST
+
+
+START_TEST(setaffinity)
+{
+	struct mm_cpuset orig, cpuset, res;
+	int cpu;
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	if (mm_thr_getaffinity(&orig) == ENOTSUP)
+		return;
+
+	cpu = first_cpu(&orig);
+	ck_assert(cpu >= 0);
+
+	mm_cpuset_zero(&cpuset);
+	mm_cpuset_set(&cpuset, cpu);
+	ck_assert(mm_thr_setaffinity(&cpuset) == 0);
+	ck_assert(mm_thr_getaffinity(&res) == 0);
+	ck_assert(!memcmp(&res, &cpuset, sizeof(res)));
+
+	// Empty set must be rejected
+	mm_cpuset_zero(&cpuset);
+	ck_assert(mm_thr_setaffinity(&cpuset) != 0);
+
+	ck_assert(mm_thr_setaffinity(&orig) == 0);
+	ck_assert(mm_thr_getaffinity(&res) == 0);
+	ck_assert(!memcmp(&res, &orig, sizeof(res)));
+}
+END_TEST
+
+
+#ifndef _WIN32
+
+#define PRIO_CONTROL    40
+#define PRIO_HIGH       30
+#define PRIO_MEDIUM     20
+#define PRIO_LOW        10
+#define LOW_HOLD_MS     50
+#define MEDIUM_BUSY_MS  200
+
+/*
+ * Priority inversion scenario: a low priority thread holds a mutex wanted
+ * by a high priority thread, while a medium priority thread keeps the CPU
+ * busy. All threads run with SCHED_FIFO on the same CPU.
+ */
+struct inversion_data {
+	mm_thr_mutex_t mutex;
+	atomic_int low_locked;
+	int64_t high_acquired_ns;
+	int64_t medium_done_ns;
+};
+
+
+static
+int64_t get_time_ns(void)
+{
+	struct mm_timespec ts;
+
+	mm_gettime(MM_CLK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static
+int set_fifo_priority(int prio)
+{
+	struct sched_param param = {.sched_priority = prio};
+
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+
+/*
+ * Get the permission of using real-time priorities for the controlling
+ * thread, raising the soft limit of RLIMIT_RTPRIO if it is not enough for
+ * an unprivileged user.
+ */
+static
+int enable_fifo_priority(int prio)
+{
+	struct rlimit rlim;
+
+	if (set_fifo_priority(prio) == 0)
+		return 0;
+
+	if (getrlimit(RLIMIT_RTPRIO, &rlim) || rlim.rlim_max < (rlim_t)prio)
+		return -1;
+
+	rlim.rlim_cur = rlim.rlim_max;
+	if (setrlimit(RLIMIT_RTPRIO, &rlim))
+		return -1;
+
+	return set_fifo_priority(prio);
+}
+
+
+static
+void busy_wait_ms(int64_t start_ns, int duration_ms)
+{
+	while (get_time_ns() - start_ns < duration_ms * 1000000LL)
+		;
+}
+
+
+static
+void* inversion_low_proc(void* arg)
+{
+	struct inversion_data* data = arg;
+	int64_t start_ns;
+
+	set_fifo_priority(PRIO_LOW);
+
+	mm_thr_mutex_lock(&data->mutex);
+	start_ns = get_time_ns();
+	atomic_store(&data->low_locked, 1);
+	busy_wait_ms(start_ns, LOW_HOLD_MS);
+	mm_thr_mutex_unlock(&data->mutex);
+
+	return NULL;
+}
+
+
+static
+void* inversion_high_proc(void* arg)
+{
+	struct inversion_data* data = arg;
+
+	set_fifo_priority(PRIO_HIGH);
+
+	mm_thr_mutex_lock(&data->mutex);
+	data->high_acquired_ns = get_time_ns();
+	mm_thr_mutex_unlock(&data->mutex);
+
+	return NULL;
+}
+
+
+static
+void* inversion_medium_proc(void* arg)
+{
+	struct inversion_data* data = arg;
+
+	set_fifo_priority(PRIO_MEDIUM);
+
+	busy_wait_ms(get_time_ns(), MEDIUM_BUSY_MS);
+	data->medium_done_ns = get_time_ns();
+
+	return NULL;
+}
+
+
+static
+void* lock_and_exit_proc(void* arg)
+{
+	mm_thr_mutex_lock(arg);
+	return NULL;
+}
+
+
+/*
+ * Test that a priority inheritance mutex owned by a thread dying is
+ * recovered if process shared (hence robust)
+ */
+START_TEST(prio_inherit_robust)
+{
+	mm_thr_mutex_t mutex;
+	mm_thread_t thid;
+
+	ck_assert(mm_thr_mutex_init(&mutex, MM_THR_PSHARED
+	                                    | MM_THR_PRIO_INHERIT) == 0);
+
+	mm_thr_create(&thid, lock_and_exit_proc, &mutex);
+	mm_thr_join(thid, NULL);
+
+	ck_assert(mm_thr_mutex_lock(&mutex) == EOWNERDEAD);
+	ck_assert(mm_thr_mutex_consistent(&mutex) == 0);
+	ck_assert(mm_thr_mutex_unlock(&mutex) == 0);
+
+	ck_assert(mm_thr_mutex_lock(&mutex) == 0);
+	ck_assert(mm_thr_mutex_unlock(&mutex) == 0);
+	mm_thr_mutex_deinit(&mutex);
+}
+END_TEST
+
+
+static const int inversion_mutex_flags[] = {0, MM_THR_PRIO_INHERIT};
+
+/*
+ * Reproduce priority inversion: without priority inheritance, the high
+ * priority thread likely gets the mutex only after the medium priority
+ * thread has finished. With priority inheritance, the low priority thread
+ * is boosted and must release the mutex before.
+ */
+START_TEST(prio_inherit_inversion)
+{
+	int flags = inversion_mutex_flags[_i];
+	struct inversion_data data = {.low_locked = 0};
+	struct mm_cpuset orig, cpuset;
+	mm_thread_t low, high, medium;
+	struct sched_param orig_param;
+	int orig_policy;
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	if (mm_thr_getaffinity(&orig) == ENOTSUP)
+		return;
+
+	ck_assert(mm_thr_mutex_init(&data.mutex, flags) == 0);
+
+	// Run all the threads on the same CPU (affinity is inherited)
+	mm_cpuset_zero(&cpuset);
+	mm_cpuset_set(&cpuset, first_cpu(&orig));
+	ck_assert(mm_thr_setaffinity(&cpuset) == 0);
+
+	// The controlling thread must preempt the others when it wakes up
+	pthread_getschedparam(pthread_self(), &orig_policy, &orig_param);
+	if (enable_fifo_priority(PRIO_CONTROL) != 0) {
+		// The priority of the owner is only boosted by real-time
+		// waiters: without them, there is nothing to check
+		fprintf(stderr, "Skipping priority inversion test: "
+		                "real-time scheduling not permitted\n");
+		goto exit;
+	}
+
+	mm_thr_create(&low, inversion_low_proc, &data);
+	while (!atomic_load(&data.low_locked))
+		mm_relative_sleep_ms(1);
+
+	mm_thr_create(&high, inversion_high_proc, &data);
+	mm_relative_sleep_ms(5);
+	mm_thr_create(&medium, inversion_medium_proc, &data);
+
+	mm_thr_join(medium, NULL);
+	mm_thr_join(high, NULL);
+	mm_thr_join(low, NULL);
+
+	pthread_setschedparam(pthread_self(), orig_policy, &orig_param);
+
+	// Without priority inheritance, whether the inversion happens
+	// depends on the scheduler: only the protocol is checked
+	if (flags & MM_THR_PRIO_INHERIT)
+		ck_assert(data.high_acquired_ns < data.medium_done_ns);
+
+exit:
+	mm_thr_setaffinity(&orig);
+	mm_thr_mutex_deinit(&data.mutex);
+}
+END_TEST
+
+#endif /* !_WIN32 */
+
+
+START_TEST(set_sched)
+{
+	mm_thread_t self = mm_thr_self();
+	int ret;
+
+	ck_assert(mm_thr_set_sched(self, MM_SCHED_OTHER, 0) == 0);
+
+	ck_assert(mm_thr_set_sched(self, -1, 0) == EINVAL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_thr_set_sched(self, MM_SCHED_OTHER, 1) == EINVAL);
+	ck_assert(mm_thr_set_sched(self, MM_SCHED_FIFO, 0) == EINVAL);
+	ck_assert(mm_thr_set_sched(self, MM_SCHED_RR, 100) == EINVAL);
+
+	// Real-time scheduling may not be permitted
+	ret = mm_thr_set_sched(self, MM_SCHED_FIFO, 10);
+	ck_assert(ret == 0 || ret == EPERM);
+	if (ret == EPERM)
+		ck_assert_int_eq(mm_get_lasterror_number(), EPERM);
+
+	ret = mm_thr_set_sched(self, MM_SCHED_RR, 10);
+	ck_assert(ret == 0 || ret == EPERM);
+
+	ck_assert(mm_thr_set_sched(self, MM_SCHED_OTHER, 0) == 0);
+}
+END_TEST
+
+
+START_TEST(prefault_stack)
+{
+	ck_assert(mm_thr_prefault_stack(0) == 0);
+	ck_assert(mm_thr_prefault_stack(MM_PAGESZ / 2) == 0);
+	ck_assert(mm_thr_prefault_stack(64 * 1024) == 0);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                       Wait on address tests                            *
+ *                                                                        *
+ **************************************************************************/
+#define WAIT_TIMEOUT_MS         50
+
+struct waitaddr_data {
+	uint32_t* addr;
+	int flags;
+	atomic_int num_woken;
+};
+
+
+static
+void* wait_on_address_proc(void* arg)
+{
+	struct waitaddr_data* data = arg;
+
+	while (__atomic_load_n(data->addr, __ATOMIC_ACQUIRE) == 0)
+		mm_wait_on_address(data->addr, 0, data->flags, NULL);
+
+	atomic_fetch_add(&data->num_woken, 1);
+	return NULL;
+}
+
+
+START_TEST(wait_wake_address)
+{
+	struct waitaddr_data data = {.flags = sync_type_flags[_i]};
+	mm_thread_t thids[NUM_CONCURRENCY];
+	uint32_t *waitmap, *wakemap;
+	int i, fd;
+
+	// Map the same shared memory twice: waiters and waker use different
+	// virtual addresses of the same word
+	fd = mm_anon_shm();
+	ck_assert(fd >= 0);
+	mm_ftruncate(fd, MM_PAGESZ);
+	waitmap = mm_mapfile(fd, 0, MM_PAGESZ, MM_MAP_RDWR|MM_MAP_SHARED);
+	wakemap = mm_mapfile(fd, 0, MM_PAGESZ, MM_MAP_RDWR|MM_MAP_SHARED);
+	mm_close(fd);
+	ck_assert(waitmap != NULL && wakemap != NULL);
+
+	// Use the same virtual address if not process shared
+	if (!(data.flags & MM_THR_PSHARED))
+		wakemap = waitmap;
+
+	data.addr = waitmap;
+	*wakemap = 0;
+
+	for (i = 0; i < MM_NELEM(thids); i++)
+		mm_thr_create(&thids[i], wait_on_address_proc, &data);
+
+	mm_relative_sleep_ms(WAIT_TIMEOUT_MS);
+	ck_assert_int_eq(atomic_load(&data.num_woken), 0);
+
+	__atomic_store_n(wakemap, 1, __ATOMIC_RELEASE);
+	ck_assert(mm_wake_by_address(wakemap, INT_MAX, data.flags) == 0);
+
+	for (i = 0; i < MM_NELEM(thids); i++)
+		mm_thr_join(thids[i], NULL);
+
+	ck_assert_int_eq(atomic_load(&data.num_woken), NUM_CONCURRENCY);
+
+	if (wakemap != waitmap)
+		mm_unmap(wakemap);
+
+	mm_unmap(waitmap);
+}
+END_TEST
+
+
+START_TEST(wait_address_timeout)
+{
+	uint32_t word = 42;
+	struct mm_timespec start, deadline, end;
+	int flags = MM_THR_WAIT_MONOTONIC | sync_type_flags[_i];
+
+	// value mismatch must return immediately
+	ck_assert(mm_wait_on_address(&word, 0, flags, NULL) == 0);
+
+	mm_gettime(MM_CLK_MONOTONIC, &start);
+	get_deadline(&deadline, WAIT_TIMEOUT_MS);
+
+	while (mm_wait_on_address(&word, 42, flags, &deadline) == 0)
+		ck_assert(word == 42);
+
+	mm_gettime(MM_CLK_MONOTONIC, &end);
+	ck_assert(mm_timediff_ms(&end, &start) >= WAIT_TIMEOUT_MS - 1);
+}
+END_TEST
+
+
+START_TEST(wait_address_unaligned)
+{
+	uint32_t words[2];
+	uint32_t* unaligned = (uint32_t*)((char*)words + 1);
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	ck_assert(mm_wait_on_address(unaligned, 0, 0, NULL) == EINVAL);
+	ck_assert(mm_wake_by_address(unaligned, 1, 0) == EINVAL);
+	ck_assert(mm_wake_by_address(words, 0, 0) == EINVAL);
+}
+END_TEST
+
+
+START_TEST(wait_address_invalid_abstime)
+{
+	uint32_t word = 0;
+	struct mm_timespec abstime = {.tv_sec = 0, .tv_nsec = -1};
+
+	// Like misalignment, invalid timeout is reported in error state
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	ck_assert(mm_wait_on_address(&word, 0, 0, &abstime) == EINVAL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
 /**************************************************************************
  *                                                                        *
  *                          Test suite setup                              *
@@ -532,11 +1087,26 @@ TCase* create_thread_tcase(void)
 	tcase_add_loop_test(tc, mutex_protection_on_pshared_write_normal, FIRST_PSHARED_MUTEX_TYPE, NUM_MUTEX_TYPE);
 	tcase_add_loop_test(tc, mutex_protection_on_pshared_write_sleep, FIRST_PSHARED_MUTEX_TYPE, NUM_MUTEX_TYPE);
 	tcase_add_loop_test(tc, robust_mutex, 0, NUM_ROBUST_CASES);
+#ifndef _WIN32
+	tcase_add_test(tc, prio_inherit_robust);
+	tcase_add_loop_test(tc, prio_inherit_inversion,
+	                    0, MM_NELEM(inversion_mutex_flags));
+#endif
 	tcase_add_loop_test(tc, signal_thread_data, 0, NUM_MUTEX_TYPE);
 	tcase_add_loop_test(tc, broadcast_thread_data, 0, NUM_MUTEX_TYPE);
 	tcase_add_loop_test(tc, signal_pshared_data, FIRST_PSHARED_MUTEX_TYPE, NUM_MUTEX_TYPE);
 	tcase_add_loop_test(tc, broadcast_pshared_data, FIRST_PSHARED_MUTEX_TYPE, NUM_MUTEX_TYPE);
 	tcase_add_test(tc, concurrent_once);
+	tcase_add_test(tc, create_ex_attrs);
+	tcase_add_test(tc, create_ex_detached);
+	tcase_add_test(tc, create_ex_null_thread);
+	tcase_add_test(tc, setaffinity);
+	tcase_add_test(tc, set_sched);
+	tcase_add_test(tc, prefault_stack);
+	tcase_add_loop_test(tc, wait_wake_address, 0, MM_NELEM(sync_type_flags));
+	tcase_add_loop_test(tc, wait_address_timeout, 0, MM_NELEM(sync_type_flags));
+	tcase_add_test(tc, wait_address_unaligned);
+	tcase_add_test(tc, wait_address_invalid_abstime);
 
 	return tc;
 }
@@ -6,6 +6,7 @@
 #endif
 
 #include "threaddata-manipulation.h"
+#include "mmatomic.h"
 #include "mmpredefs.h"
 #include "mmtime.h"
 #include <stdint.h>
@@ -144,3 +145,89 @@ intptr_t run_robust_mutex_write_data(struct robust_mutex_write_data* rdata)
 
 	return 0;
 }
+
+
+/**
+ * run_sem_event_data() - post a shared semaphore once started
+ * @sdata:      structure holding the shared event and semaphore
+ *
+ * Wait for @sdata->start to be set, then post @sdata->sem
+ * @sdata->num_iter times.
+ */
+API_EXPORTED
+intptr_t run_sem_event_data(struct sem_event_data* sdata)
+{
+	int i;
+
+	if (mm_thr_event_wait(&sdata->start))
+		return -1;
+
+	for (i = 0; i < sdata->num_iter; i++) {
+		if (mm_thr_sem_post(&sdata->sem))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * run_barrier_data() - go through phases synchronized by a shared barrier
+ * @bdata:      structure holding the shared barrier and counter
+ *
+ * In each phase, increment @bdata->count and wait on the barrier, then
+ * check that all the runners have incremented it before waiting again.
+ * Once done, count down @bdata->done.
+ */
+API_EXPORTED
+intptr_t run_barrier_data(struct barrier_data* bdata)
+{
+	int i;
+	int32_t count;
+
+	for (i = 0; i < bdata->num_iter; i++) {
+		mm_atomic_fetch_add_i32(&bdata->count, 1, MM_ATOMIC_SEQ_CST);
+		mm_thr_barrier_wait(&bdata->barrier);
+
+		count = mm_atomic_load_i32(&bdata->count, MM_ATOMIC_SEQ_CST);
+		if (count != (i + 1) * bdata->num_runner)
+			mm_atomic_store_i32(&bdata->failed, 1,
+			                    MM_ATOMIC_RELAXED);
+
+		mm_thr_barrier_wait(&bdata->barrier);
+	}
+
+	mm_thr_latch_count_down(&bdata->done, 1);
+
+	return 0;
+}
+
+
+/**
+ * run_queue_data() - produce elements in a shared queue
+ * @qdata:      structure followed by the shared queue
+ *
+ * Get a producer id from @qdata->next_producer and enqueue the values
+ * id * @qdata->num_iter + i for i in [0, @qdata->num_iter).
+ */
+API_EXPORTED
+intptr_t run_queue_data(struct queue_data* qdata)
+{
+	struct mm_queue* queue = queue_data_get_queue(qdata);
+	struct mm_timespec deadline;
+	int32_t i, id, val;
+
+	id = mm_atomic_fetch_add_i32(&qdata->next_producer, 1,
+	                             MM_ATOMIC_SEQ_CST);
+
+	mm_gettime(MM_CLK_MONOTONIC, &deadline);
+	mm_timeadd_ms(&deadline, qdata->wait_max_ms);
+
+	for (i = 0; i < qdata->num_iter; i++) {
+		val = id * qdata->num_iter + i;
+		if (mm_queue_enqueue_wait(queue, &val, &deadline))
+			return -1;
+	}
+
+	return 0;
+}
@@ -8,6 +8,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "mmatomic.h"
+#include "mmqueue.h"
 #include "mmthread.h"
 
 #define SHARED_WRITE_INIT_VALUE 0
@@ -41,8 +43,42 @@ struct notif_data {
 	mm_thr_cond_t cv2;
 };
 
+struct sem_event_data {
+	int num_iter;
+	mm_thr_event_t start;
+	mm_thr_sem_t sem;
+};
+
+struct barrier_data {
+	int num_iter;
+	int num_runner;
+	int32_t count;
+	int32_t failed;
+	mm_thr_barrier_t barrier;
+	mm_thr_latch_t done;
+};
+
+/*
+ * The queue, initialized with mm_queue_init(), follows the structure in
+ * the shared memory and starts at the next cache line.
+ */
+struct queue_data {
+	int num_iter;
+	int wait_max_ms;
+	int32_t next_producer;
+};
+
+static inline
+struct mm_queue* queue_data_get_queue(struct queue_data* qdata)
+{
+	return (struct mm_queue*)((char*)qdata + MM_CACHELINE_SIZE);
+}
+
 intptr_t run_write_shared_data(struct shared_write_data* shdata);
 intptr_t run_notif_data(struct notif_data* ndata);
 intptr_t run_robust_mutex_write_data(struct robust_mutex_write_data* rdata);
+intptr_t run_sem_event_data(struct sem_event_data* sdata);
+intptr_t run_barrier_data(struct barrier_data* bdata);
+intptr_t run_queue_data(struct queue_data* qdata);
 
 #endif
@@ -0,0 +1,227 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdatomic.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+#include "mmtime.h"
+
+#define NUM_TASK        10000
+#define NUM_WORKER      4
+#define FIB_INPUT       18
+#define FIB_EXPECTED    2584
+
+static
+int num_worker_cases[] = {1, NUM_WORKER, 0};
+
+static atomic_int num_done;
+
+
+static
+void count_task(void* arg)
+{
+	(void)arg;
+	atomic_fetch_add(&num_done, 1);
+}
+
+
+static
+void sleep_task(void* arg)
+{
+	(void)arg;
+	mm_relative_sleep_ms(1);
+	atomic_fetch_add(&num_done, 1);
+}
+
+
+START_TEST(submit_drain)
+{
+	struct mm_thrpool* pool;
+	int i;
+
+	atomic_store(&num_done, 0);
+
+	pool = mm_thrpool_create(num_worker_cases[_i]);
+	ck_assert(pool != NULL);
+
+	for (i = 0; i < NUM_TASK; i++)
+		ck_assert(mm_thrpool_submit(pool, NULL, count_task, NULL) == 0);
+
+	ck_assert(mm_thrpool_drain(pool) == 0);
+	ck_assert_int_eq(atomic_load(&num_done), NUM_TASK);
+
+	ck_assert(mm_thrpool_destroy(pool, 0) == 0);
+}
+END_TEST
+
+
+START_TEST(group_wait)
+{
+	struct mm_thrpool* pool;
+	struct mm_thrpool_group *grp1, *grp2;
+	int i;
+
+	atomic_store(&num_done, 0);
+
+	pool = mm_thrpool_create(num_worker_cases[_i]);
+	grp1 = mm_thrpool_group_create();
+	grp2 = mm_thrpool_group_create();
+	ck_assert(pool != NULL && grp1 != NULL && grp2 != NULL);
+
+	for (i = 0; i < 100; i++)
+		mm_thrpool_submit(pool, grp1, sleep_task, NULL);
+
+	ck_assert(mm_thrpool_group_wait(grp1) == 0);
+	ck_assert_int_eq(atomic_load(&num_done), 100);
+
+	// Empty group must not block
+	ck_assert(mm_thrpool_group_wait(grp2) == 0);
+
+	for (i = 0; i < NUM_TASK; i++)
+		mm_thrpool_submit(pool, grp2, count_task, NULL);
+
+	ck_assert(mm_thrpool_group_wait(grp2) == 0);
+	ck_assert_int_eq(atomic_load(&num_done), 100 + NUM_TASK);
+
+	mm_thrpool_group_destroy(grp1);
+	mm_thrpool_group_destroy(grp2);
+	ck_assert(mm_thrpool_destroy(pool, 0) == 0);
+}
+END_TEST
+
+
+struct fib_data {
+	struct mm_thrpool* pool;
+	int n;
+	int res;
+};
+
+
+/*
+ * Compute Fibonacci number by submitting the 2 sub-problems as tasks and
+ * waiting them from the task: this exercises the submission from workers,
+ * the work stealing and the wait of group from a task.
+ */
+static
+void fib_task(void* arg)
+{
+	struct fib_data* data = arg;
+	struct fib_data sub[2];
+	struct mm_thrpool_group* grp;
+	int i;
+
+	if (data->n < 2) {
+		data->res = data->n;
+		return;
+	}
+
+	grp = mm_thrpool_group_create();
+	for (i = 0; i < 2; i++) {
+		sub[i] = (struct fib_data) {.pool = data->pool,
+		                            .n = data->n - 1 - i};
+		mm_thrpool_submit(data->pool, grp, fib_task, &sub[i]);
+	}
+
+	mm_thrpool_group_wait(grp);
+	mm_thrpool_group_destroy(grp);
+
+	data->res = sub[0].res + sub[1].res;
+}
+
+
+START_TEST(nested_tasks)
+{
+	struct mm_thrpool* pool;
+	struct fib_data data;
+
+	pool = mm_thrpool_create(num_worker_cases[_i]);
+	ck_assert(pool != NULL);
+
+	data = (struct fib_data) {.pool = pool, .n = FIB_INPUT};
+	ck_assert(mm_thrpool_submit(pool, NULL, fib_task, &data) == 0);
+	ck_assert(mm_thrpool_drain(pool) == 0);
+	ck_assert_int_eq(data.res, FIB_EXPECTED);
+
+	ck_assert(mm_thrpool_destroy(pool, 0) == 0);
+}
+END_TEST
+
+
+START_TEST(destroy_discard)
+{
+	struct mm_thrpool* pool;
+	struct mm_thrpool_group* grp;
+	int i;
+
+	atomic_store(&num_done, 0);
+
+	pool = mm_thrpool_create(1);
+	grp = mm_thrpool_group_create();
+	ck_assert(pool != NULL && grp != NULL);
+
+	for (i = 0; i < 1000; i++)
+		mm_thrpool_submit(pool, grp, sleep_task, NULL);
+
+	ck_assert(mm_thrpool_destroy(pool, MM_THRPOOL_DISCARD) == 0);
+
+	// Discarded tasks must be accounted as completed in group
+	ck_assert(mm_thrpool_group_wait(grp) == 0);
+	ck_assert_int_lt(atomic_load(&num_done), 1000);
+
+	mm_thrpool_group_destroy(grp);
+}
+END_TEST
+
+
+static
+void drain_from_task(void* arg)
+{
+	struct mm_thrpool* pool = arg;
+
+	mm_error_set_flags(MM_ERROR_SET, MM_ERROR_NOLOG);
+	if (mm_thrpool_drain(pool) == -1
+	    && mm_get_lasterror_number() == EDEADLK)
+		atomic_fetch_add(&num_done, 1);
+}
+
+
+START_TEST(drain_deadlock)
+{
+	struct mm_thrpool* pool;
+
+	atomic_store(&num_done, 0);
+
+	pool = mm_thrpool_create(2);
+	ck_assert(pool != NULL);
+	mm_thrpool_submit(pool, NULL, drain_from_task, pool);
+	ck_assert(mm_thrpool_destroy(pool, 0) == 0);
+	ck_assert_int_eq(atomic_load(&num_done), 1);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_thrpool_tcase(void)
+{
+	TCase *tc = tcase_create("thrpool");
+	tcase_add_loop_test(tc, submit_drain, 0, MM_NELEM(num_worker_cases));
+	tcase_add_loop_test(tc, group_wait, 0, MM_NELEM(num_worker_cases));
+	tcase_add_loop_test(tc, nested_tasks, 0, MM_NELEM(num_worker_cases));
+	tcase_add_test(tc, destroy_discard);
+	tcase_add_test(tc, drain_deadlock);
+
+	return tc;
+}
@@ -0,0 +1,336 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "api-testcases.h"
+#include "mmatomic.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmtime.h"
+
+#define DELAY_MS        20
+#define PERIOD_MS       5
+#define WAIT_MAX_MS     5000
+#define NUM_TIMER       200
+#define SPREAD_MS       300
+#define FAR_DELAY_MS    1200
+#define ORDER_SLACK_NS  1000000
+
+static const clockid_t timer_clks[] = {
+	MM_CLK_MONOTONIC,
+	MM_CLK_REALTIME,
+};
+
+/**
+ * struct expiry_record - record of the calls of a timer callback
+ * @count:      number of calls
+ * @max_count:  number of calls after which the timer cancels itself
+ * @timer:      timer calling the callback
+ * @exp_ns:     expected expiration in ns of MM_CLK_MONOTONIC
+ * @call_ns:    time of the last call in ns of MM_CLK_MONOTONIC
+ * @order:      rank of the call among all the timers of the test
+ */
+struct expiry_record {
+	int32_t count;
+	int max_count;
+	struct mm_timer* timer;
+	int64_t exp_ns;
+	int64_t call_ns;
+	int order;
+};
+
+static int32_t num_call;
+
+
+static
+int64_t get_monotonic_ns(void)
+{
+	struct mm_timespec ts;
+
+	mm_gettime(MM_CLK_MONOTONIC, &ts);
+	return ts.tv_sec * (int64_t)NS_IN_SEC + ts.tv_nsec;
+}
+
+
+static
+void record_expiry(void* arg)
+{
+	struct expiry_record* rec = arg;
+
+	rec->call_ns = get_monotonic_ns();
+	rec->order = mm_atomic_fetch_add_i32(&num_call, 1, MM_ATOMIC_SEQ_CST);
+	mm_atomic_fetch_add_i32(&rec->count, 1, MM_ATOMIC_SEQ_CST);
+
+	if (rec->max_count && rec->count == rec->max_count)
+		mm_timer_cancel(rec->timer);
+}
+
+
+static
+int wait_count(struct expiry_record* rec, int count)
+{
+	int i;
+
+	for (i = 0; i < WAIT_MAX_MS; i++) {
+		if (mm_atomic_load_i32(&rec->count, MM_ATOMIC_SEQ_CST) >= count)
+			return 0;
+
+		mm_relative_sleep_ms(1);
+	}
+
+	return -1;
+}
+
+
+START_TEST(invalid_args)
+{
+	struct mm_timespec value = {.tv_sec = 0, .tv_nsec = NS_IN_SEC};
+	struct mm_timer* timer;
+	struct expiry_record rec = {0};
+
+	ck_assert(mm_timer_create(MM_CLK_CPU_THREAD, record_expiry, &rec)
+	          == NULL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+
+	ck_assert(mm_timer_create(MM_CLK_MONOTONIC, NULL, NULL) == NULL);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+
+	timer = mm_timer_create(MM_CLK_MONOTONIC, record_expiry, &rec);
+	ck_assert(timer != NULL);
+
+	ck_assert(mm_timer_arm(timer, 0, &value, NULL) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+
+	value.tv_nsec = 0;
+	value.tv_sec = -1;
+	ck_assert(mm_timer_arm(timer, 0, &value, NULL) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+
+	mm_timer_destroy(timer);
+	mm_timer_destroy(NULL);
+}
+END_TEST
+
+
+START_TEST(oneshot_relative)
+{
+	struct mm_timespec value = {.tv_nsec = DELAY_MS * 1000000};
+	struct expiry_record rec = {0};
+	struct mm_timer_stats stats;
+	int64_t start_ns;
+
+	rec.timer = mm_timer_create(timer_clks[_i], record_expiry, &rec);
+	ck_assert(rec.timer != NULL);
+
+	start_ns = get_monotonic_ns();
+	ck_assert(mm_timer_arm(rec.timer, 0, &value, NULL) == 0);
+	ck_assert(wait_count(&rec, 1) == 0);
+	ck_assert(rec.call_ns - start_ns >= DELAY_MS * 1000000);
+
+	// Check it does not expire again
+	mm_relative_sleep_ms(2 * DELAY_MS);
+	ck_assert_int_eq(rec.count, 1);
+
+	mm_timer_get_stats(rec.timer, &stats);
+	ck_assert(stats.num_expiry == 1);
+	ck_assert(stats.num_overrun == 0);
+	ck_assert(stats.max_jitter_ns >= 0);
+	ck_assert(stats.mean_jitter_ns == stats.max_jitter_ns);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+START_TEST(oneshot_absolute)
+{
+	struct mm_timespec value;
+	struct expiry_record rec = {0};
+	int64_t start_ns;
+
+	rec.timer = mm_timer_create(timer_clks[_i], record_expiry, &rec);
+	ck_assert(rec.timer != NULL);
+
+	start_ns = get_monotonic_ns();
+	mm_gettime(timer_clks[_i], &value);
+	mm_timeadd_ms(&value, DELAY_MS);
+	ck_assert(mm_timer_arm(rec.timer, MM_TIMER_ABSTIME, &value, NULL) == 0);
+	ck_assert(wait_count(&rec, 1) == 0);
+	ck_assert(rec.call_ns - start_ns >= DELAY_MS * 1000000);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+START_TEST(periodic)
+{
+	struct mm_timespec period = {.tv_nsec = PERIOD_MS * 1000000};
+	struct expiry_record rec = {0};
+	struct mm_timer_stats stats;
+	int count;
+
+	rec.timer = mm_timer_create(MM_CLK_MONOTONIC, record_expiry, &rec);
+	ck_assert(mm_timer_arm(rec.timer, 0, &period, &period) == 0);
+	ck_assert(wait_count(&rec, 10) == 0);
+
+	ck_assert(mm_timer_cancel(rec.timer) == 0);
+	count = rec.count;
+	mm_relative_sleep_ms(4 * PERIOD_MS);
+	ck_assert_int_eq(rec.count, count);
+
+	mm_timer_get_stats(rec.timer, &stats);
+	ck_assert(stats.num_expiry == count);
+	ck_assert(stats.max_jitter_ns >= stats.mean_jitter_ns);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+START_TEST(cancel_from_callback)
+{
+	struct mm_timespec period = {.tv_nsec = PERIOD_MS * 1000000};
+	struct expiry_record rec = {.max_count = 3};
+
+	rec.timer = mm_timer_create(MM_CLK_MONOTONIC, record_expiry, &rec);
+	ck_assert(mm_timer_arm(rec.timer, 0, &period, &period) == 0);
+	ck_assert(wait_count(&rec, 3) == 0);
+
+	mm_relative_sleep_ms(4 * PERIOD_MS);
+	ck_assert_int_eq(rec.count, 3);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+START_TEST(cancel_and_rearm)
+{
+	struct mm_timespec later = {.tv_sec = 10};
+	struct mm_timespec soon = {.tv_nsec = DELAY_MS * 1000000};
+	struct expiry_record rec = {0};
+
+	rec.timer = mm_timer_create(MM_CLK_MONOTONIC, record_expiry, &rec);
+
+	// A cancelled timer must not expire
+	ck_assert(mm_timer_arm(rec.timer, 0, &soon, NULL) == 0);
+	ck_assert(mm_timer_cancel(rec.timer) == 0);
+	mm_relative_sleep_ms(2 * DELAY_MS);
+	ck_assert_int_eq(rec.count, 0);
+
+	// Arming again replaces the previous expiration
+	ck_assert(mm_timer_arm(rec.timer, 0, &later, NULL) == 0);
+	ck_assert(mm_timer_arm(rec.timer, 0, &soon, NULL) == 0);
+	ck_assert(wait_count(&rec, 1) == 0);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+/*
+ * A timer farther than the span of the first two levels of the wheel must
+ * be cascaded down twice and never expire early. No upper bound is checked
+ * since the lateness depends on the load of the machine.
+ */
+START_TEST(far_timer)
+{
+	struct mm_timespec value = {.tv_sec = FAR_DELAY_MS / 1000};
+	struct expiry_record rec = {0};
+	int64_t start_ns;
+
+	rec.timer = mm_timer_create(MM_CLK_MONOTONIC, record_expiry, &rec);
+
+	start_ns = get_monotonic_ns();
+	mm_timeadd_ms(&value, FAR_DELAY_MS % 1000);
+	ck_assert(mm_timer_arm(rec.timer, 0, &value, NULL) == 0);
+	ck_assert(wait_count(&rec, 1) == 0);
+	ck_assert(rec.call_ns - start_ns >= FAR_DELAY_MS * (int64_t)1000000);
+
+	mm_timer_destroy(rec.timer);
+}
+END_TEST
+
+
+/*
+ * Arm many timers in random order over several turns of the first level of
+ * the wheel: they must all expire in order of expiration, never before.
+ */
+START_TEST(many_timers_order)
+{
+	struct expiry_record* recs;
+	struct mm_timespec value;
+	int64_t start_ns, delay_ns;
+	int i, j;
+
+	recs = calloc(NUM_TIMER, sizeof(*recs));
+	num_call = 0;
+
+	start_ns = get_monotonic_ns();
+	for (i = 0; i < NUM_TIMER; i++) {
+		delay_ns = (rand() % (SPREAD_MS * 1000)) * (int64_t)1000;
+		recs[i].timer = mm_timer_create(MM_CLK_MONOTONIC,
+		                                record_expiry, &recs[i]);
+		recs[i].exp_ns = get_monotonic_ns() + delay_ns;
+
+		value.tv_sec = 0;
+		value.tv_nsec = 0;
+		mm_timeadd_ns(&value, delay_ns);
+		ck_assert(mm_timer_arm(recs[i].timer, 0, &value, NULL) == 0);
+	}
+
+	for (i = 0; i < NUM_TIMER; i++)
+		ck_assert(wait_count(&recs[i], 1) == 0);
+
+	ck_assert(get_monotonic_ns() - start_ns >= SPREAD_MS * 1000000 / 2);
+
+	for (i = 0; i < NUM_TIMER; i++) {
+		ck_assert_int_eq(recs[i].count, 1);
+		ck_assert(recs[i].call_ns >= recs[i].exp_ns);
+
+		// Every timer called before must not expire later. exp_ns is
+		// read slightly before mm_timer_arm() computes the expiration,
+		// hence the tolerance.
+		for (j = 0; j < NUM_TIMER; j++) {
+			if (recs[j].order < recs[i].order)
+				ck_assert(recs[j].exp_ns
+				          <= recs[i].exp_ns + ORDER_SLACK_NS);
+		}
+	}
+
+	for (i = 0; i < NUM_TIMER; i++)
+		mm_timer_destroy(recs[i].timer);
+
+	free(recs);
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_timer_tcase(void)
+{
+	TCase *tc = tcase_create("timer");
+	tcase_add_test(tc, invalid_args);
+	tcase_add_loop_test(tc, oneshot_relative, 0, MM_NELEM(timer_clks));
+	tcase_add_loop_test(tc, oneshot_absolute, 0, MM_NELEM(timer_clks));
+	tcase_add_test(tc, periodic);
+	tcase_add_test(tc, cancel_from_callback);
+	tcase_add_test(tc, cancel_and_rearm);
+	tcase_add_test(tc, far_timer);
+	tcase_add_test(tc, many_timers_order);
+
+	return tc;
+}
@@ -0,0 +1,243 @@
+/*
+   @mindmaze_header@
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <check.h>
+
+#include "api-testcases.h"
+#include "mmerrno.h"
+#include "mmpredefs.h"
+#include "mmthread.h"
+
+#define NUM_THREAD      8
+
+static
+const int all_domains[] = {
+	MM_CPU_DOMAIN_CORE,
+	MM_CPU_DOMAIN_PACKAGE,
+	MM_CPU_DOMAIN_NODE,
+	MM_CPU_DOMAIN_L2,
+	MM_CPU_DOMAIN_L3,
+};
+
+static const struct mm_cpu_topology* thread_topology[NUM_THREAD];
+
+
+static
+int domain_count(const struct mm_cpu_topology* topo, int domain)
+{
+	switch (domain) {
+	case MM_CPU_DOMAIN_CORE: return topo->num_core;
+	case MM_CPU_DOMAIN_PACKAGE: return topo->num_package;
+	case MM_CPU_DOMAIN_NODE: return topo->num_node;
+	case MM_CPU_DOMAIN_L2: return topo->num_l2;
+	default: return topo->num_l3;
+	}
+}
+
+
+static
+int domain_id(const struct mm_cpu_info* info, int domain)
+{
+	switch (domain) {
+	case MM_CPU_DOMAIN_CORE: return info->core;
+	case MM_CPU_DOMAIN_PACKAGE: return info->package;
+	case MM_CPU_DOMAIN_NODE: return info->node;
+	case MM_CPU_DOMAIN_L2: return info->l2;
+	default: return info->l3;
+	}
+}
+
+
+static
+int cpuset_count(const struct mm_cpuset* set)
+{
+	int cpu, num = 0;
+
+	for (cpu = 0; cpu < MM_CPUSET_SIZE; cpu++)
+		num += mm_cpuset_isset(set, cpu);
+
+	return num;
+}
+
+
+START_TEST(topology_consistency)
+{
+	const struct mm_cpu_topology* topo = mm_cpu_topology_get();
+	const struct mm_cpu_info* cpus = topo->cpus;
+	int i, j;
+
+	ck_assert(topo == mm_cpu_topology_get());
+	ck_assert(topo->num_cpu >= 1);
+	ck_assert(topo->num_cpu <= MM_CPUSET_SIZE);
+	ck_assert(topo->num_core >= 1 && topo->num_core <= topo->num_cpu);
+	ck_assert(topo->num_package >= 1);
+	ck_assert(topo->num_package <= topo->num_core);
+	ck_assert(topo->num_node >= 1);
+
+	for (i = 0; i < topo->num_cpu; i++) {
+		ck_assert(cpus[i].cpu >= 0 && cpus[i].cpu < MM_CPUSET_SIZE);
+		if (i > 0)
+			ck_assert(cpus[i].cpu > cpus[i-1].cpu);
+
+		ck_assert(cpus[i].core >= 0 && cpus[i].core < topo->num_core);
+		ck_assert(cpus[i].package >= 0);
+		ck_assert(cpus[i].package < topo->num_package);
+		ck_assert(cpus[i].node >= 0 && cpus[i].node < topo->num_node);
+		ck_assert(cpus[i].l2 >= -1 && cpus[i].l2 < topo->num_l2);
+		ck_assert(cpus[i].l3 >= -1 && cpus[i].l3 < topo->num_l3);
+
+		// SMT siblings share the package and the caches
+		for (j = 0; j < i; j++) {
+			if (cpus[j].core != cpus[i].core)
+				continue;
+
+			ck_assert_int_eq(cpus[j].package, cpus[i].package);
+			ck_assert_int_eq(cpus[j].l2, cpus[i].l2);
+			ck_assert_int_eq(cpus[j].l3, cpus[i].l3);
+		}
+	}
+}
+END_TEST
+
+
+START_TEST(domain_cpuset)
+{
+	const struct mm_cpu_topology* topo = mm_cpu_topology_get();
+	int domain = all_domains[_i];
+	const struct mm_cpu_info* cpu;
+	struct mm_cpuset set;
+	int i, id, num, total = 0;
+
+	for (id = 0; id < domain_count(topo, domain); id++) {
+		num = mm_cpu_topology_cpuset(&set, domain, id);
+		ck_assert(num >= 1);
+		ck_assert_int_eq(num, cpuset_count(&set));
+		total += num;
+
+		for (i = 0; i < topo->num_cpu; i++) {
+			cpu = &topo->cpus[i];
+			ck_assert_int_eq(mm_cpuset_isset(&set, cpu->cpu),
+			                 domain_id(cpu, domain) == id);
+		}
+	}
+
+	// Instances of a domain do not overlap
+	ck_assert(total <= topo->num_cpu);
+
+	ck_assert(mm_cpu_topology_cpuset(&set, domain, -1) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_cpu_topology_cpuset(&set, domain,
+	                                 domain_count(topo, domain)) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
+START_TEST(domain_spread)
+{
+	const struct mm_cpu_topology* topo = mm_cpu_topology_get();
+	int domain = all_domains[_i];
+	struct mm_cpuset set, seen;
+	int i, id, num;
+
+	num = mm_cpu_topology_spread(&set, domain);
+	ck_assert_int_eq(num, domain_count(topo, domain));
+	ck_assert_int_eq(num, cpuset_count(&set));
+
+	// Each instance of the domain must be represented exactly once
+	mm_cpuset_zero(&seen);
+	for (i = 0; i < topo->num_cpu; i++) {
+		if (!mm_cpuset_isset(&set, topo->cpus[i].cpu))
+			continue;
+
+		id = domain_id(&topo->cpus[i], domain);
+		ck_assert(id >= 0);
+		ck_assert(!mm_cpuset_isset(&seen, id));
+		mm_cpuset_set(&seen, id);
+	}
+}
+END_TEST
+
+
+START_TEST(invalid_domain)
+{
+	struct mm_cpuset set;
+
+	ck_assert(mm_cpu_topology_spread(&set, -1) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+	ck_assert(mm_cpu_topology_cpuset(&set, 42, 0) == -1);
+	ck_assert_int_eq(mm_get_lasterror_number(), EINVAL);
+}
+END_TEST
+
+
+START_TEST(spread_affinity)
+{
+	struct mm_cpuset orig, set;
+	int rv;
+
+	ck_assert(mm_cpu_topology_spread(&set, MM_CPU_DOMAIN_CORE) >= 1);
+
+	rv = mm_thr_getaffinity(&orig);
+	if (rv == ENOTSUP)
+		return;
+
+	// The set may only be partially available to the process
+	rv = mm_thr_setaffinity(&set);
+	ck_assert(rv == 0 || rv == EINVAL);
+	mm_thr_setaffinity(&orig);
+}
+END_TEST
+
+
+static
+void* get_topology_proc(void* arg)
+{
+	intptr_t i = (intptr_t)arg;
+
+	thread_topology[i] = mm_cpu_topology_get();
+	return NULL;
+}
+
+
+START_TEST(concurrent_get)
+{
+	mm_thread_t thids[NUM_THREAD];
+	intptr_t i;
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_create(&thids[i], get_topology_proc, (void*)i);
+
+	for (i = 0; i < NUM_THREAD; i++)
+		mm_thr_join(thids[i], NULL);
+
+	for (i = 0; i < NUM_THREAD; i++) {
+		ck_assert(thread_topology[i] == mm_cpu_topology_get());
+		ck_assert(thread_topology[i]->num_cpu >= 1);
+	}
+}
+END_TEST
+
+
+/**************************************************************************
+ *                                                                        *
+ *                          Test suite setup                              *
+ *                                                                        *
+ **************************************************************************/
+LOCAL_SYMBOL
+TCase* create_topology_tcase(void)
+{
+	TCase *tc = tcase_create("topology");
+	tcase_add_test(tc, concurrent_get);
+	tcase_add_test(tc, topology_consistency);
+	tcase_add_loop_test(tc, domain_cpuset, 0, MM_NELEM(all_domains));
+	tcase_add_loop_test(tc, domain_spread, 0, MM_NELEM(all_domains));
+	tcase_add_test(tc, invalid_domain);
+	tcase_add_test(tc, spread_affinity);
+
+	return tc;
+}